@@ -27,8 +27,16 @@ public:
 
     bool is_powered(void) { return power_on; }
 
+    //! True if the previous wake left the modem powered and registered in PSM.
+    bool was_kept(void) { return kept; }
+    //! True if make_ready() has been called on this wake.
+    bool was_used(void) { return used; }
+    void keep_in_psm(void);
+
 private:
     bool power_on;
+    bool kept = false;
+    bool used = false;
 };
 
 extern CAT_M1 cat_m1;
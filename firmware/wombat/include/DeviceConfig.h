@@ -10,6 +10,14 @@
 
 #include <Arduino.h>
 #include <ArduinoJson.h>
+#include <sdi12_defn.h>
+#include <series_stats.h>
+
+//! The encoding of the messages uplinked by the node.
+enum msg_format_t {
+    MSG_FORMAT_JSON,
+    MSG_FORMAT_CBOR
+};
 
 /**
  * @brief Node configuration options for both getting and setting values.
@@ -79,6 +87,26 @@ public:
     //! Get the MQTT broker password
     std::string& getMqttPassword() { return mqttPassword; }
 
+    //! Set the uplink message encoding
+    void setMsgFormat(msg_format_t format) { msgFormat = format; }
+    //! Get the uplink message encoding
+    msg_format_t getMsgFormat() { return msgFormat; }
+
+    //! Set whether stored messages are batched into a single MQTT publish
+    void setMsgBatching(bool batch) { msgBatching = batch; }
+    //! Get whether stored messages are batched into a single MQTT publish
+    bool getMsgBatching() { return msgBatching; }
+
+    //! Set the most MQTT publishes waiting for the broker to acknowledge them at once
+    void setMqttWindow(uint8_t window) { mqttWindow = window; }
+    //! Get the most MQTT publishes waiting for the broker to acknowledge them at once
+    uint8_t getMqttWindow() { return mqttWindow; }
+
+    //! Set whether files are gzip compressed before they are uploaded by FTP
+    void setFtpCompression(bool compress) { ftpCompression = compress; }
+    //! Get whether files are gzip compressed before they are uploaded by FTP
+    bool getFtpCompression() { return ftpCompression; }
+
     //! Set the FTP hostname
     void setFtpHost(const std::string& host) { ftpHost = host; }
     //! Set the FTP username
@@ -93,6 +121,32 @@ public:
     //! Get the FTP password
     std::string& getFtpPassword() { return ftpPassword; }
 
+    //! Set whether the modem is left registered in power saving mode (PSM) between uplinks
+    void setModemPsm(bool psm) { modemPsm = psm; }
+    //! Get whether the modem is left registered in power saving mode (PSM) between uplinks
+    bool getModemPsm() { return modemPsm; }
+    //! Set the PSM periodic TAU (T3412) and active (T3324) times requested from the network, in seconds
+    void setPsmTimers(uint32_t periodic, uint32_t active) { psmPeriodic = periodic; psmActive = active; }
+    //! Get the PSM periodic TAU (T3412) time requested from the network, in seconds
+    uint32_t getPsmPeriodic() { return psmPeriodic; }
+    //! Get the PSM active (T3324) time requested from the network, in seconds
+    uint32_t getPsmActive() { return psmActive; }
+    //! Set the eDRX cycle requested from the network, in seconds, 0 for off
+    void setModemEdrx(uint32_t seconds) { modemEdrx = seconds; }
+    //! Get the eDRX cycle requested from the network, in seconds, 0 for off
+    uint32_t getModemEdrx() { return modemEdrx; }
+
+    //! Set how often summaries of the series are uplinked, in seconds, 0 for never
+    void setStatsInterval(uint32_t seconds) { statsInterval = seconds; }
+    //! Get how often summaries of the series are uplinked, in seconds, 0 for never
+    uint32_t getStatsInterval() { return statsInterval; }
+    //! Set what is uplinked for the measured series without a mode of their own
+    void setStatsMode(wombat::stats_mode_t mode) { statsMode = mode; }
+    //! Get what is uplinked for the measured series without a mode of their own
+    wombat::stats_mode_t getStatsMode() { return statsMode; }
+    //! Get the series with a mode other than the default
+    wombat::SeriesModes& getSeriesModes() { return seriesModes; }
+
     float getSleepAdjustment() { return sleep_adjustment; }
     void setSleepAdjustment(float _sleep_adjustment) {
         sleep_adjustment = _sleep_adjustment;
@@ -100,7 +154,10 @@ public:
 
     void dumpConfig(Stream& stream);
 
-    const JsonDocument& getSDI12Defns(void);
+    //! Load the SDI-12 sensor definitions, rebuilding the binary table if the JSON file has changed.
+    bool loadSDI12Defns(void);
+
+    const wombat::SensorDefnTable& getSDI12Defns(void);
 
     static const char* getMsgFilePrefix(void) {
         return "msg_";
@@ -127,6 +184,12 @@ private:
     std::string mqttUser;
     //! MQTT broker password
     std::string mqttPassword;
+    //! Uplink message encoding
+    msg_format_t msgFormat = MSG_FORMAT_JSON;
+    //! Batch stored messages into a single MQTT publish
+    bool msgBatching = false;
+    //! The most MQTT publishes waiting for the broker to acknowledge them at once
+    uint8_t mqttWindow = 4;
 
     //! FTP hostname
     std::string ftpHost;
@@ -134,6 +197,24 @@ private:
     std::string ftpUser;
     //! FTP password
     std::string ftpPassword;
+    //! Gzip compress files before they are uploaded by FTP
+    bool ftpCompression = false;
+
+    //! Leave the modem registered in PSM between uplinks
+    bool modemPsm = false;
+    //! PSM periodic TAU (T3412) time, in seconds
+    uint32_t psmPeriodic = 14400;
+    //! PSM active (T3324) time, in seconds
+    uint32_t psmActive = 10;
+    //! eDRX cycle, in seconds, 0 for off
+    uint32_t modemEdrx = 0;
+
+    //! How often summaries of the series are uplinked, in seconds, 0 for never
+    uint32_t statsInterval = 0;
+    //! What is uplinked for the measured series without a mode of their own
+    wombat::stats_mode_t statsMode = wombat::STATS_RAW;
+    //! The series with a mode other than the default
+    wombat::SeriesModes seriesModes;
 };
 
 
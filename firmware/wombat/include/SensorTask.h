@@ -7,6 +7,7 @@ constexpr size_t MAX_SENSORS = 10;
 static constexpr uint8_t MAX_VALUES = 32;
 
 void init_sensors(void);
+void scan_sensors(void);
 bool read_sensor(const char addr, JsonArray& timeseries_array);
 void sensor_task(void);
 
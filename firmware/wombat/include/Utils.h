@@ -3,6 +3,8 @@
 
 #include <ArduinoJson.h>
 #include <dpiclimate-12.h>
+#include <sdi12_defn.h>
+#include <urc_ring.h>
 
 #include "globals.h"
 
@@ -11,15 +13,25 @@ void streamPassthrough(Stream* s1, Stream* s2);
 
 int waitForChar(Stream& stream, uint32_t timeout);
 
-JsonObjectConst getSensorDefn(const char* const vendor, const char* const model);
-JsonObjectConst getSensorDefn(const size_t sensor_idx, const sensor_list& sensors);
+wombat::SensorDefn getSensorDefn(const char* const vendor, const char* const model);
+wombat::SensorDefn getSensorDefn(const size_t sensor_idx, const sensor_list& sensors);
 
 void enable12V(void);
 void disable12V(void);
 
-const char* iso8601(void);
-void log_to_sdcard(const char * msg);
+//! The size of a buffer for iso8601(), yyyy-mm-ddThh:mm:ssZ and the terminator with room to spare.
+constexpr size_t ISO8601_LEN = 24;
+
+const char* iso8601(char *buf, size_t len);
+const char* iso8601(char *buf, size_t len, time_t when);
+//! Passed to log_to_sdcard() to wait for as long as another task is writing to the log.
+constexpr uint32_t SD_LOG_WAIT_FOREVER = UINT32_MAX;
+
+void init_sdcard_log(void);
+void log_to_sdcard(const char * msg, uint32_t wait_ms = SD_LOG_WAIT_FOREVER);
 void log_to_sdcardf(const char *fmt, ...);
+void flush_sdcard_log(void);
+void close_sdcard_log(void);
 
 /**
  * Reads a file from the SPIFFS filesystem into buffer.
@@ -46,81 +58,105 @@ int read_spiffs_file(const char* filename, char* buffer, size_t max_length, size
  */
 int read_r5_file(const String& filename, char* buffer, size_t length, size_t &bytes_read, SARA_R5_error_t& r5_err);
 
+/**
+ * Sends an AT command to the modem and waits for OK.
+ *
+ * @param cmd The command without the leading "AT".
+ * @param timeout_ms How long to wait for the response.
+ * @return true if the modem responded OK, the response is left in g_buffer.
+ */
+bool modem_command(const char* cmd, unsigned long timeout_ms = SARA_R5_STANDARD_RESPONSE_TIMEOUT);
+
 bool wait_for_at(void);
 bool connect_to_internet(void);
+bool start_connect_task(void);
+bool wait_for_connect_task(void);
 
 int get_version_string(char *buffer, size_t length);
 
-template <typename T>
-struct URC {
-    bool valid { false };
-    T command { static_cast<T>(-1) };
-    int result { -1 };
-    int err1 { 0 };
-    int err2 { 0 };
-
-    URC()= default;
-    URC(bool v, T c, int r) {
-        valid = v;
-        command = c;
-        result = r;
-    }
-};
+void watch_modem_rx(void);
+bool wait_for_modem_rx(uint32_t timeout_ms);
 
+/**
+ * Holds the URCs reported by the SARA R5 library's MQTT or FTP command callback until the code
+ * that sent the command claims them.
+ */
 template <typename T>
-class CommandURCVector : public std::vector<URC<T>> {
+class CommandURCRing {
 public:
-    // Constructor - allocate space for 6 URCs.
-    CommandURCVector() : std::vector<URC<T>>() {}
-
-    // Add a pair to the vector
-    void addPair(const T& value, int intValue) {
-        this->emplace_back(true, value, intValue);
+    /**
+     * Add a URC, called from the library's command callback.
+     */
+    void add(const T command, int result, int err1 = 0, int err2 = 0) {
+        wombat::Urc urc;
+        urc.command = static_cast<int>(command);
+        urc.result = result;
+        urc.err1 = err1;
+        urc.err2 = err2;
+        if ( ! ring.push(urc)) {
+            ESP_LOGW("CommandURCRing", "URC ring full, dropped oldest URC");
+        }
     }
 
     /**
      * Check if the given command URC has been received. If so, put the result into result and
-     * remove the URC from the list and return true. Otherwise return false.
+     * remove the URC from the ring and return true. Otherwise return false.
      *
      * @param command the command to look for.
      * @param result the result of the command if it was found, otherwise unchanged.
      * @return true if the command URC was found, otherwise false.
      */
     bool hasURC(const T command, int *result) {
-        auto iter = this->begin();
-        while (iter != this->end()) {
-            ESP_LOGI("CommandURCVector", "valid = %d, command = %d, result = %d, err1 = %d, err2 = %d", iter->valid, iter->command, iter->result, iter->err1, iter->err2);
-            if (iter->command == command) {
-                *result = iter->result;
-                log_to_sdcardf("valid = %d, command = %d, result = %d, err1 = %d, err2 = %d", iter->valid, iter->command, iter->result, iter->err1, iter->err2);
-                iter->valid = false;
-                this->erase(iter);
-                return true;
-            }
-
-            iter++;
+        wombat::Urc urc;
+        if ( ! ring.take(static_cast<int>(command), urc)) {
+            return false;
         }
 
-        return false;
+        *result = urc.result;
+        log_to_sdcardf("command = %d, result = %d, err1 = %d, err2 = %d", urc.command, urc.result, urc.err1, urc.err2);
+        return true;
     }
 
+    /**
+     * Wait up to retries * delay_ms for the given command URC.
+     *
+     * The modem is polled whenever the UART receives data, so the wait ends within a few
+     * milliseconds of the URC arriving. Between URCs the task blocks rather than polling. The
+     * wait is never longer than delay_ms between polls, in case a UART event is missed.
+     *
+     * @return true if the URC was received, with its result in result.
+     */
     bool waitForURC(const T command, int *result, int retries, const long delay_ms) {
+        const unsigned long start = millis();
+        const unsigned long timeout_ms = static_cast<unsigned long>(retries) * delay_ms;
         bool found_urc = false;
-        while (retries > 0) {
+        while (true) {
             r5.bufferedPoll();
             found_urc = hasURC(command, result);
             if (found_urc) {
                 break;
             }
 
-            delay(delay_ms);
-            retries--;
+            const unsigned long elapsed = millis() - start;
+            if (elapsed >= timeout_ms) {
+                break;
+            }
+
+            const unsigned long remaining = timeout_ms - elapsed;
+            wait_for_modem_rx(remaining < static_cast<unsigned long>(delay_ms) ? remaining : delay_ms);
         }
 
-        ESP_LOGI("CommandURCVector", "command = %d, result = %d, found_urc = %d, retries = %d", command, *result, found_urc, retries);
-        log_to_sdcardf("command = %d, result = %d, found_urc = %d, retries = %d", command, *result, found_urc, retries);
+        ESP_LOGI("CommandURCRing", "command = %d, result = %d, found_urc = %d, waited %lu ms", command, *result, found_urc, millis() - start);
+        log_to_sdcardf("command = %d, result = %d, found_urc = %d, waited %lu ms", command, *result, found_urc, millis() - start);
         return found_urc;
     }
+
+    void clear(void) {
+        ring.clear();
+    }
+
+private:
+    wombat::UrcRing ring;
 };
 
 #endif //WOMBAT_UTILS_H
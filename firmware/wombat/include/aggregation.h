@@ -0,0 +1,12 @@
+#ifndef WOMBAT_AGGREGATION_H
+#define WOMBAT_AGGREGATION_H
+
+#include <stdint.h>
+#include <ArduinoJson.h>
+#include <series_stats.h>
+
+wombat::SeriesStats& get_series_stats(void);
+
+bool aggregate_series(JsonArray& timeseries);
+
+#endif //WOMBAT_AGGREGATION_H
@@ -0,0 +1,36 @@
+/**
+ * @file stats_cli.h
+ *
+ * @brief Configure which series are uplinked as summaries through the CLI.
+ *
+ * @date October 2026
+ */
+#ifndef WOMBAT_STATS_CLI_H
+#define WOMBAT_STATS_CLI_H
+
+#include <freertos/FreeRTOS.h>
+#include <Stream.h>
+
+#include "DeviceConfig.h"
+
+/**
+ * @brief CLI series statistics configuration.
+ *
+ * Sets the summary interval, the default mode of the measured series and the
+ * series with a mode of their own.
+ */
+class CLIStats {
+    //! Get the current device configuration upon initialisation
+    inline static DeviceConfig& config = DeviceConfig::get();
+
+public:
+    //! Prefix for all series statistics commands
+    inline static const std::string cmd = "stats";
+
+    static void dump(Stream& stream);
+
+    static BaseType_t enter_cli(char *pcWriteBuffer, size_t xWriteBufferLen,
+                                const char *pcCommandString);
+};
+
+#endif //WOMBAT_STATS_CLI_H
@@ -14,6 +14,7 @@
 
 #include "cli/FreeRTOS_CLI.h"
 #include "CAT_M1.h"
+#include "DeviceConfig.h"
 
 /**
  * @brief CLI for CAT-M1 commands.
@@ -23,10 +24,15 @@
  * the modem without typing several AT-commands.
  */
 class CLICatM1 {
+    //! Get the current device configuration upon initialisation
+    inline static DeviceConfig& config = DeviceConfig::get();
+
 public:
     //! CLI CAT-M1 reference, to send commands use "c1" followed by the command
     inline static const std::string cmd = "c1";
 
+    static void dump(Stream& stream);
+
     static BaseType_t enter_cli(char *pcWriteBuffer, size_t xWriteBufferLen,
                          const char *pcCommandString);
 };
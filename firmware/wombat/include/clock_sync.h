@@ -0,0 +1,17 @@
+#ifndef WOMBAT_CLOCK_SYNC_H
+#define WOMBAT_CLOCK_SYNC_H
+
+#include <stdint.h>
+#include <sleep_clock.h>
+#include <wake_schedule.h>
+
+wombat::SleepClock& get_sleep_clock(void);
+wombat::WakeSchedule& get_wake_schedule(void);
+int64_t clock_now_us(void);
+
+void clock_sync_begin(void);
+bool clock_ntp_due(void);
+void clock_ntp_synced(int64_t error_us, int64_t now_us);
+uint64_t clock_sleep_for(uint64_t sleep_us, float manual_adjustment);
+
+#endif //WOMBAT_CLOCK_SYNC_H
@@ -0,0 +1,13 @@
+#ifndef WOMBAT_ENERGY_H
+#define WOMBAT_ENERGY_H
+
+#include <stdint.h>
+#include <energy_policy.h>
+
+wombat::EnergyPolicy& get_energy_policy(void);
+
+void energy_begin(void);
+void energy_record(double battery_v, double solar_v);
+bool energy_allows_bulk(void);
+
+#endif //WOMBAT_ENERGY_H
@@ -56,6 +56,10 @@ constexpr char ftp_file_upload_dir[] = "/uploads";
 /// but nothing else does.
 constexpr const char sdi12defn_spiffs[] = "/sdi12defn.json";
 constexpr const char* sdi12defn_no_slash = &sdi12defn_spiffs[1];
+//! The sensor definitions in binary form, built from sdi12defn_spiffs.
+constexpr const char sdi12defn_bin_spiffs[] = "/sdi12defn.bin";
+//! The prefix of the outbox segment and index files on SPIFFS.
+constexpr const char outbox_prefix_spiffs[] = "/outbox_";
 
 void shutdown(void);
 
@@ -0,0 +1,15 @@
+#ifndef WOMBAT_MODEM_POWER_H
+#define WOMBAT_MODEM_POWER_H
+
+#include <ArduinoJson.h>
+#include <modem_psm.h>
+
+void modem_psm_request(void);
+bool modem_psm_update(void);
+bool modem_psm_keep(void);
+
+void uplink_energy_start(void);
+void uplink_energy_stop(bool record);
+void add_uplink_energy(JsonArray& timeseries);
+
+#endif //WOMBAT_MODEM_POWER_H
@@ -13,6 +13,26 @@ bool mqtt_logout(void);
  */
 bool mqtt_publish(String& topic, const char* msg, size_t msg_len);
 
+/**
+ * Send a QoS 1 message to the MQTT broker without waiting for the broker to acknowledge it, so
+ * more messages can be sent while it does.
+ *
+ * @param topic the topic to publish to.
+ * @param msg the message to send.
+ * @param msg_len the length of the message, which must be less than MAX_MQTT_DIRECT_MSG_LEN.
+ * @return true if the modem accepted the message, otherwise false.
+ */
+bool mqtt_publish_start(String& topic, const char* msg, size_t msg_len);
+
+/**
+ * Wait for the result of the oldest message sent by mqtt_publish_start() that has not been waited for.
+ *
+ * @param timeout_ms how long to wait.
+ * @param result set to 1 if the broker acknowledged the message.
+ * @return true if the result was received, otherwise false.
+ */
+bool mqtt_publish_wait(uint32_t timeout_ms, int& result);
+
 /**
  * Publish a message from a file on the modem filesystem.
  *
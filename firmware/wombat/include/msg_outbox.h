@@ -0,0 +1,10 @@
+#ifndef WOMBAT_MSG_OUTBOX_H
+#define WOMBAT_MSG_OUTBOX_H
+
+#include <outbox.h>
+
+wombat::Outbox& get_outbox(void);
+
+void migrate_msg_files(void);
+
+#endif //WOMBAT_MSG_OUTBOX_H
@@ -11,6 +11,8 @@ typedef struct {
     size_t file_len;
     char file_hash[41];
     char git_commit_id[41];
+    //! The size of the delta patch from the running version, or 0 if the server does not have one.
+    size_t patch_len;
 } ota_firmware_info_t;
 
 int ota_check_for_update(ota_firmware_info_t& ota_ctx);
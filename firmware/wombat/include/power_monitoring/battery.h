@@ -31,6 +31,7 @@ public:
 
     static double get_voltage();
     static float get_current();
+    static float get_power();
 
     static void sleep();
     static void wakeup();
@@ -0,0 +1,15 @@
+#ifndef WOMBAT_PROFILER_H
+#define WOMBAT_PROFILER_H
+
+#include <ArduinoJson.h>
+#include <wake_profile.h>
+
+wombat::WakeProfiler& get_profiler(void);
+
+void profile_start(wombat::wake_phase_t phase);
+void profile_stop(wombat::wake_phase_t phase);
+void profile_finish(void);
+
+void add_profile_summary(JsonArray& timeseries);
+
+#endif //WOMBAT_PROFILER_H
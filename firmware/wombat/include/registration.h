@@ -0,0 +1,14 @@
+#ifndef WOMBAT_REGISTRATION_H
+#define WOMBAT_REGISTRATION_H
+
+#include <stdint.h>
+#include <ArduinoJson.h>
+#include <reg_cache.h>
+
+bool registration_prepare(void);
+uint32_t registration_poll_ms(uint32_t elapsed_ms);
+void registration_succeeded(uint32_t ms, bool fast);
+void registration_failed(bool fast);
+void add_registration_stats(JsonArray& timeseries);
+
+#endif //WOMBAT_REGISTRATION_H
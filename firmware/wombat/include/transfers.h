@@ -0,0 +1,128 @@
+#ifndef WOMBAT_TRANSFERS_H
+#define WOMBAT_TRANSFERS_H
+
+#include <Arduino.h>
+#include <FS.h>
+#include <SparkFun_u-blox_SARA-R5_Arduino_Library.h>
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+
+#include <file_xfer.h>
+
+/**
+ * @brief Reads a file on SPIFFS or the SD card, keeping it open until the source is destroyed.
+ */
+class FsFileSource : public wombat::XferSource {
+public:
+    FsFileSource(fs::FS& fs, const char* path);
+    ~FsFileSource() override { file.close(); }
+
+    //! True if the file is open and is not a directory.
+    explicit operator bool() { return file && ! file.isDirectory(); }
+    size_t size(void) const { return file.size(); }
+    //! Move to pos bytes from the start of the file, for the next read.
+    bool seek(size_t pos) { return file.seek(pos); }
+
+    int32_t read(uint8_t* buf, size_t len) override;
+
+private:
+    fs::File file;
+};
+
+/**
+ * @brief Writes a file on SPIFFS or the SD card, replacing it or appending to it. The file is
+ * closed by finish() or when the sink is destroyed.
+ */
+class FsFileSink : public wombat::XferSink {
+public:
+    FsFileSink(fs::FS& fs, const char* path, const char* mode = FILE_WRITE);
+    ~FsFileSink() override { file.close(); }
+
+    explicit operator bool() const { return static_cast<bool>(file); }
+
+    bool write(const uint8_t* data, size_t len) override;
+    bool finish(void) override;
+
+private:
+    fs::File file;
+};
+
+/**
+ * @brief Reads a file on the modem file system.
+ */
+class R5FileSource : public wombat::XferSource {
+public:
+    explicit R5FileSource(const String& name);
+
+    //! True if the file exists.
+    explicit operator bool() const { return ok; }
+    size_t size(void) const { return file_size; }
+    //! The error from the last read of the file.
+    SARA_R5_error_t get_error(void) const { return err; }
+
+    int32_t read(uint8_t* buf, size_t len) override;
+
+private:
+    String name;
+    bool ok = false;
+    size_t file_size = 0;
+    size_t offset = 0;
+    SARA_R5_error_t err = SARA_R5_ERROR_SUCCESS;
+};
+
+/**
+ * @brief Appends to a file on the modem file system.
+ */
+class R5FileSink : public wombat::XferSink {
+public:
+    explicit R5FileSink(const String& name) : name(name) {}
+
+    bool write(const uint8_t* data, size_t len) override;
+
+private:
+    String name;
+};
+
+/**
+ * @brief Runs the reads of another source on a separate task, so a transfer can read the next
+ * block while it writes the current one.
+ *
+ * The wrapped source must not be used by anything else during the transfer. If the task cannot
+ * be created the reads are done by the caller as usual.
+ */
+class BackgroundSource : public wombat::XferSource {
+public:
+    explicit BackgroundSource(wombat::XferSource& source);
+    ~BackgroundSource() override;
+
+    int32_t read(uint8_t* buf, size_t len) override { return source.read(buf, len); }
+    void start_read(uint8_t* buf, size_t len) override;
+    int32_t finish_read(void) override;
+
+    //! The total time spent reading the wrapped source, in milliseconds.
+    uint32_t get_read_ms(void) const { return read_us / 1000; }
+    //! The total time the caller waited in finish_read() for reads to complete, in milliseconds.
+    uint32_t get_wait_ms(void) const { return wait_us / 1000; }
+
+private:
+    wombat::XferSource& source;
+    TaskHandle_t task = nullptr;
+    SemaphoreHandle_t request = nullptr;
+    SemaphoreHandle_t done = nullptr;
+
+    uint8_t* read_buf = nullptr;
+    size_t read_len = 0;
+    int32_t result = 0;
+    bool in_flight = false;
+
+    uint32_t read_us = 0;
+    uint32_t wait_us = 0;
+
+    void timed_read(void);
+    static void read_task(void* arg);
+};
+
+bool transfer(wombat::XferSource& src, wombat::XferSink& sink, size_t limit = SIZE_MAX, size_t* bytes = nullptr);
+
+#endif //WOMBAT_TRANSFERS_H
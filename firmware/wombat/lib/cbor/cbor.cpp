@@ -0,0 +1,388 @@
+#include "cbor.h"
+
+#include <cmath>
+#include <cstring>
+
+//
+// This file is a project-local platformio library so it can be unit tested.
+//
+// Do not include anything other than standard C++ headers.
+//
+
+namespace wombat {
+    //! Powers of 10 that are exactly representable as doubles.
+    static const double POW10[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9 };
+
+    void CborWriter::head(const uint8_t major, const uint64_t arg) {
+        const uint8_t mt = major << 5;
+        if (arg < 24) {
+            buf.push_back(mt | static_cast<uint8_t>(arg));
+        } else if (arg <= UINT8_MAX) {
+            buf.push_back(mt | 24);
+            buf.push_back(static_cast<uint8_t>(arg));
+        } else if (arg <= UINT16_MAX) {
+            buf.push_back(mt | 25);
+            buf.push_back(static_cast<uint8_t>(arg >> 8));
+            buf.push_back(static_cast<uint8_t>(arg));
+        } else if (arg <= UINT32_MAX) {
+            buf.push_back(mt | 26);
+            for (int shift = 24; shift >= 0; shift -= 8) {
+                buf.push_back(static_cast<uint8_t>(arg >> shift));
+            }
+        } else {
+            buf.push_back(mt | 27);
+            for (int shift = 56; shift >= 0; shift -= 8) {
+                buf.push_back(static_cast<uint8_t>(arg >> shift));
+            }
+        }
+    }
+
+    void CborWriter::uint(const uint64_t v) {
+        head(CBOR_UINT, v);
+    }
+
+    void CborWriter::integer(const int64_t v) {
+        if (v >= 0) {
+            head(CBOR_UINT, static_cast<uint64_t>(v));
+        } else {
+            // -1 - v without overflowing for INT64_MIN.
+            head(CBOR_NINT, ~static_cast<uint64_t>(v));
+        }
+    }
+
+    void CborWriter::text(const char *s) {
+        text(s, s == nullptr ? 0 : strlen(s));
+    }
+
+    void CborWriter::text(const char *s, const size_t len) {
+        head(CBOR_TEXT, len);
+        if (len > 0) {
+            buf.insert(buf.end(), s, s + len);
+        }
+    }
+
+    void CborWriter::bytes(const uint8_t *b, const size_t len) {
+        head(CBOR_BYTES, len);
+        if (len > 0) {
+            buf.insert(buf.end(), b, b + len);
+        }
+    }
+
+    void CborWriter::array(const size_t n) {
+        head(CBOR_ARRAY, n);
+    }
+
+    void CborWriter::map(const size_t n) {
+        head(CBOR_MAP, n);
+    }
+
+    void CborWriter::tag(const uint64_t t) {
+        head(CBOR_TAG, t);
+    }
+
+    void CborWriter::boolean(const bool b) {
+        buf.push_back(b ? 0xf5 : 0xf4);
+    }
+
+    void CborWriter::null(void) {
+        buf.push_back(0xf6);
+    }
+
+    void CborWriter::float32(const float f) {
+        uint32_t bits;
+        memcpy(&bits, &f, sizeof(bits));
+        buf.push_back(0xfa);
+        for (int shift = 24; shift >= 0; shift -= 8) {
+            buf.push_back(static_cast<uint8_t>(bits >> shift));
+        }
+    }
+
+    void CborWriter::float64(const double d) {
+        uint64_t bits;
+        memcpy(&bits, &d, sizeof(bits));
+        buf.push_back(0xfb);
+        for (int shift = 56; shift >= 0; shift -= 8) {
+            buf.push_back(static_cast<uint8_t>(bits >> shift));
+        }
+    }
+
+    /**
+     * @brief Write a number in the shortest form that reads back as exactly the same double.
+     *
+     * Whole numbers are written as integers and values that came from a float as a 32 bit float.
+     * SDI-12 sensors send values as decimal text with at most 7 digits, which rarely survive a round
+     * trip through a 32 bit float, so those are written as decimal fractions with the smallest
+     * exponent that reproduces the double exactly. Anything else is written as a 64 bit float.
+     */
+    void CborWriter::number(const double d) {
+        if (std::isnan(d) || std::isinf(d)) {
+            float64(d);
+            return;
+        }
+
+        // 2^53, beyond which not every integer is representable as a double.
+        static constexpr double MAX_EXACT = 9007199254740992.0;
+        if (std::fabs(d) < MAX_EXACT && d == std::floor(d)) {
+            integer(static_cast<int64_t>(d));
+            return;
+        }
+
+        if (static_cast<double>(static_cast<float>(d)) == d) {
+            float32(static_cast<float>(d));
+            return;
+        }
+
+        for (size_t k = 1; k < sizeof(POW10) / sizeof(POW10[0]); k++) {
+            const double scaled = d * POW10[k];
+            if (std::fabs(scaled) >= MAX_EXACT) {
+                break;
+            }
+
+            const double m = std::round(scaled);
+            if (m / POW10[k] == d) {
+                tag(CBOR_TAG_DECIMAL_FRACTION);
+                array(2);
+                integer(-static_cast<int64_t>(k));
+                integer(static_cast<int64_t>(m));
+                return;
+            }
+        }
+
+        float64(d);
+    }
+
+    bool CborReader::head(uint8_t &major, uint8_t &info, uint64_t &arg, size_t &next) const {
+        if (pos >= len) {
+            return false;
+        }
+
+        major = data[pos] >> 5;
+        info = data[pos] & 0x1f;
+        next = pos + 1;
+
+        size_t n = 0;
+        if (info < 24) {
+            arg = info;
+            return true;
+        } else if (info == 24) {
+            n = 1;
+        } else if (info == 25) {
+            n = 2;
+        } else if (info == 26) {
+            n = 4;
+        } else if (info == 27) {
+            n = 8;
+        } else {
+            // Indefinite lengths and reserved values are not supported.
+            return false;
+        }
+
+        if (next + n > len) {
+            return false;
+        }
+
+        arg = 0;
+        for (size_t i = 0; i < n; i++) {
+            arg = (arg << 8) | data[next++];
+        }
+
+        return true;
+    }
+
+    bool CborReader::peek(uint8_t &major) const {
+        if (pos >= len) {
+            return false;
+        }
+
+        major = data[pos] >> 5;
+        return true;
+    }
+
+    bool CborReader::read_uint(uint64_t &v) {
+        uint8_t major, info;
+        size_t next;
+        if ( ! head(major, info, v, next) || major != CBOR_UINT) {
+            return false;
+        }
+
+        pos = next;
+        return true;
+    }
+
+    bool CborReader::read_int(int64_t &v) {
+        uint8_t major, info;
+        uint64_t arg;
+        size_t next;
+        if ( ! head(major, info, arg, next) || (major != CBOR_UINT && major != CBOR_NINT) || arg > INT64_MAX) {
+            return false;
+        }
+
+        v = major == CBOR_UINT ? static_cast<int64_t>(arg) : -1 - static_cast<int64_t>(arg);
+        pos = next;
+        return true;
+    }
+
+    bool CborReader::read_text(std::string &s) {
+        uint8_t major, info;
+        uint64_t arg;
+        size_t next;
+        if ( ! head(major, info, arg, next) || major != CBOR_TEXT || arg > len - next) {
+            return false;
+        }
+
+        s.assign(reinterpret_cast<const char *>(&data[next]), arg);
+        pos = next + arg;
+        return true;
+    }
+
+    bool CborReader::read_bytes(std::vector<uint8_t> &b) {
+        uint8_t major, info;
+        uint64_t arg;
+        size_t next;
+        if ( ! head(major, info, arg, next) || major != CBOR_BYTES || arg > len - next) {
+            return false;
+        }
+
+        b.assign(&data[next], &data[next] + arg);
+        pos = next + arg;
+        return true;
+    }
+
+    bool CborReader::read_array(size_t &n) {
+        uint8_t major, info;
+        uint64_t arg;
+        size_t next;
+        if ( ! head(major, info, arg, next) || major != CBOR_ARRAY) {
+            return false;
+        }
+
+        n = arg;
+        pos = next;
+        return true;
+    }
+
+    bool CborReader::read_map(size_t &n) {
+        uint8_t major, info;
+        uint64_t arg;
+        size_t next;
+        if ( ! head(major, info, arg, next) || major != CBOR_MAP) {
+            return false;
+        }
+
+        n = arg;
+        pos = next;
+        return true;
+    }
+
+    bool CborReader::read_tag(uint64_t &t) {
+        uint8_t major, info;
+        size_t next;
+        if ( ! head(major, info, t, next) || major != CBOR_TAG) {
+            return false;
+        }
+
+        pos = next;
+        return true;
+    }
+
+    /**
+     * @brief Read any of the number forms written by CborWriter::number.
+     */
+    bool CborReader::read_number(double &d) {
+        uint8_t major, info;
+        uint64_t arg;
+        size_t next;
+        if ( ! head(major, info, arg, next)) {
+            return false;
+        }
+
+        if (major == CBOR_UINT) {
+            d = static_cast<double>(arg);
+            pos = next;
+            return true;
+        }
+
+        if (major == CBOR_NINT) {
+            d = -1.0 - static_cast<double>(arg);
+            pos = next;
+            return true;
+        }
+
+        if (major == CBOR_SIMPLE && info == 26) {
+            const uint32_t bits = static_cast<uint32_t>(arg);
+            float f;
+            memcpy(&f, &bits, sizeof(f));
+            d = f;
+            pos = next;
+            return true;
+        }
+
+        if (major == CBOR_SIMPLE && info == 27) {
+            memcpy(&d, &arg, sizeof(d));
+            pos = next;
+            return true;
+        }
+
+        if (major == CBOR_TAG && arg == CBOR_TAG_DECIMAL_FRACTION) {
+            const size_t start = pos;
+            pos = next;
+            size_t n;
+            int64_t e, m;
+            if (read_array(n) && n == 2 && read_int(e) && read_int(m) && e <= 0 && -e < 10) {
+                d = static_cast<double>(m) / POW10[-e];
+                return true;
+            }
+
+            pos = start;
+        }
+
+        return false;
+    }
+
+    /**
+     * @brief Skip over the next data item, including the contents of arrays, maps and tags.
+     */
+    bool CborReader::skip(void) {
+        uint8_t major, info;
+        uint64_t arg;
+        size_t next;
+        if ( ! head(major, info, arg, next)) {
+            return false;
+        }
+
+        const size_t start = pos;
+        pos = next;
+        switch (major) {
+            case CBOR_BYTES:
+            case CBOR_TEXT:
+                if (arg > len - pos) {
+                    pos = start;
+                    return false;
+                }
+                pos += arg;
+                return true;
+
+            case CBOR_ARRAY:
+            case CBOR_MAP: {
+                const uint64_t items = major == CBOR_MAP ? arg * 2 : arg;
+                for (uint64_t i = 0; i < items; i++) {
+                    if ( ! skip()) {
+                        pos = start;
+                        return false;
+                    }
+                }
+                return true;
+            }
+
+            case CBOR_TAG:
+                if ( ! skip()) {
+                    pos = start;
+                    return false;
+                }
+                return true;
+
+            default:
+                return true;
+        }
+    }
+}
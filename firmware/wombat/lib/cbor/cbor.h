@@ -0,0 +1,88 @@
+#ifndef CBOR_H
+#define CBOR_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace wombat {
+    /// CBOR major types, RFC 8949 section 3.1.
+    enum cbor_major_t : uint8_t {
+        CBOR_UINT = 0,
+        CBOR_NINT = 1,
+        CBOR_BYTES = 2,
+        CBOR_TEXT = 3,
+        CBOR_ARRAY = 4,
+        CBOR_MAP = 5,
+        CBOR_TAG = 6,
+        CBOR_SIMPLE = 7
+    };
+
+    //! The tag for a decimal fraction, [exponent, mantissa] meaning mantissa * 10^exponent.
+    static constexpr uint64_t CBOR_TAG_DECIMAL_FRACTION = 4;
+
+    /**
+     * @brief Writes CBOR data items into a byte vector.
+     *
+     * Only definite length items are written.
+     */
+    class CborWriter {
+    public:
+        void uint(uint64_t v);
+        void integer(int64_t v);
+        void text(const char *s);
+        void text(const char *s, size_t len);
+        void bytes(const uint8_t *b, size_t len);
+        void array(size_t n);
+        void map(size_t n);
+        void tag(uint64_t t);
+        void boolean(bool b);
+        void null(void);
+        void float32(float f);
+        void float64(double d);
+        void number(double d);
+
+        const std::vector<uint8_t> &data(void) const { return buf; }
+        void clear(void) { buf.clear(); }
+
+    private:
+        std::vector<uint8_t> buf;
+
+        void head(uint8_t major, uint64_t arg);
+    };
+
+    /**
+     * @brief Reads CBOR data items from a buffer, one at a time.
+     *
+     * Every method returns false, and leaves the position unchanged, if the next item is not
+     * of the type requested or is truncated.
+     */
+    class CborReader {
+    public:
+        CborReader(const uint8_t *data, size_t len) : data(data), len(len) {}
+
+        bool peek(uint8_t &major) const;
+        bool read_uint(uint64_t &v);
+        bool read_int(int64_t &v);
+        bool read_text(std::string &s);
+        bool read_bytes(std::vector<uint8_t> &b);
+        bool read_array(size_t &n);
+        bool read_map(size_t &n);
+        bool read_tag(uint64_t &t);
+        bool read_number(double &d);
+        bool skip(void);
+
+        bool at_end(void) const { return pos >= len; }
+        size_t position(void) const { return pos; }
+
+    private:
+        const uint8_t *data;
+        size_t len;
+        size_t pos = 0;
+
+        bool head(uint8_t &major, uint8_t &info, uint64_t &arg, size_t &next) const;
+    };
+}
+
+#endif //CBOR_H
@@ -0,0 +1,36 @@
+#include "crc32.h"
+
+//
+// This file is a project-local platformio library so it can be unit tested.
+//
+// Do not include anything other than standard C++ headers.
+//
+
+namespace wombat {
+    /**
+     * @brief Calculate the CRC-32 (IEEE 802.3, as used by zip, gzip and PNG) of a block of data.
+     *
+     * A nibble-wide table is used to keep the flash and RAM footprint small.
+     *
+     * @param data the data.
+     * @param len the number of bytes in data.
+     * @param crc the CRC of the preceding data when calculating the CRC of a stream in pieces, otherwise 0.
+     * @return the CRC of the data.
+     */
+    uint32_t crc32(const void *data, const size_t len, uint32_t crc) {
+        static const uint32_t table[16] = {
+            0x00000000, 0x1db71064, 0x3b6e20c8, 0x26d930ac, 0x76dc4190, 0x6b6b51f4, 0x4db26158, 0x5005713c,
+            0xedb88320, 0xf00f9344, 0xd6d6a3e8, 0xcb61b38c, 0x9b64c2b0, 0x86d3d2d4, 0xa00ae278, 0xbdbdf21c
+        };
+
+        const uint8_t *p = static_cast<const uint8_t *>(data);
+        crc = ~crc;
+        for (size_t i = 0; i < len; i++) {
+            crc ^= p[i];
+            crc = (crc >> 4) ^ table[crc & 0x0f];
+            crc = (crc >> 4) ^ table[crc & 0x0f];
+        }
+
+        return ~crc;
+    }
+}
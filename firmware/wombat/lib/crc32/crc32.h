@@ -0,0 +1,11 @@
+#ifndef CRC32_H
+#define CRC32_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace wombat {
+    uint32_t crc32(const void *data, size_t len, uint32_t crc = 0);
+}
+
+#endif //CRC32_H
@@ -0,0 +1,179 @@
+#include "delta_patch.h"
+#include "crc32.h"
+
+#include <cstring>
+
+//
+// This file is a project-local platformio library so it can be unit tested.
+//
+// Do not include anything other than standard C++ headers.
+//
+
+namespace wombat {
+    static const uint8_t PATCH_MAGIC[] = { 'W', 'D', 'P', '1' };
+
+    static uint32_t get_u32(const uint8_t *p) {
+        return static_cast<uint32_t>(p[0]) | (static_cast<uint32_t>(p[1]) << 8) | (static_cast<uint32_t>(p[2]) << 16) |
+            (static_cast<uint32_t>(p[3]) << 24);
+    }
+
+    DeltaPatcher::DeltaPatcher(PatchBase &base, XferSink &out) : base(base), out(out), buf(BUF_SIZE) {}
+
+    bool DeltaPatcher::write(const uint8_t *data, size_t len) {
+        while (len > 0) {
+            switch (state) {
+                case STATE_HEADER:
+                    if (gather(data, len, HEADER_SIZE) && ! start()) {
+                        state = STATE_ERROR;
+                    }
+                    break;
+
+                case STATE_OP:
+                    op = *data++;
+                    len--;
+                    if (op == OP_END) {
+                        state = STATE_END;
+                    } else if (op == OP_COPY || op == OP_ADD) {
+                        state = STATE_ARGS;
+                    } else {
+                        state = STATE_ERROR;
+                    }
+                    break;
+
+                case STATE_ARGS:
+                    if (gather(data, len, op == OP_COPY ? 8 : 4) && ! run_op()) {
+                        state = STATE_ERROR;
+                    }
+                    break;
+
+                case STATE_ADD: {
+                    const size_t n = len < add_left ? len : add_left;
+                    if ( ! emit(data, n)) {
+                        state = STATE_ERROR;
+                        break;
+                    }
+
+                    data += n;
+                    len -= n;
+                    add_left -= static_cast<uint32_t>(n);
+                    if (add_left == 0) {
+                        state = STATE_OP;
+                    }
+                    break;
+                }
+
+                case STATE_END:
+                    // Nothing may follow the end of the patch.
+                    state = STATE_ERROR;
+                    break;
+
+                case STATE_ERROR:
+                    return false;
+            }
+        }
+
+        return state != STATE_ERROR;
+    }
+
+    bool DeltaPatcher::finish(void) {
+        if (finished) {
+            return true;
+        }
+
+        if (state != STATE_END || out_bytes != target_len) {
+            return false;
+        }
+
+        finished = true;
+        return out.finish();
+    }
+
+    /**
+     * Collect bytes into pending until it holds want bytes.
+     *
+     * @return true when pending is complete, and pending_len has been reset for the next use.
+     */
+    bool DeltaPatcher::gather(const uint8_t *&data, size_t &len, const size_t want) {
+        size_t n = want - pending_len;
+        if (n > len) {
+            n = len;
+        }
+
+        memcpy(pending + pending_len, data, n);
+        pending_len += n;
+        data += n;
+        len -= n;
+
+        if (pending_len < want) {
+            return false;
+        }
+
+        pending_len = 0;
+        return true;
+    }
+
+    //! Check the header and that the base image is the one the patch was made from.
+    bool DeltaPatcher::start(void) {
+        if (memcmp(pending, PATCH_MAGIC, sizeof(PATCH_MAGIC)) != 0 || get_u32(pending + 16) != crc32(pending, 16)) {
+            return false;
+        }
+
+        base_len = get_u32(pending + 4);
+        const uint32_t base_crc = get_u32(pending + 8);
+        target_len = get_u32(pending + 12);
+
+        uint32_t crc = 0;
+        for (size_t offset = 0; offset < base_len; offset += buf.size()) {
+            const size_t n = base_len - offset < buf.size() ? base_len - offset : buf.size();
+            if ( ! base.read(offset, buf.data(), n)) {
+                return false;
+            }
+            crc = crc32(buf.data(), n, crc);
+        }
+
+        if (crc != base_crc) {
+            return false;
+        }
+
+        state = STATE_OP;
+        return true;
+    }
+
+    //! Run the operation whose arguments are in pending.
+    bool DeltaPatcher::run_op(void) {
+        if (op == OP_ADD) {
+            add_left = get_u32(pending);
+            state = add_left > 0 ? STATE_ADD : STATE_OP;
+            return true;
+        }
+
+        size_t offset = get_u32(pending);
+        size_t left = get_u32(pending + 4);
+        if (offset > base_len || left > base_len - offset) {
+            return false;
+        }
+
+        while (left > 0) {
+            const size_t n = left < buf.size() ? left : buf.size();
+            if ( ! base.read(offset, buf.data(), n) || ! emit(buf.data(), n)) {
+                return false;
+            }
+
+            offset += n;
+            left -= n;
+            copied += static_cast<uint32_t>(n);
+        }
+
+        state = STATE_OP;
+        return true;
+    }
+
+    bool DeltaPatcher::emit(const uint8_t *data, size_t len) {
+        if (len > target_len - out_bytes || ! out.write(data, len)) {
+            return false;
+        }
+
+        out_bytes += static_cast<uint32_t>(len);
+        return true;
+    }
+}
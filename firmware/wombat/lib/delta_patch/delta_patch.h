@@ -0,0 +1,105 @@
+#ifndef DELTA_PATCH_H
+#define DELTA_PATCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+#include "file_xfer.h"
+
+namespace wombat {
+    /**
+     * @brief The image a delta patch is applied to, such as the running firmware partition.
+     */
+    class PatchBase {
+    public:
+        virtual ~PatchBase() = default;
+
+        //! Read exactly len bytes from offset, returning false on error.
+        virtual bool read(size_t offset, uint8_t *buf, size_t len) = 0;
+    };
+
+    /**
+     * @brief An XferSink that applies a delta patch written to it, writing the new image to another
+     * sink.
+     *
+     * The patch is made by tools/make_ota_patch.py from the old and new images. Layout, all values
+     * little-endian:
+     *
+     * | offset | size | contents                                      |
+     * |--------|------|-----------------------------------------------|
+     * | 0      | 4    | magic "WDP1"                                  |
+     * | 4      | 4    | length of the base image                      |
+     * | 8      | 4    | CRC-32 of the base image                      |
+     * | 12     | 4    | length of the new image                       |
+     * | 16     | 4    | CRC-32 of the previous 16 bytes               |
+     * | 20     |      | operations                                    |
+     *
+     * Each operation is an op code byte followed by its arguments:
+     *
+     * - COPY (1): base offset (4) and length (4), copy bytes from the base image.
+     * - ADD (2): length (4) followed by that many bytes, which are written as they are.
+     * - END (0): the end of the patch.
+     *
+     * The base image is checked against its CRC-32 when the header has been written, so a patch made
+     * for a different image fails before anything is written to the output. The output is only
+     * complete if finish() returns true, and the caller must still check the new image, for example
+     * by its hash.
+     */
+    class DeltaPatcher : public XferSink {
+    public:
+        static constexpr size_t HEADER_SIZE = 20;
+        static constexpr uint8_t OP_END = 0;
+        static constexpr uint8_t OP_COPY = 1;
+        static constexpr uint8_t OP_ADD = 2;
+        //! The size of the buffer used to read the base image.
+        static constexpr size_t BUF_SIZE = 4096;
+
+        DeltaPatcher(PatchBase &base, XferSink &out);
+
+        bool write(const uint8_t *data, size_t len) override;
+        bool finish(void) override;
+
+        //! The length of the new image, once the header has been written.
+        uint32_t get_target_len(void) const { return target_len; }
+        //! The number of bytes written to the output sink.
+        uint32_t get_out_bytes(void) const { return out_bytes; }
+        //! The number of bytes copied from the base image.
+        uint32_t get_copied(void) const { return copied; }
+
+    private:
+        enum state_t {
+            STATE_HEADER,
+            STATE_OP,
+            STATE_ARGS,
+            STATE_ADD,
+            STATE_END,
+            STATE_ERROR
+        };
+
+        PatchBase &base;
+        XferSink &out;
+        std::vector<uint8_t> buf;
+
+        state_t state = STATE_HEADER;
+        //! The header or the arguments of the current operation, as they arrive.
+        uint8_t pending[HEADER_SIZE];
+        size_t pending_len = 0;
+        uint8_t op = OP_END;
+        //! The bytes still to come of the current ADD operation.
+        uint32_t add_left = 0;
+
+        uint32_t base_len = 0;
+        uint32_t target_len = 0;
+        uint32_t out_bytes = 0;
+        uint32_t copied = 0;
+        bool finished = false;
+
+        bool gather(const uint8_t *&data, size_t &len, size_t want);
+        bool start(void);
+        bool run_op(void);
+        bool emit(const uint8_t *data, size_t len);
+    };
+}
+
+#endif //DELTA_PATCH_H
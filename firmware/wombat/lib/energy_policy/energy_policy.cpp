@@ -0,0 +1,199 @@
+#include "energy_policy.h"
+
+#include <cstring>
+
+//
+// This file is a project-local platformio library so it can be unit tested.
+//
+// Do not include anything other than standard C++ headers.
+//
+
+namespace wombat {
+    //! Identifies a valid state, changed whenever the layout of EnergyPolicyState changes.
+    static constexpr uint32_t ENERGY_MAGIC = 0x45505932; // "EPY2"
+
+    //! A voltage in millivolts, clamped to what fits in a reading.
+    static uint16_t to_mv(const double volts) {
+        const double mv = volts * 1000.0 + 0.5;
+        if (mv >= static_cast<double>(EnergyPolicy::SOLAR_UNKNOWN - 1)) {
+            return EnergyPolicy::SOLAR_UNKNOWN - 1;
+        }
+
+        return static_cast<uint16_t>(mv);
+    }
+
+    /**
+     * @brief Reset the state if it is not valid.
+     *
+     * On a cold boot the RTC memory holds garbage or zeros, after deep sleep it holds the readings
+     * written by the previous wakes. A node with no readings is at ENERGY_NORMAL.
+     */
+    void EnergyPolicy::begin(void) {
+        if (state.magic != ENERGY_MAGIC || state.count > ENERGY_HISTORY || state.next >= ENERGY_HISTORY
+                || state.level > ENERGY_SURPLUS) {
+            memset(&state, 0, sizeof(state));
+            state.magic = ENERGY_MAGIC;
+            state.level = ENERGY_NORMAL;
+        }
+    }
+
+    /**
+     * @brief Add the readings from this wake, the oldest reading is dropped once the history is full.
+     *
+     * @param battery_v the battery voltage, negative if it could not be read, in which case nothing is added.
+     * @param solar_v the solar panel voltage, negative if it could not be read.
+     * @param elapsed_s the time since the previous reading, the measurement interval.
+     */
+    void EnergyPolicy::add(const double battery_v, const double solar_v, const uint32_t elapsed_s) {
+        if (battery_v < 0.0) {
+            return;
+        }
+
+        const uint16_t solar_mv = solar_v < 0.0 ? SOLAR_UNKNOWN : to_mv(solar_v);
+        if (solar_mv != SOLAR_UNKNOWN && solar_mv >= HARVEST_MV) {
+            state.harvest_seen = 1;
+            state.dark_s = 0;
+        } else if (state.dark_s < NO_HARVEST_S) {
+            state.dark_s += elapsed_s < NO_HARVEST_S ? elapsed_s : NO_HARVEST_S;
+        }
+
+        state.battery_mv[state.next] = to_mv(battery_v);
+        state.solar_mv[state.next] = solar_mv;
+        state.next = static_cast<uint8_t>((state.next + 1) % ENERGY_HISTORY);
+        if (state.count < ENERGY_HISTORY) {
+            state.count++;
+        }
+    }
+
+    //! The mean of the most recent battery readings, or 0 if there are none.
+    uint16_t EnergyPolicy::get_battery_mv(void) const {
+        const size_t n = state.count < RECENT ? state.count : RECENT;
+        if (n == 0) {
+            return 0;
+        }
+
+        uint32_t sum = 0;
+        for (size_t i = 1; i <= n; i++) {
+            sum += state.battery_mv[(state.next + ENERGY_HISTORY - i) % ENERGY_HISTORY];
+        }
+
+        return static_cast<uint16_t>(sum / n);
+    }
+
+    //! True if a solar reading in the last NO_HARVEST_S was charging the battery.
+    bool EnergyPolicy::has_harvest(void) const {
+        return state.harvest_seen && state.dark_s < NO_HARVEST_S;
+    }
+
+    //! True if any solar reading in the history was available.
+    bool EnergyPolicy::knows_solar(void) const {
+        for (size_t i = 0; i < state.count; i++) {
+            if (state.solar_mv[i] != SOLAR_UNKNOWN) {
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    /**
+     * @brief Choose the level for this wake from the readings of the previous wakes.
+     *
+     * A node with no readings keeps its level. A node that has never been able to read its solar
+     * monitor is never taken to be in shade, and never reaches ENERGY_SURPLUS.
+     *
+     * @return the level.
+     */
+    energy_level_t EnergyPolicy::evaluate(void) {
+        if (state.count == 0) {
+            return get_level();
+        }
+
+        const uint16_t battery_mv = get_battery_mv();
+        const energy_level_t previous = get_level();
+
+        // Crossing a threshold upwards needs a margin, crossing it downwards does not.
+        auto above = [&](const uint16_t threshold_mv, const energy_level_t level) {
+            return battery_mv >= threshold_mv + (previous < level ? HYSTERESIS_MV : 0);
+        };
+
+        energy_level_t level = ENERGY_CRITICAL;
+        if (above(CRITICAL_MV, ENERGY_LOW)) {
+            level = ENERGY_LOW;
+        }
+        if (above(LOW_MV, ENERGY_NORMAL)) {
+            level = ENERGY_NORMAL;
+        }
+
+        const bool harvest = has_harvest();
+        if (harvest && above(FULL_MV, ENERGY_SURPLUS)) {
+            level = ENERGY_SURPLUS;
+        }
+
+        // A day without harvest: spend less while the battery can still carry the node.
+        if (state.dark_s >= NO_HARVEST_S && knows_solar() && level > ENERGY_CRITICAL) {
+            level = static_cast<energy_level_t>(level - 1);
+        }
+
+        state.level = level;
+        return level;
+    }
+
+    /**
+     * @brief The uplink interval for the current level.
+     *
+     * ENERGY_LOW doubles the configured interval and ENERGY_CRITICAL quadruples it, up to
+     * MAX_UPLINK_S. ENERGY_SURPLUS halves it, down to the measurement interval. The result is always
+     * a multiple of the measurement interval, so uplinks stay on the UTC boundaries of the
+     * measurement interval.
+     *
+     * @param uplink_s the configured uplink interval, in seconds.
+     * @param measure_s the measurement interval, in seconds.
+     * @return the uplink interval to use, in seconds.
+     */
+    uint32_t EnergyPolicy::uplink_interval(const uint32_t uplink_s, const uint32_t measure_s) const {
+        if (measure_s == 0 || uplink_s < measure_s) {
+            return uplink_s;
+        }
+
+        uint32_t interval_s = uplink_s;
+        switch (get_level()) {
+            case ENERGY_CRITICAL:
+                interval_s = uplink_s * 4;
+                break;
+            case ENERGY_LOW:
+                interval_s = uplink_s * 2;
+                break;
+            case ENERGY_SURPLUS:
+                interval_s = uplink_s / 2;
+                break;
+            default:
+                break;
+        }
+
+        if (interval_s > uplink_s) {
+            const uint32_t max_s = MAX_UPLINK_S > uplink_s ? MAX_UPLINK_S : uplink_s;
+            if (interval_s > max_s) {
+                interval_s = max_s;
+            }
+        }
+
+        interval_s -= interval_s % measure_s;
+        return interval_s < measure_s ? measure_s : interval_s;
+    }
+
+    const char* EnergyPolicy::level_name(const energy_level_t level) {
+        switch (level) {
+            case ENERGY_CRITICAL:
+                return "critical";
+            case ENERGY_LOW:
+                return "low";
+            case ENERGY_NORMAL:
+                return "normal";
+            case ENERGY_SURPLUS:
+                return "surplus";
+            default:
+                return "unknown";
+        }
+    }
+}
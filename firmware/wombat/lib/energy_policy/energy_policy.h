@@ -0,0 +1,109 @@
+#ifndef ENERGY_POLICY_H
+#define ENERGY_POLICY_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace wombat {
+    //! The readings kept, one per wake.
+    static constexpr size_t ENERGY_HISTORY = 96;
+
+    /**
+     * @brief How much energy the node has to spend. Levels are ordered, so a higher level allows
+     * more work.
+     */
+    enum energy_level_t : uint8_t {
+        ENERGY_CRITICAL = 0,
+        ENERGY_LOW,
+        ENERGY_NORMAL,
+        ENERGY_SURPLUS,
+    };
+
+    /**
+     * @brief The battery and solar readings the energy policy keeps across deep sleep. It is plain
+     * data so it can live in RTC memory, and EnergyPolicy::begin() resets it if it does not hold a
+     * valid state.
+     */
+    struct EnergyPolicyState {
+        uint32_t magic;
+        //! The level chosen on the last wake, which the thresholds of the next are relative to.
+        uint8_t level;
+        //! The number of readings held.
+        uint8_t count;
+        //! The index the next reading is written to.
+        uint8_t next;
+        //! Set once a reading has shown the panel charging the battery.
+        uint8_t harvest_seen;
+        //! The time covered by the readings since the last one that showed harvest, in seconds.
+        uint32_t dark_s;
+        uint16_t battery_mv[ENERGY_HISTORY];
+        //! Solar panel voltages, SOLAR_UNKNOWN if the solar monitor could not be read.
+        uint16_t solar_mv[ENERGY_HISTORY];
+    };
+
+    /**
+     * @brief Chooses how often the node uplinks, and whether it may do bulk transfers such as FTP
+     * uploads and OTA updates, from the state of charge of the battery and the recent solar harvest.
+     *
+     * The battery voltage is the mean of the last few readings, so one reading taken while the modem
+     * was drawing current does not change the level. A level is only raised once the battery is
+     * HYSTERESIS_MV above the threshold that lowered it, so the node does not switch back and forth
+     * across a threshold.
+     *
+     * A node that has seen no harvest for NO_HARVEST_S, such as one in winter shade, drops a level
+     * so it spends less while the battery can still carry it. SURPLUS needs a full battery and some
+     * harvest in that time. The time is counted from the measurement interval of each reading rather
+     * than the number of readings, so a normal night does not count as a day in shade at a short
+     * measurement interval.
+     *
+     * The thresholds are for the single cell lithium ion battery the node is built with.
+     */
+    class EnergyPolicy {
+    public:
+        //! Below this the battery is nearly flat.
+        static constexpr uint16_t CRITICAL_MV = 3500;
+        //! Below this the battery is low.
+        static constexpr uint16_t LOW_MV = 3700;
+        //! At or above this the battery is full.
+        static constexpr uint16_t FULL_MV = 4050;
+        //! How far above a threshold the battery must be to raise the level again.
+        static constexpr uint16_t HYSTERESIS_MV = 50;
+        //! A solar voltage at or above this is charging the battery.
+        static constexpr uint16_t HARVEST_MV = 5000;
+        //! The number of the most recent battery readings averaged.
+        static constexpr size_t RECENT = 4;
+        //! Marks a solar reading that was not available.
+        static constexpr uint16_t SOLAR_UNKNOWN = 0xFFFF;
+        //! How long without harvest before the node is taken to be in shade, in seconds.
+        static constexpr uint32_t NO_HARVEST_S = 86400;
+        //! The longest a stretched uplink interval may be, in seconds.
+        static constexpr uint32_t MAX_UPLINK_S = 86400;
+
+        explicit EnergyPolicy(EnergyPolicyState &state) : state(state) {}
+
+        void begin(void);
+
+        void add(double battery_v, double solar_v, uint32_t elapsed_s);
+        energy_level_t evaluate(void);
+
+        uint32_t uplink_interval(uint32_t uplink_s, uint32_t measure_s) const;
+
+        //! The level chosen by the last call to evaluate().
+        energy_level_t get_level(void) const { return static_cast<energy_level_t>(state.level); }
+        //! True if there is energy for bulk transfers, such as FTP uploads and OTA updates.
+        bool allows_bulk(void) const { return get_level() >= ENERGY_NORMAL; }
+        //! The number of readings held.
+        size_t get_count(void) const { return state.count; }
+
+        uint16_t get_battery_mv(void) const;
+        bool has_harvest(void) const;
+        bool knows_solar(void) const;
+
+        static const char* level_name(energy_level_t level);
+
+    private:
+        EnergyPolicyState &state;
+    };
+}
+
+#endif //ENERGY_POLICY_H
@@ -0,0 +1,66 @@
+#include "file_stage.h"
+
+#include "crc32.h"
+#include "file_xfer.h"
+
+//
+// This file is a project-local platformio library so it can be unit tested.
+//
+// Do not include anything other than standard C++ headers.
+//
+
+namespace wombat {
+    /**
+     * @brief Appends each block of a transfer to a file on the modem.
+     */
+    class ModemFileSink : public XferSink {
+    public:
+        ModemFileSink(ModemFileSystem &fs, const char *name) : fs(fs), name(name) {}
+
+        bool write(const uint8_t *data, const size_t len) override { return fs.append(name, data, len); }
+
+    private:
+        ModemFileSystem &fs;
+        const char *name;
+    };
+
+    FileStager::FileStager(ModemFileSystem &fs, const char *name, const size_t chunk_size)
+        : fs(fs), name(name), xfer_buf(2 * (chunk_size > 0 ? chunk_size : DEFAULT_CHUNK_SIZE)) {}
+
+    /**
+     * @brief Make the file hold exactly the given payload.
+     *
+     * @return true if the modem reports the file is the size of the payload.
+     */
+    bool FileStager::stage(const uint8_t *data, const size_t len) {
+        const uint32_t crc = crc32(data, len);
+        size_t sz = 0;
+
+        reused = false;
+        if (staged && crc == staged_crc && len == staged_len && fs.size(name.c_str(), sz) && sz == len) {
+            reused = true;
+            return true;
+        }
+
+        staged = false;
+
+        // The file is usually left over from the previous message, it is fine if it does not exist.
+        fs.remove(name.c_str());
+
+        MemorySource src(data, len);
+        ModemFileSink sink(fs, name.c_str());
+        FileTransfer xfer(xfer_buf.data(), xfer_buf.size());
+        if ( ! xfer.run(src, sink)) {
+            return false;
+        }
+
+        if ( ! fs.size(name.c_str(), sz) || sz != len) {
+            return false;
+        }
+
+        staged = true;
+        staged_crc = crc;
+        staged_len = len;
+        return true;
+    }
+}
@@ -0,0 +1,66 @@
+#ifndef FILE_STAGE_H
+#define FILE_STAGE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace wombat {
+    /**
+     * @brief The modem file system operations needed to stage a file, so staging can be used with
+     * the SARA R5 on the node and with the R5 emulator in the unit tests.
+     */
+    class ModemFileSystem {
+    public:
+        virtual ~ModemFileSystem() = default;
+
+        //! Remove a file, returning false if it could not be removed or did not exist.
+        virtual bool remove(const char *name) = 0;
+        //! Append to a file, creating it if necessary.
+        virtual bool append(const char *name, const uint8_t *data, size_t len) = 0;
+        //! Get the size of a file as reported by the modem, returning false if it does not exist.
+        virtual bool size(const char *name, size_t &sz) = 0;
+    };
+
+    /**
+     * @brief Writes a payload to a file on the modem so it can be sent by a command that takes a
+     * file, such as an MQTT publish from a file.
+     *
+     * The payload is written once, in chunks copied by a FileTransfer, and the file is checked by the size the modem
+     * reports rather than by reading it back. Each chunk is acknowledged by the modem after it has
+     * received exactly the number of bytes announced, so a short or long write fails the chunk or
+     * the size check.
+     *
+     * The CRC-32 and length of the staged payload are kept so staging the same payload again, for
+     * example when a publish is retried, only needs the size check.
+     */
+    class FileStager {
+    public:
+        static constexpr size_t DEFAULT_CHUNK_SIZE = 2048;
+
+        FileStager(ModemFileSystem &fs, const char *name, size_t chunk_size = DEFAULT_CHUNK_SIZE);
+
+        bool stage(const uint8_t *data, size_t len);
+        void invalidate(void) { staged = false; }
+
+        const char *get_name(void) const { return name.c_str(); }
+        //! The CRC-32 of the payload passed to the last successful stage().
+        uint32_t get_crc(void) const { return staged_crc; }
+        //! True if the last successful stage() found the payload already on the modem.
+        bool was_reused(void) const { return reused; }
+
+    private:
+        ModemFileSystem &fs;
+        std::string name;
+        //! The transfer engine's two blocks, each of chunk_size bytes.
+        std::vector<uint8_t> xfer_buf;
+
+        bool staged = false;
+        bool reused = false;
+        uint32_t staged_crc = 0;
+        size_t staged_len = 0;
+    };
+}
+
+#endif //FILE_STAGE_H
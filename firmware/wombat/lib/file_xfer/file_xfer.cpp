@@ -0,0 +1,99 @@
+#include "file_xfer.h"
+
+#include <cstring>
+
+//
+// This file is a project-local platformio library so it can be unit tested.
+//
+// Do not include anything other than standard C++ headers.
+//
+
+namespace wombat {
+    int32_t MemorySource::read(uint8_t *buf, size_t n) {
+        if (n > len - offset) {
+            n = len - offset;
+        }
+
+        memcpy(buf, data + offset, n);
+        offset += n;
+        return static_cast<int32_t>(n);
+    }
+
+    bool MemorySink::write(const uint8_t *data, const size_t n) {
+        if (n > capacity - len) {
+            return false;
+        }
+
+        memcpy(buf + len, data, n);
+        len += n;
+        return true;
+    }
+
+    FileTransfer::FileTransfer(uint8_t *buffer, const size_t buffer_size) : block_size(buffer_size / 2) {
+        blocks_buf[0] = buffer;
+        blocks_buf[1] = buffer + block_size;
+    }
+
+    /**
+     * @brief Copy from src to sink until src has no more data or limit bytes have been copied.
+     *
+     * The sink's finish() is only called if src has no more data, so a sink can be left open for
+     * the next part of a transfer.
+     *
+     * @return false if the source or sink fails.
+     */
+    bool FileTransfer::run(XferSource &src, XferSink &sink, const size_t limit) {
+        bytes = 0;
+        blocks = 0;
+        end = false;
+
+        if (block_size < 1) {
+            return false;
+        }
+
+        if (limit < 1) {
+            return true;
+        }
+
+        // The bytes read from src, which are only counted as copied once they are written.
+        size_t read_total = 0;
+        int cur = 0;
+        src.start_read(blocks_buf[cur], limit < block_size ? limit : block_size);
+        while (true) {
+            const int32_t n = src.finish_read();
+            if (n < 0) {
+                return false;
+            }
+
+            if (n == 0) {
+                end = true;
+                return sink.finish();
+            }
+
+            read_total += static_cast<size_t>(n);
+
+            bool reading = false;
+            if (read_total < limit) {
+                const size_t left = limit - read_total;
+                src.start_read(blocks_buf[cur ^ 1], left < block_size ? left : block_size);
+                reading = true;
+            }
+
+            if ( ! sink.write(blocks_buf[cur], static_cast<size_t>(n))) {
+                // Do not leave a background read filling the buffer after returning.
+                if (reading) {
+                    src.finish_read();
+                }
+                return false;
+            }
+
+            bytes += static_cast<size_t>(n);
+            blocks++;
+            cur ^= 1;
+
+            if ( ! reading) {
+                return true;
+            }
+        }
+    }
+}
@@ -0,0 +1,114 @@
+#ifndef FILE_XFER_H
+#define FILE_XFER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace wombat {
+    /**
+     * @brief Something blocks of bytes can be read from, such as an open file.
+     *
+     * A source that can read in the background overrides start_read() and finish_read() so the
+     * transfer engine can write one block while the next is being read. The default implementation
+     * does the read in start_read().
+     */
+    class XferSource {
+    public:
+        virtual ~XferSource() = default;
+
+        //! Read up to len bytes, returning the number read, 0 at the end of the source or -1 on error.
+        virtual int32_t read(uint8_t *buf, size_t len) = 0;
+
+        //! Start reading up to len bytes into buf.
+        virtual void start_read(uint8_t *buf, size_t len) { pending = read(buf, len); }
+        //! Wait for the read started by start_read() and return its result, as for read().
+        virtual int32_t finish_read(void) { return pending; }
+
+    private:
+        int32_t pending = 0;
+    };
+
+    /**
+     * @brief Something blocks of bytes can be written to, such as an open file.
+     */
+    class XferSink {
+    public:
+        virtual ~XferSink() = default;
+
+        //! Write exactly len bytes, returning false on error.
+        virtual bool write(const uint8_t *data, size_t len) = 0;
+        //! Called after the last block has been written, returning false if the data could not be committed.
+        virtual bool finish(void) { return true; }
+    };
+
+    /**
+     * @brief An XferSource reading from memory.
+     */
+    class MemorySource : public XferSource {
+    public:
+        MemorySource(const uint8_t *data, size_t len) : data(data), len(len) {}
+
+        int32_t read(uint8_t *buf, size_t n) override;
+
+    private:
+        const uint8_t *data;
+        size_t len;
+        size_t offset = 0;
+    };
+
+    /**
+     * @brief An XferSink writing to memory. Writing more than the buffer holds is an error.
+     */
+    class MemorySink : public XferSink {
+    public:
+        MemorySink(uint8_t *buf, size_t capacity) : buf(buf), capacity(capacity) {}
+
+        bool write(const uint8_t *data, size_t n) override;
+
+        //! The number of bytes written.
+        size_t size(void) const { return len; }
+
+    private:
+        uint8_t *buf;
+        size_t capacity;
+        size_t len = 0;
+    };
+
+    /**
+     * @brief Copies bytes from an XferSource to an XferSink in large blocks.
+     *
+     * The buffer given to the engine is split into two blocks. While one block is being written to
+     * the sink the next is being read into the other, so a source that reads in the background
+     * overlaps its reads with the writes. With a source that does not, the transfer still makes one
+     * read and one write per block.
+     *
+     * The source and sink stay open between calls to run(), so a large file can be copied in parts,
+     * for example into a series of files on the modem, without reopening and seeking the source for
+     * each part.
+     */
+    class FileTransfer {
+    public:
+        FileTransfer(uint8_t *buffer, size_t buffer_size);
+
+        bool run(XferSource &src, XferSink &sink, size_t limit = SIZE_MAX);
+
+        //! The size of each block read and written.
+        size_t get_block_size(void) const { return block_size; }
+        //! The number of bytes written to the sink by the last call to run().
+        size_t get_bytes(void) const { return bytes; }
+        //! The number of blocks copied by the last call to run().
+        uint32_t get_blocks(void) const { return blocks; }
+        //! True if the last call to run() stopped because the source had no more data.
+        bool at_end(void) const { return end; }
+
+    private:
+        uint8_t *blocks_buf[2];
+        size_t block_size;
+
+        size_t bytes = 0;
+        uint32_t blocks = 0;
+        bool end = false;
+    };
+}
+
+#endif //FILE_XFER_H
@@ -0,0 +1,192 @@
+#include "ftp_pipeline.h"
+#include "crc32.h"
+
+#include <cstring>
+
+//
+// This file is a project-local platformio library so it can be unit tested.
+//
+// Do not include anything other than standard C++ headers.
+//
+
+namespace wombat {
+    static const uint8_t MANIFEST_MAGIC[] = { 'F', 'T', 'M', '3' };
+
+    static void put_u32(uint8_t *p, const uint32_t v) {
+        p[0] = static_cast<uint8_t>(v);
+        p[1] = static_cast<uint8_t>(v >> 8);
+        p[2] = static_cast<uint8_t>(v >> 16);
+        p[3] = static_cast<uint8_t>(v >> 24);
+    }
+
+    static uint32_t get_u32(const uint8_t *p) {
+        return p[0] | (p[1] << 8) | (p[2] << 16) | (static_cast<uint32_t>(p[3]) << 24);
+    }
+
+    PipelinedUpload::PipelinedUpload(ChunkStore &store, const size_t file_size, const size_t chunk_size, const unsigned max_attempts)
+        : store(store), file_size(file_size), chunk_size(chunk_size), max_attempts(max_attempts > 0 ? max_attempts : 1) {}
+
+    uint32_t PipelinedUpload::num_chunks(void) const {
+        if (chunk_size < 1) {
+            return 0;
+        }
+
+        return static_cast<uint32_t>((file_size + chunk_size - 1) / chunk_size);
+    }
+
+    size_t PipelinedUpload::chunk_len(const uint32_t chunk) const {
+        const size_t offset = static_cast<size_t>(chunk) * chunk_size;
+        return file_size - offset < chunk_size ? file_size - offset : chunk_size;
+    }
+
+    /**
+     * @brief PUT a staged chunk, staging the chunk after it during the first attempt.
+     *
+     * @param staged [IN/OUT] the number of chunks staged so far.
+     *
+     * @return true if the chunk was uploaded and the next chunk, if any, staged.
+     */
+    bool PipelinedUpload::put(const uint32_t chunk, uint32_t &staged) {
+        for (unsigned attempt = 0; attempt < max_attempts; attempt++) {
+            puts++;
+            const bool started = store.start_put(chunk);
+
+            if (staged == chunk + 1 && staged < num_chunks()) {
+                // Staged even if the PUT was rejected, so retries of this chunk do not stage it again.
+                const bool next_ok = store.stage(staged, chunk_len(staged));
+                staged++;
+                if ( ! next_ok) {
+                    if (started) {
+                        store.wait_put(chunk);
+                    }
+                    return false;
+                }
+            }
+
+            if (started && store.wait_put(chunk)) {
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    /**
+     * @brief Upload the file from first_chunk on, removing each chunk file once it has been sent.
+     *
+     * @return true if every chunk was uploaded.
+     */
+    bool PipelinedUpload::run(const uint32_t first_chunk) {
+        puts = 0;
+
+        const uint32_t n = num_chunks();
+        if (first_chunk >= n) {
+            return false;
+        }
+
+        uint32_t staged = first_chunk + 1;
+        bool ok = store.stage(first_chunk, chunk_len(first_chunk));
+
+        uint32_t chunk = first_chunk;
+        while (ok && chunk < n) {
+            ok = put(chunk, staged);
+            if (ok) {
+                store.uploaded(chunk);
+            }
+            if ( ! store.remove(chunk)) {
+                ok = false;
+            }
+            chunk++;
+        }
+
+        // Chunk files written but not sent, including the one that failed to stage.
+        for (; chunk < staged; chunk++) {
+            store.remove(chunk);
+        }
+
+        return ok;
+    }
+
+    bool UploadManifest::decode(const uint8_t *data, const size_t len) {
+        valid = false;
+        if (len != SIZE || memcmp(data, MANIFEST_MAGIC, sizeof(MANIFEST_MAGIC)) != 0 || get_u32(&data[56]) != crc32(data, 56)) {
+            return false;
+        }
+
+        chunk_size = get_u32(&data[4]);
+        head_crc = get_u32(&data[8]);
+        head_len = get_u32(&data[12]);
+        confirmed = get_u32(&data[16]);
+        flags = get_u32(&data[20]);
+        memcpy(name, &data[24], MAX_NAME);
+        name[MAX_NAME] = 0;
+
+        valid = chunk_size > 0 && head_len <= HEAD_SIZE;
+        return valid;
+    }
+
+    void UploadManifest::encode(uint8_t out[SIZE]) const {
+        memcpy(out, MANIFEST_MAGIC, sizeof(MANIFEST_MAGIC));
+        put_u32(&out[4], chunk_size);
+        put_u32(&out[8], head_crc);
+        put_u32(&out[12], head_len);
+        put_u32(&out[16], confirmed);
+        put_u32(&out[20], flags);
+        memset(&out[24], 0, MAX_NAME);
+        memcpy(&out[24], name, strnlen(name, MAX_NAME));
+        put_u32(&out[56], crc32(out, 56));
+    }
+
+    /**
+     * @brief The number of bytes at the start of the file to pass the CRC-32 of to start().
+     *
+     * This is the head length recorded when the manifest for the same file was created, so a file
+     * that was shorter than HEAD_SIZE and has grown since is checked over the same bytes. For a new
+     * upload, or a file now shorter than the recorded head, it is HEAD_SIZE or the whole file.
+     */
+    size_t UploadManifest::head_length(const char *file_name, const size_t file_size) const {
+        if (valid && strncmp(name, file_name, MAX_NAME) == 0 && head_len <= file_size) {
+            return head_len;
+        }
+
+        return file_size < HEAD_SIZE ? file_size : HEAD_SIZE;
+    }
+
+    /**
+     * @brief Start or resume the upload of a file.
+     *
+     * A decoded manifest for the same file is resumed if its chunks still fit in max_chunk_size,
+     * otherwise the manifest is reset to upload the whole file in chunks of max_chunk_size. A resumed
+     * upload keeps the compression it was started with, see get_gzip().
+     *
+     * @param crc the CRC-32 of the first head_length() bytes of the file.
+     * @param max_chunk_size the largest chunk the modem has room for now.
+     * @param gzip true if the chunks of a new upload are to be gzip compressed.
+     *
+     * @return the first chunk to upload, which is past the last chunk if the upload is complete.
+     */
+    uint32_t UploadManifest::start(const char *file_name, const size_t file_size, const uint32_t crc, const size_t max_chunk_size, const bool gzip) {
+        const size_t len = head_length(file_name, file_size);
+        if (valid && strncmp(name, file_name, MAX_NAME) == 0 && head_len == len && head_crc == crc &&
+            chunk_size <= max_chunk_size && confirmed <= file_size) {
+            // A file that has grown since its last chunk was confirmed resumes at that chunk.
+            return confirmed == file_size ? (confirmed + chunk_size - 1) / chunk_size : confirmed / chunk_size;
+        }
+
+        memset(name, 0, sizeof(name));
+        strncpy(name, file_name, MAX_NAME);
+        chunk_size = static_cast<uint32_t>(max_chunk_size);
+        head_crc = crc;
+        head_len = static_cast<uint32_t>(len);
+        confirmed = 0;
+        flags = gzip ? FLAG_GZIP : 0;
+        valid = chunk_size > 0;
+        return 0;
+    }
+
+    //! Record that the server has confirmed a chunk of a file of file_size bytes.
+    void UploadManifest::confirm(const uint32_t chunk, const size_t file_size) {
+        const size_t end = (static_cast<size_t>(chunk) + 1) * chunk_size;
+        confirmed = static_cast<uint32_t>(end < file_size ? end : file_size);
+    }
+}
@@ -0,0 +1,112 @@
+#ifndef FTP_PIPELINE_H
+#define FTP_PIPELINE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace wombat {
+    /**
+     * @brief The modem operations needed to upload a file by FTP as a series of chunk files, so the
+     * upload can be driven against the SARA R5 on the node and the R5 emulator in the unit tests.
+     */
+    class ChunkStore {
+    public:
+        virtual ~ChunkStore() = default;
+
+        //! Write the next len bytes of the file to the modem file for the given chunk.
+        virtual bool stage(uint32_t chunk, size_t len) = 0;
+        //! Start uploading the file for the given chunk, returning false if the modem rejects the command.
+        virtual bool start_put(uint32_t chunk) = 0;
+        //! Wait for the upload started by start_put() to finish, returning true if it succeeded.
+        virtual bool wait_put(uint32_t chunk) = 0;
+        //! Remove the modem file for the given chunk.
+        virtual bool remove(uint32_t chunk) = 0;
+        //! Called when the server has confirmed a chunk, before its modem file is removed.
+        virtual void uploaded(uint32_t /*chunk*/) {}
+    };
+
+    /**
+     * @brief Uploads a file as a series of chunk files, writing the next chunk to the modem while the
+     * previous chunk is being sent to the FTP server.
+     *
+     * An FTP PUT runs in the background on the modem, so staging the next chunk while it runs hides
+     * the shorter of the two. At most two chunk files exist on the modem at a time, so the chunk size
+     * must leave room for two.
+     *
+     * Chunks are staged in order, so the ChunkStore can read the file sequentially from an open
+     * handle. A failed PUT is retried without staging the chunk again. An upload can start at any
+     * chunk, to resume one that was interrupted.
+     */
+    class PipelinedUpload {
+    public:
+        PipelinedUpload(ChunkStore &store, size_t file_size, size_t chunk_size, unsigned max_attempts = 3);
+
+        bool run(uint32_t first_chunk = 0);
+
+        uint32_t num_chunks(void) const;
+        //! The number of PUT commands sent by run(), including retries.
+        uint32_t get_puts(void) const { return puts; }
+
+    private:
+        ChunkStore &store;
+        size_t file_size;
+        size_t chunk_size;
+        unsigned max_attempts;
+
+        uint32_t puts = 0;
+
+        size_t chunk_len(uint32_t chunk) const;
+        bool put(uint32_t chunk, uint32_t &staged);
+    };
+
+    /**
+     * @brief The progress of an FTP upload, kept on the node so an interrupted upload can resume at
+     * the first chunk the server has not confirmed.
+     *
+     * Chunks are confirmed in order, so the progress is the number of bytes confirmed. The file is
+     * identified by its name and the CRC-32 of its head rather than by its size, because data.json
+     * and log.txt are appended to between wakes. The head is the first HEAD_SIZE bytes, or the whole
+     * file if it was shorter when the manifest was created, and its length is kept so a short file
+     * that has grown is still recognised. A file that has grown resumes at the chunk holding its old
+     * end, so a partly filled last chunk is sent again with the new data.
+     *
+     * Whether the chunks are gzip compressed is kept too, so a resumed upload compresses and names
+     * its chunks the same way as the chunks already sent even if the setting has changed since.
+     *
+     * Layout, all values little-endian: magic "FTM3" (4), chunk size (4), CRC-32 of the head of the
+     * file (4), length of the head (4), bytes confirmed (4), flags (4), file name padded with nulls
+     * (32), CRC-32 of the preceding bytes (4).
+     */
+    class UploadManifest {
+    public:
+        static constexpr size_t SIZE = 60;
+        static constexpr size_t MAX_NAME = 32;
+        //! The most bytes at the start of the file covered by the head CRC.
+        static constexpr size_t HEAD_SIZE = 4096;
+
+        bool decode(const uint8_t *data, size_t len);
+        void encode(uint8_t out[SIZE]) const;
+
+        size_t head_length(const char *file_name, size_t file_size) const;
+        uint32_t start(const char *file_name, size_t file_size, uint32_t crc, size_t max_chunk_size, bool gzip = false);
+        void confirm(uint32_t chunk, size_t file_size);
+
+        size_t get_chunk_size(void) const { return chunk_size; }
+        size_t get_confirmed(void) const { return confirmed; }
+        //! True if the chunks of the upload are gzip compressed.
+        bool get_gzip(void) const { return (flags & FLAG_GZIP) != 0; }
+
+    private:
+        static constexpr uint32_t FLAG_GZIP = 1;
+
+        char name[MAX_NAME + 1] = { 0 };
+        uint32_t chunk_size = 0;
+        uint32_t head_crc = 0;
+        uint32_t head_len = 0;
+        uint32_t confirmed = 0;
+        uint32_t flags = 0;
+        bool valid = false;
+    };
+}
+
+#endif //FTP_PIPELINE_H
@@ -0,0 +1,258 @@
+#include "gzip_stream.h"
+#include "crc32.h"
+
+#include <cstring>
+
+//
+// This file is a project-local platformio library so it can be unit tested.
+//
+// Do not include anything other than standard C++ headers.
+//
+
+namespace wombat {
+    //! The gzip member header: magic, deflate, no flags, no modification time, no extra flags, unknown OS.
+    static const uint8_t GZIP_HEADER[] = { 0x1f, 0x8b, 8, 0, 0, 0, 0, 0, 0, 0xff };
+
+    //! The first match length of each length code from 257, RFC 1951 section 3.2.5.
+    static const uint16_t LENGTH_BASE[] = {
+        3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+    };
+    static const uint8_t LENGTH_EXTRA[] = {
+        0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+    };
+
+    //! The first distance of each distance code.
+    static const uint16_t DIST_BASE[] = {
+        1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073,
+        4097, 6145, 8193, 12289, 16385, 24577
+    };
+    static const uint8_t DIST_EXTRA[] = {
+        0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+    };
+
+    GzipSink::GzipSink(XferSink &out) : out(out), window(2 * WINDOW), head(1 << HASH_BITS, NIL), prev(WINDOW, NIL),
+        out_buf(OUT_BUF_SIZE) {
+        for (uint8_t b : GZIP_HEADER) {
+            put_byte(b);
+        }
+
+        // A single final block with the fixed Huffman codes.
+        put_bits(1, 1);
+        put_bits(1, 2);
+    }
+
+    bool GzipSink::write(const uint8_t *data, size_t len) {
+        if (finished) {
+            return false;
+        }
+
+        crc = crc32(data, len, crc);
+        in_bytes += static_cast<uint32_t>(len);
+
+        while (len > 0 && ok) {
+            if (window_len == window.size()) {
+                slide();
+            }
+
+            size_t n = window.size() - window_len;
+            if (n > len) {
+                n = len;
+            }
+
+            memcpy(&window[window_len], data, n);
+            window_len += n;
+            data += n;
+            len -= n;
+
+            compress(false);
+        }
+
+        return ok;
+    }
+
+    bool GzipSink::finish(void) {
+        if (finished) {
+            return ok;
+        }
+
+        finished = true;
+        compress(true);
+
+        // End of block, then pad to a byte boundary.
+        put_symbol(256);
+        if (bit_count > 0) {
+            put_bits(0, 8 - bit_count);
+        }
+
+        for (int i = 0; i < 4; i++) {
+            put_byte(static_cast<uint8_t>(crc >> (i * 8)));
+        }
+
+        for (int i = 0; i < 4; i++) {
+            put_byte(static_cast<uint8_t>(in_bytes >> (i * 8)));
+        }
+
+        flush_out();
+        return ok && out.finish();
+    }
+
+    /**
+     * @brief Encode the bytes in the window, keeping MAX_MATCH bytes back for the next write unless
+     * flush is true.
+     */
+    void GzipSink::compress(const bool flush) {
+        while (pos < window_len && (flush || window_len - pos >= MAX_MATCH)) {
+            size_t dist = 0;
+            const size_t len = longest_match(dist);
+            if (len >= MIN_MATCH) {
+                put_match(len, dist);
+                for (size_t i = 0; i < len; i++) {
+                    insert(pos++);
+                }
+            } else {
+                put_symbol(window[pos]);
+                insert(pos++);
+            }
+        }
+    }
+
+    //! Move the newest WINDOW bytes to the start of the window to make room for more input.
+    void GzipSink::slide(void) {
+        memmove(&window[0], &window[WINDOW], WINDOW);
+        window_len -= WINDOW;
+        pos -= WINDOW;
+
+        for (uint16_t &h : head) {
+            h = h >= WINDOW && h != NIL ? static_cast<uint16_t>(h - WINDOW) : NIL;
+        }
+
+        for (uint16_t &p : prev) {
+            p = p >= WINDOW && p != NIL ? static_cast<uint16_t>(p - WINDOW) : NIL;
+        }
+    }
+
+    //! Add the 3 bytes at p to the hash chains.
+    void GzipSink::insert(const size_t p) {
+        if (p + MIN_MATCH > window_len) {
+            return;
+        }
+
+        const uint32_t key = (window[p] << 16) | (window[p + 1] << 8) | window[p + 2];
+        const uint32_t h = (key * 2654435761u) >> (32 - HASH_BITS);
+        prev[p & (WINDOW - 1)] = head[h];
+        head[h] = static_cast<uint16_t>(p);
+    }
+
+    /**
+     * @brief Find the longest earlier match for the bytes at pos.
+     *
+     * @return the match length, less than MIN_MATCH if there is no match.
+     */
+    size_t GzipSink::longest_match(size_t &dist) {
+        size_t max_len = window_len - pos;
+        if (max_len > MAX_MATCH) {
+            max_len = MAX_MATCH;
+        }
+
+        if (max_len < MIN_MATCH) {
+            return 0;
+        }
+
+        const uint32_t key = (window[pos] << 16) | (window[pos + 1] << 8) | window[pos + 2];
+        uint16_t cand = head[(key * 2654435761u) >> (32 - HASH_BITS)];
+
+        size_t best = 0;
+        for (int chain = 0; chain < MAX_CHAIN && cand != NIL && cand < pos && pos - cand <= WINDOW; chain++) {
+            probes++;
+            const uint8_t *a = &window[cand];
+            const uint8_t *b = &window[pos];
+            if (a[best] == b[best]) {
+                size_t n = 0;
+                while (n < max_len && a[n] == b[n]) {
+                    n++;
+                }
+
+                if (n > best) {
+                    best = n;
+                    dist = pos - cand;
+                    if (n == max_len) {
+                        break;
+                    }
+                }
+            }
+
+            // Positions in prev are overwritten after WINDOW bytes, so a chain must always go back.
+            const uint16_t next = prev[cand & (WINDOW - 1)];
+            if (next == NIL || next >= cand) {
+                break;
+            }
+            cand = next;
+        }
+
+        return best;
+    }
+
+    //! Add bits to the output, least significant bit first.
+    void GzipSink::put_bits(const uint32_t bits, const int count) {
+        bit_buf |= bits << bit_count;
+        bit_count += count;
+        while (bit_count >= 8) {
+            put_byte(static_cast<uint8_t>(bit_buf));
+            bit_buf >>= 8;
+            bit_count -= 8;
+        }
+    }
+
+    //! Add a Huffman code to the output, which is written most significant bit first.
+    void GzipSink::put_huffman(const uint32_t code, const int count) {
+        uint32_t reversed = 0;
+        for (int i = 0; i < count; i++) {
+            reversed |= ((code >> i) & 1) << (count - 1 - i);
+        }
+        put_bits(reversed, count);
+    }
+
+    //! Add a literal/length symbol using the fixed Huffman code, RFC 1951 section 3.2.6.
+    void GzipSink::put_symbol(const int sym) {
+        if (sym < 144) {
+            put_huffman(0x30 + sym, 8);
+        } else if (sym < 256) {
+            put_huffman(0x190 + sym - 144, 9);
+        } else if (sym < 280) {
+            put_huffman(sym - 256, 7);
+        } else {
+            put_huffman(0xc0 + sym - 280, 8);
+        }
+    }
+
+    void GzipSink::put_match(const size_t len, const size_t dist) {
+        int code = 28;
+        while (LENGTH_BASE[code] > len) {
+            code--;
+        }
+        put_symbol(257 + code);
+        put_bits(static_cast<uint32_t>(len - LENGTH_BASE[code]), LENGTH_EXTRA[code]);
+
+        int dcode = 29;
+        while (DIST_BASE[dcode] > dist) {
+            dcode--;
+        }
+        put_huffman(static_cast<uint32_t>(dcode), 5);
+        put_bits(static_cast<uint32_t>(dist - DIST_BASE[dcode]), DIST_EXTRA[dcode]);
+    }
+
+    void GzipSink::put_byte(const uint8_t b) {
+        out_buf[out_len++] = b;
+        if (out_len == out_buf.size()) {
+            flush_out();
+        }
+    }
+
+    void GzipSink::flush_out(void) {
+        if (out_len > 0 && ok) {
+            ok = out.write(out_buf.data(), out_len);
+            out_bytes += static_cast<uint32_t>(out_len);
+        }
+        out_len = 0;
+    }
+}
@@ -0,0 +1,89 @@
+#ifndef GZIP_STREAM_H
+#define GZIP_STREAM_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+#include "file_xfer.h"
+
+namespace wombat {
+    /**
+     * @brief An XferSink that gzip compresses what is written to it and writes the result to
+     * another sink.
+     *
+     * The compressor is LZ77 with a 4 KB window and hash chains, encoded as a single deflate block
+     * with the fixed Huffman codes, so it needs about 28 KB of RAM and no code tables. That suits the
+     * node's data files, which repeat the same keys, labels and ids in every record, and the
+     * output is a standard gzip member any host can decompress. Members written one after another,
+     * such as a series of chunk files, can be concatenated and decompressed as one file.
+     *
+     * finish() must be called to write the end of the deflate block and the gzip trailer. It then
+     * calls finish() on the output sink.
+     */
+    class GzipSink : public XferSink {
+    public:
+        //! The LZ77 window size, the furthest back a match can be.
+        static constexpr size_t WINDOW = 4096;
+        //! The size of the buffer for compressed data, and of the writes to the output sink.
+        static constexpr size_t OUT_BUF_SIZE = 4096;
+
+        explicit GzipSink(XferSink &out);
+
+        bool write(const uint8_t *data, size_t len) override;
+        bool finish(void) override;
+
+        //! The number of bytes written to the compressor.
+        uint32_t get_in_bytes(void) const { return in_bytes; }
+        //! The number of bytes written to the output sink, including the gzip header and trailer.
+        uint32_t get_out_bytes(void) const { return out_bytes; }
+        //! The number of earlier positions compared with the input while looking for matches.
+        uint32_t get_probes(void) const { return probes; }
+
+    private:
+        static constexpr size_t MIN_MATCH = 3;
+        static constexpr size_t MAX_MATCH = 258;
+        static constexpr int HASH_BITS = 12;
+        static constexpr uint16_t NIL = 0xffff;
+        //! The most earlier positions compared at each input position.
+        static constexpr int MAX_CHAIN = 32;
+
+        XferSink &out;
+        bool ok = true;
+        bool finished = false;
+
+        //! The last WINDOW bytes encoded and the bytes waiting to be encoded.
+        std::vector<uint8_t> window;
+        size_t window_len = 0;
+        //! The position in window of the next byte to encode.
+        size_t pos = 0;
+        //! The most recent position of each hash of 3 bytes.
+        std::vector<uint16_t> head;
+        //! The previous position with the same hash as each position.
+        std::vector<uint16_t> prev;
+
+        std::vector<uint8_t> out_buf;
+        size_t out_len = 0;
+        uint32_t bit_buf = 0;
+        int bit_count = 0;
+
+        uint32_t crc = 0;
+        uint32_t in_bytes = 0;
+        uint32_t out_bytes = 0;
+        uint32_t probes = 0;
+
+        void compress(bool flush);
+        void slide(void);
+        void insert(size_t p);
+        size_t longest_match(size_t &dist);
+
+        void put_bits(uint32_t bits, int count);
+        void put_huffman(uint32_t code, int count);
+        void put_symbol(int sym);
+        void put_match(size_t len, size_t dist);
+        void put_byte(uint8_t b);
+        void flush_out(void);
+    };
+}
+
+#endif //GZIP_STREAM_H
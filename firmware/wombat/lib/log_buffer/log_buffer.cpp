@@ -0,0 +1,54 @@
+#include "log_buffer.h"
+
+#include <cstring>
+
+//
+// This file is a project-local platformio library so it can be unit tested.
+//
+// Do not include anything other than standard C++ headers.
+//
+
+namespace wombat {
+    /**
+     * @brief Add a line to the buffer.
+     *
+     * @return false if there is not enough space, in which case nothing is added.
+     */
+    bool LogBuffer::append(const char *s, const size_t len) {
+        if (s == nullptr || len < 1) {
+            return true;
+        }
+
+        if (len > space()) {
+            dropped++;
+            return false;
+        }
+
+        size_t tail = head + used;
+        if (tail >= buf.size()) {
+            tail -= buf.size();
+        }
+
+        const size_t first = len <= buf.size() - tail ? len : buf.size() - tail;
+        memcpy(&buf[tail], s, first);
+        if (first < len) {
+            memcpy(&buf[0], &s[first], len - first);
+        }
+
+        used += len;
+        return true;
+    }
+
+    void LogBuffer::consume(const size_t len) {
+        head += len;
+        if (head >= buf.size()) {
+            head -= buf.size();
+        }
+
+        used -= len;
+        if (used == 0) {
+            // Start from the beginning so the next drain is more likely to be a single write.
+            head = 0;
+        }
+    }
+}
@@ -0,0 +1,63 @@
+#ifndef LOG_BUFFER_H
+#define LOG_BUFFER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+namespace wombat {
+    /**
+     * @brief A ring buffer of log text that is written out in as few writes as possible.
+     *
+     * Lines are only ever added whole, so a line is either entirely in the buffer or was dropped.
+     */
+    class LogBuffer {
+    public:
+        explicit LogBuffer(size_t capacity) : buf(capacity) {}
+
+        bool append(const char *s, size_t len);
+
+        /**
+         * @brief Pass the buffered text to write, oldest first, and remove what was written.
+         *
+         * The text may wrap around the end of the buffer, so write is called at most twice. It must
+         * return the number of bytes it wrote.
+         *
+         * @return the number of bytes written.
+         */
+        template <typename Write>
+        size_t drain(Write write) {
+            size_t total = 0;
+            while (used > 0) {
+                const size_t chunk = head + used <= buf.size() ? used : buf.size() - head;
+                const size_t written = write(&buf[head], chunk);
+                total += written;
+                consume(written < chunk ? written : chunk);
+                if (written < chunk) {
+                    break;
+                }
+            }
+
+            return total;
+        }
+
+        //! The number of bytes waiting to be written.
+        size_t size(void) const { return used; }
+        //! The number of bytes that can be appended.
+        size_t space(void) const { return buf.size() - used; }
+        //! True if the buffer is at least three quarters full and should be written out.
+        bool high_water(void) const { return used >= buf.size() - buf.size() / 4; }
+        //! The number of lines dropped because there was no space for them.
+        uint32_t get_dropped(void) const { return dropped; }
+
+    private:
+        std::vector<char> buf;
+        size_t head = 0;
+        size_t used = 0;
+        uint32_t dropped = 0;
+
+        void consume(size_t len);
+    };
+}
+
+#endif //LOG_BUFFER_H
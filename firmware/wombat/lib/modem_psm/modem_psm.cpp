@@ -0,0 +1,293 @@
+#include "modem_psm.h"
+
+#include <cstdlib>
+#include <cstring>
+
+//
+// This file is a project-local platformio library so it can be unit tested.
+//
+// Do not include anything other than standard C++ headers.
+//
+
+namespace wombat {
+    //! Identifies a valid state, changed whenever the layout of UplinkEnergyState changes.
+    static constexpr uint32_t ENERGY_MAGIC = 0x55454E31; // "UEN1"
+
+    //! The unit, in seconds, of each value of the top 3 bits of a timer, or 0 for deactivated.
+    struct TimerUnit {
+        uint8_t bits;
+        uint32_t seconds;
+    };
+
+    //! The units of the extended periodic TAU timer, T3412, from 3GPP TS 24.008 10.5.7.4a. Shortest first.
+    static const TimerUnit PERIODIC_UNITS[] = {
+        { 0b011, 2 }, { 0b100, 30 }, { 0b101, 60 }, { 0b000, 600 }, { 0b001, 3600 }, { 0b010, 36000 }, { 0b110, 1152000 },
+    };
+
+    //! The units of the active timer, T3324, from 3GPP TS 24.008 10.5.7.3. Shortest first.
+    static const TimerUnit ACTIVE_UNITS[] = {
+        { 0b000, 2 }, { 0b001, 60 }, { 0b010, 360 },
+    };
+
+    //! The LTE-M eDRX cycles from 3GPP TS 24.008 10.5.5.32, in milliseconds, indexed by their value.
+    static const uint32_t EDRX_CYCLES_MS[] = {
+        5120, 10240, 20480, 40960, 61440, 81920, 102400, 122880,
+        143360, 163840, 327680, 655360, 1310720, 2621440, 5242880, 10485760,
+    };
+
+    static void write_bits(const uint32_t value, const size_t n, char *bits) {
+        for (size_t i = 0; i < n; i++) {
+            bits[i] = (value >> (n - 1 - i)) & 1 ? '1' : '0';
+        }
+        bits[n] = 0;
+    }
+
+    //! The value of a string of n '0' and '1' characters, or -1 if it is not one.
+    static int32_t read_bits(const char *bits, const size_t n) {
+        if (bits == nullptr || strlen(bits) != n) {
+            return -1;
+        }
+
+        int32_t value = 0;
+        for (size_t i = 0; i < n; i++) {
+            if (bits[i] != '0' && bits[i] != '1') {
+                return -1;
+            }
+            value = (value << 1) | (bits[i] - '0');
+        }
+
+        return value;
+    }
+
+    //! The shortest time the units can encode that is at least seconds.
+    static bool encode_timer(const uint32_t seconds, const TimerUnit *units, const size_t num_units, char *bits) {
+        uint64_t best = UINT64_MAX;
+        uint32_t best_bits = 0;
+        for (size_t i = 0; i < num_units; i++) {
+            const uint64_t value = (static_cast<uint64_t>(seconds) + units[i].seconds - 1) / units[i].seconds;
+            if (value > 31) {
+                continue;
+            }
+
+            const uint64_t encoded = value * units[i].seconds;
+            if (encoded < best) {
+                best = encoded;
+                best_bits = (static_cast<uint32_t>(units[i].bits) << 5) | static_cast<uint32_t>(value);
+            }
+        }
+
+        if (best == UINT64_MAX) {
+            return false;
+        }
+
+        write_bits(best_bits, PSM_TIMER_BITS, bits);
+        return true;
+    }
+
+    static int64_t decode_timer(const char *bits, const TimerUnit *units, const size_t num_units) {
+        const int32_t value = read_bits(bits, PSM_TIMER_BITS);
+        if (value < 0) {
+            return PSM_TIMER_OFF;
+        }
+
+        const uint8_t unit = static_cast<uint8_t>(value >> 5);
+        for (size_t i = 0; i < num_units; i++) {
+            if (units[i].bits == unit) {
+                return static_cast<int64_t>(value & 0x1F) * units[i].seconds;
+            }
+        }
+
+        return PSM_TIMER_OFF;
+    }
+
+    /**
+     * @brief Encode a periodic TAU time (T3412) for AT+CPSMS, as the shortest time that can be encoded
+     * that is at least the requested time.
+     *
+     * @return false if the time is too long to encode.
+     */
+    bool psm_encode_periodic(const uint32_t seconds, char bits[PSM_TIMER_BITS + 1]) {
+        return encode_timer(seconds, PERIODIC_UNITS, sizeof(PERIODIC_UNITS) / sizeof(PERIODIC_UNITS[0]), bits);
+    }
+
+    /**
+     * @brief Encode an active time (T3324) for AT+CPSMS, as the shortest time that can be encoded that is
+     * at least the requested time.
+     *
+     * @return false if the time is too long to encode.
+     */
+    bool psm_encode_active(const uint32_t seconds, char bits[PSM_TIMER_BITS + 1]) {
+        return encode_timer(seconds, ACTIVE_UNITS, sizeof(ACTIVE_UNITS) / sizeof(ACTIVE_UNITS[0]), bits);
+    }
+
+    //! The periodic TAU time in an encoded T3412, in seconds, or PSM_TIMER_OFF.
+    int64_t psm_decode_periodic(const char *bits) {
+        return decode_timer(bits, PERIODIC_UNITS, sizeof(PERIODIC_UNITS) / sizeof(PERIODIC_UNITS[0]));
+    }
+
+    //! The active time in an encoded T3324, in seconds, or PSM_TIMER_OFF.
+    int64_t psm_decode_active(const char *bits) {
+        return decode_timer(bits, ACTIVE_UNITS, sizeof(ACTIVE_UNITS) / sizeof(ACTIVE_UNITS[0]));
+    }
+
+    /**
+     * @brief Encode an LTE-M eDRX cycle for AT+CEDRXS, as the longest cycle that is no longer than the
+     * requested time, so paging is never later than asked for.
+     *
+     * @return false if the time is shorter than the shortest cycle.
+     */
+    bool edrx_encode(const uint32_t seconds, char bits[EDRX_BITS + 1]) {
+        const uint64_t ms = static_cast<uint64_t>(seconds) * 1000;
+        if (ms < EDRX_CYCLES_MS[0]) {
+            return false;
+        }
+
+        uint32_t value = 0;
+        for (uint32_t i = 0; i < sizeof(EDRX_CYCLES_MS) / sizeof(EDRX_CYCLES_MS[0]); i++) {
+            if (EDRX_CYCLES_MS[i] <= ms) {
+                value = i;
+            }
+        }
+
+        write_bits(value, EDRX_BITS, bits);
+        return true;
+    }
+
+    //! The cycle of an encoded LTE-M eDRX value, in milliseconds, or 0 if it is not valid.
+    uint32_t edrx_cycle_ms(const char *bits) {
+        const int32_t value = read_bits(bits, EDRX_BITS);
+        return value < 0 ? 0 : EDRX_CYCLES_MS[value];
+    }
+
+    /**
+     * @brief Parse the response to AT+CEREG? with unsolicited result codes set to 4, which includes the
+     * PSM timers the network granted.
+     *
+     * The response is `+CEREG: <n>,<stat>[,[<tac>],[<ci>],[<AcT>][,[<cause_type>],[<reject_cause>][,[<Active-Time>],[<Periodic-TAU>]]]]`,
+     * the timers are quoted and are missing if the network did not grant PSM.
+     *
+     * @return false if there is no +CEREG response.
+     */
+    bool psm_parse_cereg(const char *rsp, PsmGrant &grant) {
+        grant.stat = -1;
+        grant.active_s = PSM_TIMER_OFF;
+        grant.periodic_s = PSM_TIMER_OFF;
+
+        const char *p = rsp == nullptr ? nullptr : strstr(rsp, "+CEREG:");
+        if (p == nullptr) {
+            return false;
+        }
+        p += strlen("+CEREG:");
+
+        // Copy each field without its quotes.
+        static constexpr size_t MAX_FIELDS = 9;
+        static constexpr size_t MAX_FIELD = 16;
+        char fields[MAX_FIELDS][MAX_FIELD + 1] = {};
+        size_t field = 0;
+        size_t len = 0;
+        for (; *p != 0 && *p != '\r' && *p != '\n'; p++) {
+            if (*p == ',') {
+                if (++field >= MAX_FIELDS) {
+                    break;
+                }
+                len = 0;
+            } else if (*p != '"' && *p != ' ' && len < MAX_FIELD) {
+                fields[field][len++] = *p;
+            }
+        }
+
+        if (fields[1][0] == 0) {
+            return false;
+        }
+
+        grant.stat = atoi(fields[1]);
+        if (fields[7][0] != 0) {
+            grant.active_s = psm_decode_active(fields[7]);
+        }
+        if (fields[8][0] != 0) {
+            grant.periodic_s = psm_decode_periodic(fields[8]);
+        }
+
+        return true;
+    }
+
+    void EnergyMeter::start(void) {
+        uj = 0.0;
+        samples = 0;
+        ms = 0;
+        last_ms = 0;
+        last_mw = 0.0f;
+    }
+
+    /**
+     * @brief Add a power sample.
+     *
+     * @param now_ms when the sample was taken, in milliseconds.
+     * @param mw the power, in milliwatts.
+     */
+    void EnergyMeter::sample(const uint32_t now_ms, const float mw) {
+        if (samples > 0) {
+            const uint32_t gap_ms = now_ms - last_ms;
+            if (gap_ms <= MAX_GAP_MS) {
+                // mW x ms is uJ.
+                uj += (static_cast<double>(last_mw) + mw) / 2.0 * gap_ms;
+                ms += gap_ms;
+            }
+        }
+
+        last_ms = now_ms;
+        last_mw = mw;
+        samples++;
+    }
+
+    /**
+     * @brief Reset the state if it is not valid.
+     *
+     * On a cold boot the RTC memory holds garbage or zeros, after deep sleep it holds the uplinks
+     * measured by the previous wakes.
+     */
+    void UplinkEnergy::begin(void) {
+        if (state.magic != ENERGY_MAGIC || state.last_start >= MODEM_NUM_STARTS) {
+            memset(&state, 0, sizeof(state));
+            state.magic = ENERGY_MAGIC;
+            state.reported = true;
+        }
+    }
+
+    //! Record the energy of an uplink.
+    void UplinkEnergy::record(const modem_start_t start, const uint32_t mj) {
+        if (start >= MODEM_NUM_STARTS) {
+            return;
+        }
+
+        state.count[start]++;
+        state.total_mj[start] += mj;
+        state.last_mj = mj;
+        state.last_start = start;
+        state.reported = false;
+    }
+
+    uint32_t UplinkEnergy::get_mean_mj(const modem_start_t start) const {
+        if (start >= MODEM_NUM_STARTS || state.count[start] == 0) {
+            return 0;
+        }
+
+        return static_cast<uint32_t>(state.total_mj[start] / state.count[start]);
+    }
+
+    /**
+     * @brief Get the last uplink if it has not been reported, and mark it reported.
+     *
+     * @return true if there was an unreported uplink.
+     */
+    bool UplinkEnergy::take_unreported(uint32_t &mj, modem_start_t &start) {
+        if (state.reported) {
+            return false;
+        }
+
+        mj = state.last_mj;
+        start = static_cast<modem_start_t>(state.last_start);
+        state.reported = true;
+        return true;
+    }
+}
@@ -0,0 +1,117 @@
+#ifndef MODEM_PSM_H
+#define MODEM_PSM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace wombat {
+    //! A PSM timer the network did not grant, or that is deactivated.
+    static constexpr int64_t PSM_TIMER_OFF = -1;
+    //! The length of an encoded PSM timer, a string of 8 '0' and '1' characters.
+    static constexpr size_t PSM_TIMER_BITS = 8;
+    //! The length of an encoded eDRX cycle, a string of 4 '0' and '1' characters.
+    static constexpr size_t EDRX_BITS = 4;
+
+    bool psm_encode_periodic(uint32_t seconds, char bits[PSM_TIMER_BITS + 1]);
+    bool psm_encode_active(uint32_t seconds, char bits[PSM_TIMER_BITS + 1]);
+    int64_t psm_decode_periodic(const char *bits);
+    int64_t psm_decode_active(const char *bits);
+
+    bool edrx_encode(uint32_t seconds, char bits[EDRX_BITS + 1]);
+    uint32_t edrx_cycle_ms(const char *bits);
+
+    //! The registration status and PSM timers from a +CEREG read response.
+    struct PsmGrant {
+        //! The EPS registration status, 1 for home and 5 for roaming.
+        int stat;
+        //! The active time (T3324) the network granted, in seconds, or PSM_TIMER_OFF.
+        int64_t active_s;
+        //! The periodic TAU time (T3412) the network granted, in seconds, or PSM_TIMER_OFF.
+        int64_t periodic_s;
+
+        //! True if the modem is registered and can sleep in PSM.
+        bool granted(void) const { return (stat == 1 || stat == 5) && active_s >= 0 && periodic_s > 0; }
+    };
+
+    bool psm_parse_cereg(const char *rsp, PsmGrant &grant);
+
+    //! How the modem was brought up for an uplink.
+    enum modem_start_t : uint8_t {
+        //! Powered on, registered and the PDP context activated.
+        MODEM_START_COLD = 0,
+        //! Woken from PSM, still registered with the PDP context active.
+        MODEM_START_PSM,
+        MODEM_NUM_STARTS
+    };
+
+    /**
+     * @brief The energy used by uplinks, kept across deep sleep. It is plain data so it can live in RTC
+     * memory, and UplinkEnergy::begin() resets it if it does not hold a valid state.
+     */
+    struct UplinkEnergyState {
+        uint32_t magic;
+        //! The number of uplinks measured for each way of starting the modem.
+        uint32_t count[MODEM_NUM_STARTS];
+        //! The total energy of the uplinks measured for each way of starting the modem, in millijoules.
+        uint64_t total_mj[MODEM_NUM_STARTS];
+        //! The energy of the last uplink, in millijoules.
+        uint32_t last_mj;
+        //! How the modem was started for the last uplink.
+        uint8_t last_start;
+        //! True once the last uplink has been reported.
+        bool reported;
+    };
+
+    /**
+     * @brief Integrates power samples into energy with the trapezoid rule.
+     *
+     * Samples may come at any interval, but a gap of more than MAX_GAP_MS is not integrated across,
+     * so a stalled sampler does not make up the energy of a period it did not see.
+     */
+    class EnergyMeter {
+    public:
+        //! The longest gap between samples that is integrated across.
+        static constexpr uint32_t MAX_GAP_MS = 2000;
+
+        void start(void);
+        void sample(uint32_t now_ms, float mw);
+
+        //! The energy of the samples so far, in millijoules.
+        double get_mj(void) const { return uj / 1000.0; }
+        //! The number of samples so far.
+        uint32_t get_samples(void) const { return samples; }
+        //! The time covered by the samples so far, in milliseconds.
+        uint32_t get_ms(void) const { return ms; }
+
+    private:
+        double uj = 0.0;
+        uint32_t samples = 0;
+        uint32_t ms = 0;
+        uint32_t last_ms = 0;
+        float last_mw = 0.0f;
+    };
+
+    /**
+     * @brief Keeps the energy per uplink for each way of starting the modem, so a node can report how
+     * much PSM saves it.
+     */
+    class UplinkEnergy {
+    public:
+        explicit UplinkEnergy(UplinkEnergyState &state) : state(state) {}
+
+        void begin(void);
+        void record(modem_start_t start, uint32_t mj);
+
+        //! The mean energy per uplink for a way of starting the modem, in millijoules, or 0 if none were measured.
+        uint32_t get_mean_mj(modem_start_t start) const;
+        //! The number of uplinks measured for a way of starting the modem.
+        uint32_t get_count(modem_start_t start) const { return start < MODEM_NUM_STARTS ? state.count[start] : 0; }
+
+        bool take_unreported(uint32_t &mj, modem_start_t &start);
+
+    private:
+        UplinkEnergyState &state;
+    };
+}
+
+#endif //MODEM_PSM_H
@@ -0,0 +1,97 @@
+#include "msg_batch.h"
+
+//
+// This file is a project-local platformio library so it can be unit tested.
+//
+// Do not include anything other than standard C++ headers.
+//
+
+namespace wombat {
+    /**
+     * @brief The number of bytes a batch of count messages adds to the messages themselves.
+     *
+     * A JSON batch has the brackets and a comma between each message. A CBOR batch has the
+     * array header, which grows with the number of messages.
+     */
+    size_t MsgBatch::overhead(const msg_batch_format_t format, const size_t count) {
+        if (format == MSG_BATCH_JSON) {
+            return count > 0 ? count + 1 : 2;
+        }
+
+        if (count < 24) {
+            return 1;
+        }
+
+        if (count <= UINT8_MAX) {
+            return 2;
+        }
+
+        return count <= UINT16_MAX ? 3 : 5;
+    }
+
+    /**
+     * @brief Add a message to the batch if it fits.
+     *
+     * @return false if the batch would be larger than the limit with the message added. If the batch is
+     * empty this means the message is too large to be batched and must be sent on its own.
+     */
+    bool MsgBatch::add(const uint8_t *msg, const size_t len) {
+        if (msg == nullptr || len < 1) {
+            return false;
+        }
+
+        if (msg_bytes + len + overhead(format, num_msgs + 1) > limit) {
+            return false;
+        }
+
+        if (format == MSG_BATCH_JSON && num_msgs > 0) {
+            body.push_back(',');
+        }
+
+        body.insert(body.end(), msg, msg + len);
+        msg_bytes += len;
+        num_msgs++;
+        return true;
+    }
+
+    /**
+     * @brief Write the batch, with its array framing, to out.
+     */
+    void MsgBatch::payload(std::vector<uint8_t> &out) const {
+        out.clear();
+        out.reserve(size());
+
+        if (format == MSG_BATCH_JSON) {
+            out.push_back('[');
+            out.insert(out.end(), body.begin(), body.end());
+            out.push_back(']');
+            return;
+        }
+
+        // CBOR major type 4, array.
+        static constexpr uint8_t ARRAY = 4 << 5;
+        if (num_msgs < 24) {
+            out.push_back(ARRAY | static_cast<uint8_t>(num_msgs));
+        } else if (num_msgs <= UINT8_MAX) {
+            out.push_back(ARRAY | 24);
+            out.push_back(static_cast<uint8_t>(num_msgs));
+        } else if (num_msgs <= UINT16_MAX) {
+            out.push_back(ARRAY | 25);
+            out.push_back(static_cast<uint8_t>(num_msgs >> 8));
+            out.push_back(static_cast<uint8_t>(num_msgs));
+        } else {
+            out.push_back(ARRAY | 26);
+            for (int shift = 24; shift >= 0; shift -= 8) {
+                out.push_back(static_cast<uint8_t>(num_msgs >> shift));
+            }
+        }
+
+        out.insert(out.end(), body.begin(), body.end());
+    }
+
+    void MsgBatch::clear(void) {
+        num_msgs = 0;
+        msg_bytes = 0;
+        body.clear();
+    }
+}
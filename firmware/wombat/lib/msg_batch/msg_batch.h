@@ -0,0 +1,48 @@
+#ifndef MSG_BATCH_H
+#define MSG_BATCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+namespace wombat {
+    //! How the messages in a batch are combined.
+    enum msg_batch_format_t {
+        //! A JSON array of the JSON messages.
+        MSG_BATCH_JSON,
+        //! A CBOR array of the CBOR messages.
+        MSG_BATCH_CBOR
+    };
+
+    /**
+     * @brief Packs stored uplink messages into a single payload no larger than a given limit.
+     *
+     * Each message is a complete JSON object or CBOR data item, so a batch is just an array of them
+     * and the receiver can split it without any other framing.
+     */
+    class MsgBatch {
+    public:
+        MsgBatch(msg_batch_format_t format, size_t limit) : format(format), limit(limit) {}
+
+        static size_t overhead(msg_batch_format_t format, size_t count);
+
+        bool add(const uint8_t *msg, size_t len);
+        void payload(std::vector<uint8_t> &out) const;
+        void clear(void);
+
+        //! The number of messages in the batch.
+        size_t count(void) const { return num_msgs; }
+        //! The size of the payload, including the array framing.
+        size_t size(void) const { return msg_bytes + overhead(format, num_msgs); }
+
+    private:
+        msg_batch_format_t format;
+        size_t limit;
+        size_t num_msgs = 0;
+        //! The total size of the messages, not including any separators in body.
+        size_t msg_bytes = 0;
+        std::vector<uint8_t> body;
+    };
+}
+
+#endif //MSG_BATCH_H
@@ -0,0 +1,417 @@
+#include "msg_cbor.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+#include "cbor.h"
+#include "crc32.h"
+
+//
+// This file is a project-local platformio library so it can be unit tested.
+//
+// Do not include anything other than standard C++ headers.
+//
+
+namespace wombat {
+    const char *const MSG_FIXED_LABELS[] = {
+        "battery (v)", "solar (v)", "rsrq", "rsrp", "pulse_count", "shortest_pulse",
+        // The wake profile summary, see WAKE_PHASE_LABELS.
+        "wake (ms)", "wake p90 (ms)", "sdi-12 slowest (ms)",
+        "boot (ms)", "spiffs (ms)", "config (ms)", "modem (ms)", "registration (ms)", "ntp (ms)",
+        "sdi-12 (ms)", "msg write (ms)", "uplink (ms)", "shutdown (ms)",
+        "missed slots", "uplink (mJ)", "uplink psm", "registration fast", "registration mean (ms)"
+    };
+    const size_t MSG_NUM_FIXED_LABELS_USED = sizeof(MSG_FIXED_LABELS) / sizeof(MSG_FIXED_LABELS[0]);
+
+    const char *const MSG_SOURCE_ID_KEYS[] = { "serial_no", "firmware", "ccid", "sdi-12" };
+    const size_t MSG_NUM_SOURCE_ID_KEYS = sizeof(MSG_SOURCE_ID_KEYS) / sizeof(MSG_SOURCE_ID_KEYS[0]);
+
+    //! The index of "sdi-12" in MSG_SOURCE_ID_KEYS.
+    static constexpr uint64_t SOURCE_ID_SDI12 = 3;
+
+    //! Set in a label code for an SDI-12 value without a label in the sensor definitions, eg 1_V3.
+    static constexpr uint32_t LABEL_GENERIC = 0x01;
+
+    void LabelDictionary::add(const char *label) {
+        if (label != nullptr) {
+            labels.emplace_back(label);
+        }
+    }
+
+    /**
+     * @brief Sort the labels, remove duplicates and calculate the fingerprint.
+     *
+     * The fingerprint is the CRC-32 of the labels in order, each followed by a newline.
+     */
+    void LabelDictionary::finish(void) {
+        std::sort(labels.begin(), labels.end());
+        labels.erase(std::unique(labels.begin(), labels.end()), labels.end());
+
+        fp = 0;
+        for (const std::string &s : labels) {
+            fp = crc32(s.data(), s.size(), fp);
+            fp = crc32("\n", 1, fp);
+        }
+    }
+
+    /**
+     * @brief Returns the number of a label, or -1 if it is not in the dictionary.
+     */
+    int LabelDictionary::find(const char *label) const {
+        if (label == nullptr) {
+            return -1;
+        }
+
+        auto iter = std::lower_bound(labels.begin(), labels.end(), label);
+        if (iter == labels.end() || *iter != label) {
+            return -1;
+        }
+
+        return static_cast<int>(iter - labels.begin());
+    }
+
+    static int64_t days_from_civil(int64_t y, const unsigned m, const unsigned d) {
+        y -= m <= 2;
+        const int64_t era = (y >= 0 ? y : y - 399) / 400;
+        const unsigned yoe = static_cast<unsigned>(y - era * 400);
+        const unsigned doy = (153 * (m > 2 ? m - 3 : m + 9) + 2) / 5 + d - 1;
+        const unsigned doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+        return era * 146097 + static_cast<int64_t>(doe) - 719468;
+    }
+
+    /**
+     * @brief Parse a timestamp in the form returned by iso8601(), eg 2024-05-15T01:02:03Z.
+     */
+    bool parse_iso8601(const char *s, uint32_t &epoch) {
+        if (s == nullptr || strlen(s) != 20) {
+            return false;
+        }
+
+        unsigned y, mo, d, h, mi, sec;
+        char z;
+        if (sscanf(s, "%4u-%2u-%2uT%2u:%2u:%2u%c", &y, &mo, &d, &h, &mi, &sec, &z) != 7 || z != 'Z') {
+            return false;
+        }
+
+        if (y < 1970 || mo < 1 || mo > 12 || d < 1 || d > 31 || h > 23 || mi > 59 || sec > 59) {
+            return false;
+        }
+
+        const int64_t t = days_from_civil(y, mo, d) * 86400 + h * 3600 + mi * 60 + sec;
+        if (t < 0 || t > UINT32_MAX) {
+            return false;
+        }
+
+        epoch = static_cast<uint32_t>(t);
+
+        // Reject dates such as 30 February that sscanf accepts.
+        return format_iso8601(epoch) == s;
+    }
+
+    std::string format_iso8601(const uint32_t epoch) {
+        const int64_t z = epoch / 86400 + 719468;
+        const uint32_t secs = epoch % 86400;
+        const int64_t era = z / 146097;
+        const unsigned doe = static_cast<unsigned>(z - era * 146097);
+        const unsigned yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+        const unsigned doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+        const unsigned mp = (5 * doy + 2) / 153;
+        const unsigned d = doy - (153 * mp + 2) / 5 + 1;
+        const unsigned m = mp < 10 ? mp + 3 : mp - 9;
+        const int64_t y = static_cast<int64_t>(yoe) + era * 400 + (m <= 2);
+
+        char buf[32];
+        snprintf(buf, sizeof(buf), "%04d-%02u-%02uT%02u:%02u:%02uZ", static_cast<int>(y), m, d,
+                 secs / 3600, (secs / 60) % 60, secs % 60);
+        return buf;
+    }
+
+    /// Parse an unsigned decimal number with no leading zeros, so formatting it gives back the same text.
+    static bool parse_canonical_uint(const char *s, const size_t len, uint32_t &v) {
+        if (len < 1 || len > 6 || (len > 1 && s[0] == '0')) {
+            return false;
+        }
+
+        v = 0;
+        for (size_t i = 0; i < len; i++) {
+            if (s[i] < '0' || s[i] > '9') {
+                return false;
+            }
+
+            v = v * 10 + (s[i] - '0');
+        }
+
+        return true;
+    }
+
+    /**
+     * @brief Find the numeric code for a timeseries name.
+     *
+     * Codes below MSG_NUM_FIXED_LABELS are the node's own values from MSG_FIXED_LABELS. Above that, the
+     * code less MSG_NUM_FIXED_LABELS holds the sensor address in bits 1-7 and either the dictionary number
+     * of the label or, for values without a label, the value number in the bits above that. Bit 0 is set
+     * for values without a label.
+     *
+     * SDI-12 values with a label are named by sensor_task() as the address less '0' in decimal, then an
+     * underscore and the label. Values without a label are named as the address, then _V and the value number.
+     *
+     * @return false if the name has no code and must be sent as text.
+     */
+    bool encode_label(const char *name, const LabelDictionary &dict, uint32_t &code) {
+        if (name == nullptr) {
+            return false;
+        }
+
+        for (size_t i = 0; i < MSG_NUM_FIXED_LABELS_USED; i++) {
+            if ( ! strcmp(name, MSG_FIXED_LABELS[i])) {
+                code = static_cast<uint32_t>(i);
+                return true;
+            }
+        }
+
+        const char *underscore = strchr(name, '_');
+        if (underscore == nullptr || underscore == name) {
+            return false;
+        }
+
+        const size_t prefix_len = underscore - name;
+        const char *rest = underscore + 1;
+
+        uint32_t n;
+        if (parse_canonical_uint(name, prefix_len, n)) {
+            const uint32_t addr = '0' + n;
+            const int id = dict.find(rest);
+            if (addr > ' ' && addr < 0x7f && id >= 0) {
+                code = MSG_NUM_FIXED_LABELS + ((static_cast<uint32_t>(id) << 8) | (addr << 1));
+                return true;
+            }
+        }
+
+        const uint8_t addr = static_cast<uint8_t>(name[0]);
+        if (prefix_len == 1 && addr > ' ' && addr < 0x7f && rest[0] == 'V' &&
+            parse_canonical_uint(&rest[1], strlen(&rest[1]), n)) {
+            code = MSG_NUM_FIXED_LABELS + ((n << 8) | (addr << 1) | LABEL_GENERIC);
+            return true;
+        }
+
+        return false;
+    }
+
+    bool decode_label(const uint32_t code, const LabelDictionary &dict, std::string &name) {
+        if (code < MSG_NUM_FIXED_LABELS) {
+            if (code >= MSG_NUM_FIXED_LABELS_USED) {
+                return false;
+            }
+
+            name = MSG_FIXED_LABELS[code];
+            return true;
+        }
+
+        const uint32_t x = code - MSG_NUM_FIXED_LABELS;
+        const char addr = static_cast<char>((x >> 1) & 0x7f);
+        const uint32_t n = x >> 8;
+
+        char buf[16];
+        if (x & LABEL_GENERIC) {
+            snprintf(buf, sizeof(buf), "%c_V%u", addr, n);
+            name = buf;
+            return true;
+        }
+
+        if (n >= dict.size()) {
+            return false;
+        }
+
+        snprintf(buf, sizeof(buf), "%d_", addr - '0');
+        name = buf;
+        name += dict.get(n);
+        return true;
+    }
+
+    /**
+     * @brief Encode a message as CBOR.
+     *
+     * The message is a map with integer keys:
+     *
+     * - 0: the timestamp as seconds since the epoch, or text if it could not be parsed.
+     * - 1: the source_ids map, keyed by the index into MSG_SOURCE_ID_KEYS or the key text.
+     * - 2: the timeseries as a flat array of label code or text, then value.
+     * - 3: the fingerprint of the label dictionary.
+     */
+    void encode_message(const UplinkMessage &msg, const LabelDictionary &dict, std::vector<uint8_t> &out) {
+        CborWriter w;
+        w.map(4);
+
+        w.uint(MSG_KEY_TIMESTAMP);
+        uint32_t epoch;
+        if (parse_iso8601(msg.timestamp.c_str(), epoch)) {
+            w.uint(epoch);
+        } else {
+            w.text(msg.timestamp.c_str());
+        }
+
+        w.uint(MSG_KEY_SOURCE_IDS);
+        w.map(msg.source_ids.size() + 1);
+        for (const auto &id : msg.source_ids) {
+            bool coded = false;
+            for (size_t i = 0; i < MSG_NUM_SOURCE_ID_KEYS; i++) {
+                if (id.first == MSG_SOURCE_ID_KEYS[i]) {
+                    w.uint(i);
+                    coded = true;
+                    break;
+                }
+            }
+
+            if ( ! coded) {
+                w.text(id.first.c_str());
+            }
+
+            w.text(id.second.c_str());
+        }
+
+        w.uint(SOURCE_ID_SDI12);
+        w.array(msg.sdi12_ids.size());
+        for (const std::string &id : msg.sdi12_ids) {
+            w.text(id.c_str());
+        }
+
+        w.uint(MSG_KEY_TIMESERIES);
+        w.array(msg.timeseries.size() * 2);
+        for (const auto &ts : msg.timeseries) {
+            uint32_t code;
+            if (encode_label(ts.first.c_str(), dict, code)) {
+                w.uint(code);
+            } else {
+                w.text(ts.first.c_str());
+            }
+
+            w.number(ts.second);
+        }
+
+        w.uint(MSG_KEY_DICTIONARY);
+        w.uint(dict.fingerprint());
+
+        out = w.data();
+    }
+
+    /**
+     * @brief Decode a message written by encode_message.
+     *
+     * @return false if the message is invalid or was encoded with a different label dictionary.
+     */
+    bool decode_message(const uint8_t *data, const size_t len, const LabelDictionary &dict, UplinkMessage &msg) {
+        CborReader r(data, len);
+        msg = UplinkMessage();
+
+        size_t n;
+        if ( ! r.read_map(n)) {
+            return false;
+        }
+
+        // The fingerprint is needed before the labels can be decoded, so find it first.
+        CborReader scan(data, len);
+        scan.read_map(n);
+        bool have_fp = false;
+        for (size_t i = 0; i < n; i++) {
+            uint64_t key, fp;
+            if ( ! scan.read_uint(key)) {
+                return false;
+            }
+
+            if (key == MSG_KEY_DICTIONARY) {
+                if ( ! scan.read_uint(fp) || fp != dict.fingerprint()) {
+                    return false;
+                }
+                have_fp = true;
+            } else if ( ! scan.skip()) {
+                return false;
+            }
+        }
+
+        if ( ! have_fp) {
+            return false;
+        }
+
+        for (size_t i = 0; i < n; i++) {
+            uint64_t key;
+            r.read_uint(key);
+
+            if (key == MSG_KEY_TIMESTAMP) {
+                uint64_t epoch;
+                if (r.read_uint(epoch)) {
+                    msg.timestamp = format_iso8601(static_cast<uint32_t>(epoch));
+                } else if ( ! r.read_text(msg.timestamp)) {
+                    return false;
+                }
+            } else if (key == MSG_KEY_SOURCE_IDS) {
+                size_t num_ids;
+                if ( ! r.read_map(num_ids)) {
+                    return false;
+                }
+
+                for (size_t j = 0; j < num_ids; j++) {
+                    uint64_t id_code;
+                    std::string id_key;
+                    if (r.read_uint(id_code)) {
+                        if (id_code >= MSG_NUM_SOURCE_ID_KEYS) {
+                            return false;
+                        }
+                        id_key = MSG_SOURCE_ID_KEYS[id_code];
+                    } else if ( ! r.read_text(id_key)) {
+                        return false;
+                    }
+
+                    if (id_key == MSG_SOURCE_ID_KEYS[SOURCE_ID_SDI12]) {
+                        size_t num_sensors;
+                        if ( ! r.read_array(num_sensors)) {
+                            return false;
+                        }
+
+                        for (size_t k = 0; k < num_sensors; k++) {
+                            std::string id;
+                            if ( ! r.read_text(id)) {
+                                return false;
+                            }
+                            msg.sdi12_ids.push_back(id);
+                        }
+                    } else {
+                        std::string value;
+                        if ( ! r.read_text(value)) {
+                            return false;
+                        }
+                        msg.source_ids.emplace_back(id_key, value);
+                    }
+                }
+            } else if (key == MSG_KEY_TIMESERIES) {
+                size_t num_items;
+                if ( ! r.read_array(num_items) || num_items % 2 != 0) {
+                    return false;
+                }
+
+                for (size_t j = 0; j < num_items; j += 2) {
+                    uint64_t code;
+                    std::string name;
+                    if (r.read_uint(code)) {
+                        if (code > UINT32_MAX || ! decode_label(static_cast<uint32_t>(code), dict, name)) {
+                            return false;
+                        }
+                    } else if ( ! r.read_text(name)) {
+                        return false;
+                    }
+
+                    double value;
+                    if ( ! r.read_number(value)) {
+                        return false;
+                    }
+
+                    msg.timeseries.emplace_back(name, value);
+                }
+            } else if ( ! r.skip()) {
+                return false;
+            }
+        }
+
+        return r.at_end();
+    }
+}
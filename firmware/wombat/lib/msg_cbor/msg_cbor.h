@@ -0,0 +1,72 @@
+#ifndef MSG_CBOR_H
+#define MSG_CBOR_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace wombat {
+    /**
+     * @brief The labels from the SDI-12 sensor definitions, numbered so a message can carry a
+     * small integer instead of the label text.
+     *
+     * The labels are sorted and duplicates removed so the device and the host-side decoder,
+     * which both read the same sdi12defn.json file, number them identically. The fingerprint
+     * is sent in each message so the decoder can detect it has a different definitions file.
+     */
+    class LabelDictionary {
+    public:
+        void add(const char *label);
+        void finish(void);
+
+        int find(const char *label) const;
+        const std::string &get(size_t i) const { return labels[i]; }
+        size_t size(void) const { return labels.size(); }
+        uint32_t fingerprint(void) const { return fp; }
+
+    private:
+        std::vector<std::string> labels;
+        uint32_t fp = 0;
+    };
+
+    /**
+     * @brief The contents of an uplink message, as built by sensor_task().
+     */
+    struct UplinkMessage {
+        std::string timestamp;
+        //! The source_ids object other than the SDI-12 sensor ids, in order.
+        std::vector<std::pair<std::string, std::string>> source_ids;
+        std::vector<std::string> sdi12_ids;
+        std::vector<std::pair<std::string, double>> timeseries;
+    };
+
+    // Keys of the top level CBOR map.
+    static constexpr uint8_t MSG_KEY_TIMESTAMP = 0;
+    static constexpr uint8_t MSG_KEY_SOURCE_IDS = 1;
+    static constexpr uint8_t MSG_KEY_TIMESERIES = 2;
+    static constexpr uint8_t MSG_KEY_DICTIONARY = 3;
+
+    //! The number of label codes reserved for fixed node labels such as battery (v).
+    static constexpr uint32_t MSG_NUM_FIXED_LABELS = 32;
+
+    //! Labels for the values the node itself measures. Only ever append to this list.
+    extern const char *const MSG_FIXED_LABELS[];
+    extern const size_t MSG_NUM_FIXED_LABELS_USED;
+
+    //! Keys in the source_ids object with a numeric code, in order. Only ever append to this list.
+    extern const char *const MSG_SOURCE_ID_KEYS[];
+    extern const size_t MSG_NUM_SOURCE_ID_KEYS;
+
+    bool parse_iso8601(const char *s, uint32_t &epoch);
+    std::string format_iso8601(uint32_t epoch);
+
+    bool encode_label(const char *name, const LabelDictionary &dict, uint32_t &code);
+    bool decode_label(uint32_t code, const LabelDictionary &dict, std::string &name);
+
+    void encode_message(const UplinkMessage &msg, const LabelDictionary &dict, std::vector<uint8_t> &out);
+    bool decode_message(const uint8_t *data, size_t len, const LabelDictionary &dict, UplinkMessage &msg);
+}
+
+#endif //MSG_CBOR_H
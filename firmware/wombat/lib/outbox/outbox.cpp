@@ -0,0 +1,354 @@
+#include "outbox.h"
+#include "crc32.h"
+
+#include <cstring>
+
+//
+// This file is a project-local platformio library so it can be unit tested.
+//
+// Do not include anything other than standard C++ headers.
+//
+
+namespace wombat {
+    static const uint8_t INDEX_MAGIC[] = { 'O', 'B', 'X', '1' };
+    //! The byte after the message type in each record header, to catch reads from the wrong offset.
+    static constexpr uint8_t RECORD_SYNC = 0x57;
+    static constexpr size_t MAX_MSG_LEN = UINT16_MAX;
+
+    struct outbox_index {
+        uint32_t seq;
+        uint32_t head_seg;
+        uint32_t head_off;
+        uint32_t tail_seg;
+    };
+
+    static void put_u32(uint8_t *p, const uint32_t v) {
+        p[0] = static_cast<uint8_t>(v);
+        p[1] = static_cast<uint8_t>(v >> 8);
+        p[2] = static_cast<uint8_t>(v >> 16);
+        p[3] = static_cast<uint8_t>(v >> 24);
+    }
+
+    static uint32_t get_u32(const uint8_t *p) {
+        return p[0] | (p[1] << 8) | (p[2] << 16) | (static_cast<uint32_t>(p[3]) << 24);
+    }
+
+    static bool read_index(OutboxStorage &storage, const std::string &name, outbox_index &idx) {
+        uint8_t buf[Outbox::INDEX_SIZE];
+        size_t sz;
+        if ( ! storage.size(name.c_str(), sz) || sz != sizeof(buf) || ! storage.read(name.c_str(), 0, buf, sizeof(buf))) {
+            return false;
+        }
+
+        if (memcmp(buf, INDEX_MAGIC, sizeof(INDEX_MAGIC)) != 0 || get_u32(&buf[20]) != crc32(buf, 20)) {
+            return false;
+        }
+
+        idx.seq = get_u32(&buf[4]);
+        idx.head_seg = get_u32(&buf[8]);
+        idx.head_off = get_u32(&buf[12]);
+        idx.tail_seg = get_u32(&buf[16]);
+        return idx.tail_seg >= idx.head_seg;
+    }
+
+    Outbox::Outbox(OutboxStorage &storage, const char *prefix, const size_t segment_size, const uint32_t max_segments) :
+        storage(storage), prefix(prefix), segment_size(segment_size), max_segments(max_segments < 1 ? 1 : max_segments) {}
+
+    std::string Outbox::segment_name(const uint32_t seg) const {
+        return prefix + std::to_string(seg);
+    }
+
+    std::string Outbox::index_name(const uint32_t slot) const {
+        return prefix + (slot ? "idx1" : "idx0");
+    }
+
+    /**
+     * @brief Load the most recent valid index and remove any segments left behind by an
+     * interrupted ack().
+     *
+     * If neither index file is valid the outbox starts empty.
+     */
+    bool Outbox::open(void) {
+        outbox_index idx[2];
+        const bool ok0 = read_index(storage, index_name(0), idx[0]);
+        const bool ok1 = read_index(storage, index_name(1), idx[1]);
+
+        index_seq = 0;
+        head_seg = 0;
+        head_off = 0;
+        tail_seg = 0;
+        dropped = 0;
+
+        if (ok0 || ok1) {
+            const outbox_index &latest = ok0 && ( ! ok1 || idx[0].seq > idx[1].seq) ? idx[0] : idx[1];
+            index_seq = latest.seq;
+            head_seg = latest.head_seg;
+            head_off = latest.head_off;
+            tail_seg = latest.tail_seg;
+        }
+
+        if ( ! storage.size(segment_name(tail_seg).c_str(), tail_size)) {
+            tail_size = 0;
+        }
+
+        // Segments before the head are only left behind if the node was reset before ack() removed them.
+        for (uint32_t seg = head_seg, n = 0; seg > 0 && n < max_segments; n++) {
+            seg--;
+            size_t sz;
+            if ( ! storage.size(segment_name(seg).c_str(), sz)) {
+                break;
+            }
+            storage.remove(segment_name(seg).c_str());
+        }
+
+        rewind();
+
+        if ( ! tail_is_whole()) {
+            return start_segment();
+        }
+
+        if ( ! (ok0 || ok1)) {
+            return save_index();
+        }
+
+        return true;
+    }
+
+    /**
+     * @brief Check the record lengths in the tail segment add up to its size.
+     *
+     * If the node was reset while a record was being appended the tail segment ends with part of a
+     * record and anything appended after it could not be read. Only the record headers are read, so
+     * this costs at most one small read per record in a segment.
+     */
+    bool Outbox::tail_is_whole(void) {
+        const std::string name = segment_name(tail_seg);
+        size_t off = head_seg == tail_seg ? head_off : 0;
+        while (off + RECORD_HEADER_SIZE <= tail_size) {
+            uint8_t header[RECORD_HEADER_SIZE];
+            if ( ! storage.read(name.c_str(), off, header, sizeof(header)) || header[3] != RECORD_SYNC) {
+                return false;
+            }
+            off += RECORD_HEADER_SIZE + (header[0] | (header[1] << 8));
+        }
+
+        return off == tail_size;
+    }
+
+    bool Outbox::save_index(void) {
+        index_seq++;
+
+        uint8_t buf[INDEX_SIZE];
+        memcpy(buf, INDEX_MAGIC, sizeof(INDEX_MAGIC));
+        put_u32(&buf[4], index_seq);
+        put_u32(&buf[8], head_seg);
+        put_u32(&buf[12], head_off);
+        put_u32(&buf[16], tail_seg);
+        put_u32(&buf[20], crc32(buf, 20));
+
+        return storage.replace(index_name(index_seq & 1).c_str(), buf, sizeof(buf));
+    }
+
+    /**
+     * @brief Start a new tail segment, dropping the oldest segment if the outbox is full.
+     */
+    bool Outbox::start_segment(void) {
+        tail_seg++;
+        tail_size = 0;
+
+        if (num_segments() > max_segments) {
+            storage.remove(segment_name(head_seg).c_str());
+            head_seg++;
+            head_off = 0;
+            dropped++;
+
+            if (read_seg < head_seg) {
+                rewind();
+            }
+        }
+
+        return save_index();
+    }
+
+    /**
+     * @brief Append a message to the outbox.
+     *
+     * @return false if the message is empty, larger than a segment, or could not be written.
+     */
+    bool Outbox::enqueue(const outbox_msg_type_t type, const uint8_t *data, const size_t len) {
+        const size_t record_size = RECORD_HEADER_SIZE + len;
+        if (data == nullptr || len < 1 || len > MAX_MSG_LEN || record_size > segment_size) {
+            return false;
+        }
+
+        if (tail_size + record_size > segment_size && ! start_segment()) {
+            return false;
+        }
+
+        std::vector<uint8_t> record(record_size);
+        record[0] = static_cast<uint8_t>(len);
+        record[1] = static_cast<uint8_t>(len >> 8);
+        record[2] = type;
+        record[3] = RECORD_SYNC;
+        memcpy(&record[RECORD_HEADER_SIZE], data, len);
+        put_u32(&record[4], crc32(&record[RECORD_HEADER_SIZE], len, crc32(record.data(), 4)));
+
+        if ( ! storage.append(segment_name(tail_seg).c_str(), record.data(), record.size())) {
+            // The segment may end with part of the record, so nothing more can be appended to it.
+            start_segment();
+            return false;
+        }
+
+        tail_size += record_size;
+        return true;
+    }
+
+    void Outbox::next_read_segment(void) {
+        read_seg++;
+        read_off = 0;
+        peeked_size = 0;
+    }
+
+    /**
+     * @brief Read the message at the read cursor without moving the cursor.
+     *
+     * Segments that are missing, and the rest of any segment holding a damaged record, are skipped.
+     * If the damaged record is in the tail segment a new tail segment is started so new messages
+     * are not appended after it.
+     *
+     * @return false if there are no more messages.
+     */
+    bool Outbox::peek(outbox_msg_type_t &type, std::vector<uint8_t> &data) {
+        peeked_size = 0;
+
+        while ( ! empty()) {
+            const std::string name = segment_name(read_seg);
+            size_t seg_size = tail_size;
+            if (read_seg != tail_seg && ! storage.size(name.c_str(), seg_size)) {
+                next_read_segment();
+                continue;
+            }
+
+            if (read_off >= seg_size) {
+                next_read_segment();
+                continue;
+            }
+
+            uint8_t header[RECORD_HEADER_SIZE];
+            bool ok = read_off + RECORD_HEADER_SIZE <= seg_size && storage.read(name.c_str(), read_off, header, sizeof(header));
+
+            size_t len = 0;
+            if (ok) {
+                len = header[0] | (header[1] << 8);
+                ok = header[3] == RECORD_SYNC && len > 0 && read_off + RECORD_HEADER_SIZE + len <= seg_size;
+            }
+
+            if (ok) {
+                data.resize(len);
+                ok = storage.read(name.c_str(), read_off + RECORD_HEADER_SIZE, data.data(), len) &&
+                     get_u32(&header[4]) == crc32(data.data(), len, crc32(header, 4));
+            }
+
+            if ( ! ok) {
+                const bool in_tail = read_seg == tail_seg;
+                next_read_segment();
+                if (in_tail) {
+                    start_segment();
+                }
+                continue;
+            }
+
+            type = static_cast<outbox_msg_type_t>(header[2]);
+            peeked_size = RECORD_HEADER_SIZE + len;
+            return true;
+        }
+
+        return false;
+    }
+
+    /**
+     * @brief Move the read cursor past the message returned by the last call to peek().
+     */
+    void Outbox::advance(void) {
+        read_off += peeked_size;
+        peeked_size = 0;
+    }
+
+    /**
+     * @brief Mark every message before the read cursor as sent, removing segments that are no
+     * longer needed.
+     *
+     * When every message has been sent all the segments are removed and the segment numbers start
+     * again from 0.
+     */
+    bool Outbox::ack(void) {
+        if (read_seg == head_seg && read_off == head_off) {
+            return true;
+        }
+
+        if (empty()) {
+            for (uint32_t seg = head_seg; seg <= tail_seg; seg++) {
+                storage.remove(segment_name(seg).c_str());
+            }
+
+            head_seg = 0;
+            head_off = 0;
+            tail_seg = 0;
+            tail_size = 0;
+            rewind();
+            return save_index();
+        }
+
+        const uint32_t old_head_seg = head_seg;
+        head_seg = read_seg;
+        head_off = read_off;
+        if ( ! save_index()) {
+            return false;
+        }
+
+        for (uint32_t seg = old_head_seg; seg < head_seg; seg++) {
+            storage.remove(segment_name(seg).c_str());
+        }
+
+        return true;
+    }
+
+    /**
+     * @brief Mark every message before a position taken by mark() as sent, so messages read after
+     * it can be acknowledged separately.
+     *
+     * Nothing is done if the messages before the position have already been acknowledged, or
+     * dropped because the outbox was full.
+     */
+    bool Outbox::ack_to(const OutboxMark &mark) {
+        if (mark.seg == read_seg && mark.off == read_off) {
+            return ack();
+        }
+
+        if (mark.seg < head_seg || (mark.seg == head_seg && mark.off <= head_off)) {
+            return true;
+        }
+
+        const uint32_t old_head_seg = head_seg;
+        head_seg = mark.seg;
+        head_off = mark.off;
+        if ( ! save_index()) {
+            return false;
+        }
+
+        for (uint32_t seg = old_head_seg; seg < head_seg; seg++) {
+            storage.remove(segment_name(seg).c_str());
+        }
+
+        return true;
+    }
+
+    /**
+     * @brief Move the read cursor back to the oldest unsent message.
+     */
+    void Outbox::rewind(void) {
+        read_seg = head_seg;
+        read_off = head_off;
+        peeked_size = 0;
+    }
+}
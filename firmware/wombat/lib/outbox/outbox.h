@@ -0,0 +1,123 @@
+#ifndef OUTBOX_H
+#define OUTBOX_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace wombat {
+    /**
+     * @brief The file operations the outbox needs, so it can be used with SPIFFS on the node and
+     * with memory in the unit tests.
+     */
+    class OutboxStorage {
+    public:
+        virtual ~OutboxStorage() = default;
+
+        //! Get the size of a file, returning false if it does not exist.
+        virtual bool size(const char *name, size_t &sz) = 0;
+        //! Read exactly len bytes from offset in a file.
+        virtual bool read(const char *name, size_t offset, uint8_t *buf, size_t len) = 0;
+        //! Append to a file, creating it if necessary.
+        virtual bool append(const char *name, const uint8_t *data, size_t len) = 0;
+        //! Replace the contents of a file, creating it if necessary.
+        virtual bool replace(const char *name, const uint8_t *data, size_t len) = 0;
+        //! Remove a file, returning false if it could not be removed.
+        virtual bool remove(const char *name) = 0;
+    };
+
+    //! The kinds of message held in the outbox.
+    enum outbox_msg_type_t : uint8_t {
+        OUTBOX_MSG_JSON = 0,
+        OUTBOX_MSG_CBOR = 1
+    };
+
+    //! A position in the outbox, from Outbox::mark().
+    struct OutboxMark {
+        uint32_t seg;
+        uint32_t off;
+    };
+
+    /**
+     * @brief A persistent FIFO of uplink messages, stored as a series of fixed-size segment files
+     * and a small index.
+     *
+     * Messages are appended as records to the newest (tail) segment. A new segment is started when
+     * the tail segment is full. Messages are read from a cursor starting at the oldest unsent
+     * message (the head) and the head is moved up to the cursor by ack(), removing any segments that
+     * have been completely sent. No operation needs to list the file system or read more than the
+     * record at the cursor.
+     *
+     * Each record is the message length (2), message type (1), a sync byte (1) and the CRC-32 of
+     * those 4 bytes and the message (4), followed by the message. A record that was only partly
+     * written, for example because the node lost power, is found by open() and a new segment started
+     * after it. A damaged record fails the CRC check and the rest of its segment is skipped.
+     *
+     * The index holds the head and tail positions. It is written alternately to two files with a
+     * sequence number so an interrupted write leaves the previous index intact. It is written when
+     * messages are acknowledged, when a new segment is started and when a segment is dropped, never
+     * for each message appended.
+     *
+     * When the outbox holds max_segments segments the oldest segment is dropped to make room, so a
+     * node that cannot uplink for a long time keeps its newest messages.
+     */
+    class Outbox {
+    public:
+        //! The size of the header before each message in a segment.
+        static constexpr size_t RECORD_HEADER_SIZE = 8;
+        //! The size of an index file.
+        static constexpr size_t INDEX_SIZE = 24;
+
+        Outbox(OutboxStorage &storage, const char *prefix, size_t segment_size, uint32_t max_segments);
+
+        bool open(void);
+
+        bool enqueue(outbox_msg_type_t type, const uint8_t *data, size_t len);
+
+        bool peek(outbox_msg_type_t &type, std::vector<uint8_t> &data);
+        void advance(void);
+        bool ack(void);
+        void rewind(void);
+
+        //! The position of the read cursor, to acknowledge the messages before it later with ack_to().
+        OutboxMark mark(void) const { return { read_seg, read_off }; }
+        bool ack_to(const OutboxMark &mark);
+
+        //! True if there are no unsent messages after the read cursor.
+        bool empty(void) const { return read_seg == tail_seg && read_off >= tail_size; }
+        //! The number of segment files in use.
+        uint32_t num_segments(void) const { return tail_seg - head_seg + 1; }
+        //! The number of segments dropped because the outbox was full, since it was opened.
+        uint32_t get_dropped(void) const { return dropped; }
+
+    private:
+        OutboxStorage &storage;
+        std::string prefix;
+        size_t segment_size;
+        uint32_t max_segments;
+
+        uint32_t index_seq = 0;
+        uint32_t head_seg = 0;
+        uint32_t head_off = 0;
+        uint32_t tail_seg = 0;
+        size_t tail_size = 0;
+
+        uint32_t read_seg = 0;
+        uint32_t read_off = 0;
+        //! The size of the record at the read cursor, once peek() has read it.
+        uint32_t peeked_size = 0;
+
+        uint32_t dropped = 0;
+
+        std::string segment_name(uint32_t seg) const;
+        std::string index_name(uint32_t slot) const;
+
+        bool save_index(void);
+        bool tail_is_whole(void);
+        void next_read_segment(void);
+        bool start_segment(void);
+    };
+}
+
+#endif //OUTBOX_H
@@ -0,0 +1,82 @@
+#include "pub_window.h"
+
+//
+// This file is a project-local platformio library so it can be unit tested.
+//
+// Do not include anything other than standard C++ headers.
+//
+
+namespace wombat {
+    PublishWindow::PublishWindow(PublishLink &link, const size_t window, const uint32_t ack_timeout_ms)
+        : link(link), window(window < 1 ? 1 : (window > MAX_WINDOW ? MAX_WINDOW : window)), ack_timeout_ms(ack_timeout_ms) {}
+
+    /**
+     * @brief Wait for the result of the oldest publish in flight.
+     *
+     * @return true if the broker acknowledged it.
+     */
+    bool PublishWindow::take_ack(void) {
+        int result = -1;
+        if ( ! link.wait_ack(ack_timeout_ms, result) || result != 1) {
+            failed = true;
+            return false;
+        }
+
+        const uint32_t tag = tags[head];
+        head = (head + 1) % MAX_WINDOW;
+        count--;
+        delivered++;
+        link.delivered(tag);
+        return true;
+    }
+
+    void PublishWindow::push(const uint32_t tag) {
+        tags[(head + count) % MAX_WINDOW] = tag;
+        count++;
+        if (count > max_in_flight) {
+            max_in_flight = count;
+        }
+    }
+
+    /**
+     * @brief Publish a message, first waiting for the oldest publish in flight if the window is full.
+     *
+     * @return false if this or an earlier publish failed.
+     */
+    bool PublishWindow::send(const uint32_t tag) {
+        if (failed) {
+            return false;
+        }
+
+        while (count >= window) {
+            if ( ! take_ack()) {
+                return false;
+            }
+        }
+
+        if ( ! link.publish(tag)) {
+            if (count == 0 || ! flush() || ! link.publish(tag)) {
+                failed = true;
+                return false;
+            }
+
+            window = 1;
+        }
+
+        push(tag);
+        return true;
+    }
+
+    /**
+     * @brief Wait for every publish in flight.
+     *
+     * @return true if they were all delivered.
+     */
+    bool PublishWindow::flush(void) {
+        while (count > 0 && ! failed) {
+            take_ack();
+        }
+
+        return ! failed;
+    }
+}
@@ -0,0 +1,84 @@
+#ifndef PUB_WINDOW_H
+#define PUB_WINDOW_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace wombat {
+    /**
+     * @brief The modem operations needed to publish QoS 1 messages, so the window can be driven
+     * against the SARA R5 on the node and the R5 emulator in the unit tests.
+     *
+     * Each publish is identified by a tag chosen by the caller of PublishWindow::send(), so the
+     * link and the caller can keep whatever they need to know about it, such as the outbox
+     * position or file it came from.
+     */
+    class PublishLink {
+    public:
+        virtual ~PublishLink() = default;
+
+        //! Send a publish, returning false if the modem rejects the command.
+        virtual bool publish(uint32_t tag) = 0;
+        //! Wait up to timeout_ms for the result of the oldest publish in flight, returning false if there was none.
+        virtual bool wait_ack(uint32_t timeout_ms, int &result) = 0;
+        //! Called for each publish the broker acknowledged, in the order they were sent.
+        virtual void delivered(uint32_t tag) = 0;
+    };
+
+    /**
+     * @brief Keeps up to a window of QoS 1 publishes in flight, so the next message is sent while the
+     * broker acknowledges the previous ones rather than after.
+     *
+     * The SARA R5 reports the result of a publish with a +UUMQTTC URC that does not identify the
+     * message, but the URCs for the same command come in the order the commands were sent. So the
+     * first result belongs to the oldest publish in flight, and the window is a FIFO of tags.
+     *
+     * Publishes are delivered in order. The first one that fails, or whose result does not arrive,
+     * stops the window: nothing after it is reported delivered, even if the broker got it, so the
+     * caller sends those again later. That is at least once delivery, which is what QoS 1 gives.
+     * A result the modem never sends moves the later results onto earlier publishes, and is found
+     * when the newest publish gets no result, so that one is sent again.
+     *
+     * If the modem rejects a publish while others are in flight the window waits for them and tries
+     * again with nothing in flight. If that works, the modem cannot queue publishes and the rest are
+     * sent one at a time.
+     */
+    class PublishWindow {
+    public:
+        //! The most publishes that can be in flight, less than the capacity of the URC ring.
+        static constexpr size_t MAX_WINDOW = 8;
+
+        PublishWindow(PublishLink &link, size_t window, uint32_t ack_timeout_ms);
+
+        bool send(uint32_t tag);
+        bool flush(void);
+
+        //! The number of publishes sent and not yet acknowledged.
+        size_t in_flight(void) const { return count; }
+        //! True once a publish has failed, after which send() and flush() do nothing.
+        bool has_failed(void) const { return failed; }
+        //! The window size, which is 1 if the modem would not queue publishes.
+        size_t get_window(void) const { return window; }
+        //! The number of publishes delivered.
+        uint32_t get_delivered(void) const { return delivered; }
+        //! The most publishes that were in flight at once.
+        size_t get_max_in_flight(void) const { return max_in_flight; }
+
+    private:
+        PublishLink &link;
+        size_t window;
+        uint32_t ack_timeout_ms;
+
+        uint32_t tags[MAX_WINDOW] = { 0 };
+        size_t head = 0;
+        size_t count = 0;
+        bool failed = false;
+        uint32_t delivered = 0;
+        size_t max_in_flight = 0;
+
+        bool take_ack(void);
+        void push(uint32_t tag);
+    };
+}
+
+#endif //PUB_WINDOW_H
@@ -0,0 +1,719 @@
+#include "r5_emulator.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+
+//
+// This file is a project-local platformio library so it can be unit tested.
+//
+// Do not include anything other than standard C++ headers.
+//
+
+namespace wombat {
+    //! The IP address given to the emulated PDP context.
+    static const char *const IP_ADDRESS = "10.64.1.2";
+    //! Seconds from the NTP epoch, 1900, to the Unix epoch.
+    static constexpr uint32_t NTP_UNIX_OFFSET = 2208988800UL;
+    static constexpr size_t NTP_PACKET_SIZE = 48;
+
+    /**
+     * @brief Split the arguments of an AT command, removing the quotes from quoted arguments.
+     */
+    std::vector<std::string> split_at_args(const std::string &s) {
+        std::vector<std::string> args;
+        std::string arg;
+        bool quoted = false;
+        for (const char c : s) {
+            if (c == '"') {
+                quoted = ! quoted;
+            } else if (c == ',' && ! quoted) {
+                args.push_back(arg);
+                arg.clear();
+            } else {
+                arg.push_back(c);
+            }
+        }
+
+        if ( ! s.empty()) {
+            args.push_back(arg);
+        }
+
+        return args;
+    }
+
+    static int to_int(const std::vector<std::string> &args, const size_t i, const int dflt = -1) {
+        return i < args.size() && ! args[i].empty() ? atoi(args[i].c_str()) : dflt;
+    }
+
+    static std::string arg(const std::vector<std::string> &args, const size_t i) {
+        return i < args.size() ? args[i] : std::string();
+    }
+
+    R5Emulator::R5Emulator(const R5Timing &timing) : timing(timing) {}
+
+    /**
+     * @brief Receive bytes from the host, as if they were sent over the UART.
+     */
+    void R5Emulator::write(const uint8_t *data, const size_t len) {
+        for (size_t i = 0; i < len; i++) {
+            const char c = static_cast<char>(data[i]);
+
+            if (data_mode != DATA_NONE) {
+                data_buf.push_back(c);
+                if (data_buf.size() >= data_expected) {
+                    finish_data();
+                }
+                continue;
+            }
+
+            if (c == '\r') {
+                if (echo) {
+                    output.push_back({ clock_ms, line + "\r" });
+                }
+
+                if ( ! line.empty()) {
+                    run_command(line);
+                }
+                line.clear();
+            } else if (c != '\n') {
+                line.push_back(c);
+            }
+        }
+    }
+
+    void R5Emulator::write(const char *s) {
+        write(reinterpret_cast<const uint8_t *>(s), strlen(s));
+    }
+
+    /**
+     * @brief The number of response bytes due by the current emulated time.
+     */
+    size_t R5Emulator::available(void) const {
+        size_t n = 0;
+        for (const Output &out : output) {
+            if (out.due_ms > clock_ms) {
+                break;
+            }
+            n += out.bytes.size();
+        }
+
+        return n;
+    }
+
+    /**
+     * @brief Read a response byte, as if it was received over the UART.
+     *
+     * @return the byte, or -1 if no bytes are due by the current emulated time.
+     */
+    int R5Emulator::read(void) {
+        while ( ! output.empty() && output.front().due_ms <= clock_ms) {
+            Output &out = output.front();
+            if (out.bytes.empty()) {
+                output.pop_front();
+                continue;
+            }
+
+            const uint8_t c = static_cast<uint8_t>(out.bytes[0]);
+            out.bytes.erase(0, 1);
+            return c;
+        }
+
+        return -1;
+    }
+
+    void R5Emulator::advance(const uint32_t ms) {
+        clock_ms += ms;
+    }
+
+    /**
+     * @brief Make the next count commands starting with cmd_prefix fail in the given way.
+     */
+    void R5Emulator::inject_fault(const char *cmd_prefix, const r5_fault_t fault, const unsigned count) {
+        faults.push_back({ cmd_prefix, fault, count });
+    }
+
+    /**
+     * @brief Queue a message from the broker for the node to receive after it subscribes.
+     */
+    void R5Emulator::queue_downlink(const std::string &topic, const std::string &payload) {
+        downlinks.emplace_back(topic, payload);
+    }
+
+    bool R5Emulator::take_fault(const std::string &cmd, r5_fault_t &fault) {
+        for (auto it = faults.begin(); it != faults.end(); it++) {
+            if (cmd.compare(0, it->prefix.size(), it->prefix) == 0) {
+                fault = it->fault;
+                if (--it->count == 0) {
+                    faults.erase(it);
+                }
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    int R5Emulator::urc_result(const bool ok) const {
+        return ok && ! (urc_fault_active && urc_fault == R5_FAULT_URC_FAILED) ? 1 : 0;
+    }
+
+    void R5Emulator::respond(const std::string &text, const bool ok, const uint32_t delay_ms) {
+        uint32_t due = clock_ms + timing.command_ms + delay_ms;
+        if (due < last_response_ms) {
+            due = last_response_ms;
+        }
+        last_response_ms = due;
+
+        std::string bytes;
+        if ( ! text.empty()) {
+            bytes = "\r\n" + text + "\r\n";
+        }
+        bytes += ok ? "\r\nOK\r\n" : "\r\nERROR\r\n";
+        queue(due, bytes);
+    }
+
+    void R5Emulator::error(void) {
+        respond("", false);
+    }
+
+    void R5Emulator::prompt(const char *p) {
+        uint32_t due = clock_ms + timing.command_ms;
+        if (due < last_response_ms) {
+            due = last_response_ms;
+        }
+        last_response_ms = due;
+        queue(due, p);
+    }
+
+    /**
+     * @brief Send a URC after delay_ms, keeping the output in time order.
+     */
+    void R5Emulator::urc(const uint32_t delay_ms, const std::string &text) {
+        if (urc_fault_active && urc_fault == R5_FAULT_URC_LOST) {
+            return;
+        }
+
+        uint32_t due = clock_ms + delay_ms;
+        if (due < last_response_ms) {
+            due = last_response_ms;
+        }
+
+        queue(due, "\r\n" + text + "\r\n");
+    }
+
+    /**
+     * @brief Add bytes to the output in time order, so a response is not held up by a URC that is
+     * due later, such as the result of an FTP transfer running in the background.
+     */
+    void R5Emulator::queue(const uint32_t due, const std::string &bytes) {
+        auto it = output.end();
+        while (it != output.begin() && (it - 1)->due_ms > due) {
+            it--;
+        }
+        output.insert(it, { due, bytes });
+    }
+
+    int R5Emulator::reg_status(void) const {
+        if ( ! radio_on) {
+            return 0;
+        }
+
+        if (clock_ms < reg_start_ms + timing.registration_ms) {
+            return 2;
+        }
+
+        return reg_denied_status != 0 ? reg_denied_status : 1;
+    }
+
+    uint32_t R5Emulator::transfer_ms(const size_t bytes) const {
+        return timing.ftp_bytes_per_s > 0 ? static_cast<uint32_t>(bytes * 1000ULL / timing.ftp_bytes_per_s) : 0;
+    }
+
+    std::string R5Emulator::ftp_path(const std::string &name) const {
+        if ( ! name.empty() && name[0] == '/') {
+            return name;
+        }
+
+        return ftp_dir == "/" ? "/" + name : ftp_dir + "/" + name;
+    }
+
+    void R5Emulator::run_command(const std::string &cmd) {
+        commands.push_back({ clock_ms, cmd });
+
+        urc_fault_active = false;
+        r5_fault_t fault;
+        if (take_fault(cmd, fault)) {
+            if (fault == R5_FAULT_ERROR) {
+                error();
+                return;
+            }
+
+            if (fault == R5_FAULT_NO_RESPONSE) {
+                return;
+            }
+
+            urc_fault_active = true;
+            urc_fault = fault;
+        }
+
+        if (cmd.size() < 2 || (cmd[0] != 'A' && cmd[0] != 'a') || (cmd[1] != 'T' && cmd[1] != 't')) {
+            error();
+            return;
+        }
+
+        const std::string body = cmd.substr(2);
+        const size_t eq = body.find('=');
+        const std::string name = body.substr(0, eq);
+        const std::vector<std::string> args = eq == std::string::npos ? std::vector<std::string>() : split_at_args(body.substr(eq + 1));
+        const bool is_set = eq != std::string::npos;
+        char buf[128];
+
+        if (name.empty() || name == "&K0" || name == "+CMEE" || name == "+CTZU" || name == "+UPSD" || name == "+CEREG" ||
+                name == "+USOCL") {
+            respond("");
+        } else if (name == "E0" || name == "E1") {
+            echo = name == "E1";
+            respond("");
+        } else if (name == "+UMNOPROF?") {
+            respond("+UMNOPROF: 4");
+        } else if (name == "+UMNOPROF") {
+            respond("");
+        } else if (name == "+CFUN?") {
+            respond(radio_on ? "+CFUN: 1" : "+CFUN: 0");
+        } else if (name == "+CFUN") {
+            const bool on = to_int(args, 0) == 1;
+            if (on && ! radio_on) {
+                reg_start_ms = clock_ms;
+            }
+            if ( ! on) {
+                pdp_active = false;
+                mqtt_connected = false;
+                ftp_connected = false;
+            }
+            radio_on = on;
+            respond("");
+        } else if (name == "+CPWROFF") {
+            radio_on = false;
+            pdp_active = false;
+            respond("");
+        } else if (name == "+CEREG?") {
+            snprintf(buf, sizeof(buf), "+CEREG: 0,%d", reg_status());
+            respond(buf);
+        } else if (name == "+COPS?") {
+            const int stat = reg_status();
+            respond(stat == 1 || stat == 5 ? "+COPS: 0,0,\"Telstra Mobile\",7" : "+COPS: 0");
+        } else if (name == "+CSQ") {
+            respond("+CSQ: 20,99");
+        } else if (name == "+CESQ") {
+            respond("+CESQ: 99,99,255,255,24,50");
+        } else if (name == "+CCID") {
+            respond("+CCID: 89610185002185410000");
+        } else if (name == "+CGSN") {
+            respond("356726110000000");
+        } else if (name == "+CCLK?") {
+            const time_t t = epoch_at_power_on + clock_ms / 1000;
+            struct tm tm_utc;
+            gmtime_r(&t, &tm_utc);
+            snprintf(buf, sizeof(buf), "+CCLK: \"%02d/%02d/%02d,%02d:%02d:%02d+00\"", tm_utc.tm_year % 100, tm_utc.tm_mon + 1,
+                     tm_utc.tm_mday, tm_utc.tm_hour, tm_utc.tm_min, tm_utc.tm_sec);
+            respond(buf);
+        } else if (name == "+CCLK") {
+            struct tm tm_utc = {};
+            if (sscanf(arg(args, 0).c_str(), "%d/%d/%d,%d:%d:%d", &tm_utc.tm_year, &tm_utc.tm_mon, &tm_utc.tm_mday,
+                       &tm_utc.tm_hour, &tm_utc.tm_min, &tm_utc.tm_sec) != 6) {
+                error();
+                return;
+            }
+            tm_utc.tm_year += 100;
+            tm_utc.tm_mon -= 1;
+            epoch_at_power_on = static_cast<uint32_t>(timegm(&tm_utc)) - clock_ms / 1000;
+            respond("");
+        } else if (name == "+UPSDA") {
+            const int stat = reg_status();
+            if (stat != 1 && stat != 5) {
+                error();
+                return;
+            }
+
+            if (to_int(args, 1) == 3) {
+                const bool ok = urc_result(true) == 1;
+                respond("", ok, timing.pdp_ms);
+                if (ok) {
+                    pdp_active = true;
+                    pdp_due_ms = clock_ms + timing.pdp_ms;
+                }
+                snprintf(buf, sizeof(buf), ok ? "+UUPSDA: 0,\"%s\"" : "+UUPSDA: 1", IP_ADDRESS);
+                urc(timing.pdp_ms, buf);
+            } else {
+                pdp_active = false;
+                respond("");
+            }
+        } else if (name == "+UPSND") {
+            const bool active = pdp_active && clock_ms >= pdp_due_ms;
+            if (to_int(args, 1) == 8) {
+                snprintf(buf, sizeof(buf), "+UPSND: 0,8,%d", active ? 1 : 0);
+            } else {
+                snprintf(buf, sizeof(buf), "+UPSND: 0,0,\"%s\"", active ? IP_ADDRESS : "0.0.0.0");
+            }
+            respond(buf);
+        } else if (name == "+USOCR") {
+            socket_open = true;
+            udp_rx.clear();
+            respond("+USOCR: 0");
+        } else if (name == "+USOST") {
+            const int len = to_int(args, 3, 0);
+            if ( ! socket_open || ! pdp_active || clock_ms < pdp_due_ms || len < 1) {
+                error();
+                return;
+            }
+            data_mode = DATA_UDP;
+            data_expected = static_cast<size_t>(len);
+            data_buf.clear();
+            prompt("@");
+        } else if (name == "+USORF") {
+            const bool due = clock_ms >= udp_rx_due_ms;
+            const int len = to_int(args, 1, 0);
+            if (len == 0) {
+                snprintf(buf, sizeof(buf), "+USORF: 0,%u", due ? static_cast<unsigned>(udp_rx.size()) : 0U);
+                respond(buf);
+            } else {
+                const std::string data = due ? udp_rx.substr(0, static_cast<size_t>(len)) : std::string();
+                if (due) {
+                    udp_rx.erase(0, data.size());
+                }
+                snprintf(buf, sizeof(buf), "+USORF: 0,\"162.159.200.1\",123,%u,\"", static_cast<unsigned>(data.size()));
+                respond(std::string(buf) + data + "\"");
+            }
+        } else if (name == "+UMQTT") {
+            if ( ! at_mqtt(args)) {
+                error();
+            }
+        } else if (name == "+UMQTTC") {
+            if ( ! at_mqttc(args)) {
+                error();
+            }
+        } else if (name == "+UMQTTER") {
+            respond("+UMQTTER: 0,0");
+        } else if (name == "+UFTP") {
+            ftp_params[to_int(args, 0)] = arg(args, 1);
+            respond("");
+        } else if (name == "+UFTPC") {
+            if ( ! at_ftpc(args)) {
+                error();
+            }
+        } else if (name == "+UFTPER") {
+            respond("+UFTPER: 0,0");
+        } else if (name == "+UDWNFILE") {
+            const int len = to_int(args, 1, 0);
+            if (args.empty() || len < 1) {
+                error();
+                return;
+            }
+            data_mode = DATA_FILE;
+            data_name = arg(args, 0);
+            data_expected = static_cast<size_t>(len);
+            data_buf.clear();
+            prompt(">");
+        } else if (name == "+URDFILE") {
+            auto it = files.find(arg(args, 0));
+            if (it == files.end()) {
+                error();
+                return;
+            }
+            snprintf(buf, sizeof(buf), "+URDFILE: \"%s\",%u,\"", it->first.c_str(), static_cast<unsigned>(it->second.size()));
+            respond(std::string(buf) + std::string(it->second.begin(), it->second.end()) + "\"");
+        } else if (name == "+URDBLOCK") {
+            auto it = files.find(arg(args, 0));
+            const int offset = to_int(args, 1, 0);
+            const int len = to_int(args, 2, 0);
+            if (it == files.end() || offset < 0 || len < 1 || static_cast<size_t>(offset) > it->second.size()) {
+                error();
+                return;
+            }
+            const size_t n = std::min(static_cast<size_t>(len), it->second.size() - offset);
+            snprintf(buf, sizeof(buf), "+URDBLOCK: \"%s\",%u,\"", it->first.c_str(), static_cast<unsigned>(n));
+            respond(std::string(buf) + std::string(it->second.begin() + offset, it->second.begin() + offset + n) + "\"");
+        } else if (name == "+UDELFILE") {
+            if (files.erase(arg(args, 0)) < 1) {
+                error();
+                return;
+            }
+            respond("");
+        } else if (name == "+ULSTFILE" && is_set) {
+            const int op = to_int(args, 0, 0);
+            if (op == 0) {
+                std::string list = "+ULSTFILE: ";
+                for (auto it = files.begin(); it != files.end(); it++) {
+                    list += (it == files.begin() ? "\"" : ",\"") + it->first + "\"";
+                }
+                respond(list);
+            } else if (op == 1) {
+                size_t used = 0;
+                for (const auto &f : files) {
+                    used += f.second.size();
+                }
+                snprintf(buf, sizeof(buf), "+ULSTFILE: %u", static_cast<unsigned>(used < fs_capacity ? fs_capacity - used : 0));
+                respond(buf);
+            } else {
+                auto it = files.find(arg(args, 1));
+                if (it == files.end()) {
+                    error();
+                    return;
+                }
+                snprintf(buf, sizeof(buf), "+ULSTFILE: %u", static_cast<unsigned>(it->second.size()));
+                respond(buf);
+            }
+        } else {
+            error();
+        }
+    }
+
+    /**
+     * @brief Handle the data sent after a prompt.
+     */
+    void R5Emulator::finish_data(void) {
+        const data_mode_t mode = data_mode;
+        data_mode = DATA_NONE;
+        char buf[64];
+
+        if (mode == DATA_FILE) {
+            std::vector<uint8_t> &f = files[data_name];
+            f.insert(f.end(), data_buf.begin(), data_buf.end());
+            respond("");
+        } else if (mode == DATA_MQTT_BINARY) {
+            respond("+UMQTTC: 9,1");
+            const int result = urc_result(mqtt_connected);
+            if (result) {
+                published.push_back({ clock_ms + timing.mqtt_publish_ms, data_name,
+                                      std::vector<uint8_t>(data_buf.begin(), data_buf.end()), data_qos, data_retain });
+            }
+            snprintf(buf, sizeof(buf), "+UUMQTTC: 9,%d", result);
+            urc(timing.mqtt_publish_ms, buf);
+        } else if (mode == DATA_UDP) {
+            snprintf(buf, sizeof(buf), "+USOST: 0,%u", static_cast<unsigned>(data_buf.size()));
+            respond(buf);
+
+            // Answer NTP queries with the emulated time.
+            if (data_buf.size() == NTP_PACKET_SIZE) {
+                std::string rsp(NTP_PACKET_SIZE, '\0');
+                rsp[0] = 0x24;
+                rsp[1] = 1;
+                const uint32_t secs = epoch_at_power_on + (clock_ms + timing.udp_rtt_ms / 2) / 1000 + NTP_UNIX_OFFSET;
+                for (int i = 0; i < 4; i++) {
+                    rsp[40 + i] = static_cast<char>(secs >> (24 - 8 * i));
+                }
+                udp_rx = rsp;
+                udp_rx_due_ms = clock_ms + timing.udp_rtt_ms;
+                snprintf(buf, sizeof(buf), "+UUSORF: 0,%u", static_cast<unsigned>(rsp.size()));
+                urc(timing.udp_rtt_ms, buf);
+            }
+        }
+
+        data_buf.clear();
+    }
+
+    bool R5Emulator::at_mqtt(const std::vector<std::string> &args) {
+        const int op = to_int(args, 0);
+        if (op < 0) {
+            return false;
+        }
+
+        std::string value;
+        for (size_t i = 1; i < args.size(); i++) {
+            value += (i > 1 ? "," : "") + args[i];
+        }
+        mqtt_params[op] = value;
+
+        char buf[32];
+        snprintf(buf, sizeof(buf), "+UMQTT: %d,1", op);
+        respond(buf);
+        return true;
+    }
+
+    bool R5Emulator::at_mqttc(const std::vector<std::string> &args) {
+        const int op = to_int(args, 0);
+        char buf[64];
+
+        switch (op) {
+            case 0:
+                respond("+UMQTTC: 0,1");
+                mqtt_connected = false;
+                snprintf(buf, sizeof(buf), "+UUMQTTC: 0,%d", urc_result(true));
+                urc(timing.mqtt_logout_ms, buf);
+                return true;
+
+            case 1: {
+                respond("+UMQTTC: 1,1");
+                const int result = urc_result(pdp_active && mqtt_params.count(2) > 0);
+                mqtt_connected = result == 1;
+                snprintf(buf, sizeof(buf), "+UUMQTTC: 1,%d", result);
+                urc(timing.mqtt_login_ms, buf);
+                return true;
+            }
+
+            case 2:
+            case 3: {
+                if ( ! mqtt_connected || args.size() < 5) {
+                    return false;
+                }
+
+                std::vector<uint8_t> payload;
+                if (op == 2) {
+                    payload.assign(args[4].begin(), args[4].end());
+                } else {
+                    auto it = files.find(args[4]);
+                    if (it == files.end()) {
+                        return false;
+                    }
+                    payload = it->second;
+                }
+
+                snprintf(buf, sizeof(buf), "+UMQTTC: %d,1", op);
+                respond(buf);
+                const int result = urc_result(true);
+                if (result) {
+                    published.push_back({ clock_ms + timing.mqtt_publish_ms, args[3], payload, to_int(args, 1, 0), to_int(args, 2, 0) == 1 });
+                }
+                snprintf(buf, sizeof(buf), "+UUMQTTC: %d,%d", op, result);
+                urc(timing.mqtt_publish_ms, buf);
+                return true;
+            }
+
+            case 4: {
+                if ( ! mqtt_connected || args.size() < 3) {
+                    return false;
+                }
+
+                respond("+UMQTTC: 4,1");
+                snprintf(buf, sizeof(buf), "+UUMQTTC: 4,%d,%d,\"", urc_result(true), to_int(args, 1, 0));
+                urc(timing.mqtt_subscribe_ms, std::string(buf) + args[2] + "\"");
+
+                size_t unread = 0;
+                for (const auto &msg : downlinks) {
+                    if (msg.first == args[2]) {
+                        unread++;
+                    }
+                }
+                if (unread > 0) {
+                    snprintf(buf, sizeof(buf), "+UUMQTTCM: 6,%u", static_cast<unsigned>(unread));
+                    urc(timing.mqtt_subscribe_ms + timing.command_ms, buf);
+                }
+                return true;
+            }
+
+            case 5:
+                respond("+UMQTTC: 5,1");
+                return true;
+
+            case 6: {
+                if ( ! mqtt_connected || downlinks.empty()) {
+                    return false;
+                }
+
+                const std::pair<std::string, std::string> msg = downlinks.front();
+                downlinks.pop_front();
+                snprintf(buf, sizeof(buf), "+UMQTTC: 6,0,%u,\"", static_cast<unsigned>(msg.first.size()));
+                std::string rsp = std::string(buf) + msg.first + "\",";
+                snprintf(buf, sizeof(buf), "%u,\"", static_cast<unsigned>(msg.second.size()));
+                respond(rsp + buf + msg.second + "\"");
+                return true;
+            }
+
+            case 9: {
+                // AT+UMQTTC=9,<qos>,<retain>,<topic>,<length> then the message after the prompt.
+                const int len = args.empty() ? 0 : atoi(args.back().c_str());
+                if ( ! mqtt_connected || args.size() < 5 || len < 1) {
+                    return false;
+                }
+
+                data_mode = DATA_MQTT_BINARY;
+                data_expected = static_cast<size_t>(len);
+                data_buf.clear();
+                data_name = args[3];
+                data_qos = to_int(args, 1, 0);
+                data_retain = to_int(args, 2, 0) == 1;
+                prompt(">");
+                return true;
+            }
+
+            default:
+                return false;
+        }
+    }
+
+    bool R5Emulator::at_ftpc(const std::vector<std::string> &args) {
+        const int op = to_int(args, 0);
+        char buf[64];
+
+        if (op == 1) {
+            respond("");
+            const int result = urc_result(pdp_active && ftp_params.count(1) > 0);
+            ftp_connected = result == 1;
+            ftp_dir = "/";
+            snprintf(buf, sizeof(buf), "+UUFTPCR: 1,%d", result);
+            urc(timing.ftp_login_ms, buf);
+            return true;
+        }
+
+        if (op == 0) {
+            respond("");
+            ftp_connected = false;
+            snprintf(buf, sizeof(buf), "+UUFTPCR: 0,%d", urc_result(true));
+            urc(timing.ftp_command_ms, buf);
+            return true;
+        }
+
+        if ( ! ftp_connected) {
+            return false;
+        }
+
+        uint32_t delay_ms = timing.ftp_command_ms;
+        bool ok = true;
+        switch (op) {
+            case 2:
+                ok = ftp_files.erase(ftp_path(arg(args, 1))) > 0;
+                break;
+
+            case 4: {
+                // AT+UFTPC=4,<remote>,<local>
+                auto it = ftp_files.find(ftp_path(arg(args, 1)));
+                ok = it != ftp_files.end();
+                if (ok && urc_result(true)) {
+                    const std::string local = args.size() > 2 && ! args[2].empty() ? args[2] : arg(args, 1);
+                    files[local] = it->second;
+                    delay_ms += transfer_ms(it->second.size());
+                }
+                break;
+            }
+
+            case 5: {
+                // AT+UFTPC=5,<local>,<remote>
+                auto it = files.find(arg(args, 1));
+                ok = it != files.end();
+                if (ok && urc_result(true)) {
+                    const std::string remote = args.size() > 2 && ! args[2].empty() ? args[2] : arg(args, 1);
+                    ftp_files[ftp_path(remote)] = it->second;
+                    delay_ms += transfer_ms(it->second.size());
+                }
+                break;
+            }
+
+            case 8:
+                ftp_dir = ftp_path(arg(args, 1));
+                break;
+
+            case 10:
+                break;
+
+            default:
+                return false;
+        }
+
+        respond("");
+        snprintf(buf, sizeof(buf), "+UUFTPCR: %d,%d", op, urc_result(ok));
+        urc(delay_ms, buf);
+        return true;
+    }
+}
@@ -0,0 +1,190 @@
+#ifndef R5_EMULATOR_H
+#define R5_EMULATOR_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <deque>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace wombat {
+    /**
+     * @brief How long the emulated modem takes to do things, in milliseconds of emulated time.
+     *
+     * The defaults are typical of a SARA-R5 on the Telstra Cat-M1 network.
+     */
+    struct R5Timing {
+        //! Time from receiving a command to sending its response.
+        uint32_t command_ms = 20;
+        //! Time from power on or AT+CFUN=1 to registering with the network.
+        uint32_t registration_ms = 4000;
+        //! Time to activate the PDP context, AT+UPSDA does not respond until it is active.
+        uint32_t pdp_ms = 1500;
+        //! Round trip time of a UDP packet, such as an NTP query.
+        uint32_t udp_rtt_ms = 600;
+        uint32_t mqtt_login_ms = 1200;
+        uint32_t mqtt_publish_ms = 700;
+        uint32_t mqtt_logout_ms = 300;
+        uint32_t mqtt_subscribe_ms = 400;
+        uint32_t ftp_login_ms = 1500;
+        uint32_t ftp_command_ms = 500;
+        //! FTP transfer rate, in bytes per second.
+        uint32_t ftp_bytes_per_s = 20000;
+    };
+
+    //! Failures that can be injected into the emulated modem.
+    enum r5_fault_t {
+        //! The command fails with ERROR.
+        R5_FAULT_ERROR,
+        //! The command gets no response at all.
+        R5_FAULT_NO_RESPONSE,
+        //! The command succeeds but the URC for it reports failure.
+        R5_FAULT_URC_FAILED,
+        //! The command succeeds but the URC for it is never sent.
+        R5_FAULT_URC_LOST
+    };
+
+    /**
+     * @brief An emulation of the SARA-R5 AT command dialect used by the firmware, for driving the
+     * network code in the native test environment.
+     *
+     * The emulator is the modem side of the UART. Bytes written to it are AT commands and data, and
+     * its responses and URCs become readable once the emulated clock reaches the time they are due.
+     * The clock only moves when advance() is called, so tests run as fast as the host allows and
+     * the emulated time taken by a sequence of commands is exact and repeatable.
+     *
+     * The emulator covers network registration, the PDP context, UDP sockets for NTP, the MQTT
+     * client (+UMQTTC and +UUMQTTC), the FTP client (+UFTPC and +UUFTPCR) and the modem file
+     * system. The MQTT broker and FTP server are part of the emulator so tests can check what was
+     * published or uploaded and supply messages and files for the node to receive.
+     */
+    class R5Emulator {
+    public:
+        explicit R5Emulator(const R5Timing &timing = R5Timing());
+
+        void write(const uint8_t *data, size_t len);
+        void write(const char *s);
+        int read(void);
+        size_t available(void) const;
+
+        void advance(uint32_t ms);
+        //! The emulated time since power on, in milliseconds.
+        uint32_t now(void) const { return clock_ms; }
+
+        void inject_fault(const char *cmd_prefix, r5_fault_t fault, unsigned count = 1);
+        //! Fail network registration with the given +CEREG status, 3 for denied.
+        void deny_registration(int status = 3) { reg_denied_status = status; }
+        //! Set the UTC time of power on, as seconds since 1970, for AT+CCLK and NTP.
+        void set_epoch(uint32_t epoch) { epoch_at_power_on = epoch; }
+
+        void queue_downlink(const std::string &topic, const std::string &payload);
+
+        struct MqttMessage {
+            uint32_t time_ms;
+            std::string topic;
+            std::vector<uint8_t> payload;
+            int qos;
+            bool retain;
+        };
+
+        struct CommandRecord {
+            uint32_t time_ms;
+            std::string command;
+        };
+
+        //! Files on the modem file system.
+        std::map<std::string, std::vector<uint8_t>> files;
+        //! Files on the FTP server, keyed by path.
+        std::map<std::string, std::vector<uint8_t>> ftp_files;
+        //! Messages received by the MQTT broker.
+        std::vector<MqttMessage> published;
+        //! Every command received, with the time it was received.
+        std::vector<CommandRecord> commands;
+
+        //! The size of the modem file system, for AT+ULSTFILE=1.
+        size_t fs_capacity = 1024 * 1024;
+
+    private:
+        struct Output {
+            uint32_t due_ms;
+            std::string bytes;
+        };
+
+        struct Fault {
+            std::string prefix;
+            r5_fault_t fault;
+            unsigned count;
+        };
+
+        //! What bytes written to the emulator are, after a command that takes a data prompt.
+        enum data_mode_t {
+            DATA_NONE,
+            DATA_FILE,
+            DATA_MQTT_BINARY,
+            DATA_UDP
+        };
+
+        R5Timing timing;
+        uint32_t clock_ms = 0;
+        uint32_t epoch_at_power_on = 0;
+        //! Responses are sent in order, so a response is never due before the one before it.
+        uint32_t last_response_ms = 0;
+        std::deque<Output> output;
+        std::string line;
+        bool echo = true;
+
+        data_mode_t data_mode = DATA_NONE;
+        size_t data_expected = 0;
+        std::string data_buf;
+        std::string data_name;
+        int data_qos = 0;
+        bool data_retain = false;
+
+        bool radio_on = true;
+        uint32_t reg_start_ms = 0;
+        int reg_denied_status = 0;
+        bool pdp_active = false;
+
+        std::map<int, std::string> mqtt_params;
+        bool mqtt_connected = false;
+        std::deque<std::pair<std::string, std::string>> downlinks;
+
+        std::map<int, std::string> ftp_params;
+        bool ftp_connected = false;
+        std::string ftp_dir = "/";
+
+        bool socket_open = false;
+        std::string udp_rx;
+        uint32_t udp_rx_due_ms = 0;
+        uint32_t pdp_due_ms = 0;
+
+        std::vector<Fault> faults;
+        //! True if the URC of the command being run must fail or be lost.
+        bool urc_fault_active = false;
+        r5_fault_t urc_fault = R5_FAULT_ERROR;
+
+        void run_command(const std::string &cmd);
+        void finish_data(void);
+
+        void respond(const std::string &text, bool ok = true, uint32_t delay_ms = 0);
+        void error(void);
+        void urc(uint32_t delay_ms, const std::string &text);
+        void prompt(const char *p);
+        void queue(uint32_t due, const std::string &bytes);
+
+        bool take_fault(const std::string &cmd, r5_fault_t &fault);
+        int urc_result(bool ok) const;
+        int reg_status(void) const;
+        uint32_t transfer_ms(size_t bytes) const;
+        std::string ftp_path(const std::string &name) const;
+
+        bool at_mqtt(const std::vector<std::string> &args);
+        bool at_mqttc(const std::vector<std::string> &args);
+        bool at_ftpc(const std::vector<std::string> &args);
+    };
+
+    std::vector<std::string> split_at_args(const std::string &s);
+}
+
+#endif //R5_EMULATOR_H
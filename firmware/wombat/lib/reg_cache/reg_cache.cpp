@@ -0,0 +1,285 @@
+#include "reg_cache.h"
+
+#include <cstdlib>
+#include <cstring>
+
+//
+// This file is a project-local platformio library so it can be unit tested.
+//
+// Do not include anything other than standard C++ headers.
+//
+
+namespace wombat {
+    //! Identifies a valid state, changed whenever the layout of RegCacheState changes.
+    static constexpr uint32_t REG_CACHE_MAGIC = 0x52454731; // "REG1"
+
+    //! The downlink EARFCN range of an LTE band, from 3GPP TS 36.101 table 5.7.3-1.
+    struct BandRange {
+        uint16_t band;
+        uint32_t first;
+        uint32_t last;
+    };
+
+    //! The bands LTE-M and NB-IoT are deployed on.
+    static const BandRange BANDS[] = {
+        { 1, 0, 599 }, { 2, 600, 1199 }, { 3, 1200, 1949 }, { 4, 1950, 2399 }, { 5, 2400, 2649 },
+        { 8, 3450, 3799 }, { 12, 5010, 5179 }, { 13, 5180, 5279 }, { 14, 5280, 5379 }, { 17, 5730, 5849 },
+        { 18, 5850, 5999 }, { 19, 6000, 6149 }, { 20, 6150, 6449 }, { 25, 8040, 8689 }, { 26, 8690, 9039 },
+        { 28, 9210, 9659 }, { 66, 66436, 67335 }, { 71, 68586, 68935 }, { 85, 70366, 70545 },
+    };
+
+    //! The band of a downlink EARFCN, or 0 if it is not in a known band.
+    uint16_t earfcn_to_band(const uint32_t earfcn) {
+        for (const BandRange &range : BANDS) {
+            if (earfcn >= range.first && earfcn <= range.last) {
+                return range.band;
+            }
+        }
+
+        return 0;
+    }
+
+    /**
+     * @brief Split a line into comma separated fields, without quotes or spaces.
+     *
+     * @return the number of fields.
+     */
+    static size_t split_fields(const char *p, char fields[][17], const size_t max_fields) {
+        size_t field = 0;
+        size_t len = 0;
+        memset(fields, 0, max_fields * sizeof(fields[0]));
+        for (; *p != 0 && *p != '\r' && *p != '\n'; p++) {
+            if (*p == ',') {
+                if (++field >= max_fields) {
+                    return max_fields;
+                }
+                len = 0;
+            } else if (*p != '"' && *p != ' ' && len < sizeof(fields[0]) - 1) {
+                fields[field][len++] = *p;
+            }
+        }
+
+        return field + 1;
+    }
+
+    //! The start of the line after the one p is on, or nullptr if there is none.
+    static const char *next_line(const char *p) {
+        p = strchr(p, '\n');
+        if (p == nullptr) {
+            return nullptr;
+        }
+
+        while (*p == '\r' || *p == '\n') {
+            p++;
+        }
+
+        return *p != 0 ? p : nullptr;
+    }
+
+    /**
+     * @brief Parse the response to AT+COPS? with the numeric format set by AT+COPS=3,2, which is
+     * `+COPS: <mode>[,<format>,<oper>[,<AcT>]]`.
+     *
+     * @return false if the modem is not registered to an operator, or the operator is not numeric.
+     */
+    bool parse_cops(const char *rsp, char plmn[PLMN_LEN + 1], uint8_t &act) {
+        const char *p = rsp == nullptr ? nullptr : strstr(rsp, "+COPS:");
+        if (p == nullptr) {
+            return false;
+        }
+
+        char fields[4][17];
+        const size_t n = split_fields(p + strlen("+COPS:"), fields, 4);
+        if (n < 3 || strcmp(fields[1], "2") != 0) {
+            return false;
+        }
+
+        const size_t len = strlen(fields[2]);
+        if (len < 5 || len > PLMN_LEN || strspn(fields[2], "0123456789") != len) {
+            return false;
+        }
+
+        strncpy(plmn, fields[2], PLMN_LEN + 1);
+        act = n > 3 ? static_cast<uint8_t>(atoi(fields[3])) : 0;
+        return true;
+    }
+
+    /**
+     * @brief Parse the LTE serving cell from the response to AT+UCGED? in mode 2, which on the
+     * SARA-R5 is a line of `<rat>,<svc>,<MCC>,<MNC>` followed by one starting
+     * `<earfcn>,<Lband>,<ul_BW>,<dl_BW>,<tac>,<LcellId>`. The TAC and cell ID are in hex.
+     *
+     * A missing or zero band is worked out from the EARFCN.
+     *
+     * @return false if there is no serving cell.
+     */
+    bool parse_ucged(const char *rsp, ServingCell &cell) {
+        const char *p = rsp == nullptr ? nullptr : strstr(rsp, "+UCGED:");
+        if (p == nullptr) {
+            return false;
+        }
+
+        p = next_line(p);
+        p = p == nullptr ? nullptr : next_line(p);
+        if (p == nullptr) {
+            return false;
+        }
+
+        char fields[6][17];
+        if (split_fields(p, fields, 6) < 6 || strspn(fields[0], "0123456789") == 0) {
+            return false;
+        }
+
+        cell.earfcn = static_cast<uint32_t>(strtoul(fields[0], nullptr, 10));
+        cell.band = static_cast<uint16_t>(atoi(fields[1]));
+        if (cell.band == 0) {
+            cell.band = earfcn_to_band(cell.earfcn);
+        }
+        cell.tac = static_cast<uint16_t>(strtoul(fields[4], nullptr, 16));
+        cell.cell_id = static_cast<uint32_t>(strtoul(fields[5], nullptr, 16));
+        return cell.band != 0;
+    }
+
+    /**
+     * @brief Parse the LTE-M band mask, bands 1 to 64, from the response to AT+UBANDMASK?, which is
+     * `+UBANDMASK: 0,<LTE-M mask>[,<mask 2>],1,<NB-IoT mask>[,<mask 2>]`.
+     */
+    bool parse_ubandmask(const char *rsp, uint64_t &mask) {
+        const char *p = rsp == nullptr ? nullptr : strstr(rsp, "+UBANDMASK:");
+        if (p == nullptr) {
+            return false;
+        }
+
+        char fields[2][17];
+        if (split_fields(p + strlen("+UBANDMASK:"), fields, 2) < 2 || strcmp(fields[0], "0") != 0
+                || fields[1][0] == 0 || strspn(fields[1], "0123456789") != strlen(fields[1])) {
+            return false;
+        }
+
+        mask = strtoull(fields[1], nullptr, 10);
+        return mask != 0;
+    }
+
+    /**
+     * @brief Reset the state if it is not valid.
+     *
+     * On a cold boot the RTC memory holds garbage or zeros, after deep sleep it holds the state
+     * written by the previous wakes.
+     */
+    void RegCache::begin(void) {
+        if (state.magic != REG_CACHE_MAGIC || state.plmn[PLMN_LEN] != 0) {
+            memset(&state, 0, sizeof(state));
+            state.magic = REG_CACHE_MAGIC;
+            state.reported = true;
+        }
+    }
+
+    /**
+     * @brief The band mask to register with, if it should be narrowed to the cached band.
+     *
+     * @param current the modem's LTE-M band mask.
+     * @param mask the narrowed mask.
+     * @return true if the mask should be set to the narrowed mask.
+     */
+    bool RegCache::narrow_mask(const uint64_t current, uint64_t &mask) const {
+        const uint64_t bit = band_bit(state.cell.band);
+        if ( ! use_fast_path() || state.stable < STABLE_ATTACHES || bit == 0 || (current & bit) == 0 || current == bit) {
+            return false;
+        }
+
+        mask = bit;
+        return true;
+    }
+
+    /**
+     * @brief Record a registration.
+     *
+     * @param plmn the PLMN registered on, or nullptr if it could not be read.
+     * @param act the access technology registered with.
+     * @param cell the serving cell, with a band of 0 if it could not be read.
+     * @param ms how long the registration took, in milliseconds.
+     * @param fast true if the fast path was used.
+     */
+    void RegCache::registered(const char *plmn, const uint8_t act, const ServingCell &cell, const uint32_t ms, const bool fast) {
+        state.attaches++;
+        state.total_ms += ms;
+        if (fast) {
+            state.fast_attaches++;
+            state.fast_total_ms += ms;
+        }
+        if (ms > state.max_ms) {
+            state.max_ms = ms;
+        }
+        state.last_ms = ms;
+        state.last_fast = fast;
+        state.reported = false;
+        state.fails = 0;
+
+        if (plmn == nullptr || plmn[0] == 0) {
+            return;
+        }
+
+        const bool same = ! strncmp(state.plmn, plmn, PLMN_LEN) && cell.band != 0 && state.cell.band == cell.band;
+        if (same) {
+            if (state.stable < UINT8_MAX) {
+                state.stable++;
+            }
+        } else {
+            state.stable = 1;
+        }
+
+        strncpy(state.plmn, plmn, PLMN_LEN);
+        state.plmn[PLMN_LEN] = 0;
+        state.act = act;
+        if (cell.band != 0) {
+            state.cell = cell;
+        }
+    }
+
+    //! Record that the fast path did not register.
+    void RegCache::fast_failed(void) {
+        if (state.fails < UINT8_MAX) {
+            state.fails++;
+        }
+        state.stable = 0;
+    }
+
+    //! How long to wait before polling the registration status again.
+    uint32_t RegCache::poll_ms(const uint32_t elapsed_ms) {
+        if (elapsed_ms < 10000) {
+            return 250;
+        }
+
+        if (elapsed_ms < 30000) {
+            return 1000;
+        }
+
+        return 2000;
+    }
+
+    //! The mean time of all registrations, in milliseconds, or 0 if there have been none.
+    uint32_t RegCache::get_mean_ms(void) const {
+        return state.attaches > 0 ? static_cast<uint32_t>(state.total_ms / state.attaches) : 0;
+    }
+
+    //! The mean time of the fast path registrations, in milliseconds, or 0 if there have been none.
+    uint32_t RegCache::get_fast_mean_ms(void) const {
+        return state.fast_attaches > 0 ? static_cast<uint32_t>(state.fast_total_ms / state.fast_attaches) : 0;
+    }
+
+    /**
+     * @brief Get the last registration if it has not been reported, and mark it reported.
+     *
+     * @return true if there was an unreported registration.
+     */
+    bool RegCache::take_unreported(uint32_t &ms, bool &fast) {
+        if (state.reported) {
+            return false;
+        }
+
+        ms = state.last_ms;
+        fast = state.last_fast;
+        state.reported = true;
+        return true;
+    }
+}
@@ -0,0 +1,119 @@
+#ifndef REG_CACHE_H
+#define REG_CACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace wombat {
+    //! The longest PLMN, 3 digits of MCC and up to 3 of MNC.
+    static constexpr size_t PLMN_LEN = 6;
+
+    //! The serving cell, from AT+UCGED.
+    struct ServingCell {
+        uint32_t earfcn;
+        uint16_t band;
+        uint16_t tac;
+        uint32_t cell_id;
+    };
+
+    bool parse_cops(const char *rsp, char plmn[PLMN_LEN + 1], uint8_t &act);
+    bool parse_ucged(const char *rsp, ServingCell &cell);
+    bool parse_ubandmask(const char *rsp, uint64_t &mask);
+
+    uint16_t earfcn_to_band(uint32_t earfcn);
+    //! The LTE band mask bit of a band, or 0 if the band is not in the first 64.
+    inline uint64_t band_bit(const uint16_t band) { return band >= 1 && band <= 64 ? 1ULL << (band - 1) : 0; }
+
+    /**
+     * @brief The network the node last registered on, and how long registrations take, kept across
+     * deep sleep. It is plain data so it can live in RTC memory, and RegCache::begin() resets it if it
+     * does not hold a valid state.
+     */
+    struct RegCacheState {
+        uint32_t magic;
+        //! The PLMN last registered on, empty if none.
+        char plmn[PLMN_LEN + 1];
+        //! The access technology last registered with, 7 for LTE-M and 9 for NB-IoT.
+        uint8_t act;
+        //! The serving cell after the last registration.
+        ServingCell cell;
+        //! The registrations in a row on the same PLMN and band.
+        uint8_t stable;
+        //! The fast path attempts in a row that did not register.
+        uint8_t fails;
+        //! The LTE-M band mask before it was narrowed to the cached band, 0 if it has not been narrowed.
+        uint64_t full_mask;
+
+        //! The number of registrations, and how many of them used the fast path.
+        uint32_t attaches;
+        uint32_t fast_attaches;
+        //! The total time of the registrations, and of those that used the fast path, in milliseconds.
+        uint64_t total_ms;
+        uint64_t fast_total_ms;
+        //! The longest and the last registration, in milliseconds.
+        uint32_t max_ms;
+        uint32_t last_ms;
+        //! True if the last registration used the fast path.
+        bool last_fast;
+        //! True once the last registration has been reported.
+        bool reported;
+    };
+
+    /**
+     * @brief Remembers the network and cell of the last registration, so the next can go straight to
+     * them instead of searching, and keeps statistics of how long registration takes.
+     *
+     * The fast path asks the modem for the cached PLMN and access technology first, falling back to
+     * automatic selection, and is used while it keeps working. Once the node has registered on the
+     * same PLMN and band STABLE_ATTACHES times in a row the LTE-M band mask is narrowed to that band
+     * so the modem does not scan the others. A fast path that does not register stops the narrowing,
+     * and MAX_FAILS in a row stop the fast path until a normal registration succeeds.
+     *
+     * The registration status is polled quickly at first, because most registrations take a few
+     * seconds, and more slowly after that.
+     */
+    class RegCache {
+    public:
+        //! The registrations in a row on the same PLMN and band before the band mask is narrowed.
+        static constexpr uint8_t STABLE_ATTACHES = 3;
+        //! The fast path attempts in a row that may fail before it is not used.
+        static constexpr uint8_t MAX_FAILS = 2;
+
+        explicit RegCache(RegCacheState &state) : state(state) {}
+
+        void begin(void);
+
+        //! True if the fast path should be used for the next registration.
+        bool use_fast_path(void) const { return state.plmn[0] != 0 && state.fails < MAX_FAILS; }
+        bool narrow_mask(uint64_t current, uint64_t &mask) const;
+        //! Record that the band mask was narrowed from the given mask, so it can be restored.
+        void narrowed(const uint64_t full) { if (state.full_mask == 0) state.full_mask = full; }
+        //! The band mask to restore, 0 if it was not narrowed.
+        uint64_t get_full_mask(void) const { return state.full_mask; }
+        //! Record that the band mask has been restored.
+        void restored(void) { state.full_mask = 0; }
+
+        void registered(const char *plmn, uint8_t act, const ServingCell &cell, uint32_t ms, bool fast);
+        void fast_failed(void);
+
+        static uint32_t poll_ms(uint32_t elapsed_ms);
+
+        const char *get_plmn(void) const { return state.plmn; }
+        uint8_t get_act(void) const { return state.act; }
+        const ServingCell &get_cell(void) const { return state.cell; }
+        uint8_t get_stable(void) const { return state.stable; }
+        uint32_t get_attaches(void) const { return state.attaches; }
+        uint32_t get_fast_attaches(void) const { return state.fast_attaches; }
+        uint32_t get_max_ms(void) const { return state.max_ms; }
+        uint32_t get_last_ms(void) const { return state.last_ms; }
+        uint32_t get_mean_ms(void) const;
+        uint32_t get_fast_mean_ms(void) const;
+
+        bool take_unreported(uint32_t &ms, bool &fast);
+
+    private:
+        RegCacheState &state;
+    };
+}
+
+#endif //REG_CACHE_H
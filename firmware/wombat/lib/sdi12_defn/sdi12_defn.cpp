@@ -0,0 +1,375 @@
+#include "sdi12_defn.h"
+
+#include <algorithm>
+#include <cstring>
+#include <map>
+
+#include "crc32.h"
+
+//
+// This file is a project-local platformio library so it can be unit tested.
+//
+// Do not include anything other than standard C++ headers.
+//
+
+namespace wombat {
+    static constexpr uint8_t MAGIC[4] = { 'S', 'D', 'T', '2' };
+
+    //! Set in the definition flags if the sensor's service request should be ignored.
+    static constexpr uint8_t FLAG_IGNORE_SR = 0x01;
+
+    // Offsets of the fields in a definition record.
+    static constexpr size_t REC_HASH = 0;
+    static constexpr size_t REC_VENDOR = 4;
+    static constexpr size_t REC_MODEL = 6;
+    static constexpr size_t REC_MASK = 8;
+    static constexpr size_t REC_LIST = 10;
+    static constexpr size_t REC_NUM_CMDS = 12;
+    static constexpr size_t REC_NUM_LABELS = 13;
+    static constexpr size_t REC_FLAGS = 14;
+
+    static uint16_t rd16(const uint8_t *p) {
+        return static_cast<uint16_t>(p[0] | (p[1] << 8));
+    }
+
+    static uint32_t rd32(const uint8_t *p) {
+        return static_cast<uint32_t>(p[0]) | (static_cast<uint32_t>(p[1]) << 8) |
+               (static_cast<uint32_t>(p[2]) << 16) | (static_cast<uint32_t>(p[3]) << 24);
+    }
+
+    static void wr16(uint8_t *p, const uint16_t v) {
+        p[0] = v & 0xff;
+        p[1] = v >> 8;
+    }
+
+    static void wr32(uint8_t *p, const uint32_t v) {
+        p[0] = v & 0xff;
+        p[1] = (v >> 8) & 0xff;
+        p[2] = (v >> 16) & 0xff;
+        p[3] = v >> 24;
+    }
+
+    size_t SensorDefn::num_read_cmds(void) const {
+        return rec == nullptr ? 0 : rec[REC_NUM_CMDS];
+    }
+
+    /**
+     * @brief Returns read command i, eg "aC!", or nullptr if there is no such command.
+     */
+    const char *SensorDefn::read_cmd(const size_t i) const {
+        if (i >= num_read_cmds()) {
+            return nullptr;
+        }
+
+        return list_entry(i);
+    }
+
+    /**
+     * @brief Returns the value mask, or nullptr if the definition does not have one.
+     */
+    const char *SensorDefn::value_mask(void) const {
+        if (rec == nullptr) {
+            return nullptr;
+        }
+
+        const uint16_t offset = rd16(&rec[REC_MASK]);
+        return offset == 0 ? nullptr : reinterpret_cast<const char *>(&blob[offset]);
+    }
+
+    size_t SensorDefn::num_labels(void) const {
+        return rec == nullptr ? 0 : rec[REC_NUM_LABELS];
+    }
+
+    /**
+     * @brief Returns label i, or nullptr if the definition has fewer labels than that.
+     */
+    const char *SensorDefn::label(const size_t i) const {
+        if (i >= num_labels()) {
+            return nullptr;
+        }
+
+        return list_entry(num_read_cmds() + i);
+    }
+
+    bool SensorDefn::ignore_sr(void) const {
+        return rec != nullptr && (rec[REC_FLAGS] & FLAG_IGNORE_SR) != 0;
+    }
+
+    const char *SensorDefn::list_entry(const size_t i) const {
+        const uint16_t list = rd16(&rec[REC_LIST]);
+        return reinterpret_cast<const char *>(&blob[rd16(&blob[list + i * 2])]);
+    }
+
+    /**
+     * @brief Add a sensor definition to the table.
+     *
+     * @return false if the vendor and model have already been added or there are too many commands or labels.
+     */
+    bool SensorDefnTableBuilder::add(const char *vendor, const char *model, const std::vector<const char *> &read_cmds,
+                                     const char *value_mask, const std::vector<const char *> &labels, const bool ignore_sr) {
+        if (vendor == nullptr || model == nullptr || read_cmds.size() > UINT8_MAX || labels.size() > UINT8_MAX) {
+            return false;
+        }
+
+        for (const Entry &e : entries) {
+            if (e.vendor == vendor && e.model == model) {
+                return false;
+            }
+        }
+
+        Entry e;
+        e.vendor = vendor;
+        e.model = model;
+        for (const char *cmd : read_cmds) {
+            e.read_cmds.emplace_back(cmd != nullptr ? cmd : "");
+        }
+
+        if (value_mask != nullptr) {
+            e.has_mask = true;
+            e.value_mask = value_mask;
+        }
+
+        for (const char *label : labels) {
+            e.labels.emplace_back(label != nullptr ? label : "");
+        }
+
+        e.ignore_sr = ignore_sr;
+        entries.push_back(e);
+        return true;
+    }
+
+    /**
+     * @brief Write the binary table.
+     *
+     * @param source_size the size of the JSON file the definitions were read from, so a changed file can be detected.
+     * @param source_crc the CRC-32 of the JSON file, so a change that keeps the size is also detected.
+     * @param out [OUT] the table.
+     * @return false if the table would be larger than the 16 bit offsets can address.
+     */
+    bool SensorDefnTableBuilder::build(const uint32_t source_size, const uint32_t source_crc, std::vector<uint8_t> &out) const {
+        const size_t count = entries.size();
+        if (count > UINT16_MAX / 2) {
+            return false;
+        }
+
+        // Keep the load factor at or below 0.5 so lookups rarely probe more than one bucket.
+        size_t num_buckets = 4;
+        while (num_buckets < count * 2) {
+            num_buckets *= 2;
+        }
+
+        const size_t buckets_at = SensorDefnTable::HEADER_SIZE;
+        const size_t records_at = buckets_at + num_buckets * 2;
+        const size_t lists_at = records_at + count * SensorDefnTable::RECORD_SIZE;
+
+        size_t list_entries = 0;
+        for (const Entry &e : entries) {
+            list_entries += e.read_cmds.size() + e.labels.size();
+        }
+
+        // Strings are stored once, many sensors share labels such as Temperature.
+        std::vector<uint8_t> strings;
+        std::map<std::string, size_t> string_offsets;
+        const size_t strings_at = lists_at + list_entries * 2;
+        auto intern = [&](const std::string &s) -> size_t {
+            auto iter = string_offsets.find(s);
+            if (iter != string_offsets.end()) {
+                return iter->second;
+            }
+
+            const size_t offset = strings_at + strings.size();
+            strings.insert(strings.end(), s.begin(), s.end());
+            strings.push_back(0);
+            string_offsets[s] = offset;
+            return offset;
+        };
+
+        std::vector<uint8_t> records(count * SensorDefnTable::RECORD_SIZE, 0);
+        std::vector<uint8_t> lists(list_entries * 2, 0);
+        std::vector<uint16_t> buckets(num_buckets, 0);
+
+        size_t list_idx = 0;
+        for (size_t i = 0; i < count; i++) {
+            const Entry &e = entries[i];
+            uint8_t *rec = &records[i * SensorDefnTable::RECORD_SIZE];
+
+            const uint32_t h = SensorDefnTable::hash(e.vendor.c_str(), e.model.c_str());
+            wr32(&rec[REC_HASH], h);
+            wr16(&rec[REC_VENDOR], static_cast<uint16_t>(intern(e.vendor)));
+            wr16(&rec[REC_MODEL], static_cast<uint16_t>(intern(e.model)));
+            wr16(&rec[REC_MASK], e.has_mask ? static_cast<uint16_t>(intern(e.value_mask)) : 0);
+            wr16(&rec[REC_LIST], static_cast<uint16_t>(lists_at + list_idx * 2));
+            rec[REC_NUM_CMDS] = static_cast<uint8_t>(e.read_cmds.size());
+            rec[REC_NUM_LABELS] = static_cast<uint8_t>(e.labels.size());
+            rec[REC_FLAGS] = e.ignore_sr ? FLAG_IGNORE_SR : 0;
+
+            for (const std::string &s : e.read_cmds) {
+                wr16(&lists[list_idx++ * 2], static_cast<uint16_t>(intern(s)));
+            }
+
+            for (const std::string &s : e.labels) {
+                wr16(&lists[list_idx++ * 2], static_cast<uint16_t>(intern(s)));
+            }
+
+            size_t b = h & (num_buckets - 1);
+            while (buckets[b] != 0) {
+                b = (b + 1) & (num_buckets - 1);
+            }
+
+            buckets[b] = static_cast<uint16_t>(i + 1);
+        }
+
+        const size_t total = strings_at + strings.size();
+        if (total > UINT16_MAX) {
+            return false;
+        }
+
+        out.assign(total, 0);
+        memcpy(&out[0], MAGIC, sizeof(MAGIC));
+        wr16(&out[4], static_cast<uint16_t>(count));
+        wr16(&out[6], static_cast<uint16_t>(num_buckets));
+        wr32(&out[8], source_size);
+        wr32(&out[12], source_crc);
+        wr32(&out[20], static_cast<uint32_t>(total));
+
+        for (size_t b = 0; b < num_buckets; b++) {
+            wr16(&out[buckets_at + b * 2], buckets[b]);
+        }
+
+        std::copy(records.begin(), records.end(), out.begin() + records_at);
+        std::copy(lists.begin(), lists.end(), out.begin() + lists_at);
+        std::copy(strings.begin(), strings.end(), out.begin() + strings_at);
+
+        wr32(&out[16], crc32(&out[SensorDefnTable::HEADER_SIZE], total - SensorDefnTable::HEADER_SIZE));
+        return true;
+    }
+
+    /**
+     * @brief FNV-1a hash of the vendor and model, separated by a null.
+     */
+    uint32_t SensorDefnTable::hash(const char *vendor, const char *model) {
+        uint32_t h = 2166136261u;
+        for (const char *p = vendor; *p != 0; p++) {
+            h = (h ^ static_cast<uint8_t>(*p)) * 16777619u;
+        }
+
+        h = h * 16777619u;
+        for (const char *p = model; *p != 0; p++) {
+            h = (h ^ static_cast<uint8_t>(*p)) * 16777619u;
+        }
+
+        return h;
+    }
+
+    /**
+     * @brief Check a binary table and use it for subsequent lookups.
+     *
+     * The table is not copied, data must remain valid until the table is cleared or another is loaded.
+     *
+     * @return false if the data is not a valid table, in which case the table is left empty.
+     */
+    bool SensorDefnTable::load(const uint8_t *data, const size_t len) {
+        clear();
+
+        if (data == nullptr || len < HEADER_SIZE || memcmp(data, MAGIC, sizeof(MAGIC)) != 0) {
+            return false;
+        }
+
+        const uint16_t n = rd16(&data[4]);
+        const uint16_t nb = rd16(&data[6]);
+        if (rd32(&data[20]) != len || nb == 0 || (nb & (nb - 1)) != 0) {
+            return false;
+        }
+
+        const size_t records_at = HEADER_SIZE + nb * 2;
+        if (records_at + n * RECORD_SIZE > len) {
+            return false;
+        }
+
+        if (crc32(&data[HEADER_SIZE], len - HEADER_SIZE) != rd32(&data[16])) {
+            return false;
+        }
+
+        // Every string in the table is null-terminated, so if the last byte is a null no
+        // string can run off the end.
+        if (n > 0 && data[len - 1] != 0) {
+            return false;
+        }
+
+        for (size_t i = 0; i < n; i++) {
+            const uint8_t *rec = &data[records_at + i * RECORD_SIZE];
+            const size_t list = rd16(&rec[REC_LIST]);
+            const size_t list_len = rec[REC_NUM_CMDS] + rec[REC_NUM_LABELS];
+            if (rd16(&rec[REC_VENDOR]) >= len || rd16(&rec[REC_MODEL]) >= len || rd16(&rec[REC_MASK]) >= len ||
+                list + list_len * 2 > len) {
+                return false;
+            }
+
+            for (size_t j = 0; j < list_len; j++) {
+                if (rd16(&data[list + j * 2]) >= len) {
+                    return false;
+                }
+            }
+        }
+
+        blob = data;
+        blob_len = len;
+        count = n;
+        num_buckets = nb;
+        source_size = rd32(&data[8]);
+        source_crc = rd32(&data[12]);
+        return true;
+    }
+
+    void SensorDefnTable::clear(void) {
+        blob = nullptr;
+        blob_len = 0;
+        count = 0;
+        num_buckets = 0;
+        source_size = 0;
+        source_crc = 0;
+    }
+
+    /**
+     * @brief Find the definition for a sensor.
+     *
+     * @return a view of the definition, which is false if there is no definition for the sensor.
+     */
+    SensorDefn SensorDefnTable::find(const char *vendor, const char *model) const {
+        if (blob == nullptr || vendor == nullptr || model == nullptr) {
+            return {};
+        }
+
+        const uint32_t h = hash(vendor, model);
+        const uint8_t *records = &blob[HEADER_SIZE + num_buckets * 2];
+        size_t b = h & (num_buckets - 1);
+        for (size_t probe = 0; probe < num_buckets; probe++) {
+            const uint16_t idx = rd16(&blob[HEADER_SIZE + b * 2]);
+            if (idx == 0 || idx > count) {
+                break;
+            }
+
+            const uint8_t *rec = &records[(idx - 1) * RECORD_SIZE];
+            if (rd32(&rec[REC_HASH]) == h &&
+                strcmp(reinterpret_cast<const char *>(&blob[rd16(&rec[REC_VENDOR])]), vendor) == 0 &&
+                strcmp(reinterpret_cast<const char *>(&blob[rd16(&rec[REC_MODEL])]), model) == 0) {
+                return { blob, rec };
+            }
+
+            b = (b + 1) & (num_buckets - 1);
+        }
+
+        return {};
+    }
+
+    /**
+     * @brief Returns definition i, in the order they were added to the builder, for iterating over the table.
+     */
+    SensorDefn SensorDefnTable::at(const size_t i) const {
+        if (blob == nullptr || i >= count) {
+            return {};
+        }
+
+        return { blob, &blob[HEADER_SIZE + num_buckets * 2 + i * RECORD_SIZE] };
+    }
+}
@@ -0,0 +1,123 @@
+#ifndef SDI12_DEFN_H
+#define SDI12_DEFN_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace wombat {
+    /**
+     * @brief A read-only view of one sensor definition in a SensorDefnTable.
+     *
+     * The strings returned point into the table's buffer, so the view is only valid while
+     * that buffer is.
+     */
+    class SensorDefn {
+    public:
+        SensorDefn() = default;
+
+        //! True if the view refers to a sensor definition.
+        explicit operator bool() const { return rec != nullptr; }
+
+        size_t num_read_cmds(void) const;
+        const char *read_cmd(size_t i) const;
+        const char *value_mask(void) const;
+        size_t num_labels(void) const;
+        const char *label(size_t i) const;
+        bool ignore_sr(void) const;
+
+    private:
+        friend class SensorDefnTable;
+
+        SensorDefn(const uint8_t *blob, const uint8_t *rec) : blob(blob), rec(rec) {}
+
+        const uint8_t *blob = nullptr;
+        const uint8_t *rec = nullptr;
+
+        const char *list_entry(size_t i) const;
+    };
+
+    /**
+     * @brief Builds the binary form of the SDI-12 sensor definitions file.
+     *
+     * The JSON file is parsed once, each definition added to the builder, and the result written
+     * to the file system to be loaded by SensorDefnTable on subsequent wakes.
+     */
+    class SensorDefnTableBuilder {
+    public:
+        bool add(const char *vendor, const char *model, const std::vector<const char *> &read_cmds,
+                 const char *value_mask, const std::vector<const char *> &labels, bool ignore_sr);
+
+        bool build(uint32_t source_size, uint32_t source_crc, std::vector<uint8_t> &out) const;
+
+    private:
+        struct Entry {
+            std::string vendor;
+            std::string model;
+            std::vector<std::string> read_cmds;
+            bool has_mask = false;
+            std::string value_mask;
+            std::vector<std::string> labels;
+            bool ignore_sr = false;
+        };
+
+        std::vector<Entry> entries;
+    };
+
+    /**
+     * @brief A hash table of SDI-12 sensor definitions keyed by vendor and model, in a single
+     * contiguous buffer that can be read directly from the file system.
+     *
+     * Layout, all values little-endian:
+     *
+     * | offset | size | contents                                                        |
+     * |--------|------|-----------------------------------------------------------------|
+     * | 0      | 4    | magic "SDT2"                                                    |
+     * | 4      | 2    | number of definitions                                           |
+     * | 6      | 2    | number of hash buckets, a power of 2                            |
+     * | 8      | 4    | size of the JSON file the table was built from                  |
+     * | 12     | 4    | CRC-32 of the JSON file the table was built from                |
+     * | 16     | 4    | CRC-32 of the rest of the table, from offset 24                 |
+     * | 20     | 4    | total size of the table                                         |
+     * | 24     | 2n   | buckets, each the index + 1 of a definition or 0 if empty       |
+     * |        | 16n  | definitions                                                     |
+     * |        |      | string offset lists and null-terminated strings                 |
+     *
+     * Each definition is the key hash (4), vendor offset (2), model offset (2), value mask offset
+     * or 0 (2), offset of the read command then label string offset list (2), number of read
+     * commands (1), number of labels (1), flags (1) and padding (1).
+     */
+    class SensorDefnTable {
+    public:
+        //! The size of the fixed header at the start of the table.
+        static constexpr size_t HEADER_SIZE = 24;
+        //! The size of each definition record.
+        static constexpr size_t RECORD_SIZE = 16;
+
+        static uint32_t hash(const char *vendor, const char *model);
+
+        bool load(const uint8_t *data, size_t len);
+        void clear(void);
+
+        SensorDefn find(const char *vendor, const char *model) const;
+        SensorDefn at(size_t i) const;
+
+        //! The number of definitions in the table.
+        size_t size(void) const { return count; }
+        //! The size of the JSON file the table was built from.
+        uint32_t get_source_size(void) const { return source_size; }
+        //! The CRC-32 of the JSON file the table was built from.
+        uint32_t get_source_crc(void) const { return source_crc; }
+
+    private:
+        const uint8_t *blob = nullptr;
+        size_t blob_len = 0;
+        uint16_t count = 0;
+        uint16_t num_buckets = 0;
+        uint32_t source_size = 0;
+        uint32_t source_crc = 0;
+    };
+}
+
+#endif //SDI12_DEFN_H
@@ -0,0 +1,263 @@
+#include "sdi12_sched.h"
+
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+
+//
+// This file is a project-local platformio library so it can be unit tested.
+//
+// Do not include anything other than standard C++ headers.
+//
+
+namespace wombat {
+    /// The longest response to a D command from a concurrent measurement is 75 characters plus CR LF.
+    static constexpr size_t MAX_RSP = 82;
+
+    /**
+     * @brief Parse the response to a measure or concurrent command.
+     *
+     * The response is atttn for a measure command, or atttnn for a concurrent command, where a is
+     * the sensor address, ttt is the number of seconds until the data is ready and n/nn is the number
+     * of values the measurement will return.
+     *
+     * @param rsp the response, without the trailing CR LF.
+     * @param addr the address of the sensor the command was sent to.
+     * @param ready_secs [OUT] the number of seconds until the data is ready.
+     * @param num_values [OUT] the number of values the measurement will return.
+     * @return true if the response was valid, otherwise false.
+     */
+    bool parse_start_response(const char *rsp, const char addr, uint16_t &ready_secs, uint8_t &num_values) {
+        if (rsp == nullptr || rsp[0] != addr) {
+            return false;
+        }
+
+        const size_t len = strlen(rsp);
+        if (len < 5 || len > 7) {
+            return false;
+        }
+
+        for (size_t i = 1; i < len; i++) {
+            if ( ! isdigit(static_cast<unsigned char>(rsp[i]))) {
+                return false;
+            }
+        }
+
+        ready_secs = static_cast<uint16_t>((rsp[1] - '0') * 100 + (rsp[2] - '0') * 10 + (rsp[3] - '0'));
+        num_values = static_cast<uint8_t>(strtoul(&rsp[4], nullptr, 10));
+        return true;
+    }
+
+    /**
+     * @brief Parse the values from the response to a data command, eg 0+1.23-4.5+6.
+     *
+     * Every value is preceded by its sign.
+     *
+     * @param rsp the response, without the trailing CR LF.
+     * @param addr the address of the sensor the command was sent to.
+     * @param values the vector the values are appended to.
+     * @return the number of values appended to values, or -1 if the response was not from the sensor at addr.
+     */
+    int parse_data_values(const char *rsp, const char addr, std::vector<double> &values) {
+        if (rsp == nullptr || rsp[0] != addr) {
+            return -1;
+        }
+
+        int count = 0;
+        const char *p = &rsp[1];
+        while (*p == '+' || *p == '-') {
+            char *end = nullptr;
+            const double value = strtod(p, &end);
+            if (end == p + 1 || end == p) {
+                break;
+            }
+
+            values.push_back(value);
+            count++;
+            p = end;
+        }
+
+        return count;
+    }
+
+    /**
+     * @brief Returns true if cmd is a concurrent command, ie aC! or aCn! but not aCC! (which requests a CRC).
+     */
+    bool ConcurrentScheduler::is_concurrent_cmd(const char *cmd) {
+        if (cmd == nullptr || strlen(cmd) < 3 || cmd[1] != 'C') {
+            return false;
+        }
+
+        if (cmd[2] == '!') {
+            return true;
+        }
+
+        return cmd[2] > '0' && cmd[2] <= '9' && cmd[3] == '!';
+    }
+
+    /**
+     * @brief Add a sensor and its list of commands to the schedule.
+     *
+     * The commands are given as they appear in the sensor definitions file, with 'a' in place of the address.
+     *
+     * @param addr the sensor address.
+     * @param cmds the commands to run, in order.
+     * @return false if any of the commands is not a concurrent command, in which case the sensor is not added.
+     */
+    bool ConcurrentScheduler::add(const char addr, const std::vector<const char *> &cmds) {
+        if (cmds.empty()) {
+            return false;
+        }
+
+        for (const char *cmd : cmds) {
+            if ( ! is_concurrent_cmd(cmd)) {
+                return false;
+            }
+        }
+
+        Job job;
+        job.addr = addr;
+        for (const char *cmd : cmds) {
+            CmdResult r;
+            r.cmd = cmd;
+            r.cmd[0] = addr;
+            job.cmds.push_back(r);
+        }
+
+        jobs.push_back(job);
+        return true;
+    }
+
+    /**
+     * @brief Send the first command to every sensor in the schedule.
+     */
+    void ConcurrentScheduler::start(void) {
+        for (Job &job : jobs) {
+            start_next(job);
+        }
+    }
+
+    /**
+     * @brief Collect the data from any sensor whose measurement is ready and start its next command.
+     *
+     * @return true when every command on every sensor has completed.
+     */
+    bool ConcurrentScheduler::poll(void) {
+        bool finished = true;
+        for (Job &job : jobs) {
+            if (job.busy && static_cast<int32_t>(bus.now_ms() - job.ready_at) >= 0) {
+                collect(job);
+                start_next(job);
+            }
+
+            if (job.busy || job.next_cmd < job.cmds.size()) {
+                finished = false;
+            }
+        }
+
+        return finished;
+    }
+
+    /**
+     * @brief Block until every command on every sensor has completed.
+     */
+    void ConcurrentScheduler::finish(void) {
+        while ( ! poll()) {
+            // Sleep until the next sensor is ready rather than spinning on the bus.
+            const uint32_t now = bus.now_ms();
+            int32_t wait = INT32_MAX;
+            for (const Job &job : jobs) {
+                if (job.busy) {
+                    const int32_t delta = static_cast<int32_t>(job.ready_at - now);
+                    if (delta < wait) {
+                        wait = delta;
+                    }
+                }
+            }
+
+            if (wait > 0 && wait != INT32_MAX) {
+                bus.wait_ms(static_cast<uint32_t>(wait));
+            }
+        }
+    }
+
+    /**
+     * @brief Start the schedule and block until every command on every sensor has completed.
+     */
+    void ConcurrentScheduler::run(void) {
+        start();
+        finish();
+    }
+
+    /**
+     * @brief Returns the job for the sensor at addr, or nullptr if that sensor is not in the schedule.
+     */
+    const ConcurrentScheduler::Job *ConcurrentScheduler::find(const char addr) const {
+        for (const Job &job : jobs) {
+            if (job.addr == addr) {
+                return &job;
+            }
+        }
+
+        return nullptr;
+    }
+
+    void ConcurrentScheduler::start_next(Job &job) {
+        char rsp[MAX_RSP + 1];
+
+        while (job.next_cmd < job.cmds.size()) {
+            CmdResult &r = job.cmds[job.next_cmd];
+
+            uint16_t ready_secs = 0;
+            uint8_t num_values = 0;
+            bool started = false;
+            for (int attempt = 0; attempt < MAX_ATTEMPTS && ! started; attempt++) {
+                memset(rsp, 0, sizeof(rsp));
+                if (bus.transact(r.cmd.c_str(), rsp, sizeof(rsp)) > 0) {
+                    started = parse_start_response(rsp, job.addr, ready_secs, num_values);
+                }
+            }
+
+            if (started && num_values > 0) {
+                r.expected = num_values;
+                job.ready_at = bus.now_ms() + static_cast<uint32_t>(ready_secs) * 1000;
+                job.busy = true;
+                return;
+            }
+
+            // Either the sensor did not respond or there is nothing to collect, move on to the next command.
+            r.ok = started;
+            job.next_cmd++;
+        }
+
+        job.done_at = bus.now_ms();
+    }
+
+    void ConcurrentScheduler::collect(Job &job) {
+        char rsp[MAX_RSP + 1];
+        char cmd[] = "aD0!";
+        cmd[0] = job.addr;
+
+        CmdResult &r = job.cmds[job.next_cmd];
+        for (char d = '0'; d <= '9' && r.values.size() < r.expected; d++) {
+            cmd[2] = d;
+
+            int count = -1;
+            for (int attempt = 0; attempt < MAX_ATTEMPTS && count < 0; attempt++) {
+                memset(rsp, 0, sizeof(rsp));
+                if (bus.transact(cmd, rsp, sizeof(rsp)) > 0) {
+                    count = parse_data_values(rsp, job.addr, r.values);
+                }
+            }
+
+            // A sensor with no more values responds with just its address.
+            if (count < 1) {
+                break;
+            }
+        }
+
+        r.ok = r.values.size() == r.expected;
+        job.busy = false;
+        job.next_cmd++;
+    }
+}
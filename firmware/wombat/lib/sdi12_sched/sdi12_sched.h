@@ -0,0 +1,94 @@
+#ifndef SDI12_SCHED_H
+#define SDI12_SCHED_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace wombat {
+    /**
+     * @brief The bus operations the concurrent measurement scheduler needs.
+     *
+     * The firmware implements this over the EnviroDIY SDI12 object, the unit tests implement
+     * it with a simulated bus and clock.
+     */
+    class SDI12Bus {
+    public:
+        virtual ~SDI12Bus() = default;
+
+        /**
+         * @brief Send a command and read the single line response.
+         *
+         * @param cmd the complete command, including the address and trailing '!'.
+         * @param rsp the buffer to write the response into, with the trailing CR LF removed.
+         * @param rsp_max the size of rsp in bytes, including space for a terminating null.
+         * @return the length of the response, or 0 if the sensor did not respond.
+         */
+        virtual size_t transact(const char *cmd, char *rsp, size_t rsp_max) = 0;
+
+        /// A millisecond tick counter.
+        virtual uint32_t now_ms() = 0;
+
+        /// Block for the given number of milliseconds.
+        virtual void wait_ms(uint32_t ms) = 0;
+    };
+
+    bool parse_start_response(const char *rsp, char addr, uint16_t &ready_secs, uint8_t &num_values);
+    int parse_data_values(const char *rsp, char addr, std::vector<double> &values);
+
+    /**
+     * @brief Runs concurrent (aC!, aCn!) measurements on several sensors at once.
+     *
+     * Each sensor has a list of commands that must be run in order because a new command to a
+     * sensor aborts any measurement in progress on it. The scheduler starts the next command on
+     * every idle sensor, then collects the data from whichever sensor becomes ready first, so
+     * the total time is close to that of the slowest sensor rather than the sum of all of them.
+     */
+    class ConcurrentScheduler {
+    public:
+        /// The result of a single concurrent command.
+        struct CmdResult {
+            std::string cmd;
+            uint8_t expected = 0;
+            bool ok = false;
+            std::vector<double> values;
+        };
+
+        /// The commands and results for one sensor.
+        struct Job {
+            char addr = 0;
+            std::vector<CmdResult> cmds;
+            size_t next_cmd = 0;
+            bool busy = false;
+            uint32_t ready_at = 0;
+            //! When the last command on the sensor completed.
+            uint32_t done_at = 0;
+        };
+
+        //! How many times a command is sent before giving up on a sensor.
+        static constexpr int MAX_ATTEMPTS = 3;
+
+        explicit ConcurrentScheduler(SDI12Bus &bus) : bus(bus) {}
+
+        static bool is_concurrent_cmd(const char *cmd);
+
+        bool add(char addr, const std::vector<const char *> &cmds);
+        void start(void);
+        bool poll(void);
+        void finish(void);
+        void run(void);
+
+        const Job *find(char addr) const;
+        const std::vector<Job> &get_jobs(void) const { return jobs; }
+
+    private:
+        SDI12Bus &bus;
+        std::vector<Job> jobs;
+
+        void start_next(Job &job);
+        void collect(Job &job);
+    };
+}
+
+#endif //SDI12_SCHED_H
@@ -0,0 +1,226 @@
+#include "series_stats.h"
+
+#include <cmath>
+#include <cstring>
+
+//
+// This file is a project-local platformio library so it can be unit tested.
+//
+// Do not include anything other than standard C++ headers.
+//
+
+namespace wombat {
+    //! Identifies a valid state, changed whenever the layout of SeriesStatsState changes.
+    static constexpr uint32_t STATS_MAGIC = 0x53545331; // "STS1"
+
+    static const char *MODE_NAMES[STATS_NUM_MODES] = { "raw", "summary", "both" };
+
+    //! The name of a mode as used by the CLI.
+    const char *stats_mode_name(const stats_mode_t mode) {
+        return mode < STATS_NUM_MODES ? MODE_NAMES[mode] : "?";
+    }
+
+    //! Parse a mode name of len characters, which need not be null terminated.
+    bool parse_stats_mode(const char *str, const size_t len, stats_mode_t &mode) {
+        if (str == nullptr) {
+            return false;
+        }
+
+        for (uint8_t i = 0; i < STATS_NUM_MODES; i++) {
+            if (strlen(MODE_NAMES[i]) == len && ! strncmp(str, MODE_NAMES[i], len)) {
+                mode = static_cast<stats_mode_t>(i);
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    //! The 32 bit FNV-1a hash of a series name, which identifies the series in RTC memory.
+    uint32_t series_hash(const char *name) {
+        uint32_t hash = 2166136261U;
+        for (const char *p = name; *p != 0; p++) {
+            hash ^= static_cast<uint8_t>(*p);
+            hash *= 16777619U;
+        }
+
+        return hash;
+    }
+
+    /**
+     * @brief True if the name is one sensor_task() gives an SDI-12 value, which is the address less '0'
+     * in decimal or the address itself, then an underscore and the label or value number.
+     */
+    bool is_sdi12_series(const char *name) {
+        const char *underscore = name == nullptr ? nullptr : strchr(name, '_');
+        if (underscore == nullptr || underscore == name || underscore[1] == 0) {
+            return false;
+        }
+
+        const size_t prefix_len = underscore - name;
+        return prefix_len == 1 || strspn(name, "0123456789") == prefix_len;
+    }
+
+    /**
+     * @brief Reset the state if it is not valid.
+     *
+     * On a cold boot the RTC memory holds garbage or zeros, after deep sleep it holds the statistics
+     * added by the previous wakes.
+     */
+    void SeriesStats::begin(void) {
+        if (state.magic != STATS_MAGIC || state.num_series > STATS_MAX_SERIES || state.next >= STATS_MAX_SERIES) {
+            memset(&state, 0, sizeof(state));
+            state.magic = STATS_MAGIC;
+        }
+    }
+
+    /**
+     * @brief Add a value to the statistics of a series.
+     *
+     * @return false if the value is not a finite number, so it was not added.
+     */
+    bool SeriesStats::add(const char *name, const double value) {
+        if (name == nullptr || ! std::isfinite(value)) {
+            return false;
+        }
+
+        const uint32_t hash = series_hash(name);
+        SeriesStat *s = nullptr;
+        for (size_t i = 0; i < state.num_series && s == nullptr; i++) {
+            if (state.series[i].hash == hash) {
+                s = &state.series[i];
+            }
+        }
+
+        if (s == nullptr) {
+            if (state.num_series < STATS_MAX_SERIES) {
+                s = &state.series[state.num_series++];
+            } else {
+                s = &state.series[state.next];
+                state.next = (state.next + 1) % STATS_MAX_SERIES;
+                state.evicted++;
+            }
+
+            memset(s, 0, sizeof(*s));
+            s->hash = hash;
+            s->min = static_cast<float>(value);
+            s->max = static_cast<float>(value);
+        }
+
+        s->count++;
+        const double delta = value - s->mean;
+        s->mean += delta / s->count;
+        s->m2 += delta * (value - s->mean);
+
+        const float f = static_cast<float>(value);
+        if (f < s->min) {
+            s->min = f;
+        }
+        if (f > s->max) {
+            s->max = f;
+        }
+        s->last = f;
+        return true;
+    }
+
+    //! The statistics of a series, or nullptr if it has none.
+    const SeriesStat *SeriesStats::find(const char *name) const {
+        const uint32_t hash = series_hash(name);
+        for (size_t i = 0; i < state.num_series; i++) {
+            if (state.series[i].hash == hash) {
+                return &state.series[i];
+            }
+        }
+
+        return nullptr;
+    }
+
+    /**
+     * @brief True if the summaries should be sent this cycle.
+     *
+     * Once the clock is set they are sent on the UTC boundaries of the summary interval, like uplinks.
+     * Until then they are sent every interval_s / measure_s cycles.
+     *
+     * @param slot the UTC second of this measurement slot, or 0 if the clock is not set.
+     * @param interval_s the summary interval, 0 for no summaries.
+     * @param measure_s the measurement interval.
+     */
+    bool SeriesStats::summary_due(const int64_t slot, const uint32_t interval_s, const uint32_t measure_s) const {
+        if (interval_s == 0) {
+            return false;
+        }
+
+        if (slot > 0) {
+            return slot % interval_s == 0;
+        }
+
+        const uint32_t cycles = measure_s > 0 && interval_s > measure_s ? interval_s / measure_s : 1;
+        return state.cycles >= cycles;
+    }
+
+    //! Start the next summary, dropping the statistics of every series.
+    void SeriesStats::clear(void) {
+        state.cycles = 0;
+        state.num_series = 0;
+        state.next = 0;
+    }
+
+    SeriesMode *SeriesModes::find(const char *name, const size_t len) {
+        for (size_t i = 0; i < count; i++) {
+            if ( ! strncmp(modes[i].name, name, len) && modes[i].name[len] == 0) {
+                return &modes[i];
+            }
+        }
+
+        return nullptr;
+    }
+
+    /**
+     * @brief Set the mode of a series, given the first len characters of its name.
+     *
+     * @return false if the name is empty or too long, or there are already STATS_MAX_MODES series with a mode.
+     */
+    bool SeriesModes::set(const char *name, const size_t len, const stats_mode_t mode) {
+        if (name == nullptr || len == 0 || len > STATS_NAME_LEN || mode >= STATS_NUM_MODES) {
+            return false;
+        }
+
+        SeriesMode *m = find(name, len);
+        if (m == nullptr) {
+            if (count >= STATS_MAX_MODES) {
+                return false;
+            }
+
+            m = &modes[count++];
+            memcpy(m->name, name, len);
+            m->name[len] = 0;
+        }
+
+        m->mode = mode;
+        return true;
+    }
+
+    //! Remove the mode of a series so it uses the default, given the first len characters of its name.
+    bool SeriesModes::remove(const char *name, const size_t len) {
+        const SeriesMode *m = name == nullptr ? nullptr : find(name, len);
+        if (m == nullptr) {
+            return false;
+        }
+
+        const size_t i = m - modes;
+        memmove(&modes[i], &modes[i + 1], (count - i - 1) * sizeof(modes[0]));
+        count--;
+        return true;
+    }
+
+    //! The mode of a series, or default_mode if it does not have one.
+    stats_mode_t SeriesModes::get(const char *name, const stats_mode_t default_mode) const {
+        for (size_t i = 0; i < count; i++) {
+            if ( ! strcmp(modes[i].name, name)) {
+                return modes[i].mode;
+            }
+        }
+
+        return default_mode;
+    }
+}
@@ -0,0 +1,120 @@
+#ifndef SERIES_STATS_H
+#define SERIES_STATS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace wombat {
+    //! The most series whose statistics are kept between summaries.
+    static constexpr size_t STATS_MAX_SERIES = 32;
+    //! The most series with a mode other than the default.
+    static constexpr size_t STATS_MAX_MODES = 16;
+    //! The longest series name a mode can be set for.
+    static constexpr size_t STATS_NAME_LEN = 31;
+
+    //! What is uplinked for a series: each value, a summary of the values every summary interval, or both.
+    enum stats_mode_t : uint8_t {
+        STATS_RAW,
+        STATS_SUMMARY,
+        STATS_BOTH,
+        STATS_NUM_MODES
+    };
+
+    const char *stats_mode_name(stats_mode_t mode);
+    bool parse_stats_mode(const char *str, size_t len, stats_mode_t &mode);
+    //! True if each value of a series with the mode is uplinked.
+    inline bool stats_sends_raw(const stats_mode_t mode) { return mode != STATS_SUMMARY; }
+    //! True if summaries of a series with the mode are uplinked.
+    inline bool stats_sends_summary(const stats_mode_t mode) { return mode == STATS_SUMMARY || mode == STATS_BOTH; }
+
+    uint32_t series_hash(const char *name);
+    bool is_sdi12_series(const char *name);
+
+    //! The running statistics of a series, identified by the hash of its name.
+    struct SeriesStat {
+        uint32_t hash;
+        uint32_t count;
+        float min;
+        float max;
+        float last;
+        //! The mean and the sum of the squared differences from it, updated by Welford's algorithm.
+        double mean;
+        double m2;
+
+        //! The sample variance, 0 until there are two values.
+        double variance(void) const { return count > 1 ? m2 / (count - 1) : 0.0; }
+    };
+
+    /**
+     * @brief The statistics of each series since the last summary, kept across deep sleep. It is plain
+     * data so it can live in RTC memory, and SeriesStats::begin() resets it if it does not hold a valid
+     * state.
+     */
+    struct SeriesStatsState {
+        uint32_t magic;
+        //! The measurement cycles since the last summary.
+        uint32_t cycles;
+        uint16_t num_series;
+        //! The slot the next series replaces once every slot is in use.
+        uint16_t next;
+        //! The series whose statistics were dropped to make room for another.
+        uint32_t evicted;
+        SeriesStat series[STATS_MAX_SERIES];
+    };
+
+    /**
+     * @brief Keeps the count, minimum, maximum, mean, variance and last value of each series across
+     * measurement cycles, so a summary can be uplinked instead of every value.
+     *
+     * The series are kept in a ring of STATS_MAX_SERIES slots. When a new series arrives and every
+     * slot is in use, the slots are reused oldest first and the statistics they held are lost.
+     */
+    class SeriesStats {
+    public:
+        explicit SeriesStats(SeriesStatsState &state) : state(state) {}
+
+        void begin(void);
+
+        bool add(const char *name, double value);
+        const SeriesStat *find(const char *name) const;
+
+        //! Count a measurement cycle.
+        void next_cycle(void) { state.cycles++; }
+        bool summary_due(int64_t slot, uint32_t interval_s, uint32_t measure_s) const;
+        void clear(void);
+
+        size_t size(void) const { return state.num_series; }
+        const SeriesStat &at(const size_t i) const { return state.series[i]; }
+        uint32_t get_cycles(void) const { return state.cycles; }
+        uint32_t get_evicted(void) const { return state.evicted; }
+
+    private:
+        SeriesStatsState &state;
+    };
+
+    //! A series with a mode other than the default.
+    struct SeriesMode {
+        char name[STATS_NAME_LEN + 1];
+        stats_mode_t mode;
+    };
+
+    //! The series with a mode other than the default.
+    class SeriesModes {
+    public:
+        bool set(const char *name, size_t len, stats_mode_t mode);
+        bool remove(const char *name, size_t len);
+        stats_mode_t get(const char *name, stats_mode_t default_mode) const;
+        void clear(void) { count = 0; }
+
+        size_t size(void) const { return count; }
+        const SeriesMode &at(const size_t i) const { return modes[i]; }
+
+    private:
+        SeriesMode *find(const char *name, size_t len);
+
+        SeriesMode modes[STATS_MAX_MODES] = {};
+        size_t count = 0;
+    };
+}
+
+#endif //SERIES_STATS_H
@@ -0,0 +1,164 @@
+#include "sleep_clock.h"
+
+#include <cstring>
+
+//
+// This file is a project-local platformio library so it can be unit tested.
+//
+// Do not include anything other than standard C++ headers.
+//
+
+namespace wombat {
+    //! Identifies a valid state, changed whenever the layout of SleepClockState changes.
+    static constexpr uint32_t CLOCK_MAGIC = 0x57534331; // "WSC1"
+
+    static int64_t abs64(const int64_t x) {
+        return x < 0 ? -x : x;
+    }
+
+    //! The drift of error_us built up over sleep_us, in parts per billion, limited to MAX_DRIFT_PPB.
+    static double drift_of(const int64_t error_us, const uint64_t sleep_us) {
+        const double ppb = static_cast<double>(error_us) * 1e9 / static_cast<double>(sleep_us);
+        if (ppb > SleepClock::MAX_DRIFT_PPB) {
+            return SleepClock::MAX_DRIFT_PPB;
+        }
+
+        if (ppb < -SleepClock::MAX_DRIFT_PPB) {
+            return -SleepClock::MAX_DRIFT_PPB;
+        }
+
+        return ppb;
+    }
+
+    /**
+     * @brief Reset the state if it is not valid, or if the RTC slow clock source has changed since
+     * the drift was measured.
+     *
+     * On a cold boot the RTC memory holds garbage or zeros, after deep sleep it holds the state
+     * written by the previous wakes.
+     */
+    void SleepClock::begin(const uint8_t source) {
+        if (state.magic != CLOCK_MAGIC || state.source != source) {
+            memset(&state, 0, sizeof(state));
+            state.magic = CLOCK_MAGIC;
+            state.source = source;
+        }
+    }
+
+    /**
+     * @brief The correction to add to the clock now, for the drift expected since the last NTP sync.
+     *
+     * The correction is recorded so the next NTP sync measures only what the estimate missed.
+     */
+    int64_t SleepClock::correction(void) {
+        if ( ! state.has_sync) {
+            return 0;
+        }
+
+        const int64_t predicted = static_cast<int64_t>(static_cast<double>(state.sync_sleep_us) * get_drift_ppb() / 1e9);
+        const int64_t delta = predicted - state.sync_applied_us;
+        state.sync_applied_us = predicted;
+        return delta;
+    }
+
+    /**
+     * @brief Record an NTP sync.
+     *
+     * @param error_us the time from NTP less the local time, which the clock has been corrected by.
+     * @param now_us the time from NTP.
+     */
+    void SleepClock::synced(const int64_t error_us, const int64_t now_us) {
+        const int64_t total = state.sync_applied_us + error_us;
+
+        // The first sync after a power on sets the clock from 1970, and a clock that has been set by
+        // something else cannot be used either, so start again from this sync.
+        if ( ! state.has_sync || abs64(total) > static_cast<int64_t>(state.sync_sleep_us / 10) + 10000000) {
+            restart(now_us);
+            return;
+        }
+
+        state.window_sleep_us += state.sync_sleep_us;
+        state.window_error_us += total;
+        state.sync_sleep_us = 0;
+        state.sync_applied_us = 0;
+        state.last_sync_us = now_us;
+
+        if (state.window_sleep_us >= MIN_WINDOW_US) {
+            fold();
+        }
+    }
+
+    //! True if the clock must be set by NTP on this wake.
+    bool SleepClock::sync_due(const int64_t now_us) const {
+        return ! state.has_sync || ! is_trusted() || now_us - state.last_sync_us >= MAX_SKIP_US;
+    }
+
+    //! The local time to sleep for so that real_us passes.
+    uint64_t SleepClock::sleep_for(const uint64_t real_us) const {
+        return static_cast<uint64_t>(static_cast<double>(real_us) / (1.0 + get_drift_ppb() / 1e9));
+    }
+
+    //! Record a sleep that has ended, of local_us by the sleep clock.
+    void SleepClock::slept(const uint64_t local_us) {
+        state.sync_sleep_us += local_us;
+    }
+
+    /**
+     * @brief The drift of the sleep clock, in parts per billion, or 0 if it is not known yet.
+     *
+     * Before the first window is complete, the drift of that window is used once it has enough
+     * sleep for a rough estimate.
+     */
+    int32_t SleepClock::get_drift_ppb(void) const {
+        if (state.windows > 0) {
+            return state.drift_ppb;
+        }
+
+        if (state.window_sleep_us < MIN_PROVISIONAL_US) {
+            return 0;
+        }
+
+        return static_cast<int32_t>(drift_of(state.window_error_us, state.window_sleep_us));
+    }
+
+    bool SleepClock::is_trusted(void) const {
+        return state.windows >= MIN_WINDOWS && state.spread_ppb <= TRUSTED_PPB;
+    }
+
+    void SleepClock::restart(const int64_t now_us) {
+        state.has_sync = true;
+        state.last_sync_us = now_us;
+        state.sync_sleep_us = 0;
+        state.sync_applied_us = 0;
+        state.window_sleep_us = 0;
+        state.window_error_us = 0;
+    }
+
+    //! Add the drift of the current window to the estimate and start a new window.
+    void SleepClock::fold(void) {
+        const double ppb = drift_of(state.window_error_us, state.window_sleep_us);
+
+        // The NTP errors at the two ends of the window limit how well its drift is known.
+        const double uncertainty = 2.0 * SYNC_ERROR_US * 1e9 / static_cast<double>(state.window_sleep_us);
+
+        if (state.windows == 0) {
+            state.drift_ppb = static_cast<int32_t>(ppb);
+            state.spread_ppb = static_cast<uint32_t>(uncertainty);
+        } else {
+            double diff = ppb - state.drift_ppb;
+            diff = diff < 0 ? -diff : diff;
+            if (diff < uncertainty) {
+                diff = uncertainty;
+            }
+
+            // Recent windows count most, so the estimate follows slow changes such as the seasons.
+            const uint32_t weight = state.windows < 3 ? state.windows + 1 : 4;
+            state.drift_ppb += static_cast<int32_t>((ppb - state.drift_ppb) / weight);
+            state.spread_ppb = static_cast<uint32_t>((state.spread_ppb + diff) / 2);
+        }
+
+        state.windows++;
+        state.window_sleep_us = 0;
+        state.window_error_us = 0;
+    }
+}
@@ -0,0 +1,92 @@
+#ifndef SLEEP_CLOCK_H
+#define SLEEP_CLOCK_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace wombat {
+    /**
+     * @brief What the sleep clock keeps across deep sleep. It is plain data so it can live in RTC
+     * memory, and SleepClock::begin() resets it if it does not hold a valid state.
+     *
+     * Times are in microseconds. Local times are measured by the node's clock, which runs from the
+     * RTC slow clock during deep sleep, and errors are the true time less the local time.
+     */
+    struct SleepClockState {
+        uint32_t magic;
+        //! The RTC slow clock source the drift was measured with.
+        uint8_t source;
+        //! True once the clock has been set by NTP.
+        bool has_sync;
+        //! The number of measurement windows the drift estimate has been made from.
+        uint32_t windows;
+        //! The estimated drift of the sleep clock, in parts per billion. Positive if it runs slow.
+        int32_t drift_ppb;
+        //! How far apart the recent window estimates have been, in parts per billion.
+        uint32_t spread_ppb;
+        //! The time of the last NTP sync.
+        int64_t last_sync_us;
+        //! The local time slept since the last NTP sync.
+        uint64_t sync_sleep_us;
+        //! The corrections made from the drift estimate since the last NTP sync.
+        int64_t sync_applied_us;
+        //! The local time slept in the current window.
+        uint64_t window_sleep_us;
+        //! The error the sleep clock built up in the current window.
+        int64_t window_error_us;
+    };
+
+    /**
+     * @brief Estimates the drift of the clock used in deep sleep from the corrections made by NTP,
+     * and uses it to correct sleep durations and the time between NTP syncs.
+     *
+     * Only the time spent asleep is counted because the clock is only inaccurate then, while awake it
+     * runs from the main crystal. The errors of the syncs in a window of at least MIN_WINDOW_US of
+     * sleep are summed, so the error of each NTP query only counts at the ends of the window, and the
+     * drift of each window is averaged into the estimate.
+     *
+     * The estimate is trusted once it comes from MIN_WINDOWS windows that agree within TRUSTED_PPB.
+     * NTP is then only needed every MAX_SKIP_US, and the clock is corrected by the estimate on each
+     * wake in between.
+     */
+    class SleepClock {
+    public:
+        //! The error assumed for a time from NTP over the modem.
+        static constexpr int64_t SYNC_ERROR_US = 500000;
+        //! The least sleep a window must have before its drift is added to the estimate.
+        static constexpr uint64_t MIN_WINDOW_US = 12ULL * 3600 * 1000000;
+        //! The least sleep in the first window before its drift is used to correct sleeps.
+        static constexpr uint64_t MIN_PROVISIONAL_US = 3600ULL * 1000000;
+        //! The longest time between NTP syncs with a trusted estimate.
+        static constexpr int64_t MAX_SKIP_US = 24LL * 3600 * 1000000;
+        static constexpr uint32_t MIN_WINDOWS = 2;
+        static constexpr uint32_t TRUSTED_PPB = 50000;
+        //! The largest drift believed, the 150 kHz RC oscillator is within a few percent.
+        static constexpr int32_t MAX_DRIFT_PPB = 100000000;
+
+        explicit SleepClock(SleepClockState &state) : state(state) {}
+
+        void begin(uint8_t source);
+
+        int64_t correction(void);
+        void synced(int64_t error_us, int64_t now_us);
+        bool sync_due(int64_t now_us) const;
+
+        uint64_t sleep_for(uint64_t real_us) const;
+        void slept(uint64_t local_us);
+
+        int32_t get_drift_ppb(void) const;
+        //! True if the drift has been estimated, even roughly.
+        bool has_estimate(void) const { return state.windows > 0 || state.window_sleep_us >= MIN_PROVISIONAL_US; }
+        bool is_trusted(void) const;
+        uint32_t get_windows(void) const { return state.windows; }
+
+    private:
+        SleepClockState &state;
+
+        void restart(int64_t now_us);
+        void fold(void);
+    };
+}
+
+#endif //SLEEP_CLOCK_H
@@ -0,0 +1,50 @@
+#include "urc_ring.h"
+
+//
+// This file is a project-local platformio library so it can be unit tested.
+//
+// Do not include anything other than standard C++ headers.
+//
+
+namespace wombat {
+    /**
+     * @brief Add a URC, dropping the oldest URC if the ring is full.
+     *
+     * @return false if a URC was dropped.
+     */
+    bool UrcRing::push(const Urc &urc) {
+        bool ok = true;
+        if (count == CAPACITY) {
+            head = (head + 1) % CAPACITY;
+            count--;
+            dropped++;
+            ok = false;
+        }
+
+        at(count) = urc;
+        count++;
+        return ok;
+    }
+
+    /**
+     * @brief Remove the oldest URC for command.
+     *
+     * @return true if there was a URC for command, otherwise false and urc is unchanged.
+     */
+    bool UrcRing::take(const int command, Urc &urc) {
+        for (size_t i = 0; i < count; i++) {
+            if (at(i).command == command) {
+                urc = at(i);
+
+                // Close the gap, keeping the rest in order.
+                for (size_t j = i; j + 1 < count; j++) {
+                    at(j) = at(j + 1);
+                }
+                count--;
+                return true;
+            }
+        }
+
+        return false;
+    }
+}
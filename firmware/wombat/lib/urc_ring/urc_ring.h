@@ -0,0 +1,45 @@
+#ifndef URC_RING_H
+#define URC_RING_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace wombat {
+    //! The result of a modem command, reported by a URC such as +UUMQTTC or +UUFTPCR.
+    struct Urc {
+        int command = -1;
+        int result = -1;
+        int err1 = 0;
+        int err2 = 0;
+    };
+
+    /**
+     * @brief A fixed-capacity FIFO of command URCs waiting to be claimed by the code that sent the
+     * command.
+     *
+     * URCs are taken by command, oldest first, so a URC for one command does not hide a URC for
+     * another that arrived in the same poll. If the ring is full the oldest URC is dropped, these
+     * are URCs nothing waited for, such as a read URC after a retained message is cleared.
+     */
+    class UrcRing {
+    public:
+        static constexpr size_t CAPACITY = 16;
+
+        bool push(const Urc &urc);
+        bool take(int command, Urc &urc);
+        void clear(void) { count = 0; }
+
+        size_t size(void) const { return count; }
+        uint32_t get_dropped(void) const { return dropped; }
+
+    private:
+        Urc urcs[CAPACITY];
+        size_t head = 0;
+        size_t count = 0;
+        uint32_t dropped = 0;
+
+        Urc &at(size_t i) { return urcs[(head + i) % CAPACITY]; }
+    };
+}
+
+#endif //URC_RING_H
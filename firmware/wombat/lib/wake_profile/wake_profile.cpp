@@ -0,0 +1,157 @@
+#include "wake_profile.h"
+
+#include <cstring>
+
+//
+// This file is a project-local platformio library so it can be unit tested.
+//
+// Do not include anything other than standard C++ headers.
+//
+
+namespace wombat {
+    const char *const WAKE_PHASE_LABELS[] = {
+        "boot (ms)", "spiffs (ms)", "config (ms)", "modem (ms)", "registration (ms)", "ntp (ms)",
+        "sdi-12 (ms)", "msg write (ms)", "uplink (ms)", "shutdown (ms)"
+    };
+
+    static_assert(sizeof(WAKE_PHASE_LABELS) / sizeof(WAKE_PHASE_LABELS[0]) == WAKE_NUM_PHASES,
+                  "A wake phase is missing a label");
+
+    //! Identifies a valid profile, changed whenever the layout of WakeProfile changes.
+    static constexpr uint32_t PROFILE_MAGIC = 0x57504631; // "WPF1"
+
+    /**
+     * @brief Start timing a new wake, resetting the profile if it is not valid.
+     *
+     * On a cold boot the profile memory holds garbage or zeros, after deep sleep it holds the
+     * profile written by the previous wakes.
+     */
+    void WakeProfiler::begin(void) {
+        if (profile.magic != PROFILE_MAGIC) {
+            memset(&profile, 0, sizeof(profile));
+            profile.magic = PROFILE_MAGIC;
+        }
+
+        wake = WakeRecord();
+        running = 0;
+    }
+
+    void WakeProfiler::start(const wake_phase_t phase, const uint32_t now_ms) {
+        if (phase < WAKE_NUM_PHASES) {
+            started_at[phase] = now_ms;
+            running |= 1UL << phase;
+        }
+    }
+
+    /**
+     * @brief Stop timing a phase and add the time since start() to it. Does nothing if the phase
+     * was not started.
+     */
+    void WakeProfiler::stop(const wake_phase_t phase, const uint32_t now_ms) {
+        if (phase < WAKE_NUM_PHASES && (running & (1UL << phase))) {
+            running &= ~(1UL << phase);
+            add(phase, now_ms - started_at[phase]);
+        }
+    }
+
+    void WakeProfiler::add(const wake_phase_t phase, const uint32_t ms) {
+        if (phase < WAKE_NUM_PHASES) {
+            wake.phase_ms[phase] += ms;
+        }
+    }
+
+    /**
+     * @brief Note how long an SDI-12 sensor took to read, keeping the slowest.
+     */
+    void WakeProfiler::sensor(const char addr, const uint32_t ms) {
+        if (wake.slowest_sensor == 0 || ms > wake.slowest_sensor_ms) {
+            wake.slowest_sensor = addr;
+            wake.slowest_sensor_ms = ms;
+        }
+    }
+
+    /**
+     * @brief Record the wake in the profile. Phases still running are not included.
+     */
+    void WakeProfiler::finish(const uint32_t total_ms) {
+        wake.total_ms = total_ms;
+        running = 0;
+
+        profile.ring[profile.wakes % WAKE_RING_SIZE] = wake;
+        profile.wakes++;
+
+        for (size_t phase = 0; phase < WAKE_NUM_PHASES; phase++) {
+            if (wake.phase_ms[phase] > 0) {
+                count(phase, wake.phase_ms[phase]);
+            }
+        }
+        count(WAKE_HISTOGRAM_TOTAL, total_ms);
+    }
+
+    /**
+     * @brief Returns a completed wake from the ring, 0 being the most recent, or nullptr if there
+     * is no such wake.
+     */
+    const WakeRecord *WakeProfiler::record(const size_t i) const {
+        if (i >= num_records()) {
+            return nullptr;
+        }
+
+        return &profile.ring[(profile.wakes - 1 - i) % WAKE_RING_SIZE];
+    }
+
+    /**
+     * @brief The duration below which a bucket's times fall, in milliseconds. The last bucket has
+     * no limit and returns UINT32_MAX.
+     */
+    uint32_t WakeProfiler::bucket_limit(const size_t bucket) {
+        return bucket + 1 < WAKE_HISTOGRAM_BUCKETS ? 64UL << bucket : UINT32_MAX;
+    }
+
+    /**
+     * @brief Estimate a percentile of a histogram row as the limit of the bucket it falls in.
+     *
+     * @return the estimate in milliseconds, or 0 if the row is empty.
+     */
+    uint32_t WakeProfiler::percentile(const size_t row, const unsigned pct) const {
+        if (row > WAKE_HISTOGRAM_TOTAL) {
+            return 0;
+        }
+
+        const uint16_t *counts = profile.histogram[row];
+        uint32_t n = 0;
+        for (size_t i = 0; i < WAKE_HISTOGRAM_BUCKETS; i++) {
+            n += counts[i];
+        }
+
+        if (n == 0) {
+            return 0;
+        }
+
+        const uint32_t target = (n * pct + 99) / 100;
+        uint32_t sum = 0;
+        for (size_t i = 0; i < WAKE_HISTOGRAM_BUCKETS; i++) {
+            sum += counts[i];
+            if (sum >= target && sum > 0) {
+                return bucket_limit(i);
+            }
+        }
+
+        return UINT32_MAX;
+    }
+
+    void WakeProfiler::count(const size_t row, const uint32_t ms) {
+        size_t bucket = 0;
+        while (bucket + 1 < WAKE_HISTOGRAM_BUCKETS && ms >= bucket_limit(bucket)) {
+            bucket++;
+        }
+
+        uint16_t *counts = profile.histogram[row];
+        if (counts[bucket] == UINT16_MAX) {
+            for (size_t i = 0; i < WAKE_HISTOGRAM_BUCKETS; i++) {
+                counts[i] /= 2;
+            }
+        }
+        counts[bucket]++;
+    }
+}
@@ -0,0 +1,96 @@
+#ifndef WAKE_PROFILE_H
+#define WAKE_PROFILE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace wombat {
+    //! The timed phases of a wake cycle. Only ever append to this list, it is uplinked by index.
+    enum wake_phase_t : uint8_t {
+        WAKE_PHASE_BOOT,
+        WAKE_PHASE_SPIFFS,
+        WAKE_PHASE_CONFIG,
+        WAKE_PHASE_MODEM,
+        WAKE_PHASE_REGISTRATION,
+        WAKE_PHASE_NTP,
+        WAKE_PHASE_SDI12,
+        WAKE_PHASE_MSG_WRITE,
+        WAKE_PHASE_UPLINK,
+        WAKE_PHASE_SHUTDOWN,
+        WAKE_NUM_PHASES
+    };
+
+    //! The timeseries names of the phases in the uplink summary, in wake_phase_t order.
+    extern const char *const WAKE_PHASE_LABELS[];
+
+    //! The number of wakes kept in the ring of recent wakes.
+    static constexpr size_t WAKE_RING_SIZE = 8;
+    //! Histogram bucket i counts durations below 64 ms << i, the last bucket counts everything longer.
+    static constexpr size_t WAKE_HISTOGRAM_BUCKETS = 16;
+    //! The histogram row for the total wake time, after the phase rows.
+    static constexpr size_t WAKE_HISTOGRAM_TOTAL = WAKE_NUM_PHASES;
+
+    //! The phase durations of one wake, in milliseconds.
+    struct WakeRecord {
+        uint32_t total_ms;
+        uint32_t phase_ms[WAKE_NUM_PHASES];
+        //! The SDI-12 sensor that took longest to read, or 0 if none were read.
+        char slowest_sensor;
+        uint32_t slowest_sensor_ms;
+    };
+
+    /**
+     * @brief The profile data kept across deep sleep. It is plain data so it can live in RTC memory,
+     * and WakeProfiler::begin() resets it if it does not hold a valid profile.
+     */
+    struct WakeProfile {
+        uint32_t magic;
+        //! The number of wakes recorded since the profile was reset.
+        uint32_t wakes;
+        WakeRecord ring[WAKE_RING_SIZE];
+        //! One row per phase and one for the total wake time.
+        uint16_t histogram[WAKE_NUM_PHASES + 1][WAKE_HISTOGRAM_BUCKETS];
+    };
+
+    /**
+     * @brief Times the phases of a wake cycle and records them in a WakeProfile.
+     *
+     * Phases are timed with start() and stop() and may run more than once in a wake, in which case
+     * the times are added. finish() copies the wake into the ring of recent wakes and adds each
+     * phase to its histogram. A histogram row is halved when a count would overflow, so it weights
+     * recent wakes more heavily than very old ones.
+     */
+    class WakeProfiler {
+    public:
+        explicit WakeProfiler(WakeProfile &profile) : profile(profile) {}
+
+        void begin(void);
+
+        void start(wake_phase_t phase, uint32_t now_ms);
+        void stop(wake_phase_t phase, uint32_t now_ms);
+        void add(wake_phase_t phase, uint32_t ms);
+        void sensor(char addr, uint32_t ms);
+
+        void finish(uint32_t total_ms);
+
+        //! The wake being timed.
+        const WakeRecord &current(void) const { return wake; }
+        //! The number of completed wakes in the ring.
+        size_t num_records(void) const { return profile.wakes < WAKE_RING_SIZE ? profile.wakes : WAKE_RING_SIZE; }
+        const WakeRecord *record(size_t i) const;
+        uint32_t get_wakes(void) const { return profile.wakes; }
+
+        uint32_t percentile(size_t row, unsigned pct) const;
+        static uint32_t bucket_limit(size_t bucket);
+
+    private:
+        WakeProfile &profile;
+        WakeRecord wake = {};
+        uint32_t started_at[WAKE_NUM_PHASES] = {};
+        uint32_t running = 0;
+
+        void count(size_t row, uint32_t ms);
+    };
+}
+
+#endif //WAKE_PROFILE_H
@@ -0,0 +1,88 @@
+#include "wake_schedule.h"
+
+#include <cstring>
+
+//
+// This file is a project-local platformio library so it can be unit tested.
+//
+// Do not include anything other than standard C++ headers.
+//
+
+namespace wombat {
+    //! Identifies a valid state, changed whenever the layout of WakeScheduleState changes.
+    static constexpr uint32_t SCHEDULE_MAGIC = 0x57534431; // "WSD1"
+
+    //! The slots missed between the expected slot and the slot that came, if they are on the same boundaries.
+    static uint32_t slots_between(const int64_t expected, const int64_t actual, const uint32_t interval_s) {
+        if (expected <= 0 || actual <= expected || expected % interval_s != 0) {
+            return 0;
+        }
+
+        return static_cast<uint32_t>((actual - expected) / interval_s);
+    }
+
+    /**
+     * @brief Reset the state if it is not valid.
+     *
+     * On a cold boot the RTC memory holds garbage or zeros, after deep sleep it holds the state
+     * written by the previous wake.
+     */
+    void WakeSchedule::begin(void) {
+        if (state.magic != SCHEDULE_MAGIC) {
+            memset(&state, 0, sizeof(state));
+            state.magic = SCHEDULE_MAGIC;
+        }
+
+        slot = 0;
+        missed_before = 0;
+    }
+
+    /**
+     * @brief Find the slot of a wake starting at now_us, and count any slots missed before it.
+     *
+     * @return the slot, in seconds since 1970, or 0 if the clock has not been set.
+     */
+    int64_t WakeSchedule::wake(const int64_t now_us, const uint32_t interval_s) {
+        const int64_t now_s = now_us / 1000000;
+        if (interval_s == 0 || now_s < VALID_TIME_S) {
+            slot = 0;
+            return slot;
+        }
+
+        // The nearest boundary, so a wake that starts a little early is for the boundary it was aiming at.
+        slot = (now_us + static_cast<int64_t>(interval_s) * 500000) / (static_cast<int64_t>(interval_s) * 1000000) * interval_s;
+
+        missed_before = slots_between(state.expected_slot, slot, interval_s);
+        state.missed += missed_before;
+        state.expected_slot = 0;
+        return slot;
+    }
+
+    /**
+     * @brief Choose the next wake and return how long to sleep until it.
+     *
+     * If the clock has not been set the node sleeps for one interval.
+     *
+     * @return the time to sleep, in microseconds of true time.
+     */
+    uint64_t WakeSchedule::next(const int64_t now_us, const uint32_t interval_s) {
+        const int64_t now_s = now_us / 1000000;
+        if (interval_s == 0 || now_s < VALID_TIME_S) {
+            state.expected_slot = 0;
+            return static_cast<uint64_t>(interval_s) * 1000000;
+        }
+
+        const int64_t interval_us = static_cast<int64_t>(interval_s) * 1000000;
+        const int64_t earliest_us = now_us + static_cast<int64_t>(MIN_SLEEP_US);
+        int64_t target = (earliest_us / interval_us + 1) * static_cast<int64_t>(interval_s);
+        if (target <= slot) {
+            target = slot + interval_s;
+        }
+
+        // Slots skipped because this wake ran over are counted by the next wake, so they are reported
+        // with the next measurement. A wake that did not know its slot, such as the first after a
+        // power on, starts the count at the next wake.
+        state.expected_slot = slot > 0 ? slot + interval_s : target;
+        return static_cast<uint64_t>(target * 1000000 - now_us);
+    }
+}
@@ -0,0 +1,62 @@
+#ifndef WAKE_SCHEDULE_H
+#define WAKE_SCHEDULE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace wombat {
+    /**
+     * @brief What the wake schedule keeps across deep sleep. It is plain data so it can live in RTC
+     * memory, and WakeSchedule::begin() resets it if it does not hold a valid state.
+     */
+    struct WakeScheduleState {
+        uint32_t magic;
+        //! The slot after the last wake's slot, in seconds since 1970, or 0 if not known.
+        int64_t expected_slot;
+        //! The slots missed since the schedule was reset.
+        uint32_t missed;
+    };
+
+    /**
+     * @brief Schedules wakes on the UTC boundaries of the measurement interval, so every node
+     * measures at the same times, for example on the hour and at 15, 30 and 45 minutes past.
+     *
+     * A wake is for the boundary nearest the time it starts, which allows for waking a little early
+     * or late. The next wake is the first boundary after this one that leaves at least MIN_SLEEP_US
+     * to sleep. Boundaries passed while a wake ran over, or while the node was not running, are
+     * counted as missed by the next wake.
+     *
+     * Times before 2020 are taken to mean the clock has not been set since a power on, and wakes
+     * then are not counted as slots.
+     */
+    class WakeSchedule {
+    public:
+        //! The shortest sleep scheduled, in microseconds.
+        static constexpr uint64_t MIN_SLEEP_US = 2000000;
+        //! 2020-01-01T00:00:00Z, anything earlier is not a real time.
+        static constexpr int64_t VALID_TIME_S = 1577836800;
+
+        explicit WakeSchedule(WakeScheduleState &state) : state(state) {}
+
+        void begin(void);
+
+        int64_t wake(int64_t now_us, uint32_t interval_s);
+        uint64_t next(int64_t now_us, uint32_t interval_s);
+
+        //! The slot of this wake, in seconds since 1970, or 0 if the clock was not set.
+        int64_t get_slot(void) const { return slot; }
+        //! True if this wake's slot is on a boundary of the given interval.
+        bool is_slot_on(uint32_t interval_s) const { return slot > 0 && interval_s > 0 && slot % interval_s == 0; }
+        //! The slots missed just before this wake.
+        uint32_t get_missed_before(void) const { return missed_before; }
+        //! The slots missed since the schedule was reset.
+        uint32_t get_missed(void) const { return state.missed; }
+
+    private:
+        WakeScheduleState &state;
+        int64_t slot = 0;
+        uint32_t missed_before = 0;
+    };
+}
+
+#endif //WAKE_SCHEDULE_H
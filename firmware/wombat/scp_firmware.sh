@@ -14,6 +14,9 @@ fi
 ./split_firmware.sh
 scp .pio/build/wombat/firmware.bin $SSH_HOST:$DEST_DIR/wombat.bin
 scp .pio/build/wombat/wombat.sha1 $SSH_HOST:$DEST_DIR
+if ls .pio/build/wombat/wombat-*.patch >/dev/null 2>&1; then
+    scp .pio/build/wombat/wombat-*.patch $SSH_HOST:$DEST_DIR
+fi
 scp data/sdi12defn.json $SSH_HOST:$DEST_DIR
 ssh $SSH_HOST ls -l $DEST_DIR
 ssh $SSH_HOST cat $DEST_DIR/wombat.sha1
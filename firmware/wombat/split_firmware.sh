@@ -11,7 +11,18 @@ VERSION=$(fgrep '_VERSION_NUM =' ../../../gen_version_h.py | cut -d= -f2 | tr -d
 LENGTH=$(ls -l firmware.bin | cut -w -f5)
 FILE_SHA1=$(shasum -a 1 -b firmware.bin | cut -w -f1)
 COMMIT_HASH=$(git show --format=%H | head -1)
-echo $VERSION $LENGTH $FILE_SHA1 $COMMIT_HASH >wombat.sha1
+
+# If OLD_FIRMWARE is the image of an earlier release and OLD_VERSION its version, also make a
+# delta patch from it so nodes running that release download only what has changed.
+PATCHES=""
+rm -f wombat-*.patch
+if [ -n "${OLD_FIRMWARE:-}" ] && [ -n "${OLD_VERSION:-}" ]; then
+    ../../../tools/make_ota_patch.py "$OLD_FIRMWARE" firmware.bin wombat-$OLD_VERSION.patch
+    PATCH_LENGTH=$(ls -l wombat-$OLD_VERSION.patch | cut -w -f5)
+    PATCHES=" $OLD_VERSION:$PATCH_LENGTH"
+fi
+
+echo $VERSION $LENGTH $FILE_SHA1 $COMMIT_HASH$PATCHES >wombat.sha1
 
 #rm wombat.tgz
 #tar zcf wombat.tgz wombat.*
@@ -3,10 +3,15 @@
 #include "Utils.h"
 #include "globals.h"
 
+#include <esp_attr.h>
+
 #define TAG "CAT_M1"
 
 CAT_M1 cat_m1;
 
+//! Set when a wake leaves the modem powered and registered in PSM for the next wake.
+static RTC_DATA_ATTR bool psm_kept = false;
+
 void CAT_M1::begin(TCA9534& io_ex){
 
     // Setup TCA9534
@@ -16,8 +21,15 @@ void CAT_M1::begin(TCA9534& io_ex){
     io_expander->config(ARDUINO_TO_IO(LTE_VCC), TCA9534::Config::OUT);
     io_expander->config(ARDUINO_TO_IO(LTE_PWR_ON), TCA9534::Config::OUT);
 
-    // Switches off VCC
-    power_supply(false);
+    // The IO expander holds VCC on through deep sleep, so a modem left in PSM is still registered.
+    kept = psm_kept;
+    if (kept) {
+        ESP_LOGI(TAG, "Modem was left in PSM");
+        power_on = true;
+    } else {
+        // Switches off VCC
+        power_supply(false);
+    }
 
     // Turns Q4 off, allowing PWR_ON to be controlled by the R5 internal pull-up.
     digitalWrite(LTE_PWR_ON, LOW);
@@ -27,6 +39,10 @@ void CAT_M1::power_supply(bool state) {
     ESP_LOGI(TAG, "state = %d", state);
     digitalWrite(LTE_VCC, state ? HIGH : LOW);
     power_on = state;
+    if ( ! state) {
+        kept = false;
+        psm_kept = false;
+    }
     delay(10); // May not be needed
 }
 
@@ -79,6 +95,14 @@ void CAT_M1::interface(){
     }
 }
 
+/**
+ * @brief Leave the modem powered when the ESP32 sleeps, so it stays registered in PSM and the
+ * next wake does not have to power it on and register again.
+ */
+void CAT_M1::keep_in_psm(void) {
+    psm_kept = true;
+}
+
 bool CAT_M1::make_ready() {
     static bool already_called = false;
 
@@ -87,15 +111,25 @@ bool CAT_M1::make_ready() {
         return true;
     }
 
+    used = true;
     if ( ! is_powered()) {
         ESP_LOGI(TAG, "Enabling R5 VCC");
         power_supply(true);
     }
 
+    // A modem in PSM deep sleep is woken by a pulse on PWR_ON, the same as powering it on. The pulse
+    // is too short to turn off a modem that is already awake.
+    if (kept) {
+        ESP_LOGI(TAG, "Waking modem from PSM");
+        device_on();
+    }
+
     ESP_LOGI(TAG, "Looking for response to AT command");
     if ( ! wait_for_at()) {
         already_called = false;
         restart();
+        // A restarted modem has to register again.
+        kept = false;
         if ( ! wait_for_at()) {
             ESP_LOGE(TAG, "Cannot talk to SARA R5");
             return false;
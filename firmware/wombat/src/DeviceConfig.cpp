@@ -8,12 +8,15 @@
 #include "DeviceConfig.h"
 
 #include <SPIFFS.h>
+#include <crc32.h>
 
 #include "Utils.h"
 #include "cli/FreeRTOS_CLI.h"
 #include "cli/device_config/acquisition_intervals.h"
 #include "cli/device_config/mqtt_cli.h"
 #include "cli/device_config/ftp_cli.h"
+#include "cli/peripherals/cat-m1.h"
+#include "cli/device_config/stats_cli.h"
 #include "globals.h"
 
 //! ESP32 debug output tag
@@ -32,8 +35,10 @@ static char rsp[BUF_SIZE+1];
 //! Counter on the number of times the ESP32 has been re-booted
 static RTC_DATA_ATTR uint32_t bootCount = 0;
 
-//! JSON document instance to handle SDI-12 device definitions
-JsonDocument sdi12Defns;
+//! The binary SDI-12 sensor definitions table, read from sdi12defn_bin_spiffs.
+static std::vector<uint8_t> sdi12defn_bin;
+//! Lookups into sdi12defn_bin.
+static wombat::SensorDefnTable sdi12Defns;
 
 /**
  * @brief Device configuration constructor with default values.
@@ -61,6 +66,17 @@ mqttHost(), mqttUser(), mqttPassword() {
  * @see mqttPort
  * @see mqttUser
  * @see mqttPassword
+ * @see msgFormat
+ * @see msgBatching
+ * @see mqttWindow
+ * @see ftpCompression
+ * @see modemPsm
+ * @see psmPeriodic
+ * @see psmActive
+ * @see modemEdrx
+ * @see statsInterval
+ * @see statsMode
+ * @see seriesModes
  */
 void DeviceConfig::reset() {
     ESP_LOGI(TAG, "Resetting values to defaults");
@@ -75,6 +91,17 @@ void DeviceConfig::reset() {
     mqttPort = 1833;
     mqttUser.clear();
     mqttPassword.clear();
+    msgFormat = MSG_FORMAT_JSON;
+    msgBatching = false;
+    mqttWindow = 4;
+    ftpCompression = false;
+    modemPsm = false;
+    psmPeriodic = 14400;
+    psmActive = 10;
+    modemEdrx = 0;
+    statsInterval = 0;
+    statsMode = wombat::STATS_RAW;
+    seriesModes.clear();
 }
 
 /**
@@ -86,8 +113,7 @@ void DeviceConfig::reset() {
  *
  * @see reset
  * @see config_filename
- * @see sdi12defn_spiffs
- * @see sdi12Defns
+ * @see loadSDI12Defns
  */
 void DeviceConfig::load() {
     // Ensure any settings not present in the config file have the default value.
@@ -122,22 +148,7 @@ void DeviceConfig::load() {
             ESP_LOGE(TAG, "File not found: %s", config_filename);
         }
 
-        if (SPIFFS.exists(sdi12defn_spiffs)) {
-            File f = SPIFFS.open(sdi12defn_spiffs, FILE_READ);
-            while (f.available() > 0) {
-                DeserializationError err = deserializeJson(sdi12Defns, f);
-                f.close();
-                if (err) {
-                    ESP_LOGE(TAG, "Failed to load SDI-12 sensor definitions: %s", err.f_str());
-                } else {
-//                    std::string str;
-//                    serializeJsonPretty(sdi12Defns, str);
-//                    ESP_LOGI(TAG, "SDI-12 sensor definitions:\r\n%s\r\n", str.c_str());
-                }
-            }
-        } else {
-            ESP_LOGE(TAG, "File not found: %s", sdi12defn_spiffs);
-        }
+        loadSDI12Defns();
     } else {
         ESP_LOGE(TAG, "Failed to initialise SPIFFS");
     }
@@ -165,6 +176,8 @@ void DeviceConfig::dumpConfig(Stream& stream) {
     CLIConfigIntervals::dump(stream);
     CLIMQTT::dump(stream);
     CLIFTP::dump(stream);
+    CLICatM1::dump(stream);
+    CLIStats::dump(stream);
 }
 
 /**
@@ -222,8 +235,152 @@ void DeviceConfig::setMeasurementAndUplinkIntervals(const uint16_t measurement_s
 }
 
 /**
- * @brief Get the SDI-12 device definitions from SPIFFS storage.
+ * @brief Calculate the CRC-32 of the SDI-12 sensor definitions JSON file, a piece at a time.
+ */
+static uint32_t sdi12defn_crc(void) {
+    uint8_t chunk[256];
+    uint32_t crc = 0;
+    File f = SPIFFS.open(sdi12defn_spiffs, FILE_READ);
+    size_t len;
+    while ((len = f.read(chunk, sizeof(chunk))) > 0) {
+        crc = wombat::crc32(chunk, len, crc);
+    }
+    f.close();
+
+    return crc;
+}
+
+/**
+ * @brief Parse the SDI-12 sensor definitions JSON file and write the binary table.
+ *
+ * @param json_size the size of the JSON file, recorded in the table so a changed file is detected.
+ * @return true if the binary table was written to sdi12defn_bin.
+ */
+static bool build_sdi12defn_bin(const size_t json_size) {
+    const uint32_t json_crc = sdi12defn_crc();
+    const uint32_t heap_before = ESP.getFreeHeap();
+    const unsigned long start = micros();
+
+    JsonDocument doc;
+    File f = SPIFFS.open(sdi12defn_spiffs, FILE_READ);
+    DeserializationError err = deserializeJson(doc, f);
+    f.close();
+    if (err) {
+        ESP_LOGE(TAG, "Failed to load SDI-12 sensor definitions: %s", err.f_str());
+        return false;
+    }
+
+    const unsigned long parse_us = micros() - start;
+    const uint32_t heap_used = heap_before - ESP.getFreeHeap();
+
+    wombat::SensorDefnTableBuilder builder;
+    std::vector<const char *> read_cmds;
+    std::vector<const char *> labels;
+    for (JsonPairConst vendor : doc.as<JsonObjectConst>()) {
+        for (JsonPairConst model : vendor.value().as<JsonObjectConst>()) {
+            JsonObjectConst defn = model.value();
+            read_cmds.clear();
+            for (JsonVariantConst cmd : defn["read_cmds"].as<JsonArrayConst>()) {
+                read_cmds.push_back(cmd.as<const char *>());
+            }
+
+            labels.clear();
+            for (JsonVariantConst label : defn["labels"].as<JsonArrayConst>()) {
+                labels.push_back(label.as<const char *>());
+            }
+
+            if ( ! builder.add(vendor.key().c_str(), model.key().c_str(), read_cmds, defn["value_mask"], labels, defn["ignore_sr"])) {
+                ESP_LOGW(TAG, "Skipping SDI-12 sensor definition %s %s", vendor.key().c_str(), model.key().c_str());
+            }
+        }
+    }
+
+    if ( ! builder.build(json_size, json_crc, sdi12defn_bin)) {
+        ESP_LOGE(TAG, "SDI-12 sensor definitions too large for binary table");
+        sdi12defn_bin.clear();
+        return false;
+    }
+
+    log_to_sdcardf("SDI-12 definitions: parsed %u byte JSON in %lu us using %u bytes heap, built %u byte table",
+                   json_size, parse_us, heap_used, sdi12defn_bin.size());
+
+    f = SPIFFS.open(sdi12defn_bin_spiffs, FILE_WRITE);
+    if (f) {
+        f.write(sdi12defn_bin.data(), sdi12defn_bin.size());
+        f.close();
+    } else {
+        ESP_LOGE(TAG, "Could not write %s", sdi12defn_bin_spiffs);
+    }
+
+    return true;
+}
+
+/**
+ * @brief Load the SDI-12 sensor definitions.
+ *
+ * Parsing the JSON definitions file on every wake is slow and needs a lot of heap for the
+ * JSON document, so the definitions are converted to a compact binary table the first time
+ * they are loaded after the JSON file changes. Subsequent wakes read the table straight
+ * into memory, and lookups by vendor and model are hash table lookups.
+ *
+ * Everything that writes the JSON file removes the table, so it is rebuilt on the next wake.
+ * The table also records the size of the JSON file it was built from and is rebuilt if that
+ * no longer matches. The JSON file is not read on wakes that load the table.
+ *
+ * @return true if the definitions were loaded.
+ */
+bool DeviceConfig::loadSDI12Defns(void) {
+    sdi12Defns.clear();
+    sdi12defn_bin.clear();
+
+    if ( ! spiffs_ok) {
+        return false;
+    }
+
+    if ( ! SPIFFS.exists(sdi12defn_spiffs)) {
+        ESP_LOGE(TAG, "File not found: %s", sdi12defn_spiffs);
+        return false;
+    }
+
+    File f = SPIFFS.open(sdi12defn_spiffs, FILE_READ);
+    const size_t json_size = f.size();
+    f.close();
+
+    if (SPIFFS.exists(sdi12defn_bin_spiffs)) {
+        const uint32_t heap_before = ESP.getFreeHeap();
+        const unsigned long start = micros();
+
+        f = SPIFFS.open(sdi12defn_bin_spiffs, FILE_READ);
+        sdi12defn_bin.resize(f.size());
+        const size_t bytes_read = f.read(sdi12defn_bin.data(), sdi12defn_bin.size());
+        f.close();
+
+        if (bytes_read == sdi12defn_bin.size() && sdi12Defns.load(sdi12defn_bin.data(), sdi12defn_bin.size())) {
+            if (sdi12Defns.get_source_size() == json_size) {
+                log_to_sdcardf("SDI-12 definitions: loaded %u byte table in %lu us using %u bytes heap",
+                               sdi12defn_bin.size(), micros() - start, heap_before - ESP.getFreeHeap());
+                return true;
+            }
+
+            ESP_LOGI(TAG, "%s has changed, rebuilding %s", sdi12defn_spiffs, sdi12defn_bin_spiffs);
+        } else {
+            ESP_LOGW(TAG, "Invalid %s, rebuilding", sdi12defn_bin_spiffs);
+        }
+
+        sdi12Defns.clear();
+        sdi12defn_bin.clear();
+    }
+
+    if ( ! build_sdi12defn_bin(json_size)) {
+        return false;
+    }
+
+    return sdi12Defns.load(sdi12defn_bin.data(), sdi12defn_bin.size());
+}
+
+/**
+ * @brief Get the SDI-12 device definitions loaded from SPIFFS storage.
  *
- * @return SDI-12 device definitions as a JSONDocument.
+ * @return SDI-12 device definitions as a binary table.
  */
-const JsonDocument& DeviceConfig::getSDI12Defns(void) { return sdi12Defns; }
+const wombat::SensorDefnTable& DeviceConfig::getSDI12Defns(void) { return sdi12Defns; }
@@ -4,6 +4,13 @@
 #include "Utils.h"
 #include "globals.h"
 #include "ulp.h"
+#include "msg_outbox.h"
+#include "profiler.h"
+#include "clock_sync.h"
+#include "energy.h"
+#include "modem_power.h"
+#include "registration.h"
+#include "aggregation.h"
 #include "sd-card/interface.h"
 #include "power_monitoring/battery.h"
 #include "power_monitoring/solar.h"
@@ -12,7 +19,10 @@
 #include <freertos/FreeRTOS.h>
 
 #include <dpiclimate-12.h>
-#include <SPIFFS.h>
+#include <crc32.h>
+#include <msg_cbor.h>
+#include <sdi12_sched.h>
+#include <Preferences.h>
 
 #define TAG "sensors"
 
@@ -25,11 +35,194 @@ DPIClimate12 dpi12(sdi12);
 sensor_list sensors;
 
 ///
-/// \brief Scans the SDI-12 bus and fills in the sensors object.
+/// \brief Runs SDI-12 commands for the concurrent scheduler using the EnviroDIY SDI12 object.
+///
+class EnviroDIYBus : public wombat::SDI12Bus {
+public:
+    size_t transact(const char *cmd, char *rsp, const size_t rsp_max) override {
+        sdi12.clearBuffer();
+        sdi12.sendCommand(cmd);
+
+        size_t len = 0;
+        int ch = -1;
+        if (waitForChar(sdi12, 750) != -1) {
+            while (ch != '\n' && len < rsp_max - 1) {
+                while (sdi12.available() && len < rsp_max - 1) {
+                    ch = sdi12.read();
+                    if (ch == '\n') {
+                        break;
+                    }
+
+                    if (ch >= ' ') {
+                        rsp[len++] = static_cast<char>(ch);
+                    }
+                }
+
+                if (ch != '\n' && waitForChar(sdi12, 50) < 0) {
+                    break;
+                }
+            }
+        }
+
+        rsp[len] = 0;
+        ESP_LOGI(TAG, "%s -> [%s]", cmd, rsp);
+        return len;
+    }
+
+    uint32_t now_ms() override { return millis(); }
+    void wait_ms(const uint32_t ms) override { delay(ms); }
+};
+
+//! A full bus scan is done after this many wakes even if every known sensor still responds.
+static constexpr uint32_t FULL_SCAN_INTERVAL = 96;
+
+//! NVS namespace for the SDI-12 bus scan, used to restore the sensor list after a power loss.
+static constexpr const char* SCAN_NVS_NAMESPACE = "sdi12";
+//! NVS key for the SDI-12 bus scan.
+static constexpr const char* SCAN_NVS_KEY = "scan";
+
+//! The value of bus_scan.magic when the RTC memory holds a valid bus scan.
+static constexpr uint32_t SCAN_MAGIC = 0x53444931;
+
+/// The result of the last full SDI-12 bus scan, kept across deep sleep.
+struct bus_scan {
+    uint32_t magic;
+    //! CRC-32 of the sensor list, so an RTC memory or NVS copy can be checked.
+    uint32_t crc;
+    //! How long the last full scan took, used to report the time saved by not scanning.
+    uint32_t scan_ms;
+    //! How many wakes have used this scan since it was done.
+    uint32_t wakes_since_scan;
+    sensor_list list;
+};
+
+static RTC_DATA_ATTR bus_scan cached_scan;
+
+static bool scan_valid(const bus_scan& scan) {
+    return scan.magic == SCAN_MAGIC && scan.crc == wombat::crc32(&scan.list, sizeof(scan.list));
+}
+
+/// \brief Restore the last bus scan from NVS, for when RTC memory has been lost due to a power cycle.
+static bool load_scan_from_nvs(void) {
+    Preferences prefs;
+    if ( ! prefs.begin(SCAN_NVS_NAMESPACE, true)) {
+        return false;
+    }
+
+    bus_scan scan;
+    const size_t len = prefs.getBytes(SCAN_NVS_KEY, &scan, sizeof(scan));
+    prefs.end();
+
+    if (len != sizeof(scan) || ! scan_valid(scan)) {
+        return false;
+    }
+
+    cached_scan = scan;
+    cached_scan.wakes_since_scan = 0;
+    return true;
+}
+
+/// \brief Save the bus scan to NVS. This is only done when the set of sensors changes to limit flash wear.
+static void save_scan_to_nvs(void) {
+    Preferences prefs;
+    if ( ! prefs.begin(SCAN_NVS_NAMESPACE, false)) {
+        ESP_LOGE(TAG, "Could not open NVS namespace %s", SCAN_NVS_NAMESPACE);
+        return;
+    }
+
+    prefs.putBytes(SCAN_NVS_KEY, &cached_scan, sizeof(cached_scan));
+    prefs.end();
+}
+
+///
+/// \brief Scan the whole SDI-12 bus, fill in the sensors object and remember the result across deep sleep.
+///
+/// The SDI-12 bus must have been started by the caller.
+///
+void scan_sensors(void) {
+    const unsigned long start = millis();
+    dpi12.scan_bus(sensors);
+    const unsigned long scan_ms = millis() - start;
+
+    const bool changed = ! scan_valid(cached_scan) || memcmp(&cached_scan.list, &sensors, sizeof(sensors)) != 0;
+
+    cached_scan.magic = SCAN_MAGIC;
+    cached_scan.list = sensors;
+    cached_scan.crc = wombat::crc32(&cached_scan.list, sizeof(cached_scan.list));
+    cached_scan.scan_ms = scan_ms;
+    cached_scan.wakes_since_scan = 0;
+
+    if (changed) {
+        save_scan_to_nvs();
+    }
+
+    log_to_sdcardf("Full SDI-12 bus scan took %lu ms", scan_ms);
+}
+
+///
+/// \brief Check each sensor from the last bus scan is still present by sending it an identify command.
+///
+/// \return true if every known sensor responded with the same identification as when the bus was scanned.
+///
+static bool verify_cached_sensors(void) {
+    EnviroDIYBus bus;
+    char cmd[] = "aI!";
+    char rsp[sizeof(sensor_info) + 8];
+
+    for (uint8_t i = 0; i < cached_scan.list.count; i++) {
+        const char* id = (char*)&cached_scan.list.sensors[i];
+        cmd[0] = cached_scan.list.sensors[i].address;
+
+        bool found = false;
+        for (int attempt = 0; attempt < wombat::ConcurrentScheduler::MAX_ATTEMPTS && ! found; attempt++) {
+            if (bus.transact(cmd, rsp, sizeof(rsp)) > 0) {
+                found = strncmp(rsp, id, strnlen(id, sizeof(sensor_info))) == 0;
+            }
+        }
+
+        if ( ! found) {
+            ESP_LOGW(TAG, "SDI-12 sensor %c did not respond or has changed", cmd[0]);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+///
+/// \brief Fills in the sensors object, scanning the SDI-12 bus only when necessary.
+///
+/// The set of sensors on a node rarely changes, so the result of a full bus scan is kept in RTC memory across
+/// deep sleep, and in NVS for after a power loss. On most wakes each known sensor is just sent an identify command,
+/// and the whole bus is only scanned if one of them does not respond correctly, or every FULL_SCAN_INTERVAL wakes
+/// to find sensors that have been added.
 ///
 void init_sensors(void) {
     sdi12.begin();
-    dpi12.scan_bus(sensors);
+
+    bool have_scan = scan_valid(cached_scan) || load_scan_from_nvs();
+    if (have_scan && cached_scan.wakes_since_scan >= FULL_SCAN_INTERVAL) {
+        ESP_LOGI(TAG, "Scheduled SDI-12 bus scan");
+        have_scan = false;
+    }
+
+    bool verified = false;
+    if (have_scan) {
+        const unsigned long start = millis();
+        verified = verify_cached_sensors();
+        const unsigned long verify_ms = millis() - start;
+        if (verified) {
+            cached_scan.wakes_since_scan++;
+            sensors = cached_scan.list;
+            log_to_sdcardf("Verified %u SDI-12 sensors in %lu ms, saved %ld ms", sensors.count, verify_ms,
+                           static_cast<long>(cached_scan.scan_ms) - static_cast<long>(verify_ms));
+        }
+    }
+
+    if ( ! verified) {
+        scan_sensors();
+    }
+
     sdi12.end();
 
     log_to_sdcardf("Found %u sensors", sensors.count);
@@ -41,20 +234,17 @@ void init_sensors(void) {
 }
 
 
-/// \brief Read a single SDI-12 sensor and add its values to timeseries_array.
-bool read_sensor(const char addr, JsonArray& timeseries_array) {
-    // Will be true if the sensor is read using information from the sensor definitions. If that fails
-    // and this is false after the attempt, then a standard measure command will be issued as a fall-back.
-    bool have_reading = false;
-
-    // If the sensor definition gives a C command this will be true.
-    bool is_concurrent = false;
-
-    // If the 3rd character of the command from a sensor definition is '0' < ch <= '9' then this
-    // will be set to true to indicate an 'additional' measure or concurrent command is used.
-    bool is_additional = false;
+/// The values read from one SDI-12 sensor, before they are labelled and added to the message.
+struct sensor_reading {
+    //! The sensor definition, if there is one for this type of sensor.
+    wombat::SensorDefn defn;
+    //! True if the sensor was read, the fallback measure command can fail.
+    bool ok = false;
+    //! The values that passed the value mask, or all values if there is no sensor definition.
+    std::vector<double> values;
+};
 
-    std::vector<double> plain_values;
+static size_t find_sensor(const char addr) {
     size_t sensor_idx = 0;
     for (; sensor_idx < sensors.count; sensor_idx++) {
         if (addr == sensors.sensors[sensor_idx].address) {
@@ -62,20 +252,45 @@ bool read_sensor(const char addr, JsonArray& timeseries_array) {
         }
     }
 
-    if (sensor_idx >= sensors.count) {
-        ESP_LOGE(TAG, "SDI-12 sensor %c not found", addr);
-        return false;
+    return sensor_idx;
+}
+
+/// \brief Append the values from one read command that pass the value mask to plain_values.
+static void apply_value_mask(const char* value_mask, const std::vector<double>& values, std::vector<double>& plain_values) {
+    const int num_values = static_cast<int>(values.size());
+    for (int value_idx = 0; value_idx < num_values; value_idx++) {
+        double value = values[value_idx];
+        char mask = '1'; // Default to including the value.
+        if (value_mask != nullptr && strnlen(value_mask, num_values) >= value_idx + 1) {
+            mask = value_mask[value_idx];
+        }
+
+        if (mask == '1') {
+            plain_values.push_back(value);
+        } else {
+            ESP_LOGI(TAG, "Skipping value %d due to value mask", value_idx);
+        }
     }
+}
+
+/// \brief Read a single SDI-12 sensor one command at a time, waiting for each measurement to complete.
+static void measure_sensor(const size_t sensor_idx, sensor_reading& reading) {
+    // If the sensor definition gives a C command this will be true.
+    bool is_concurrent = false;
 
-    JsonObjectConst s = getSensorDefn(sensor_idx, sensors);
+    // If the 3rd character of the command from a sensor definition is '0' < ch <= '9' then this
+    // will be set to true to indicate an 'additional' measure or concurrent command is used.
+    bool is_additional = false;
+
+    const char addr = sensors.sensors[sensor_idx].address;
+    const wombat::SensorDefn& s = reading.defn;
     if (s) {
-        JsonArrayConst read_cmds = s["read_cmds"];
-        const char* value_mask = s["value_mask"];
+        const char* value_mask = s.value_mask();
 
         // This loop issues all the read and data commands for the sensor, and gathers the values
         // that pass the value mask into the values vector.
-        for (size_t cmd_idx = 0; cmd_idx < read_cmds.size(); cmd_idx++) {
-            const char *crc = read_cmds[cmd_idx];
+        for (size_t cmd_idx = 0; cmd_idx < s.num_read_cmds(); cmd_idx++) {
+            const char *crc = s.read_cmd(cmd_idx);
 
             is_concurrent = crc[1] == 'C';
             is_additional = crc[2] > '0' && crc[2] <= '9';
@@ -85,91 +300,216 @@ bool read_sensor(const char addr, JsonArray& timeseries_array) {
             if (is_concurrent) {
                 if (is_additional) {
                     ESP_LOGI(TAG, "Concurrent (additional)");
-                    num_values = dpi12.do_additional_concurrent(sensors.sensors[sensor_idx].address, crc[2]);
+                    num_values = dpi12.do_additional_concurrent(addr, crc[2]);
                 } else {
                     ESP_LOGI(TAG, "Concurrent");
-                    num_values = dpi12.do_concurrent(sensors.sensors[sensor_idx].address);
+                    num_values = dpi12.do_concurrent(addr);
                 }
             } else {
-                bool wait_full_time = s["ignore_sr"];
+                bool wait_full_time = s.ignore_sr();
                 if (is_additional) {
                     ESP_LOGI(TAG, "Measure (additional), wait_full_time: %d", wait_full_time);
-                    num_values = dpi12.do_additional_measure(sensors.sensors[sensor_idx].address, crc[2]);
+                    num_values = dpi12.do_additional_measure(addr, crc[2]);
                 } else {
                     ESP_LOGI(TAG, "Measure, wait_full_time: %d", wait_full_time);
-                    num_values = dpi12.do_measure(sensors.sensors[sensor_idx].address, wait_full_time);
+                    num_values = dpi12.do_measure(addr, wait_full_time);
                 }
             }
 
+            std::vector<double> values;
             for (int value_idx = 0; value_idx < num_values; value_idx++) {
-                double value = dpi12.get_value(value_idx).value;
-                char mask = '1'; // Default to including the value.
-                if (value_mask != nullptr && strnlen(value_mask, num_values) >= value_idx + 1) {
-                    mask = value_mask[value_idx];
-                }
-
-                if (mask == '1') {
-                    plain_values.push_back(value);
-                } else {
-                    ESP_LOGI(TAG, "Skipping value %d due to value mask", value_idx);
-                }
+                values.push_back(dpi12.get_value(value_idx).value);
             }
+
+            apply_value_mask(value_mask, values, reading.values);
         }
 
-        JsonArrayConst labels = s["labels"];
+        reading.ok = true;
+        return;
+    }
 
+    ESP_LOGI(TAG, "No sensor definition found, performing fallback plain measure command.");
+    // Setting wait_full_time to true because we don't know what type of sensor we're reading
+    // in this code so try to handle those sensors that send a service request but then don't
+    // send the data immediately afterwards.
+    int res = dpi12.do_measure(addr, true);
+    for (int value_idx = 0; value_idx < res; value_idx++) {
+        reading.values.push_back(dpi12.get_value(value_idx).value);
+    }
+
+    reading.ok = res > 0;
+}
+
+/// \brief Label the values read from a sensor and add them to timeseries_array.
+static bool add_sensor_values(const size_t sensor_idx, const sensor_reading& reading, JsonArray& timeseries_array) {
+    if (reading.defn) {
         // This loop runs through the kept values, finds or generates a label for them, and
         // appends them to the timeSeries array of the JSON document.
-        for (int value_idx = 0; value_idx < plain_values.size(); value_idx++) {
+        for (int value_idx = 0; value_idx < reading.values.size(); value_idx++) {
             auto ts_entry = timeseries_array.add<JsonObject>();
-            JsonVariantConst label = labels[value_idx];
-            if (label) {
+            const char* label = reading.defn.label(value_idx);
+            if (label != nullptr) {
                 String generated_label(sensors.sensors[sensor_idx].address - '0');
                 generated_label += "_";
-                generated_label += label.as<String>();
+                generated_label += label;
                 ts_entry["name"] = generated_label;
             } else {
                 snprintf(g_buffer, sizeof(MAX_G_BUFFER), "%c_V%d", sensors.sensors[sensor_idx].address, value_idx);
                 ts_entry["name"] = g_buffer;
             }
 
-            ts_entry["value"] = plain_values.at(value_idx);
+            ts_entry["value"] = reading.values.at(value_idx);
         }
 
-        have_reading = true;
+        return true;
     }
 
-    if ( ! have_reading) {
-        ESP_LOGI(TAG, "No sensor definition found, performing fallback plain measure command.");
-        // Setting wait_full_time to true because we don't know what type of sensor we're reading
-        // in this code so try to handle those sensors that send a service request but then don't
-        // send the data immediately afterwards.
-        int res = dpi12.do_measure(sensors.sensors[sensor_idx].address, true);
-        if (res > 0) {
-            for (uint8_t value_idx = 0; value_idx < res; value_idx++) {
-                auto ts_entry = timeseries_array.add<JsonObject>();
-                snprintf(g_buffer, MAX_G_BUFFER, "%c_V%u", sensors.sensors[sensor_idx].address, value_idx+1);
-                ts_entry["name"] = g_buffer;
-                ts_entry["value"] = dpi12.get_value(value_idx).value;
+    if ( ! reading.ok) {
+        ESP_LOGE(TAG, "Failed to read sensor");
+        return false;
+    }
+
+    for (uint8_t value_idx = 0; value_idx < reading.values.size(); value_idx++) {
+        auto ts_entry = timeseries_array.add<JsonObject>();
+        snprintf(g_buffer, MAX_G_BUFFER, "%c_V%u", sensors.sensors[sensor_idx].address, value_idx+1);
+        ts_entry["name"] = g_buffer;
+        ts_entry["value"] = reading.values.at(value_idx);
+    }
+
+    return true;
+}
+
+/// \brief Read a single SDI-12 sensor and add its values to timeseries_array.
+bool read_sensor(const char addr, JsonArray& timeseries_array) {
+    const size_t sensor_idx = find_sensor(addr);
+    if (sensor_idx >= sensors.count) {
+        ESP_LOGE(TAG, "SDI-12 sensor %c not found", addr);
+        return false;
+    }
+
+    sensor_reading reading;
+    reading.defn = getSensorDefn(sensor_idx, sensors);
+    measure_sensor(sensor_idx, reading);
+    return add_sensor_values(sensor_idx, reading, timeseries_array);
+}
+
+///
+/// \brief Read every sensor on the bus, running concurrent measurements at the same time where possible.
+///
+/// A sensor whose definition only uses concurrent commands is handed to the concurrent scheduler, which
+/// starts a measurement on all of them before collecting any data. The remaining sensors are read one at
+/// a time while those measurements are in progress.
+///
+static void read_all_sensors(sensor_reading readings[]) {
+    EnviroDIYBus bus;
+    wombat::ConcurrentScheduler scheduler(bus);
+    bool scheduled[MAX_SENSORS] = { false };
+
+    for (size_t sensor_idx = 0; sensor_idx < sensors.count; sensor_idx++) {
+        readings[sensor_idx].defn = getSensorDefn(sensor_idx, sensors);
+        const wombat::SensorDefn& s = readings[sensor_idx].defn;
+        if (s) {
+            std::vector<const char *> cmds;
+            for (size_t cmd_idx = 0; cmd_idx < s.num_read_cmds(); cmd_idx++) {
+                cmds.push_back(s.read_cmd(cmd_idx));
             }
-        } else {
-            ESP_LOGE(TAG, "Failed to read sensor");
-            return false;
+
+            scheduled[sensor_idx] = scheduler.add(sensors.sensors[sensor_idx].address, cmds);
         }
     }
 
-    return true;
+    const uint32_t start = millis();
+    scheduler.start();
+
+    for (size_t sensor_idx = 0; sensor_idx < sensors.count; sensor_idx++) {
+        if ( ! scheduled[sensor_idx]) {
+            const uint32_t sensor_start = millis();
+            measure_sensor(sensor_idx, readings[sensor_idx]);
+            get_profiler().sensor(sensors.sensors[sensor_idx].address, millis() - sensor_start);
+            scheduler.poll();
+        }
+    }
+
+    scheduler.finish();
+
+    for (const auto& job : scheduler.get_jobs()) {
+        get_profiler().sensor(job.addr, job.done_at - start);
+    }
+
+    for (size_t sensor_idx = 0; sensor_idx < sensors.count; sensor_idx++) {
+        if (scheduled[sensor_idx]) {
+            const char* value_mask = readings[sensor_idx].defn.value_mask();
+            const auto *job = scheduler.find(sensors.sensors[sensor_idx].address);
+            for (const auto& r : job->cmds) {
+                if ( ! r.ok) {
+                    ESP_LOGW(TAG, "%s returned %u of %u values", r.cmd.c_str(), r.values.size(), r.expected);
+                }
+
+                apply_value_mask(value_mask, r.values, readings[sensor_idx].values);
+            }
+
+            readings[sensor_idx].ok = true;
+        }
+    }
 }
 
 
-/// \brief Read all sensors, put the readings in a JSON message and save the JSON to a file on SPIFFS to be uplinked later.
+///
+/// \brief Encode a message as CBOR.
+///
+/// SDI-12 value names are sent as numbers from a dictionary of the labels in the sensor definitions.
+///
+static void encode_cbor_msg(JsonDocument& msg, std::vector<uint8_t>& cbor) {
+    wombat::LabelDictionary dict;
+    const wombat::SensorDefnTable& defns = DeviceConfig::get().getSDI12Defns();
+    for (size_t defn_idx = 0; defn_idx < defns.size(); defn_idx++) {
+        const wombat::SensorDefn defn = defns.at(defn_idx);
+        for (size_t label_idx = 0; label_idx < defn.num_labels(); label_idx++) {
+            dict.add(defn.label(label_idx));
+        }
+    }
+    dict.finish();
+
+    wombat::UplinkMessage cbor_msg;
+    cbor_msg.timestamp = msg["timestamp"].as<String>().c_str();
+    for (JsonPairConst id : msg["source_ids"].as<JsonObjectConst>()) {
+        if ( ! strcmp(id.key().c_str(), "sdi-12")) {
+            for (JsonVariantConst sensor_id : id.value().as<JsonArrayConst>()) {
+                cbor_msg.sdi12_ids.emplace_back(sensor_id.as<String>().c_str());
+            }
+        } else {
+            cbor_msg.source_ids.emplace_back(id.key().c_str(), id.value().as<String>().c_str());
+        }
+    }
+
+    for (JsonVariantConst ts_entry : msg["timeseries"].as<JsonArrayConst>()) {
+        cbor_msg.timeseries.emplace_back(ts_entry["name"].as<String>().c_str(), ts_entry["value"].as<double>());
+    }
+
+    wombat::encode_message(cbor_msg, dict, cbor);
+}
+
+/// \brief Read all sensors, put the readings in a JSON message and add it to the outbox to be uplinked later.
 void sensor_task(void) {
+    const unsigned long sdi12_start = millis();
+
+    // Read the SDI-12 sensors first, the modem may still be connecting on core 0 while this runs.
     sdi12.begin();
+    profile_start(wombat::WAKE_PHASE_SDI12);
+    sensor_reading readings[MAX_SENSORS];
+    read_all_sensors(readings);
+    profile_stop(wombat::WAKE_PHASE_SDI12);
+    log_to_sdcardf("SDI-12 phase took %lu ms", millis() - sdi12_start);
+    sdi12.end();
+
+    // The rest of the message needs the modem, and the clock may be set by NTP, so wait for the connection.
+    wait_for_connect_task();
 
     JsonDocument msg;
 
-    const char *timestamp = iso8601();
-    msg["timestamp"] = timestamp;
+    // The timestamp is when the readings started, which is before the clock may have been set.
+    char timestamp[ISO8601_LEN];
+    msg["timestamp"] = iso8601(timestamp, sizeof(timestamp), time(nullptr) - (millis() - sdi12_start) / 1000);
 
     auto source_ids = msg["source_ids"].to<JsonObject>();
     source_ids["serial_no"] = DeviceConfig::get().node_id;
@@ -184,13 +524,18 @@ void sensor_task(void) {
     //
     // Node sensors
     //
+    const double battery_volts = BatteryMonitor::get_voltage();
     auto battery_v = timeseries_array.add<JsonObject>();
     battery_v["name"] = "battery (v)";
-    battery_v["value"] = BatteryMonitor::get_voltage();
+    battery_v["value"] = battery_volts;
 
+    const double solar_volts = SolarMonitor::get_voltage();
     auto solar_v = timeseries_array.add<JsonObject>();
     solar_v["name"] = "solar (v)";
-    solar_v["value"] = SolarMonitor::get_voltage();
+    solar_v["value"] = solar_volts;
+
+    // The energy level of the next wake is chosen from these readings.
+    energy_record(battery_volts, solar_volts);
 
     if (r5_ok) {
         signal_quality sq;
@@ -225,6 +570,31 @@ void sensor_task(void) {
     shortest_pulse["name"] = "shortest_pulse";
     shortest_pulse["value"] = sp;
 
+    //
+    // How long the previous wake took
+    //
+    add_profile_summary(timeseries_array);
+
+    //
+    // The energy of the last uplink
+    //
+    add_uplink_energy(timeseries_array);
+
+    //
+    // How the last network registration went
+    //
+    add_registration_stats(timeseries_array);
+
+    //
+    // Measurement slots missed since the last measurement
+    //
+    const uint32_t missed = get_wake_schedule().get_missed_before();
+    if (missed > 0) {
+        auto missed_slots = timeseries_array.add<JsonObject>();
+        missed_slots["name"] = "missed slots";
+        missed_slots["value"] = missed;
+    }
+
     //
     // SDI-12 sensors
     //
@@ -233,33 +603,53 @@ void sensor_task(void) {
     // SMP nodes because the 6 SDI-12 ID strings add about 200 bytes to the message.
     auto sdi12_ids = source_ids["sdi-12"].to<JsonArray>();
     for (size_t sensor_idx = 0; sensor_idx < sensors.count; sensor_idx++) {
-        read_sensor(sensors.sensors[sensor_idx].address, timeseries_array);
+        add_sensor_values(sensor_idx, readings[sensor_idx], timeseries_array);
         sdi12_ids.add((char*)&sensors.sensors[sensor_idx]);
     }
 
-    sdi12.end();
-
     String str;
     serializeJson(msg, str);
     ESP_LOGI(TAG, "Msg:\r\n%s\r\n", str.c_str());
 
-    if (spiffs_ok) {
-        // Write the message to a file so it can be sent on the next uplink cycle.
-        static const size_t MAX_FNAME = 32;
-        static char filename[MAX_FNAME + 1];
-
-        snprintf(filename, MAX_FNAME, "/%s%s.json", DeviceConfig::getMsgFilePrefix(), timestamp);
-        ESP_LOGI(TAG, "Creating unsent msg file [%s]", filename);
-        File f = SPIFFS.open(filename, FILE_WRITE);
-        serializeJson(msg, f);
-        f.close();
-    } else {
-        log_to_sdcard("[E] spiffs_ok is false, no message stored");
-    }
-
-    // Append the message to a file on the SD card.
+    // Append the message to a file on the SD card. It keeps every value, even those only uplinked as summaries.
     if (SDCardInterface::is_ready()) {
         snprintf(g_buffer, MAX_G_BUFFER, "%s,\n", str.c_str());
         SDCardInterface::append_to_file(sd_card_datafile_name, g_buffer);
     }
+
+    //
+    // Summaries of the series across measurement cycles
+    //
+    bool queue_msg = true;
+    if (DeviceConfig::get().getStatsInterval() > 0) {
+        queue_msg = aggregate_series(timeseries_array);
+        str = "";
+        serializeJson(msg, str);
+        ESP_LOGI(TAG, "Uplink msg:\r\n%s\r\n", str.c_str());
+    }
+
+    if ( ! queue_msg) {
+        ESP_LOGI(TAG, "Every measured series is summarised and no summary is due, no message queued");
+    } else if (spiffs_ok) {
+        // Add the message to the outbox so it can be sent on the next uplink cycle.
+        profile_start(wombat::WAKE_PHASE_MSG_WRITE);
+        bool queued;
+        if (DeviceConfig::get().getMsgFormat() == MSG_FORMAT_CBOR) {
+            std::vector<uint8_t> cbor;
+            encode_cbor_msg(msg, cbor);
+            ESP_LOGI(TAG, "Queueing CBOR msg, %u bytes", cbor.size());
+            queued = get_outbox().enqueue(wombat::OUTBOX_MSG_CBOR, cbor.data(), cbor.size());
+        } else {
+            ESP_LOGI(TAG, "Queueing JSON msg, %u bytes", str.length());
+            queued = get_outbox().enqueue(wombat::OUTBOX_MSG_JSON, reinterpret_cast<const uint8_t*>(str.c_str()), str.length());
+        }
+
+        profile_stop(wombat::WAKE_PHASE_MSG_WRITE);
+
+        if ( ! queued) {
+            log_to_sdcard("[E] Failed to add message to the outbox");
+        }
+    } else {
+        log_to_sdcard("[E] spiffs_ok is false, no message stored");
+    }
 }
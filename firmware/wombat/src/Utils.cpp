@@ -6,6 +6,9 @@
 #include <Arduino.h>
 #include "Utils.h"
 
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+
 #include <SPIFFS.h>
 
 #include "DeviceConfig.h"
@@ -13,6 +16,13 @@
 #include "CAT_M1.h"
 #include "globals.h"
 #include "sd-card/interface.h"
+#include "profiler.h"
+#include "transfers.h"
+#include "clock_sync.h"
+#include "modem_power.h"
+#include "registration.h"
+
+#include <log_buffer.h>
 
 #define TAG "utils"
 
@@ -121,13 +131,11 @@ int waitForChar(Stream& stream, uint32_t timeout) {
     return a > 0 ? a : -1;
 }
 
-JsonObjectConst getSensorDefn(const char* const vendor, const char* const model) {
-    const JsonDocument& sdi12Defns = DeviceConfig::get().getSDI12Defns();
-    JsonObjectConst obj = sdi12Defns[vendor][model];
-    return obj;
+wombat::SensorDefn getSensorDefn(const char* const vendor, const char* const model) {
+    return DeviceConfig::get().getSDI12Defns().find(vendor, model);
 }
 
-JsonObjectConst getSensorDefn(const size_t sensor_idx, const sensor_list& sensors) {
+wombat::SensorDefn getSensorDefn(const size_t sensor_idx, const sensor_list& sensors) {
     char vendor[LEN_VENDOR+1];
     char model[LEN_MODEL+1];
     DPIClimate12::get_vendor(vendor, sensor_idx, sensors);
@@ -157,38 +165,137 @@ void disable12V(void) {
     v12_enabled = false;
 }
 
-// yyyy-mm-ddThh:mm:ssZ
-static char iso8601_buf[24];
-
-const char* iso8601(void) {
-    memset(iso8601_buf, 0, sizeof(iso8601_buf));
+/**
+ * Format a time as yyyy-mm-ddThh:mm:ssZ into the caller's buffer, which should be ISO8601_LEN bytes.
+ * Each caller has its own buffer because both cores format times during an uplink cycle.
+ *
+ * @return buf
+ */
+const char* iso8601(char *buf, const size_t len, const time_t when) {
+    memset(buf, 0, len);
 
     struct tm t{};
     memset(&t, 0, sizeof(t));
-    time_t now;
-    time(&now);
-    gmtime_r(&now, &t);
+    gmtime_r(&when, &t);
 
-    snprintf(iso8601_buf, sizeof(iso8601_buf)-1, "%04d-%02d-%02dT%02d:%02d:%02dZ", t.tm_year+1900, t.tm_mon+1, t.tm_mday, t.tm_hour, t.tm_min, t.tm_sec);
+    snprintf(buf, len-1, "%04d-%02d-%02dT%02d:%02d:%02dZ", t.tm_year+1900, t.tm_mon+1, t.tm_mday, t.tm_hour, t.tm_min, t.tm_sec);
+    return buf;
+}
 
-    return iso8601_buf;
+const char* iso8601(char *buf, const size_t len) {
+    time_t now;
+    time(&now);
+    return iso8601(buf, len, now);
 }
 
 constexpr size_t MAX_SD_CARD_MSG = 255;
 static char sd_card_msg[MAX_SD_CARD_MSG + 1];
 
-void log_to_sdcard(const char *msg) {
-    if ( ! SDCardInterface::is_ready() || msg == nullptr) {
+//! Log lines waiting to be written to the SD card.
+static wombat::LogBuffer sd_log(8192);
+//! Guards sd_log and sd_log_file, log_to_sdcard() is called from more than one task. Created by init_sdcard_log().
+static SemaphoreHandle_t sd_log_mutex = nullptr;
+//! The log file is kept open while the SD card is powered.
+static File sd_log_file;
+static uint32_t sd_log_flushes = 0;
+static unsigned long sd_log_write_ms = 0;
+
+/**
+ * Create the SD card log mutex. Called from setup() before any other task is started, so the tasks
+ * on both cores see the same mutex.
+ */
+void init_sdcard_log(void) {
+    if (sd_log_mutex == nullptr) {
+        sd_log_mutex = xSemaphoreCreateMutex();
+        configASSERT(sd_log_mutex);
+    }
+}
+
+static bool lock_sd_log(const TickType_t wait) {
+    return sd_log_mutex != nullptr && xSemaphoreTake(sd_log_mutex, wait) == pdTRUE;
+}
+
+static void unlock_sd_log(void) {
+    xSemaphoreGive(sd_log_mutex);
+}
+
+/**
+ * Write the buffered log lines to the log file in one write. The caller must hold sd_log_mutex.
+ */
+static void write_sd_log(void) {
+    if (sd_log.size() < 1) {
+        return;
+    }
+
+    if ( ! sd_log_file) {
+        sd_log_file = SD.open(sd_card_logfile_name, FILE_APPEND, true);
+        if ( ! sd_log_file) {
+            ESP_LOGE(TAG, "Could not open SD card log file");
+            return;
+        }
+    }
+
+    const unsigned long start = millis();
+    sd_log.drain([](const char *p, size_t n) { return sd_log_file.write(reinterpret_cast<const uint8_t*>(p), n); });
+    sd_log_file.flush();
+    sd_log_write_ms += millis() - start;
+    sd_log_flushes++;
+}
+
+/**
+ * Add the line in sd_card_msg to the SD card log buffer, writing the buffer to the card first if
+ * the line does not fit or afterwards if it is nearly full. The line is only counted as dropped if
+ * it still does not fit. The caller must hold sd_log_mutex.
+ */
+static void buffer_sd_log_line(void) {
+    const size_t len = strlen(sd_card_msg);
+    if (len > sd_log.space()) {
+        write_sd_log();
+    }
+
+    if (sd_log.append(sd_card_msg, len) && sd_log.high_water()) {
+        write_sd_log();
+    }
+}
+
+/**
+ * Start a log line in sd_card_msg with the current time. The caller must hold sd_log_mutex, the
+ * line is formatted under the mutex because both cores log during an uplink cycle.
+ */
+static size_t start_sd_log_line(void) {
+    time_t now;
+    time(&now);
+    char timestamp[ISO8601_LEN];
+    iso8601(timestamp, sizeof(timestamp), now);
+    snprintf(sd_card_msg, MAX_SD_CARD_MSG, "%s: ", timestamp);
+    return strnlen(sd_card_msg, MAX_SD_CARD_MSG - 1);
+}
+
+/**
+ * Add a line to the SD card log.
+ *
+ * @param msg the line to log.
+ * @param wait_ms how long to wait for another task writing to the log, SD_LOG_WAIT_FOREVER to wait
+ * until it has finished. The line is dropped if the wait runs out.
+ */
+void log_to_sdcard(const char *msg, const uint32_t wait_ms) {
+    const TickType_t wait = wait_ms == SD_LOG_WAIT_FOREVER ? portMAX_DELAY : pdMS_TO_TICKS(wait_ms);
+    if ( ! SDCardInterface::is_ready() || msg == nullptr || ! lock_sd_log(wait)) {
         return;
     }
 
-    snprintf(sd_card_msg, MAX_SD_CARD_MSG, "%s: %s\n", iso8601(), msg);
-    SDCardInterface::append_to_file(sd_card_logfile_name, sd_card_msg);
+    const size_t ts_len = start_sd_log_line();
+    snprintf(&sd_card_msg[ts_len], MAX_SD_CARD_MSG - ts_len, "%s\n", msg);
+    buffer_sd_log_line();
+    unlock_sd_log();
 }
 
 void log_to_sdcardf(const char *fmt, ...) {
-    snprintf(sd_card_msg, MAX_SD_CARD_MSG, "%s: ", iso8601());
-    size_t ts_len = strnlen(sd_card_msg, MAX_SD_CARD_MSG - 1);
+    if ( ! SDCardInterface::is_ready() || ! lock_sd_log(portMAX_DELAY)) {
+        return;
+    }
+
+    const size_t ts_len = start_sd_log_line();
 
     va_list args;
     va_start(args, fmt);
@@ -196,7 +303,43 @@ void log_to_sdcardf(const char *fmt, ...) {
     va_end(args);
 
     strcat(sd_card_msg, "\n");
-    SDCardInterface::append_to_file(sd_card_logfile_name, sd_card_msg);
+    buffer_sd_log_line();
+    unlock_sd_log();
+}
+
+/**
+ * Write any buffered log lines to the SD card.
+ *
+ * Called at the end of each phase of a wake so the log shows how far the node got if it
+ * stops unexpectedly, and by timeout_task() before it forces a reboot. If another task is
+ * writing to the log the lines are not written rather than blocking the caller.
+ */
+void flush_sdcard_log(void) {
+    if ( ! SDCardInterface::is_ready() || ! lock_sd_log(1000 / portTICK_PERIOD_MS)) {
+        return;
+    }
+
+    write_sd_log();
+    unlock_sd_log();
+}
+
+/**
+ * Write any buffered log lines to the SD card and close the log file. Called before the SD
+ * card is powered down, and before the log file is read or removed. The file is opened again
+ * by the next write.
+ */
+void close_sdcard_log(void) {
+    if ( ! SDCardInterface::is_ready() || ! lock_sd_log(1000 / portTICK_PERIOD_MS)) {
+        return;
+    }
+
+    write_sd_log();
+    ESP_LOGI(TAG, "SD card log: %lu writes taking %lu ms, %lu lines dropped", (unsigned long)sd_log_flushes, sd_log_write_ms, (unsigned long)sd_log.get_dropped());
+    if (sd_log_file) {
+        sd_log_file.close();
+    }
+
+    unlock_sd_log();
 }
 
 int read_spiffs_file(const char* const filename, char* buffer, const size_t max_length, size_t &bytes_read) {
@@ -205,70 +348,103 @@ int read_spiffs_file(const char* const filename, char* buffer, const size_t max_
         fn_str = "/" + fn_str;
     }
 
-    File file = SPIFFS.open(fn_str);
-    if (file.isDirectory()) {
-        ESP_LOGE(TAG, "%s is a directory", filename);
-        file.close();
+    FsFileSource file(SPIFFS, fn_str.c_str());
+    if ( ! file) {
+        ESP_LOGE(TAG, "%s is a directory or could not be opened", filename);
         return -1;
     }
 
-    const size_t len = file.available();
+    const size_t len = file.size();
     if (len > max_length) {
         ESP_LOGE(TAG, "File too long (%lu > %lu)", len, max_length);
-        file.close();
         return -2;
     }
 
+    // The file fits in buffer so it is read in one block, there is nothing to gain from staging it through g_buffer.
     ESP_LOGI(TAG, "Reading %lu bytes in total", len);
+    const int32_t r_b = file.read(reinterpret_cast<uint8_t*>(buffer), len);
+    if (r_b < 0 || static_cast<size_t>(r_b) != len) {
+        ESP_LOGE(TAG, "Short read on SPIFFS file");
+        bytes_read = r_b < 0 ? 0 : static_cast<size_t>(r_b);
+        return -3;
+    }
+
+    bytes_read = len;
+    return 0;
+}
+
+int read_r5_file(const String& filename, char* const buffer, const size_t length, size_t &bytes_read, SARA_R5_error_t& r5_err) {
     bytes_read = 0;
-    size_t chunk_sz = 128;
-    while (bytes_read < len) {
-        const size_t left = len - bytes_read;
-        if (left < chunk_sz) {
-            chunk_sz = left;
-        }
+    R5FileSource file(filename);
+    r5_err = file.get_error();
+    if ( ! file) {
+        return -1;
+    }
 
-        const size_t r_b = file.readBytes(&buffer[bytes_read], chunk_sz);
-        if (r_b != chunk_sz) {
-            ESP_LOGE(TAG, "Short read on SPIFFS file chunk");
-            file.close();
-            return -3;
-        }
+    // As for read_spiffs_file(), the caller's buffer is filled in one block.
+    const int32_t r_b = file.read(reinterpret_cast<uint8_t*>(buffer), length);
+    r5_err = file.get_error();
+    r5.bufferedPoll();
+    if (r_b < 0) {
+        return -1;
+    }
 
-        bytes_read += r_b;
-        delay(250);
+    bytes_read = static_cast<size_t>(r_b);
+    if (bytes_read != length) {
+        return -3;
     }
 
-    file.close();
     return 0;
 }
 
-int read_r5_file(const String& filename, char* const buffer, const size_t length, size_t &bytes_read, SARA_R5_error_t& r5_err) {
-    bytes_read = 0;
-    size_t chunk_sz = 128;
-    r5_err = SARA_R5_ERROR_SUCCESS;
-    while (bytes_read < length) {
-        const size_t left = length - bytes_read;
-        if (left < chunk_sz) {
-            chunk_sz = left;
-        }
+bool modem_command(const char *cmd, const unsigned long timeout_ms) {
+    memset(g_buffer, 0, sizeof(g_buffer));
+    const SARA_R5_error_t err = r5.sendCustomCommandWithResponse(cmd, "OK", g_buffer, timeout_ms);
+    if (err != SARA_R5_ERROR_SUCCESS) {
+        ESP_LOGW(TAG, "AT%s failed: %d", cmd, err);
+        return false;
+    }
 
-        size_t r_b;
-        r5_err = r5.getFileBlock(filename, &buffer[bytes_read], bytes_read, chunk_sz, r_b);
-        if (r5_err) {
-            return -1;
-        }
+    return true;
+}
+
+//! Given when the modem UART receives data.
+static SemaphoreHandle_t modem_rx = nullptr;
+
+static void modem_rx_callback(void) {
+    xSemaphoreGive(modem_rx);
+}
 
-        if (r_b != chunk_sz) {
-            return -3;
+/**
+ * @brief Have the modem UART signal wait_for_modem_rx() when data arrives. Call once, after
+ * LTE_Serial.begin().
+ */
+void watch_modem_rx(void) {
+    if (modem_rx == nullptr) {
+        modem_rx = xSemaphoreCreateBinary();
+        if (modem_rx == nullptr) {
+            ESP_LOGE(TAG, "Could not create modem rx semaphore");
+            return;
         }
+    }
 
-        bytes_read += r_b;
-        delay(100);
-        r5.bufferedPoll();
+    LTE_Serial.onReceive(modem_rx_callback);
+}
+
+/**
+ * @brief Block until the modem UART receives data or timeout_ms passes.
+ *
+ * The data itself is left in the UART buffer for the SARA R5 library to read.
+ *
+ * @return true if data arrived, false on timeout.
+ */
+bool wait_for_modem_rx(const uint32_t timeout_ms) {
+    if (modem_rx == nullptr) {
+        delay(timeout_ms);
+        return false;
     }
 
-    return 0;
+    return xSemaphoreTake(modem_rx, pdMS_TO_TICKS(timeout_ms)) == pdTRUE;
 }
 
 /**
@@ -323,43 +499,16 @@ bool wait_for_at(void) {
     return false;
 }
 
+//! How long to wait for network registration.
+static constexpr uint32_t REGISTRATION_TIMEOUT_MS = 90000;
+
 /**
- * @brief Get the R5 modem connected to the internet.
- *
- * This function sets the ESP32 and modem RTCs from the network time using NTP.
+ * @brief Register with the network and activate the PDP context.
  *
- * If this function returns true, the modem has registered to the network, brought up a
- * packet switched profile, and obtained an IP address. MQTT, FTP, etc can be used.
- *
- * @return true if the connection succeeds, otherwise false.
+ * @param reg_status the registration status read before calling this function.
+ * @return true if the modem is registered and the PDP context has been activated.
  */
-bool connect_to_internet(void) {
-    static bool already_called = false;
-
-    log_to_sdcard("connect_to_internet");
-
-    if ( ! cat_m1.make_ready()) {
-        ESP_LOGE(TAG, "Could not initialise modem");
-        log_to_sdcard("[E] Could not initialise modem");
-        return false;
-    }
-
-    IPAddress ip_addr(0, 0, 0, 0);
-
-    // If we've been through this function all the way (so the time is set) and we are connected
-    // to the internet, return quickly.
-    int reg_status = r5.registration();
-    delay(20);
-    if (reg_status == SARA_R5_REGISTRATION_HOME) {
-        if (r5.getNetworkAssignedIPAddress(0, &ip_addr) == SARA_R5_ERROR_SUCCESS) {
-            if (already_called && ip_addr[0] != 0) {
-                ESP_LOGI(TAG, "Already connected to internet");
-                log_to_sdcard(" Already connected to internet");
-                return true;
-            }
-        }
-    }
-
+static bool attach_to_network(int reg_status) {
     // Hardware flow control pins not connected on the Wombat and R5 does not support software flow control.
     r5.setFlowControl(SARA_R5_DISABLE_FLOW_CONTROL);
     delay(20);
@@ -375,15 +524,24 @@ bool connect_to_internet(void) {
     }
     delay(20);
 
-    // Network registration takes 4 seconds at best.
+    // Ask for the PSM timers before registering so they are negotiated in the attach.
+    modem_psm_request();
+
+    // Network registration takes 4 seconds at best. Poll quickly at first so a fast registration
+    // is not left waiting for the next poll.
     ESP_LOGI(TAG, "Waiting for network registration");
-    int attempts = 0;
-    while (reg_status != SARA_R5_REGISTRATION_HOME && attempts < 45) {
+    profile_start(wombat::WAKE_PHASE_REGISTRATION);
+    const uint32_t reg_start = millis();
+    const bool registering = reg_status != SARA_R5_REGISTRATION_HOME;
+    const bool fast = registering && registration_prepare();
+    while (reg_status != SARA_R5_REGISTRATION_HOME && millis() - reg_start < REGISTRATION_TIMEOUT_MS) {
         reg_status = r5.registration();
         delay(20);
         if (reg_status == SARA_R5_REGISTRATION_INVALID) {
             ESP_LOGI(TAG, "ESP registration query failed");
             log_to_sdcard("[E] ESP registration query failed");
+            profile_stop(wombat::WAKE_PHASE_REGISTRATION);
+            registration_failed(fast);
             return false;
         }
 
@@ -393,24 +551,21 @@ bool connect_to_internet(void) {
             break;
         }
 
-        delay(2000);
-        attempts++;
+        delay(registration_poll_ms(millis() - reg_start));
     }
+    const uint32_t reg_ms = millis() - reg_start;
+    profile_stop(wombat::WAKE_PHASE_REGISTRATION);
 
     if (reg_status != SARA_R5_REGISTRATION_HOME) {
         ESP_LOGE(TAG, "Failed to register with network");
         log_to_sdcard("[E] Failed to register with network");
+        registration_failed(fast);
         return false;
     }
 
-    log_to_sdcard("Getting network time");
-
-    // Work in UTC.
-    setenv("TZ", "UTC", 1);
-    tzset();
-
-    ESP_LOGI(TAG, "RTC time before ntp: %s", iso8601());
-    log_to_sdcardf("RTC time before ntp: %s", iso8601_buf); // Look out, this is a side-effect of calling iso8601.
+    if (registering) {
+        registration_succeeded(reg_ms, fast);
+    }
 
     log_to_sdcard("Starting PDP");
 
@@ -427,17 +582,149 @@ bool connect_to_internet(void) {
     delay(20);
     r5.bufferedPoll();
 
-    ESP_LOGI(TAG, "Attempting NTP query");
-    if ( ! getNTPTime(r5)) {
-        ESP_LOGW(TAG, "NTP query failed");
-        log_to_sdcard("NTP query failed");
+    return true;
+}
+
+/**
+ * @brief Get the R5 modem connected to the internet.
+ *
+ * This function sets the ESP32 and modem RTCs from the network time using NTP.
+ *
+ * If this function returns true, the modem has registered to the network, brought up a
+ * packet switched profile, and obtained an IP address. MQTT, FTP, etc can be used.
+ *
+ * A modem left in PSM by the previous wake is still registered with its PDP context active,
+ * so it is used as it is.
+ *
+ * @return true if the connection succeeds, otherwise false.
+ */
+bool connect_to_internet(void) {
+    static bool already_called = false;
+
+    log_to_sdcard("connect_to_internet");
+
+    profile_start(wombat::WAKE_PHASE_MODEM);
+    const bool modem_ready = cat_m1.make_ready();
+    profile_stop(wombat::WAKE_PHASE_MODEM);
+    if ( ! modem_ready) {
+        ESP_LOGE(TAG, "Could not initialise modem");
+        log_to_sdcard("[E] Could not initialise modem");
+        return false;
+    }
+
+    IPAddress ip_addr(0, 0, 0, 0);
+
+    // If we've been through this function all the way (so the time is set) and we are connected
+    // to the internet, return quickly.
+    int reg_status = r5.registration();
+    delay(20);
+    if (reg_status == SARA_R5_REGISTRATION_HOME) {
+        if (r5.getNetworkAssignedIPAddress(0, &ip_addr) == SARA_R5_ERROR_SUCCESS) {
+            if (already_called && ip_addr[0] != 0) {
+                ESP_LOGI(TAG, "Already connected to internet");
+                log_to_sdcard(" Already connected to internet");
+                return true;
+            }
+        }
+    }
+
+    if (cat_m1.was_kept() && reg_status == SARA_R5_REGISTRATION_HOME && ip_addr[0] != 0) {
+        ESP_LOGI(TAG, "Modem resumed from PSM");
+        log_to_sdcard("Modem resumed from PSM");
+    } else if ( ! attach_to_network(reg_status)) {
+        return false;
     }
 
-    ESP_LOGI(TAG, "RTC time after ntp: %s", iso8601());
-    log_to_sdcardf("RTC time after ntp: %s", iso8601_buf); // Look out, this is a side-effect of calling iso8601.
+    modem_psm_update();
+
+    log_to_sdcard("Getting network time");
+
+    // Work in UTC.
+    setenv("TZ", "UTC", 1);
+    tzset();
+
+    char timestamp[ISO8601_LEN];
+    iso8601(timestamp, sizeof(timestamp));
+    ESP_LOGI(TAG, "RTC time before ntp: %s", timestamp);
+    log_to_sdcardf("RTC time before ntp: %s", timestamp);
+
+    // Once the drift of the sleep clock is well known the clock only needs to be checked once a day.
+    if (clock_ntp_due()) {
+        ESP_LOGI(TAG, "Attempting NTP query");
+        profile_start(wombat::WAKE_PHASE_NTP);
+        if ( ! getNTPTime(r5)) {
+            ESP_LOGW(TAG, "NTP query failed");
+            log_to_sdcard("NTP query failed");
+        }
+        profile_stop(wombat::WAKE_PHASE_NTP);
+
+        iso8601(timestamp, sizeof(timestamp));
+        ESP_LOGI(TAG, "RTC time after ntp: %s", timestamp);
+        log_to_sdcardf("RTC time after ntp: %s", timestamp);
+    } else {
+        ESP_LOGI(TAG, "Skipping NTP query, sleep clock drift is known");
+    }
 
     log_to_sdcard("cti returning");
 
     already_called = true;
     return true;
 }
+
+//! Given by connect_task when connect_to_internet() returns.
+static SemaphoreHandle_t connect_done = nullptr;
+static volatile bool connect_result = false;
+static bool connect_joined = false;
+
+static void connect_task(void *pvParameters) {
+    connect_result = connect_to_internet();
+    xSemaphoreGive(connect_done);
+    vTaskDelete(nullptr);
+}
+
+/**
+ * @brief Run connect_to_internet() in a task on core 0 so the modem powers up, registers, activates
+ * the PDP context and gets the time while the sensors are read on core 1.
+ *
+ * Nothing else may use the modem until wait_for_connect_task() has returned.
+ *
+ * @return true if the task was started, otherwise the caller must call connect_to_internet() itself.
+ */
+bool start_connect_task(void) {
+    if (connect_done == nullptr) {
+        connect_done = xSemaphoreCreateBinary();
+        if (connect_done == nullptr) {
+            return false;
+        }
+    }
+
+    connect_joined = false;
+    if (xTaskCreatePinnedToCore(connect_task, "Connect", 8192, nullptr, 1, nullptr, 0) != pdPASS) {
+        ESP_LOGE(TAG, "Could not start connect task");
+        connect_joined = true;
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * @brief Wait for the task started by start_connect_task() to finish. Returns immediately if no task
+ * was started or it has already been waited for.
+ *
+ * @return the result of connect_to_internet() in the task, or false if no task was started.
+ */
+bool wait_for_connect_task(void) {
+    if (connect_done == nullptr) {
+        return false;
+    }
+
+    if ( ! connect_joined) {
+        const unsigned long start = millis();
+        xSemaphoreTake(connect_done, portMAX_DELAY);
+        connect_joined = true;
+        log_to_sdcardf("Waited %lu ms for connect task", millis() - start);
+    }
+
+    return connect_result;
+}
@@ -0,0 +1,152 @@
+#include <Arduino.h>
+#include "aggregation.h"
+#include "DeviceConfig.h"
+#include "Utils.h"
+#include "clock_sync.h"
+
+#include <esp_attr.h>
+#include <esp_log.h>
+
+#define TAG "aggregation"
+
+static RTC_DATA_ATTR wombat::SeriesStatsState series_stats_state;
+static wombat::SeriesStats series_stats(series_stats_state);
+static bool series_stats_begun = false;
+
+//! The node sensor series the default mode applies to, as well as the SDI-12 values.
+static const char *NODE_SERIES[] = { "battery (v)", "solar (v)" };
+
+/**
+ * @brief Returns the statistics of each series since the last summary, loading them on the first call.
+ */
+wombat::SeriesStats& get_series_stats(void) {
+    if ( ! series_stats_begun) {
+        series_stats.begin();
+        series_stats_begun = true;
+    }
+
+    return series_stats;
+}
+
+/**
+ * @brief The mode of a series.
+ *
+ * A series with a mode of its own uses it. The SDI-12 values and the node sensors use the default
+ * mode, and everything else in the message, such as the wake diagnostics, is always sent raw.
+ *
+ * @param measured set to true if the series is a measurement rather than a diagnostic.
+ */
+static wombat::stats_mode_t series_mode(const char *name, bool &measured) {
+    DeviceConfig& config = DeviceConfig::get();
+    measured = true;
+    const wombat::stats_mode_t mode = config.getSeriesModes().get(name, wombat::STATS_NUM_MODES);
+    if (mode != wombat::STATS_NUM_MODES) {
+        return mode;
+    }
+
+    if (wombat::is_sdi12_series(name)) {
+        return config.getStatsMode();
+    }
+
+    for (const char *node_series : NODE_SERIES) {
+        if ( ! strcmp(name, node_series)) {
+            return config.getStatsMode();
+        }
+    }
+
+    measured = false;
+    return wombat::STATS_RAW;
+}
+
+static void add_summary_value(JsonArray& timeseries, const char *name, const char *suffix, const double value) {
+    char summary_name[64];
+    snprintf(summary_name, sizeof(summary_name), "%s %s", name, suffix);
+    auto entry = timeseries.add<JsonObject>();
+    entry["name"] = summary_name;
+    entry["value"] = value;
+}
+
+/**
+ * @brief Add the summary of a series to the message. The last value is left out when the series also
+ * sends raw values, because it is the value already in the message.
+ */
+static void add_summary(JsonArray& timeseries, const char *name, const wombat::SeriesStat& s, const wombat::stats_mode_t mode) {
+    add_summary_value(timeseries, name, "n", s.count);
+    add_summary_value(timeseries, name, "min", s.min);
+    add_summary_value(timeseries, name, "max", s.max);
+    add_summary_value(timeseries, name, "mean", s.mean);
+    add_summary_value(timeseries, name, "var", s.variance());
+    if ( ! wombat::stats_sends_raw(mode)) {
+        add_summary_value(timeseries, name, "last", s.last);
+    }
+}
+
+/**
+ * @brief The aggregation stage between reading the sensors and queueing the message.
+ *
+ * Each value of a series with the summary or both mode is added to the statistics of the series, kept
+ * in RTC memory across deep sleep. The values of summary series are taken out of the message, and on
+ * the UTC boundaries of the summary interval the count, minimum, maximum, mean, variance and last
+ * value of each series are added instead and the statistics start again.
+ *
+ * A series that was not read on the cycle its summary is due has its statistics dropped.
+ *
+ * @return false if every measured series was taken out of the message and no summary was due, so the
+ * message is not worth uplinking.
+ */
+bool aggregate_series(JsonArray& timeseries) {
+    DeviceConfig& config = DeviceConfig::get();
+    const uint32_t interval_s = config.getStatsInterval();
+    if (interval_s == 0) {
+        return true;
+    }
+
+    wombat::SeriesStats& stats = get_series_stats();
+    stats.next_cycle();
+    const bool due = stats.summary_due(get_wake_schedule().get_slot(), interval_s, config.getMeasureInterval());
+
+    JsonDocument values;
+    values.set(timeseries);
+    timeseries.clear();
+
+    size_t measured = 0;
+    size_t kept = 0;
+    size_t summarised = 0;
+    for (JsonObjectConst entry : values.as<JsonArrayConst>()) {
+        const char *name = entry["name"];
+        bool is_measured = false;
+        const wombat::stats_mode_t mode = name != nullptr ? series_mode(name, is_measured) : wombat::STATS_RAW;
+        if (is_measured) {
+            measured++;
+        }
+
+        if ( ! wombat::stats_sends_summary(mode)) {
+            timeseries.add(entry);
+            kept += is_measured ? 1 : 0;
+            continue;
+        }
+
+        // A value that cannot be added, such as a NaN from a sensor that did not respond, is sent as it is.
+        const bool added = stats.add(name, entry["value"].as<double>());
+        if ( ! added || wombat::stats_sends_raw(mode)) {
+            timeseries.add(entry);
+            kept++;
+        }
+
+        const wombat::SeriesStat *s = stats.find(name);
+        if (due && s != nullptr) {
+            add_summary(timeseries, name, *s, mode);
+            summarised++;
+        }
+    }
+
+    if (due) {
+        log_to_sdcardf("Summarised %lu series over %lu cycles, %lu series evicted since power on", (unsigned long)summarised,
+                       (unsigned long)stats.get_cycles(), (unsigned long)stats.get_evicted());
+        stats.clear();
+    }
+
+    ESP_LOGI(TAG, "%lu measured series, %lu sent raw, %lu summarised, %lu series in RTC memory",
+             (unsigned long)measured, (unsigned long)kept, (unsigned long)summarised, (unsigned long)stats.size());
+    return measured == 0 || kept > 0 || summarised > 0;
+}
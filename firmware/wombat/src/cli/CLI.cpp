@@ -15,6 +15,7 @@
 #include "cli/device_config/mqtt_cli.h"
 #include "cli/device_config/ftp_cli.h"
 #include "cli/device_config/config_cli.h"
+#include "cli/device_config/stats_cli.h"
 
 //! Command line stream
 Stream *CLI::cliInput = nullptr;
@@ -73,6 +74,14 @@ static const CLI_Command_Definition_t ftpCmd = {
         -1
 };
 
+//! Series statistics commands
+static const CLI_Command_Definition_t statsCmd = {
+        CLIStats::cmd.c_str(),
+        "stats:\r\n Configure which series are uplinked as summaries\r\n",
+        CLIStats::enter_cli,
+        -1
+};
+
 //! Power commands
 static const CLI_Command_Definition_t powerCmd = {
         CLIPower::cmd.c_str(),
@@ -108,6 +117,7 @@ void CLI::init() {
     FreeRTOS_CLIRegisterCommand(&catM1Cmd);
     FreeRTOS_CLIRegisterCommand(&mqttCmd);
     FreeRTOS_CLIRegisterCommand(&ftpCmd);
+    FreeRTOS_CLIRegisterCommand(&statsCmd);
     FreeRTOS_CLIRegisterCommand(&powerCmd);
     FreeRTOS_CLIRegisterCommand(&sdCmd);
     FreeRTOS_CLIRegisterCommand(&spiffsCmd);
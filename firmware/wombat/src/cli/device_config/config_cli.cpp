@@ -17,6 +17,7 @@
 #include "ota_update.h"
 #include "ftp_stack.h"
 #include "globals.h"
+#include "energy.h"
 
 //! ESP32 debugging output tag
 #define TAG "config_cli"
@@ -115,6 +116,13 @@ BaseType_t CLIConfig::enter_cli(char *pcWriteBuffer, size_t xWriteBufferLen,
                 force = (*ch == '1');
             }
 
+            // An update is left for a wake with more energy, rather than risk a brownout part way through it.
+            if ( ! energy_allows_bulk()) {
+                log_to_sdcard("[W] ota deferred, energy low");
+                strncpy(pcWriteBuffer, "ERROR: Deferred, energy low\r\n", xWriteBufferLen - 1);
+                return pdFALSE;
+            }
+
             bool success = false;
             if (cat_m1.make_ready()) {
                 if (connect_to_internet()) {
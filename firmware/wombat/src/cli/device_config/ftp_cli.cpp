@@ -13,6 +13,8 @@
 #include "cli/CLI.h"
 #include "cli/device_config/ftp_cli.h"
 #include "ftp_stack.h"
+#include "energy.h"
+#include "Utils.h"
 
 //! ESP32 debug output tag
 #define TAG "ftp_cli"
@@ -32,6 +34,8 @@ void CLIFTP::dump(Stream& stream) {
     stream.println(config.getFtpUser().c_str());
     stream.print("ftp password ");
     stream.println(config.getFtpPassword().c_str());
+    stream.print("ftp gzip ");
+    stream.println(config.getFtpCompression() ? "on" : "off");
 }
 
 /**
@@ -44,6 +48,7 @@ void CLIFTP::dump(Stream& stream) {
  * - `host`: FTP server hostname.
  * - `user`: FTP  username.
  * - `password`: FTP  password.
+ * - `gzip`: Compress files before they are uploaded, on or off.
  *
  * @param pcWriteBuffer The buffer to write the command's output to.
  * @param xWriteBufferLen The length of the write buffer.
@@ -132,6 +137,28 @@ BaseType_t CLIFTP::enter_cli(char *pcWriteBuffer, size_t xWriteBufferLen,
             return pdFALSE;
         }
 
+        if (!strncmp("gzip", param, paramLen)) {
+            paramNum++;
+            param = FreeRTOS_CLIGetParameter(pcCommandString, paramNum, &paramLen);
+            if (param != nullptr && paramLen > 0) {
+                if (!strncmp("on", param, paramLen)) {
+                    config.setFtpCompression(true);
+                    strncpy(pcWriteBuffer, OK_RESPONSE, xWriteBufferLen - 1);
+                    return pdFALSE;
+                }
+
+                if (!strncmp("off", param, paramLen)) {
+                    config.setFtpCompression(false);
+                    strncpy(pcWriteBuffer, OK_RESPONSE, xWriteBufferLen - 1);
+                    return pdFALSE;
+                }
+            }
+
+            memset(pcWriteBuffer, 0, xWriteBufferLen);
+            strncpy(pcWriteBuffer, "ERROR: Missing or invalid gzip setting, use on or off\r\n", xWriteBufferLen - 1);
+            return pdFALSE;
+        }
+
         if (!strncmp("login", param, paramLen)) {
             bool rc = ftp_login();
             snprintf(pcWriteBuffer, xWriteBufferLen - 1, "%s", rc ? OK_RESPONSE : ERROR_RESPONSE);
@@ -165,6 +192,12 @@ BaseType_t CLIFTP::enter_cli(char *pcWriteBuffer, size_t xWriteBufferLen,
             paramNum++;
             param = FreeRTOS_CLIGetParameter(pcCommandString, paramNum, &paramLen);
             if (param != nullptr && paramLen > 0) {
+                if ( ! energy_allows_bulk()) {
+                    log_to_sdcard("[W] ftp upload deferred, energy low");
+                    strncpy(pcWriteBuffer, "ERROR: Deferred, energy low\r\n", xWriteBufferLen - 1);
+                    return pdFALSE;
+                }
+
                 strncpy(pcWriteBuffer, param, paramLen);
                 pcWriteBuffer[paramLen] = 0;
 
@@ -19,6 +19,8 @@
 #include "mqtt_stack.h"
 #include "globals.h"
 
+#include <pub_window.h>
+
 //! ESP32 debug output tag
 #define TAG "mqtt_cli"
 
@@ -41,6 +43,12 @@ void CLIMQTT::dump(Stream& stream) {
     stream.println(config.getMqttPassword().c_str());
     stream.print("mqtt topic ");
     stream.println(config.mqtt_topic_template);
+    stream.print("mqtt format ");
+    stream.println(config.getMsgFormat() == MSG_FORMAT_CBOR ? "cbor" : "json");
+    stream.print("mqtt batch ");
+    stream.println(config.getMsgBatching() ? "on" : "off");
+    stream.print("mqtt window ");
+    stream.println(config.getMqttWindow());
 }
 
 /**
@@ -54,6 +62,9 @@ void CLIMQTT::dump(Stream& stream) {
  * - `port`: MQTT broker port.
  * - `user`: MQTT broker username.
  * - `password`: MQTT broker password.
+ * - `format`: Uplink message encoding, json or cbor.
+ * - `batch`: Batch stored messages into a single publish, on or off.
+ * - `window`: The most publishes waiting for the broker to acknowledge them at once.
  *
  * @param pcWriteBuffer The buffer to write the command's output to.
  * @param xWriteBufferLen The length of the write buffer.
@@ -187,6 +198,69 @@ BaseType_t CLIMQTT::enter_cli(char *pcWriteBuffer, size_t xWriteBufferLen,
             return pdFALSE;
         }
 
+        if (!strncmp("format", param, paramLen)) {
+            paramNum++;
+            param = FreeRTOS_CLIGetParameter(pcCommandString, paramNum, &paramLen);
+            if (param != nullptr && paramLen > 0) {
+                if (!strncmp("json", param, paramLen)) {
+                    config.setMsgFormat(MSG_FORMAT_JSON);
+                    strncpy(pcWriteBuffer, OK_RESPONSE, xWriteBufferLen - 1);
+                    return pdFALSE;
+                }
+
+                if (!strncmp("cbor", param, paramLen)) {
+                    config.setMsgFormat(MSG_FORMAT_CBOR);
+                    strncpy(pcWriteBuffer, OK_RESPONSE, xWriteBufferLen - 1);
+                    return pdFALSE;
+                }
+            }
+
+            memset(pcWriteBuffer, 0, xWriteBufferLen);
+            strncpy(pcWriteBuffer, "ERROR: Missing or invalid message format, use json or cbor\r\n", xWriteBufferLen - 1);
+            return pdFALSE;
+        }
+
+        if (!strncmp("batch", param, paramLen)) {
+            paramNum++;
+            param = FreeRTOS_CLIGetParameter(pcCommandString, paramNum, &paramLen);
+            if (param != nullptr && paramLen > 0) {
+                if (!strncmp("on", param, paramLen)) {
+                    config.setMsgBatching(true);
+                    strncpy(pcWriteBuffer, OK_RESPONSE, xWriteBufferLen - 1);
+                    return pdFALSE;
+                }
+
+                if (!strncmp("off", param, paramLen)) {
+                    config.setMsgBatching(false);
+                    strncpy(pcWriteBuffer, OK_RESPONSE, xWriteBufferLen - 1);
+                    return pdFALSE;
+                }
+            }
+
+            memset(pcWriteBuffer, 0, xWriteBufferLen);
+            strncpy(pcWriteBuffer, "ERROR: Missing or invalid batch setting, use on or off\r\n", xWriteBufferLen - 1);
+            return pdFALSE;
+        }
+
+        if (!strncmp("window", param, paramLen)) {
+            unsigned long window = 0;
+            paramNum++;
+            param = FreeRTOS_CLIGetParameter(pcCommandString, paramNum, &paramLen);
+            if (param != nullptr && paramLen > 0 && param[0] != '-') {
+                window = strtoul(param, nullptr, 10);
+            }
+
+            memset(pcWriteBuffer, 0, xWriteBufferLen);
+            if (window < 1 || window > wombat::PublishWindow::MAX_WINDOW) {
+                snprintf(pcWriteBuffer, xWriteBufferLen - 1, "ERROR: Missing or invalid window, use 1 to %u\r\n",
+                         (unsigned)wombat::PublishWindow::MAX_WINDOW);
+            } else {
+                config.setMqttWindow(static_cast<uint8_t>(window));
+                strncpy(pcWriteBuffer, OK_RESPONSE, xWriteBufferLen - 1);
+            }
+            return pdFALSE;
+        }
+
         if (!strncmp("login", param, paramLen)) {
             bool rc = mqtt_login();
             snprintf(pcWriteBuffer, xWriteBufferLen-1, "%s", rc ? OK_RESPONSE : ERROR_RESPONSE);
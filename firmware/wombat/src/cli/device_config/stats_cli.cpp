@@ -0,0 +1,201 @@
+/**
+ * @file stats_cli.cpp
+ *
+ * @brief Configure which series are uplinked as summaries through the CLI.
+ *
+ * @date October 2026
+ */
+#include <freertos/FreeRTOS.h>
+#include <Stream.h>
+#include <StreamString.h>
+
+#include "cli/FreeRTOS_CLI.h"
+#include "cli/CLI.h"
+#include "cli/device_config/stats_cli.h"
+
+#include "aggregation.h"
+
+//! ESP32 debug output tag
+#define TAG "stats_cli"
+
+//! Statistics CLI response buffer for output to the user
+static StreamString response_buffer_;
+
+/**
+ * @brief Display the current series statistics configuration.
+ *
+ * @param stream Output stream.
+ */
+void CLIStats::dump(Stream& stream) {
+    stream.print("stats interval ");
+    stream.println(config.getStatsInterval());
+    stream.print("stats mode ");
+    stream.println(wombat::stats_mode_name(config.getStatsMode()));
+
+    const wombat::SeriesModes& modes = config.getSeriesModes();
+    for (size_t i = 0; i < modes.size(); i++) {
+        stream.print("stats series ");
+        stream.print(modes.at(i).name);
+        stream.print(" ");
+        stream.println(wombat::stats_mode_name(modes.at(i).mode));
+    }
+}
+
+/**
+ * @brief Display the statistics kept since the last summary. Series are identified by the hash of
+ * their name because that is all RTC memory holds.
+ *
+ * @param stream Output stream.
+ */
+static void show(Stream& stream) {
+    wombat::SeriesStats& stats = get_series_stats();
+    stream.printf("%lu cycles since the last summary, %lu series evicted since power on\r\n",
+                  (unsigned long)stats.get_cycles(), (unsigned long)stats.get_evicted());
+    for (size_t i = 0; i < stats.size(); i++) {
+        const wombat::SeriesStat& s = stats.at(i);
+        stream.printf("%08lX n %lu min %g max %g mean %g var %g last %g\r\n", (unsigned long)s.hash,
+                      (unsigned long)s.count, s.min, s.max, s.mean, s.variance(), s.last);
+    }
+}
+
+/**
+ * @brief Command-line interface command for the series statistics. Commands include:
+ *
+ * - `list`: List the series statistics configuration.
+ * - `interval`: How often summaries are uplinked, in seconds, 0 for never.
+ * - `mode`: What is uplinked for the measured series without a mode of their own, raw, summary or both.
+ * - `series`: Set the mode of a series by name, or `default` to use the default mode. The name may have spaces.
+ * - `show`: Show the statistics kept since the last summary.
+ * - `clear`: Drop the statistics kept since the last summary.
+ *
+ * @param pcWriteBuffer The buffer to write the command's output to.
+ * @param xWriteBufferLen The length of the write buffer.
+ * @param pcCommandString The command string to be parsed.
+ * @return pdTRUE if there are more responses to come, pdFALSE if this is the final response.
+ */
+BaseType_t CLIStats::enter_cli(char *pcWriteBuffer, size_t xWriteBufferLen,
+                               const char *pcCommandString) {
+    BaseType_t paramLen = 0;
+    UBaseType_t paramNum = 1;
+    const char *param;
+
+    // More in the buffer?
+    if (response_buffer_.available()) {
+        memset(pcWriteBuffer, 0, xWriteBufferLen);
+        if (response_buffer_.length() < xWriteBufferLen) {
+            strncpy(pcWriteBuffer, response_buffer_.c_str(), response_buffer_.length());
+            response_buffer_.clear();
+            return pdFALSE;
+        }
+
+        size_t len = response_buffer_.readBytesUntil('\n', pcWriteBuffer, xWriteBufferLen - 1);
+
+        // readBytesUntil strips the delimiter, so put the '\n' back in.
+        if (len <= xWriteBufferLen) {
+            pcWriteBuffer[len - 1] = '\n';
+        }
+
+        return response_buffer_.available() > 0 ? pdTRUE : pdFALSE;
+    }
+
+    memset(pcWriteBuffer, 0, xWriteBufferLen);
+    param = FreeRTOS_CLIGetParameter(pcCommandString, paramNum, &paramLen);
+    if (param != nullptr && paramLen > 0) {
+        if (!strncmp("list", param, paramLen)) {
+            response_buffer_.clear();
+            dump(response_buffer_);
+            return pdTRUE;
+        }
+
+        if (!strncmp("show", param, paramLen)) {
+            response_buffer_.clear();
+            show(response_buffer_);
+            return pdTRUE;
+        }
+
+        if (!strncmp("clear", param, paramLen)) {
+            get_series_stats().clear();
+            strncpy(pcWriteBuffer, OK_RESPONSE, xWriteBufferLen - 1);
+            return pdFALSE;
+        }
+
+        if (!strncmp("interval", param, paramLen)) {
+            unsigned long interval = 0;
+            bool ok = false;
+            paramNum++;
+            param = FreeRTOS_CLIGetParameter(pcCommandString, paramNum, &paramLen);
+            if (param != nullptr && paramLen > 0 && param[0] != '-') {
+                interval = strtoul(param, nullptr, 10);
+                ok = interval % config.getMeasureInterval() == 0;
+            }
+
+            memset(pcWriteBuffer, 0, xWriteBufferLen);
+            if ( ! ok) {
+                strncpy(pcWriteBuffer, "ERROR: Missing or invalid interval, use 0 or a multiple of the "
+                                       "measure interval\r\n", xWriteBufferLen - 1);
+            } else {
+                config.setStatsInterval(static_cast<uint32_t>(interval));
+                strncpy(pcWriteBuffer, OK_RESPONSE, xWriteBufferLen - 1);
+            }
+            return pdFALSE;
+        }
+
+        if (!strncmp("mode", param, paramLen)) {
+            wombat::stats_mode_t mode;
+            paramNum++;
+            param = FreeRTOS_CLIGetParameter(pcCommandString, paramNum, &paramLen);
+            memset(pcWriteBuffer, 0, xWriteBufferLen);
+            if (wombat::parse_stats_mode(param, paramLen, mode)) {
+                config.setStatsMode(mode);
+                strncpy(pcWriteBuffer, OK_RESPONSE, xWriteBufferLen - 1);
+            } else {
+                strncpy(pcWriteBuffer, "ERROR: Missing or invalid mode, use raw, summary or both\r\n", xWriteBufferLen - 1);
+            }
+            return pdFALSE;
+        }
+
+        if (!strncmp("series", param, paramLen)) {
+            // The name is everything between "series" and the last parameter, which is the mode.
+            paramNum++;
+            const char *name = FreeRTOS_CLIGetParameter(pcCommandString, paramNum, &paramLen);
+            const char *mode_str = nullptr;
+            BaseType_t mode_len = 0;
+            for (paramNum++; (param = FreeRTOS_CLIGetParameter(pcCommandString, paramNum, &paramLen)) != nullptr; paramNum++) {
+                mode_str = param;
+                mode_len = paramLen;
+            }
+
+            memset(pcWriteBuffer, 0, xWriteBufferLen);
+            if (name == nullptr || mode_str == nullptr) {
+                strncpy(pcWriteBuffer, "ERROR: Use stats series NAME raw|summary|both|default\r\n", xWriteBufferLen - 1);
+                return pdFALSE;
+            }
+
+            size_t name_len = mode_str - name;
+            while (name_len > 0 && name[name_len - 1] == ' ') {
+                name_len--;
+            }
+
+            wombat::SeriesModes& modes = config.getSeriesModes();
+            wombat::stats_mode_t mode;
+            bool ok;
+            if (mode_len == 7 && ! strncmp("default", mode_str, mode_len)) {
+                ok = modes.remove(name, name_len);
+            } else {
+                ok = wombat::parse_stats_mode(mode_str, mode_len, mode) && modes.set(name, name_len, mode);
+            }
+
+            if (ok) {
+                strncpy(pcWriteBuffer, OK_RESPONSE, xWriteBufferLen - 1);
+            } else {
+                snprintf(pcWriteBuffer, xWriteBufferLen - 1, "ERROR: Invalid mode, or the name is unknown, longer "
+                         "than %u or there are already %u series with a mode\r\n",
+                         (unsigned)wombat::STATS_NAME_LEN, (unsigned)wombat::STATS_MAX_MODES);
+            }
+            return pdFALSE;
+        }
+    }
+
+    strncpy(pcWriteBuffer, INVALID_CMD_RESPONSE, xWriteBufferLen - 1);
+    return pdFALSE;
+}
@@ -12,6 +12,8 @@
 #include "globals.h"
 #include "cli/CLI.h"
 
+#include <modem_psm.h>
+
 bool getNTPTime(SARA_R5 &r5);
 
 //! Sparkfun SARA-R5 library instance
@@ -45,6 +47,26 @@ static int get_response(uint32_t timeout = 500) {
     return i;
 }
 
+/**
+ * @brief Print the modem power saving settings as commands that restore them.
+ *
+ * @param stream Output stream.
+ */
+void CLICatM1::dump(Stream& stream) {
+    stream.print("c1 psm timers ");
+    stream.print(config.getPsmPeriodic());
+    stream.print(" ");
+    stream.println(config.getPsmActive());
+    stream.print("c1 psm ");
+    stream.println(config.getModemPsm() ? "on" : "off");
+    stream.print("c1 edrx ");
+    if (config.getModemEdrx() > 0) {
+        stream.println(config.getModemEdrx());
+    } else {
+        stream.println("off");
+    }
+}
+
 /**
  * @brief Command line interface handler for a Cat M1 device.
  *
@@ -55,6 +77,9 @@ static int get_response(uint32_t timeout = 500) {
  *     forwarded to the Cat M1 device and all output from the Cat M1 device is
  *     displayed to the user. The mode is exited by pressing ctrl-D.
  * - `pwr`: Set the power state of the Cat M1 device, 1 on, 0 off.
+ * - `psm`: Leave the modem registered in power saving mode between uplinks, on or off,
+ *     or `psm timers` followed by the periodic TAU and active times in seconds.
+ * - `edrx`: The eDRX cycle in seconds, or off.
  * - `on`: Turn the Cat M1 device on.
  * - `off`: Turn the Cat M1 device off.
  * - `restart`: Restart the Cat M1 device.
@@ -149,6 +174,63 @@ static int get_response(uint32_t timeout = 500) {
             }
         }
 
+        if (!strncmp("psm", param, paramLen)) {
+            param = FreeRTOS_CLIGetParameter(pcCommandString, 2, &paramLen);
+            if (param != nullptr && paramLen > 0) {
+                if (!strncmp("on", param, paramLen)) {
+                    config.setModemPsm(true);
+                    snprintf(pcWriteBuffer, xWriteBufferLen-1, OK_RESPONSE);
+                    return pdFALSE;
+                }
+
+                if (!strncmp("off", param, paramLen)) {
+                    config.setModemPsm(false);
+                    snprintf(pcWriteBuffer, xWriteBufferLen-1, OK_RESPONSE);
+                    return pdFALSE;
+                }
+
+                if (!strncmp("timers", param, paramLen)) {
+                    const char *periodic = FreeRTOS_CLIGetParameter(pcCommandString, 3, &paramLen);
+                    const char *active = FreeRTOS_CLIGetParameter(pcCommandString, 4, &paramLen);
+                    if (periodic != nullptr && active != nullptr) {
+                        const uint32_t periodic_s = strtoul(periodic, nullptr, 10);
+                        const uint32_t active_s = strtoul(active, nullptr, 10);
+                        char bits[wombat::PSM_TIMER_BITS + 1];
+                        if (periodic_s > 0 && wombat::psm_encode_periodic(periodic_s, bits) && wombat::psm_encode_active(active_s, bits)) {
+                            config.setPsmTimers(periodic_s, active_s);
+                            snprintf(pcWriteBuffer, xWriteBufferLen-1, OK_RESPONSE);
+                            return pdFALSE;
+                        }
+                    }
+                }
+            }
+
+            snprintf(pcWriteBuffer, xWriteBufferLen-1, "\r\nERROR: use psm on, psm off or psm timers PERIODIC_SECS ACTIVE_SECS\r\n");
+            return pdFALSE;
+        }
+
+        if (!strncmp("edrx", param, paramLen)) {
+            param = FreeRTOS_CLIGetParameter(pcCommandString, 2, &paramLen);
+            if (param != nullptr && paramLen > 0) {
+                if (!strncmp("off", param, paramLen)) {
+                    config.setModemEdrx(0);
+                    snprintf(pcWriteBuffer, xWriteBufferLen-1, OK_RESPONSE);
+                    return pdFALSE;
+                }
+
+                const uint32_t edrx_s = strtoul(param, nullptr, 10);
+                char bits[wombat::EDRX_BITS + 1];
+                if (wombat::edrx_encode(edrx_s, bits)) {
+                    config.setModemEdrx(edrx_s);
+                    snprintf(pcWriteBuffer, xWriteBufferLen-1, OK_RESPONSE);
+                    return pdFALSE;
+                }
+            }
+
+            snprintf(pcWriteBuffer, xWriteBufferLen-1, "\r\nERROR: use edrx off or edrx SECS, at least 6\r\n");
+            return pdFALSE;
+        }
+
         if (!strncmp("ls", param, paramLen)) {
             if ( ! r5_ok) {
                 snprintf(pcWriteBuffer, xWriteBufferLen-1, "\r\nERROR: modem not ready\r\n");
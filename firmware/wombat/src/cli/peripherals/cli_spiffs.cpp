@@ -17,6 +17,7 @@
 #include "cli/CLI.h"
 #include "cli/peripherals/cli_spiffs.h"
 #include "Utils.h"
+#include "transfers.h"
 
 //! ESP32 debug output tag
 #define TAG "cli_spiffs"
@@ -144,6 +145,11 @@ BaseType_t CLISPIFFS::enter_cli(char *pcWriteBuffer, size_t xWriteBufferLen, con
                     max_len--;
                 }
 
+                // As for cat, only copy the source filename and not the destination after it.
+                if (paramLen < max_len) {
+                    max_len = paramLen;
+                }
+
                 strncat(g_buffer, filename, max_len);
 
                 paramNum++;
@@ -160,11 +166,56 @@ BaseType_t CLISPIFFS::enter_cli(char *pcWriteBuffer, size_t xWriteBufferLen, con
 
                     if (fcd == 1 && *dest_filename == '/') {
                         dest_filename++;
+                        dest_filename_len--;
+                    }
+
+                    // The source filename must be copied out of g_buffer because the copy uses g_buffer.
+                    const String src_filename(g_buffer);
+                    char dest_buf[64];
+                    snprintf(dest_buf, sizeof(dest_buf), "%s%.*s", fcd != 1 && *dest_filename != '/' ? "/" : "",
+                             static_cast<int>(dest_filename_len), dest_filename);
+                    const String dest_path(dest_buf);
+
+                    FsFileSource src(SPIFFS, src_filename.c_str());
+                    if ( ! src) {
+                        snprintf(pcWriteBuffer, xWriteBufferLen - 1, "ERROR: could not open %s\r\n", src_filename.c_str());
+                        return pdFALSE;
                     }
 
+                    bool ok = false;
+                    if (fcd == 1) {
+                        // Appending to an existing file would leave its old contents at the start.
+                        r5.deleteFile(dest_path);
+                        R5FileSink sink(dest_path);
+                        ok = transfer(src, sink);
+                    } else if (fcd == 2 && ! SDCardInterface::is_ready()) {
+                        snprintf(pcWriteBuffer, xWriteBufferLen - 1, "ERROR: SD card not initialised\r\n");
+                        return pdFALSE;
+                    } else {
+                        FsFileSink sink(fcd == 2 ? static_cast<fs::FS&>(SD) : static_cast<fs::FS&>(SPIFFS), dest_path.c_str());
+                        ok = sink && transfer(src, sink);
+
+                        // The binary sensor definitions are rebuilt from the new file on the next wake.
+                        if (fcd != 2 && dest_path == sdi12defn_spiffs) {
+                            SPIFFS.remove(sdi12defn_bin_spiffs);
+                        }
+                    }
 
+                    if ( ! ok) {
+                        snprintf(pcWriteBuffer, xWriteBufferLen - 1, "ERROR: copy to %s failed\r\n", dest_path.c_str());
+                        return pdFALSE;
+                    }
+
+                    snprintf(pcWriteBuffer, xWriteBufferLen - 1, OK_RESPONSE);
+                    return pdFALSE;
                 }
+
+                snprintf(pcWriteBuffer, xWriteBufferLen - 1, "ERROR: dest:filename required\r\n");
+                return pdFALSE;
             }
+
+            snprintf(pcWriteBuffer, xWriteBufferLen - 1, "ERROR: filename required\r\n");
+            return pdFALSE;
         }
 
         if (!strncmp("rm", param, paramLen)) {
@@ -11,6 +11,7 @@
 #include "globals.h"
 #include "sd-card/interface.h"
 #include "cli/CLI.h"
+#include "Utils.h"
 
 //! ESP32 debug output tag
 #define TAG "cli_sd"
@@ -40,6 +41,9 @@ BaseType_t CLISDCard::enter_cli(char *pcWriteBuffer, size_t xWriteBufferLen,
 
     static unsigned int step = 0;
 
+    // Write out any buffered log lines and close the log file so it can be read or removed.
+    close_sdcard_log();
+
     memset(pcWriteBuffer, 0, xWriteBufferLen);
     param = FreeRTOS_CLIGetParameter(pcCommandString, paramNum, &paramLen);
     if (param != nullptr && paramLen > 0) {
@@ -84,7 +84,7 @@ BaseType_t CLISdi12::enter_cli(char *pcWriteBuffer, size_t xWriteBufferLen,
         if (!strncmp("scan", param, paramLen)) {
             sdi12.begin();
 
-            dpi12.scan_bus(sensors);
+            scan_sensors();
             for (size_t i = 0; i < sensors.count; i++) {
                 response_buffer_.print((char*)&sensors.sensors[i]);
                 response_buffer_.print("\r\n");
@@ -0,0 +1,104 @@
+#include <Arduino.h>
+#include "clock_sync.h"
+#include "Utils.h"
+
+#include <esp_attr.h>
+#include <esp_log.h>
+#include <esp_sleep.h>
+#include <soc/rtc.h>
+#include <sys/time.h>
+
+#define TAG "clock_sync"
+
+static RTC_DATA_ATTR wombat::SleepClockState clock_state;
+static wombat::SleepClock sleep_clock(clock_state);
+
+//! The local time the last deep sleep started, or 0 if it was not started by clock_sleep_for().
+static RTC_DATA_ATTR int64_t sleep_start_us = 0;
+
+static RTC_DATA_ATTR wombat::WakeScheduleState schedule_state;
+static wombat::WakeSchedule wake_schedule(schedule_state);
+
+//! The current time by the node's clock, in microseconds since 1970.
+int64_t clock_now_us(void) {
+    struct timeval tv;
+    gettimeofday(&tv, nullptr);
+    return static_cast<int64_t>(tv.tv_sec) * 1000000 + tv.tv_usec;
+}
+
+wombat::SleepClock& get_sleep_clock(void) {
+    return sleep_clock;
+}
+
+wombat::WakeSchedule& get_wake_schedule(void) {
+    return wake_schedule;
+}
+
+/**
+ * @brief Load the sleep clock state, record the sleep that has just ended, and correct the clock for
+ * the drift expected since the last NTP sync. Called on each wake once the RTC slow clock source has
+ * been chosen.
+ *
+ * The sleep is measured by the node's clock rather than taken from the timer, because a wake by the
+ * button or the ULP ends it early. A reset rather than a wake from deep sleep means the time since
+ * the sleep started was not all spent asleep, so it is not counted.
+ */
+void clock_sync_begin(void) {
+    sleep_clock.begin(static_cast<uint8_t>(rtc_clk_slow_freq_get()));
+
+    if (sleep_start_us != 0) {
+        const int64_t slept_us = clock_now_us() - sleep_start_us;
+        if (esp_sleep_get_wakeup_cause() != ESP_SLEEP_WAKEUP_UNDEFINED && slept_us > 0) {
+            sleep_clock.slept(static_cast<uint64_t>(slept_us));
+        }
+        sleep_start_us = 0;
+    }
+
+    const int64_t correction = sleep_clock.correction();
+    if (correction != 0) {
+        const int64_t corrected = clock_now_us() + correction;
+        struct timeval tv;
+        tv.tv_sec = static_cast<time_t>(corrected / 1000000);
+        tv.tv_usec = static_cast<suseconds_t>(corrected % 1000000);
+        settimeofday(&tv, nullptr);
+    }
+
+    ESP_LOGI(TAG, "Sleep clock drift %ld ppb from %lu windows%s, corrected by %ld us", (long)sleep_clock.get_drift_ppb(),
+             (unsigned long)sleep_clock.get_windows(), sleep_clock.is_trusted() ? " (trusted)" : "", (long)correction);
+}
+
+//! True if the clock must be set by NTP on this wake.
+bool clock_ntp_due(void) {
+    return sleep_clock.sync_due(clock_now_us());
+}
+
+/**
+ * @brief Record that NTP has set the clock.
+ *
+ * @param error_us the time from NTP less the time by the node's clock.
+ * @param now_us the time from NTP, in microseconds since 1970.
+ */
+void clock_ntp_synced(const int64_t error_us, const int64_t now_us) {
+    sleep_clock.synced(error_us, now_us);
+    log_to_sdcardf("NTP corrected clock by %ld ms, drift %ld ppb", (long)(error_us / 1000), (long)sleep_clock.get_drift_ppb());
+}
+
+/**
+ * @brief The time to set the deep sleep timer to, for a sleep of sleep_us. Called just before deep
+ * sleep starts.
+ *
+ * The measured drift of the sleep clock is used once it is known, until then the sleep is scaled
+ * by the manual adjustment set with `interval clockmult`. The start of the sleep is recorded so
+ * clock_sync_begin() can count how long it lasted.
+ */
+uint64_t clock_sleep_for(const uint64_t sleep_us, const float manual_adjustment) {
+    uint64_t local_us;
+    if (sleep_clock.has_estimate()) {
+        local_us = sleep_clock.sleep_for(sleep_us);
+    } else {
+        local_us = static_cast<uint64_t>(static_cast<float>(sleep_us) * manual_adjustment);
+    }
+
+    sleep_start_us = clock_now_us();
+    return local_us;
+}
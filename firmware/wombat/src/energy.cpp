@@ -0,0 +1,59 @@
+#include <Arduino.h>
+#include "energy.h"
+#include "Utils.h"
+#include "DeviceConfig.h"
+
+#include <esp_attr.h>
+#include <esp_log.h>
+
+#define TAG "energy"
+
+static RTC_DATA_ATTR wombat::EnergyPolicyState energy_state;
+static wombat::EnergyPolicy energy_policy(energy_state);
+
+//! True once the level for this wake has been chosen.
+static bool energy_evaluated = false;
+
+wombat::EnergyPolicy& get_energy_policy(void) {
+    return energy_policy;
+}
+
+/**
+ * @brief Load the battery and solar history and choose the energy level for this wake from the
+ * readings of the previous wakes. Called on each wake before deciding whether to uplink.
+ */
+void energy_begin(void) {
+    energy_policy.begin();
+    const wombat::energy_level_t previous = energy_policy.get_level();
+    const wombat::energy_level_t level = energy_policy.evaluate();
+    energy_evaluated = true;
+
+    ESP_LOGI(TAG, "Energy level %s, battery %u mV from %lu readings, harvest: %d",
+             wombat::EnergyPolicy::level_name(level), energy_policy.get_battery_mv(),
+             (unsigned long)energy_policy.get_count(), energy_policy.has_harvest());
+    if (level != previous) {
+        log_to_sdcardf("Energy level %s -> %s, battery %u mV", wombat::EnergyPolicy::level_name(previous),
+                       wombat::EnergyPolicy::level_name(level), energy_policy.get_battery_mv());
+    }
+}
+
+/**
+ * @brief Add this wake's readings to the history.
+ *
+ * @param battery_v the battery voltage, negative if it could not be read.
+ * @param solar_v the solar panel voltage, negative if it could not be read.
+ */
+void energy_record(const double battery_v, const double solar_v) {
+    energy_policy.begin();
+    energy_policy.add(battery_v, solar_v, DeviceConfig::get().getMeasureInterval());
+}
+
+/**
+ * @brief True if there is energy for bulk transfers, such as FTP uploads and OTA updates.
+ *
+ * Until the level has been chosen for this wake, such as in the REPL entered with the programmable
+ * button, the person at the node decides.
+ */
+bool energy_allows_bulk(void) {
+    return ! energy_evaluated || energy_policy.allows_bulk();
+}
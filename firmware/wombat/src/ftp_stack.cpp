@@ -3,25 +3,27 @@
 #include "globals.h"
 #include "sd-card/interface.h"
 #include "Utils.h"
+#include "transfers.h"
+
+#include <crc32.h>
+#include <ftp_pipeline.h>
+#include <gzip_stream.h>
 
 #define TAG "ftp_stack"
 
-static CommandURCVector<SARA_R5_ftp_command_opcode_t> urcs;
+static CommandURCRing<SARA_R5_ftp_command_opcode_t> urcs;
 
 static void ftp_cmd_callback(int cmd, int result) {
     ESP_LOGI(TAG, "cmd: %d, result: %d", cmd, result);
     log_to_sdcardf("ftp cb cmd: %d, result: %d", cmd, result);
 
-    urcs.addPair(static_cast<SARA_R5_ftp_command_opcode_t>(cmd), result);
-
+    int e1 = 0, e2 = 0;
     if (result == 0) {
-        int e1, e2;
         r5.getFTPprotocolError(&e1, &e2);
-        urcs.back().err1 = e1;
-        urcs.back().err2 = e2;
-
         ESP_LOGE(TAG, "FTP op failed: %d, %d", e1, e2);
     }
+
+    urcs.add(static_cast<SARA_R5_ftp_command_opcode_t>(cmd), result, e1, e2);
 }
 
 [[nodiscard]]
@@ -168,11 +170,144 @@ bool ftp_change_dir() {
     return result == 1;
 }
 
+/**
+ * Reads the progress of an earlier upload from the SD card.
+ *
+ * @return true if the manifest exists and is valid.
+ */
+static bool load_manifest(const String& path, wombat::UploadManifest& manifest) {
+    if ( ! SD.exists(path)) {
+        return false;
+    }
+
+    uint8_t buf[wombat::UploadManifest::SIZE];
+    FsFileSource file(SD, path.c_str());
+    return file && file.read(buf, sizeof(buf)) == sizeof(buf) && manifest.decode(buf, sizeof(buf));
+}
+
+static bool save_manifest(const String& path, const wombat::UploadManifest& manifest) {
+    uint8_t buf[wombat::UploadManifest::SIZE];
+    manifest.encode(buf);
+
+    FsFileSink file(SD, path.c_str());
+    if ( ! file || ! file.write(buf, sizeof(buf)) || ! file.finish()) {
+        ESP_LOGE(TAG, "Could not write %s", path.c_str());
+        log_to_sdcardf("[E] Could not write %s", path.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * Writes the chunks of an SD card file to the modem and uploads them to the FTP server.
+ *
+ * The +UUFTPCR for a PUT usually arrives while the next chunk is being written. The SARA R5 library
+ * keeps URCs that arrive during a command in its backlog, so the result is seen by the bufferedPoll()
+ * in waitForURC().
+ */
+class R5ChunkStore : public wombat::ChunkStore {
+public:
+    R5ChunkStore(const String& filename, wombat::XferSource& src, wombat::UploadManifest& manifest, const String& manifest_path, const size_t file_size, const bool compress) :
+        filename(filename), src(src), manifest(manifest), manifest_path(manifest_path), file_size(file_size), compress(compress) {}
+
+    bool stage(const uint32_t chunk, const size_t len) override {
+        set_chunk_filename(chunk);
+
+        R5FileSink sink(chunk_filename);
+        size_t bytes_copied = 0;
+        if ( ! compress) {
+            if ( ! transfer(src, sink, len, &bytes_copied) || bytes_copied != len) {
+                ESP_LOGE(TAG, "Copy to chunk file failed after %lu bytes", (unsigned long)bytes_copied);
+                log_to_sdcard("[E] ftp upload failing b");
+                return false;
+            }
+
+            ESP_LOGI(TAG, "Written chunk %s", chunk_filename);
+            return true;
+        }
+
+        // Each chunk is a complete gzip member, so the chunk files can be concatenated and
+        // decompressed on the server whichever uplink each was sent in.
+        wombat::GzipSink gz(sink);
+        if ( ! transfer(src, gz, len, &bytes_copied) || bytes_copied != len || ! gz.finish()) {
+            ESP_LOGE(TAG, "Compress to chunk file failed after %lu bytes", (unsigned long)bytes_copied);
+            log_to_sdcard("[E] ftp upload failing b");
+            return false;
+        }
+
+        ESP_LOGI(TAG, "Written chunk %s, %lu bytes compressed to %lu", chunk_filename, (unsigned long)gz.get_in_bytes(), (unsigned long)gz.get_out_bytes());
+        return true;
+    }
+
+    bool start_put(const uint32_t chunk) override {
+        set_chunk_filename(chunk);
+
+        SARA_R5_error_t err = r5.ftpPutFile(chunk_filename, chunk_filename);
+        if (err != SARA_R5_ERROR_SUCCESS) {
+            ESP_LOGE(TAG, "FTP put != OK");
+            log_to_sdcard("[E] FTP put != OK");
+            return false;
+        }
+
+        return true;
+    }
+
+    bool wait_put(const uint32_t chunk) override {
+        int result = -1;
+        urcs.waitForURC(SARA_R5_FTP_COMMAND_PUT_FILE, &result, 300, 2000);
+        if (result != 1) {
+            ESP_LOGE(TAG, "Upload chunk %lu failed", (unsigned long)chunk);
+            log_to_sdcard("[E] ftp upload failing d");
+            return false;
+        }
+
+        ESP_LOGI(TAG, "Uploaded chunk %lu to ftp", (unsigned long)chunk);
+        log_to_sdcard("Uploaded chunk to ftp");
+        return true;
+    }
+
+    bool remove(const uint32_t chunk) override {
+        set_chunk_filename(chunk);
+
+        SARA_R5_error_t err = r5.deleteFile(chunk_filename);
+        if (err != SARA_R5_ERROR_SUCCESS) {
+            ESP_LOGE(TAG, "Delete chunk failed: %d", err);
+            log_to_sdcardf("[E] Delete chunk failed: %d", err);
+            return false;
+        }
+
+        return true;
+    }
+
+    void uploaded(const uint32_t chunk) override {
+        manifest.confirm(chunk, file_size);
+        save_manifest(manifest_path, manifest);
+    }
+
+private:
+    static const size_t filename_size = 50;
+
+    const String& filename;
+    wombat::XferSource& src;
+    wombat::UploadManifest& manifest;
+    const String& manifest_path;
+    const size_t file_size;
+    const bool compress;
+    char chunk_filename[filename_size + 1];
+
+    void set_chunk_filename(const uint32_t chunk) {
+        snprintf(chunk_filename, filename_size, compress ? "%s_%05lu.gz" : "%s_%05lu", filename.c_str(), (unsigned long)chunk);
+    }
+};
+
 [[nodiscard]]
 bool ftp_upload_file(const String& filename) {
     DeviceConfig &config = DeviceConfig::get();
 
     log_to_sdcard("ftp upload");
+    // The file may be the SD card log, which must be written out and closed to be read.
+    close_sdcard_log();
 
     const String path_name = "/" + filename;
     size_t file_size = SDCardInterface::get_file_size(path_name.c_str());
@@ -194,6 +329,7 @@ bool ftp_upload_file(const String& filename) {
         return false;
     }
 
+    // Two chunks are on the modem at once while the next is written during the upload of the previous.
     size = size / 3;
     size_t CHUNK_SIZE = size; // Allow for space remaining on the modem
     if (CHUNK_SIZE < MAX_G_BUFFER) {
@@ -203,9 +339,7 @@ bool ftp_upload_file(const String& filename) {
     }
 
     ESP_LOGI(TAG, "Each block with be of size %zu", CHUNK_SIZE);
-
-    size_t num_chunks = std::ceil(file_size / CHUNK_SIZE);
-    ESP_LOGI(TAG, "Size of file to upload is %zu, will be split into %zu chunks", file_size, num_chunks + 1);
+    ESP_LOGI(TAG, "Size of file to upload is %zu", file_size);
 
     //Create unique directory on ftp server for sd card files
     bool dir_created = ftp_create_remote_dir();
@@ -221,89 +355,66 @@ bool ftp_upload_file(const String& filename) {
         return false;
     }
 
-    static const size_t filename_size = 50;
-    char chunk_filename[filename_size + 1]; // Filename for chunk
-    bool success = true;
-    size_t file_position = 0;
-    for (int i = 0; i <= num_chunks && success; i++) {
-        size_t bytes_read_chnk = 0; // Number of bytes read into the current chunk
-
-        snprintf(chunk_filename, filename_size, "%s_%05d", filename.c_str(), i);
-
-        // Write the file chunk to the modem fs.
-        while ((bytes_read_chnk < CHUNK_SIZE) && (file_position < file_size)) {
-            size_t bytes_to_read = MAX_G_BUFFER;
-            if (CHUNK_SIZE - bytes_read_chnk < MAX_G_BUFFER) {
-                bytes_to_read = CHUNK_SIZE - bytes_read_chnk;
-            }
-
-            size_t bytes_read = SDCardInterface::read_file(path_name.c_str(), g_buffer, bytes_to_read, file_position);
-            if (bytes_read == 0) {
-                ESP_LOGE(TAG, "File bytes_read failed");
-                log_to_sdcard("[E] ftp upload failing a");
-                success = false;
-                break;
-            }
-
-            int bytes_to_write = static_cast<int>(bytes_read);
-            SARA_R5_error_t err = r5.appendFileContents(chunk_filename, g_buffer, bytes_to_write);
-            delay(20);
-            if (err != SARA_R5_ERROR_SUCCESS) {
-                ESP_LOGE(TAG, "Append to chunk file failed, error: %d", err);
-                log_to_sdcard("[E] ftp upload failing b");
-                success = false;
-                break;
-            }
-
-            file_position += bytes_read;
-            bytes_read_chnk += bytes_read;
+    // The SD card file stays open for the whole upload and is read in the background while each
+    // block is written to the modem.
+    FsFileSource sd_file(SD, path_name.c_str());
+    if ( ! sd_file) {
+        ESP_LOGE(TAG, "Could not open file on SD card");
+        log_to_sdcard("[E] ftp upload failing a");
+        return false;
+    }
 
-            ESP_LOGI(TAG, "Bytes written %d, bytes written in chunk %d", file_position, bytes_read_chnk);
-        }
+    // Resume an earlier upload of the same file that was interrupted, by the timeout task, a brownout
+    // or a chunk that could not be sent, at the first chunk the server has not confirmed.
+    const String manifest_path = path_name + ".ftp";
+    wombat::UploadManifest manifest;
+    const bool have_manifest = load_manifest(manifest_path, manifest);
+
+    // The head of a file that has grown since the manifest was made is the length it had then.
+    const size_t head_len = manifest.head_length(filename.c_str(), file_size);
+    if (sd_file.read(reinterpret_cast<uint8_t*>(g_buffer), head_len) != static_cast<int32_t>(head_len)) {
+        ESP_LOGE(TAG, "Could not read file on SD card");
+        log_to_sdcard("[E] ftp upload failing a");
+        return false;
+    }
 
-        ESP_LOGI(TAG, "Written chunk %s, now uploading", chunk_filename);
+    // Chunks of an earlier upload are only resumed if two of them still fit in the space free on the
+    // modem now, otherwise the upload starts again with chunks of CHUNK_SIZE.
+    const uint32_t head_crc = wombat::crc32(g_buffer, head_len);
+    const size_t saved_chunk_size = manifest.get_chunk_size();
+    const uint32_t first_chunk = manifest.start(filename.c_str(), file_size, head_crc, CHUNK_SIZE, config.getFtpCompression());
+    const size_t chunk_size = manifest.get_chunk_size();
+    if (have_manifest && saved_chunk_size > chunk_size) {
+        ESP_LOGW(TAG, "Chunks of %lu bytes no longer fit on the modem, restarting upload", (unsigned long)saved_chunk_size);
+        log_to_sdcardf("[W] ftp upload restarting, chunks of %lu bytes no longer fit on the modem", (unsigned long)saved_chunk_size);
+    }
 
-        // Upload chunk to ftp server.
-        uint8_t retry = 0;
+    if (have_manifest && first_chunk > 0) {
+        ESP_LOGI(TAG, "Resuming upload at chunk %lu, %lu bytes already sent, gzip: %d", (unsigned long)first_chunk,
+                 (unsigned long)manifest.get_confirmed(), manifest.get_gzip());
+        log_to_sdcardf("ftp upload resuming at chunk %lu", (unsigned long)first_chunk);
+    }
 
-        // Loop condition is success so the loop is not entered if reading the chunk from the SD card
-        // or writing it to the modem fs failed above.
-        while (success) {
-            retry++;
-            if (retry > 3) {
-                ESP_LOGE(TAG, "Upload failed, giving up");
-                log_to_sdcard("[E] ftp upload failing c");
-                success = false;
-                break;
-            }
+    if (static_cast<size_t>(first_chunk) * chunk_size >= file_size) {
+        ESP_LOGI(TAG, "%s has already been uploaded", filename.c_str());
+        SD.remove(manifest_path);
+        log_to_sdcard("ftp upload ok");
+        return true;
+    }
 
-            SARA_R5_error_t err = r5.ftpPutFile(chunk_filename, chunk_filename);
-            delay(20);
-            if (err != SARA_R5_ERROR_SUCCESS) {
-                ESP_LOGE(TAG, "FTP put != OK");
-                log_to_sdcard("[E] FTP put != OK");
-                continue;
-            }
+    if ( ! save_manifest(manifest_path, manifest) || ! sd_file.seek(static_cast<size_t>(first_chunk) * chunk_size)) {
+        return false;
+    }
 
-            int result = -1;
-            urcs.waitForURC(SARA_R5_FTP_COMMAND_PUT_FILE, &result, 300, 2000);
-            if (result == 1) {
-                ESP_LOGI(TAG, "Uploaded chunk to ftp");
-                log_to_sdcard("Uploaded chunk to ftp");
-                break;
-            } else {
-                ESP_LOGE(TAG, "Upload chunk failed");
-                log_to_sdcard("[E] ftp upload failing d");
-            }
-        }
+    BackgroundSource src(sd_file);
+    // A resumed upload is compressed, and its chunks named, as it was when it started.
+    R5ChunkStore store(filename, src, manifest, manifest_path, file_size, manifest.get_gzip());
+    wombat::PipelinedUpload upload(store, file_size, chunk_size);
 
-        SARA_R5_error_t err = r5.deleteFile(chunk_filename);
-        delay(20);
-        if (err != SARA_R5_ERROR_SUCCESS) {
-            ESP_LOGE(TAG, "Delete chunk failed: %d", err);
-            log_to_sdcardf("[E] Delete chunk failed: %d", err);
-            success = false;
-        }
+    const bool success = upload.run(first_chunk);
+    ESP_LOGI(TAG, "%lu chunks, %lu PUT commands", (unsigned long)upload.num_chunks(), (unsigned long)upload.get_puts());
+    if (success) {
+        SD.remove(manifest_path);
     }
 
     if (success) {
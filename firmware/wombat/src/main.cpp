@@ -39,6 +39,10 @@
 #include "power_monitoring/solar.h"
 
 #include "Utils.h"
+#include "profiler.h"
+#include "clock_sync.h"
+#include "energy.h"
+#include "modem_power.h"
 
 #define TAG "wombat"
 
@@ -140,7 +144,11 @@ int my_log_printf(const char *fmt, ...) {
         vTaskDelay(delay);
 
         if (timeout_active && timeout_restart) {
-            log_to_sdcard("[E] timeout_task forced reboot");
+            // Keep the profile of this wake, it is the one that shows why the node was stuck.
+            profile_finish();
+            // Bounded waits, a task stuck writing to the SD card must not stop the reboot.
+            log_to_sdcard("[E] timeout_task forced reboot", 1000);
+            flush_sdcard_log();
             ESP_LOGE(TAG, "Removing power from R5");
             cat_m1.power_supply(false);
             vTaskDelay(5000 / portTICK_PERIOD_MS); // 5s
@@ -154,6 +162,9 @@ int my_log_printf(const char *fmt, ...) {
 static TaskHandle_t xHandle = nullptr;
 
 void setup(void) {
+    // millis() starts when the app starts, so this is the time since the last boot stage began.
+    get_profiler().add(wombat::WAKE_PHASE_BOOT, millis());
+
     // Disable brown-out detection until the BT LE radio is running.
     // The radio startup triggers a brown out detection, but the
     // voltage seems ok and the node keeps running.
@@ -162,6 +173,9 @@ void setup(void) {
     pinMode(PROG_BTN, INPUT);
     progBtnPressed = digitalRead(PROG_BTN);
 
+    // Before any task that logs is started.
+    init_sdcard_log();
+
     // The timeout task is pinned to core 0, which usually runs the wireless stacks. We're not using
     // them so the core is free and this should mean the task is not blocked by anything the app does.
     timeout_active = true;
@@ -181,7 +195,9 @@ void setup(void) {
     setenv("TZ", "UTC", 1);
     tzset();
 
+    profile_start(wombat::WAKE_PHASE_SPIFFS);
     spiffs_ok = SPIFFS.begin();
+    profile_stop(wombat::WAKE_PHASE_SPIFFS);
 
     // The device configuration singleton is created on entry to setup() due to C++ object creation rules.
     // The node id is available without loading the configuration because it is retrieved from the ESP32
@@ -191,7 +207,8 @@ void setup(void) {
 
     //ESP_LOGI(TAG, "Old func: %p", old_log_fn);
 
-    ESP_LOGI(TAG, "Wake up time: %s", iso8601());
+    char timestamp[ISO8601_LEN];
+    ESP_LOGI(TAG, "Wake up time: %s", iso8601(timestamp, sizeof(timestamp)));
     ESP_LOGI(TAG, "CPU MHz: %lu", getCpuFrequencyMhz());
 
     ESP_LOGI(TAG, "Boot partition");
@@ -206,6 +223,9 @@ void setup(void) {
         select_rtc_slow_clk();
     }
 
+    // Correct the clock for the drift of the slow clock during the last sleep.
+    clock_sync_begin();
+
     // Try to avoid it getting optimized out.
     uxTopUsedPriority = configMAX_PRIORITIES - 1;
 
@@ -238,6 +258,7 @@ void setup(void) {
     while(!LTE_Serial) {
         delay(1);
     }
+    watch_modem_rx();
 
     // ==== CAT-M1 Setup END ====
 
@@ -254,8 +275,10 @@ void setup(void) {
 
     // This must be done before the config is loaded because the config file is
     // a list of commands.
+    profile_start(wombat::WAKE_PHASE_CONFIG);
     CLI::init();
     config.load();
+    profile_stop(wombat::WAKE_PHASE_CONFIG);
     config.dumpConfig(Serial);
 
     // Enable the brown out detection now the node has stabilised its
@@ -301,20 +324,45 @@ void setup(void) {
         config.reset();
     }
 
+    // Measurements are made on the UTC boundaries of the measurement interval, and uplinks on the
+    // boundaries of the uplink interval, so all nodes measure and uplink at the same times.
+    wombat::WakeSchedule& schedule = get_wake_schedule();
+    schedule.begin();
+    schedule.wake(clock_now_us(), measurement_interval_secs);
+
+    // The uplink interval is stretched when the battery is low or the panel has not been charging it,
+    // and shortened when the battery is full and charging. It stays a multiple of the measurement interval.
+    energy_begin();
+    const uint32_t energy_uplink_secs = get_energy_policy().uplink_interval(uplink_interval_secs, measurement_interval_secs);
+
     // Assuming the measure interval is a factor of the uplink interval,
     // boots_between_uplinks is the number of boots between uplinks.
-    uint16_t boots_between_uplinks = uplink_interval_secs / measurement_interval_secs;
+    uint32_t boots_between_uplinks = energy_uplink_secs / measurement_interval_secs;
 
-    // If the current boot cycle is a multiple of boots_between_uplinks, then this boot cycle
-    // should do an uplink.
-    bool is_uplink_cycle = config.getBootCount() % boots_between_uplinks == 0;
+    // Until the clock has been set after a power on there are no boundaries, so every
+    // boots_between_uplinks boot cycle does an uplink. The first boot is one of them.
+    bool is_uplink_cycle;
+    if (schedule.get_slot() > 0) {
+        is_uplink_cycle = schedule.is_slot_on(energy_uplink_secs);
+    } else {
+        is_uplink_cycle = config.getBootCount() % boots_between_uplinks == 0;
+    }
 
     ESP_LOGI(TAG, "Boot count: %lu, measurement interval: %u, "
-                  "uplink interval: %u, uplink_interval_secs/measurement_interval_secs: %u, uplink this cycle: %d",
-             config.getBootCount(), measurement_interval_secs, uplink_interval_secs, boots_between_uplinks, is_uplink_cycle);
+                  "uplink interval: %u (%lu for energy), slot: %lld, missed slots: %lu, uplink this cycle: %d",
+             config.getBootCount(), measurement_interval_secs, uplink_interval_secs, (unsigned long)energy_uplink_secs,
+             schedule.get_slot(), (unsigned long)schedule.get_missed_before(), is_uplink_cycle);
+    if (schedule.get_missed_before() > 0) {
+        log_to_sdcardf("[W] missed %lu slots", (unsigned long)schedule.get_missed_before());
+    }
 
+    // On an uplink cycle the modem is brought up on core 0 while the sensors are read, so the wake
+    // takes about as long as the slower of the two instead of both together.
+    bool connect_in_task = false;
     if (is_uplink_cycle) {
-        if ( ! connect_to_internet()) {
+        uplink_energy_start();
+        connect_in_task = start_connect_task();
+        if ( ! connect_in_task && ! connect_to_internet()) {
             ESP_LOGW(TAG, "Could not connect to the internet on an uplink cycle. This is now a measurement-only cycle");
             log_to_sdcard("[E] cti failed, only measuring");
             is_uplink_cycle = false;
@@ -323,14 +371,28 @@ void setup(void) {
 
     log_to_sdcard("init_sensors");
     init_sensors();
+    flush_sdcard_log();
     log_to_sdcard("sensor_task");
     sensor_task();
     log_to_sdcard("back from sensor_task");
+    flush_sdcard_log();
+
+    // sensor_task() has already waited for the connect task, this gets the result.
+    if (connect_in_task && ! wait_for_connect_task()) {
+        ESP_LOGW(TAG, "Could not connect to the internet on an uplink cycle. This is now a measurement-only cycle");
+        log_to_sdcard("[E] cti failed, only measuring");
+        is_uplink_cycle = false;
+    }
 
     if (is_uplink_cycle) {
         log_to_sdcard("send_messages");
+        profile_start(wombat::WAKE_PHASE_UPLINK);
         send_messages();
+        profile_stop(wombat::WAKE_PHASE_UPLINK);
+        // The energy of bringing up the modem and publishing, the same work whether or not the modem was in PSM.
+        uplink_energy_stop(true);
         log_to_sdcard("back from send_messages");
+        flush_sdcard_log();
         // If a config script turned up, run it now.
         if (script != nullptr) {
             log_to_sdcard("Running config script");
@@ -345,54 +407,26 @@ void setup(void) {
             CLI::repl(scriptStream, Serial);
 
             log_to_sdcard("Finished script");
+            flush_sdcard_log();
         }
     }
 
+    profile_start(wombat::WAKE_PHASE_SHUTDOWN);
     shutdown();
+    profile_stop(wombat::WAKE_PHASE_SHUTDOWN);
+    profile_finish();
 
-    // NOTE: Because the ESP32 effectively reboots after waking from deep sleep the ESP32 internal tick counter
-    // always starts at 0. This means simply getting the value of millis() here is sufficient to get an idea of
-    // how long it took to get here. There is no need to save the millis() at the top of the function and do a
-    // subtraction here.
-    uint64_t measurement_interval_ms = measurement_interval_secs * 1000;
-    uint64_t delta_ms = 0;
-    uint64_t sleep_time_us = 0;
+    // The next wake is the next boundary of the measurement interval, or the one after if this wake
+    // has run over it.
     uint64_t setup_duration_ms = millis();
-
-    if (setup_duration_ms > measurement_interval_ms) {
-        ESP_LOGW(TAG, "run time > measurement interval");
-        delta_ms = setup_duration_ms - measurement_interval_ms;
-        while (delta_ms > measurement_interval_ms) {
-            delta_ms = setup_duration_ms - measurement_interval_ms;
-            setup_duration_ms = setup_duration_ms - measurement_interval_ms;
-            ESP_LOGW(TAG, "skipping an interval, setup_duration_ms now = %llu, delta_ms = %llu", setup_duration_ms, delta_ms);
-        }
-
-        sleep_time_us = (measurement_interval_ms - delta_ms) * 1000;
-    } else {
-        delta_ms = measurement_interval_ms - setup_duration_ms;
-        // Catch the case of the run time being exactly the measurement interval. With the current
-        // code structure there is no simple way of just running the whole thing again, so sleep for 1ms
-        // and reboot.
-        if (delta_ms < 1) {
-            delta_ms = 1;
-        }
-
-        sleep_time_us = delta_ms * 1000;
-    }
-
-    // A final sanity check.
-    if (sleep_time_us > (measurement_interval_ms * 1000)) {
-        ESP_LOGE(TAG, "sleep time us %llu > measurement interval us %llu", sleep_time_us, (measurement_interval_ms * 1000));
-        sleep_time_us = measurement_interval_ms * 1000;
-    }
+    uint64_t sleep_time_us = schedule.next(clock_now_us(), measurement_interval_secs);
 
     ESP_LOGI(TAG, "Unadjusted sleep_time_us = %llu", sleep_time_us);
-    sleep_time_us = (uint64_t)((float)sleep_time_us * config.getSleepAdjustment());
+    sleep_time_us = clock_sleep_for(sleep_time_us, config.getSleepAdjustment());
     ESP_LOGI(TAG, "Adjusted sleep_time_us = %llu", sleep_time_us);
 
     float f_s_time = (float)sleep_time_us / 1000000.0f;
-    ESP_LOGI(TAG, "Run took %llu ms, going to sleep at: %s, for %.2f s", setup_duration_ms, iso8601(), f_s_time);
+    ESP_LOGI(TAG, "Run took %llu ms, going to sleep at: %s, for %.2f s", setup_duration_ms, iso8601(timestamp, sizeof(timestamp)), f_s_time);
     Serial.flush();
 
     esp_sleep_enable_timer_wakeup(sleep_time_us);
@@ -404,14 +438,23 @@ void shutdown(void) {
 
     SPIFFS.end();
 
-    if (r5_ok) {
-        log_to_sdcard("r5.modulePowerOff");
-        r5.modulePowerOff();
+    // An uplink that failed part way through is not a fair measure of either way of starting the modem.
+    uplink_energy_stop(false);
+
+    if (modem_psm_keep()) {
+        // The modem goes into PSM by itself once the active time has passed.
+        log_to_sdcard("Leaving modem in PSM");
+        cat_m1.keep_in_psm();
     } else {
-        log_to_sdcard("[E] r5_ok was false");
-    }
+        if (r5_ok) {
+            log_to_sdcard("r5.modulePowerOff");
+            r5.modulePowerOff();
+        } else {
+            log_to_sdcard("[E] r5_ok was false");
+        }
 
-    cat_m1.power_supply(false);
+        cat_m1.power_supply(false);
+    }
     delay(20);
     BatteryMonitor::sleep();
     SolarMonitor::sleep();
@@ -420,6 +463,7 @@ void shutdown(void) {
     delay(20);
 
     log_to_sdcard("power down SD card");
+    close_sdcard_log();
     SD.end();
     digitalWrite(SD_CARD_ENABLE, LOW);
 
@@ -0,0 +1,240 @@
+#include <Arduino.h>
+#include "modem_power.h"
+#include "CAT_M1.h"
+#include "DeviceConfig.h"
+#include "Utils.h"
+#include "globals.h"
+#include "power_monitoring/battery.h"
+
+#include <esp_attr.h>
+#include <esp_log.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <Preferences.h>
+
+#define TAG "modem_power"
+
+//! NVS namespace for the modem power settings.
+static constexpr const char* MODEM_NVS_NAMESPACE = "modem";
+//! NVS key set while the modem may have PSM or eDRX requested. The R5 keeps +CPSMS and +CEDRXS across a power loss.
+static constexpr const char* MODEM_NVS_PSM_KEY = "psm";
+
+//! The PSM timers granted on this wake, valid once psm_checked is set.
+static wombat::PsmGrant psm_grant;
+static bool psm_checked = false;
+
+static RTC_DATA_ATTR wombat::UplinkEnergyState uplink_energy_state;
+static wombat::UplinkEnergy uplink_energy(uplink_energy_state);
+static wombat::EnergyMeter energy_meter;
+
+//! How often the battery power is sampled during an uplink.
+static constexpr uint32_t ENERGY_SAMPLE_MS = 100;
+static volatile bool sampling = false;
+//! Given by the sampler task when it stops.
+static SemaphoreHandle_t sampler_done = nullptr;
+
+//! True if PSM or eDRX was last requested from the modem, rather than turned off.
+static bool load_psm_requested(void) {
+    Preferences prefs;
+    if ( ! prefs.begin(MODEM_NVS_NAMESPACE, true)) {
+        return false;
+    }
+
+    const bool requested = prefs.getBool(MODEM_NVS_PSM_KEY, false);
+    prefs.end();
+    return requested;
+}
+
+static void save_psm_requested(const bool requested) {
+    Preferences prefs;
+    if ( ! prefs.begin(MODEM_NVS_NAMESPACE, false)) {
+        ESP_LOGE(TAG, "Could not open NVS namespace %s", MODEM_NVS_NAMESPACE);
+        return;
+    }
+
+    prefs.putBool(MODEM_NVS_PSM_KEY, requested);
+    prefs.end();
+}
+
+/**
+ * @brief Ask the network for the PSM timers and eDRX cycle in the config. Called before registering
+ * so they are negotiated in the attach.
+ *
+ * With PSM and eDRX off, the default, nothing is sent unless an earlier wake requested them, in
+ * which case they are turned off once.
+ *
+ * eDRX only matters during the PSM active time, because without PSM the modem is powered off
+ * between uplinks.
+ */
+void modem_psm_request(void) {
+    DeviceConfig& config = DeviceConfig::get();
+    const bool requested = load_psm_requested();
+    if ( ! config.getModemPsm() && config.getModemEdrx() == 0) {
+        if (requested && modem_command("+CPSMS=0") && modem_command("+CEDRXS=0")) {
+            save_psm_requested(false);
+        }
+        return;
+    }
+
+    char cmd[48];
+    char periodic[wombat::PSM_TIMER_BITS + 1];
+    char active[wombat::PSM_TIMER_BITS + 1];
+
+    const bool psm = config.getModemPsm() && wombat::psm_encode_periodic(config.getPsmPeriodic(), periodic)
+            && wombat::psm_encode_active(config.getPsmActive(), active);
+    if (psm) {
+        snprintf(cmd, sizeof(cmd), "+CPSMS=1,,,\"%s\",\"%s\"", periodic, active);
+    } else {
+        strncpy(cmd, "+CPSMS=0", sizeof(cmd));
+    }
+    modem_command(cmd);
+
+    char edrx[wombat::EDRX_BITS + 1];
+    if (psm && config.getModemEdrx() > 0 && wombat::edrx_encode(config.getModemEdrx(), edrx)) {
+        // 4 is the access technology for LTE-M.
+        snprintf(cmd, sizeof(cmd), "+CEDRXS=1,4,\"%s\"", edrx);
+    } else {
+        strncpy(cmd, "+CEDRXS=0", sizeof(cmd));
+    }
+    modem_command(cmd);
+
+    // Include the granted PSM timers in the +CEREG read response.
+    modem_command("+CEREG=4");
+
+    if ( ! requested) {
+        save_psm_requested(true);
+    }
+}
+
+/**
+ * @brief Read the PSM timers the network granted.
+ *
+ * @return true if PSM was granted.
+ */
+bool modem_psm_update(void) {
+    psm_checked = true;
+    psm_grant.stat = -1;
+    psm_grant.active_s = wombat::PSM_TIMER_OFF;
+    psm_grant.periodic_s = wombat::PSM_TIMER_OFF;
+
+    // Saves a round trip on every connect when PSM is off.
+    if ( ! DeviceConfig::get().getModemPsm()) {
+        return false;
+    }
+
+    if ( ! modem_command("+CEREG?") || ! wombat::psm_parse_cereg(g_buffer, psm_grant)) {
+        psm_grant.stat = -1;
+        psm_grant.active_s = wombat::PSM_TIMER_OFF;
+        psm_grant.periodic_s = wombat::PSM_TIMER_OFF;
+    }
+
+    ESP_LOGI(TAG, "PSM granted: %d, active %ld s, periodic TAU %ld s", psm_grant.granted(),
+             (long)psm_grant.active_s, (long)psm_grant.periodic_s);
+    log_to_sdcardf("PSM granted: %d, active %ld s, periodic TAU %ld s", psm_grant.granted(),
+                   (long)psm_grant.active_s, (long)psm_grant.periodic_s);
+
+    return psm_grant.granted();
+}
+
+/**
+ * @brief True if the modem should be left powered in PSM when the node sleeps.
+ *
+ * A modem used on this wake is kept if the network granted PSM. A modem not used on this wake is
+ * left as the previous wake left it.
+ */
+bool modem_psm_keep(void) {
+    if ( ! DeviceConfig::get().getModemPsm() || ! cat_m1.is_powered()) {
+        return false;
+    }
+
+    if (cat_m1.was_used()) {
+        return psm_checked && psm_grant.granted();
+    }
+
+    return cat_m1.was_kept();
+}
+
+static void sampler_task(void *pvParameters) {
+    while (sampling) {
+        energy_meter.sample(millis(), BatteryMonitor::get_power());
+        vTaskDelay(pdMS_TO_TICKS(ENERGY_SAMPLE_MS));
+    }
+
+    xSemaphoreGive(sampler_done);
+    vTaskDelete(nullptr);
+}
+
+/**
+ * @brief Start measuring the energy drawn from the battery for an uplink, by sampling the battery
+ * power in a task on core 0.
+ */
+void uplink_energy_start(void) {
+    if (sampling || BatteryMonitor::get_voltage() < 0.0) {
+        return;
+    }
+
+    if (sampler_done == nullptr) {
+        sampler_done = xSemaphoreCreateBinary();
+        if (sampler_done == nullptr) {
+            return;
+        }
+    }
+
+    energy_meter.start();
+    sampling = true;
+    if (xTaskCreatePinnedToCore(sampler_task, "Energy", 2048, nullptr, 1, nullptr, 0) != pdPASS) {
+        ESP_LOGE(TAG, "Could not start energy sampler task");
+        sampling = false;
+    }
+}
+
+/**
+ * @brief Stop measuring the energy of an uplink.
+ *
+ * @param record true to record the energy for the way the modem was started on this wake, false
+ * if the uplink failed.
+ */
+void uplink_energy_stop(const bool record) {
+    if ( ! sampling) {
+        return;
+    }
+
+    sampling = false;
+    xSemaphoreTake(sampler_done, pdMS_TO_TICKS(ENERGY_SAMPLE_MS * 10));
+    if ( ! record || energy_meter.get_samples() < 2) {
+        return;
+    }
+
+    const wombat::modem_start_t start = cat_m1.was_kept() ? wombat::MODEM_START_PSM : wombat::MODEM_START_COLD;
+    const double mj = energy_meter.get_mj();
+    uplink_energy.begin();
+    uplink_energy.record(start, mj > 0.0 ? static_cast<uint32_t>(mj) : 0);
+
+    log_to_sdcardf("Uplink used %lu mJ in %lu ms from %s, mean %lu mJ from cold (%lu), %lu mJ from PSM (%lu)",
+                   (unsigned long)mj, (unsigned long)energy_meter.get_ms(), start == wombat::MODEM_START_PSM ? "PSM" : "cold",
+                   (unsigned long)uplink_energy.get_mean_mj(wombat::MODEM_START_COLD),
+                   (unsigned long)uplink_energy.get_count(wombat::MODEM_START_COLD),
+                   (unsigned long)uplink_energy.get_mean_mj(wombat::MODEM_START_PSM),
+                   (unsigned long)uplink_energy.get_count(wombat::MODEM_START_PSM));
+}
+
+/**
+ * @brief Add the energy of the last uplink to a message, once.
+ */
+void add_uplink_energy(JsonArray& timeseries) {
+    uplink_energy.begin();
+
+    uint32_t mj;
+    wombat::modem_start_t start;
+    if ( ! uplink_energy.take_unreported(mj, start)) {
+        return;
+    }
+
+    auto entry = timeseries.add<JsonObject>();
+    entry["name"] = "uplink (mJ)";
+    entry["value"] = mj;
+
+    entry = timeseries.add<JsonObject>();
+    entry["name"] = "uplink psm";
+    entry["value"] = start == wombat::MODEM_START_PSM ? 1 : 0;
+}
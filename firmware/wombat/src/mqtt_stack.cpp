@@ -14,22 +14,19 @@ static char rsp[MAX_RSP + 1];
 // run later, so it must be freed elsewhere after the run.
 char *script = nullptr;
 
-static CommandURCVector<SARA_R5_mqtt_command_opcode_t> urcs;
+static CommandURCRing<SARA_R5_mqtt_command_opcode_t> urcs;
 
 void mqttCmdCallback(int cmd, int result) {
     ESP_LOGI(TAG, "cmd: %d, result: %d", cmd, result);
     log_to_sdcardf("mqtt cb cmd: %d, result: %d", cmd, result);
 
-    urcs.addPair(static_cast<SARA_R5_mqtt_command_opcode_t>(cmd), result);
-
+    int e1 = 0, e2 = 0;
     if (result == 0) {
-        int e1, e2;
         r5.getMQTTprotocolError(&e1, &e2);
-        urcs.back().err1 = e1;
-        urcs.back().err2 = e2;
-
         ESP_LOGE(TAG, "MQTT op failed: %d, %d", e1, e2);
     }
+
+    urcs.add(static_cast<SARA_R5_mqtt_command_opcode_t>(cmd), result, e1, e2);
 }
 
 bool mqtt_login(void) {
@@ -187,30 +184,42 @@ bool mqtt_logout(void) {
     return result == 1;
 }
 
-bool mqtt_publish(String &topic, const char * const msg, size_t msg_len) {
-    log_to_sdcard("mqtt_publish");
-    int result = -1;
-    if (msg_len < MAX_MQTT_DIRECT_MSG_LEN) {
-        ESP_LOGD(TAG, "Direct publish message: %s/%s", topic.c_str(), msg);
-        SARA_R5_error_t err = r5.mqttPublishBinaryMsg(topic, msg, msg_len, 1);
-        delay(20);
-
-        if (err != SARA_R5_error_t::SARA_R5_ERROR_SUCCESS) {
-            ESP_LOGE(TAG, "Publish failed");
-            log_to_sdcardf("[E] pub failed, err: %d", err);
-            return false;
-        }
-
-        log_to_sdcard("waiting for pub urc");
-        delay(20);
-
-        urcs.waitForURC(SARA_R5_MQTT_COMMAND_PUBLISHBINARY, &result, 60, 500);
-    } else {
+bool mqtt_publish_start(String &topic, const char * const msg, size_t msg_len) {
+    if (msg_len >= MAX_MQTT_DIRECT_MSG_LEN) {
         ESP_LOGE(TAG, "Message too long");
         log_to_sdcardf("[E] message too long");
         return false;
     }
 
+    ESP_LOGD(TAG, "Direct publish message: %s/%s", topic.c_str(), msg);
+    SARA_R5_error_t err = r5.mqttPublishBinaryMsg(topic, msg, msg_len, 1);
+    delay(20);
+
+    if (err != SARA_R5_error_t::SARA_R5_ERROR_SUCCESS) {
+        ESP_LOGE(TAG, "Publish failed");
+        log_to_sdcardf("[E] pub failed, err: %d", err);
+        return false;
+    }
+
+    return true;
+}
+
+bool mqtt_publish_wait(uint32_t timeout_ms, int &result) {
+    result = -1;
+    return urcs.waitForURC(SARA_R5_MQTT_COMMAND_PUBLISHBINARY, &result, (timeout_ms + 499) / 500, 500);
+}
+
+bool mqtt_publish(String &topic, const char * const msg, size_t msg_len) {
+    log_to_sdcard("mqtt_publish");
+    if ( ! mqtt_publish_start(topic, msg, msg_len)) {
+        return false;
+    }
+
+    log_to_sdcard("waiting for pub urc");
+    delay(20);
+
+    int result = -1;
+    mqtt_publish_wait(30000, result);
     return result == 1;
 }
 
@@ -0,0 +1,194 @@
+#include "msg_outbox.h"
+#include "globals.h"
+#include "Utils.h"
+#include "DeviceConfig.h"
+#include "transfers.h"
+
+#include <esp_attr.h>
+#include <SPIFFS.h>
+#include <Preferences.h>
+#include <vector>
+
+#define TAG "msg_outbox"
+
+//! The size of each outbox segment file on SPIFFS.
+static constexpr size_t SEGMENT_SIZE = 8192;
+//! The outbox uses at most 2 MB of the SPIFFS partition.
+static constexpr uint32_t MAX_SEGMENTS = 256;
+
+//! NVS namespace for the outbox.
+static constexpr const char* OUTBOX_NVS_NAMESPACE = "outbox";
+//! NVS key set once the message files written by earlier firmware versions have been moved into the outbox.
+static constexpr const char* OUTBOX_NVS_MIGRATED_KEY = "migrated";
+
+//! Saves reading NVS on every uplink once the message files have been moved.
+static RTC_DATA_ATTR bool msg_files_migrated = false;
+
+/**
+ * Gives the outbox access to files on SPIFFS.
+ */
+class SpiffsOutboxStorage : public wombat::OutboxStorage {
+public:
+    bool size(const char *name, size_t &sz) override {
+        // Check first because opening a missing file logs an error.
+        if ( ! SPIFFS.exists(name)) {
+            return false;
+        }
+
+        File f = SPIFFS.open(name, FILE_READ);
+        if ( ! f) {
+            return false;
+        }
+
+        sz = f.size();
+        f.close();
+        return true;
+    }
+
+    bool read(const char *name, const size_t offset, uint8_t *buf, const size_t len) override {
+        File f = SPIFFS.open(name, FILE_READ);
+        if ( ! f) {
+            return false;
+        }
+
+        const bool ok = f.seek(offset) && f.read(buf, len) == len;
+        f.close();
+        return ok;
+    }
+
+    bool append(const char *name, const uint8_t *data, const size_t len) override {
+        File f = SPIFFS.open(name, FILE_APPEND);
+        if ( ! f) {
+            return false;
+        }
+
+        const bool ok = f.write(data, len) == len;
+        f.close();
+        return ok;
+    }
+
+    bool replace(const char *name, const uint8_t *data, const size_t len) override {
+        File f = SPIFFS.open(name, FILE_WRITE);
+        if ( ! f) {
+            return false;
+        }
+
+        const bool ok = f.write(data, len) == len;
+        f.close();
+        return ok;
+    }
+
+    bool remove(const char *name) override {
+        return SPIFFS.remove(name);
+    }
+};
+
+/**
+ * Get the queue of messages waiting to be uplinked, opening it on first use.
+ *
+ * Must only be called when spiffs_ok is true.
+ */
+wombat::Outbox& get_outbox(void) {
+    static SpiffsOutboxStorage storage;
+    static wombat::Outbox outbox(storage, outbox_prefix_spiffs, SEGMENT_SIZE, MAX_SEGMENTS);
+    static bool opened = false;
+
+    if ( ! opened) {
+        const unsigned long start = millis();
+        opened = outbox.open();
+        ESP_LOGI(TAG, "Opened outbox with %lu segments in %lu ms", (unsigned long)outbox.num_segments(), millis() - start);
+        if ( ! opened) {
+            log_to_sdcard("[E] Failed to open the message outbox");
+        }
+    }
+
+    return outbox;
+}
+
+/**
+ * Move the message files written by earlier firmware versions into the outbox, oldest first as far
+ * as SPIFFS lists them, so uplinks never have to walk the SPIFFS root to find them.
+ *
+ * This is done once and recorded in NVS. If any file could not be moved the flag is not set and the
+ * remaining files are tried again on the next uplink.
+ *
+ * Must only be called when spiffs_ok is true.
+ */
+void migrate_msg_files(void) {
+    if (msg_files_migrated) {
+        return;
+    }
+
+    Preferences prefs;
+    if ( ! prefs.begin(OUTBOX_NVS_NAMESPACE, false)) {
+        ESP_LOGE(TAG, "Could not open NVS namespace %s", OUTBOX_NVS_NAMESPACE);
+        return;
+    }
+
+    if (prefs.getBool(OUTBOX_NVS_MIGRATED_KEY, false)) {
+        prefs.end();
+        msg_files_migrated = true;
+        return;
+    }
+
+    File root = SPIFFS.open("/");
+    if ( ! root) {
+        ESP_LOGE(TAG, "Failed to open root directory of SPIFFS");
+        prefs.end();
+        return;
+    }
+
+    // Collect the names first rather than removing files from the directory being listed.
+    const char *msg_file_prefix = DeviceConfig::getMsgFilePrefix();
+    const size_t msg_file_prefix_len = strlen(msg_file_prefix);
+    std::vector<String> filenames;
+    String filename = root.getNextFileName();
+    while (filename.length() > 0) {
+        if ( ! strncmp(&filename.c_str()[1], msg_file_prefix, msg_file_prefix_len)) {
+            filenames.push_back(filename);
+        }
+        filename = root.getNextFileName();
+    }
+    root.close();
+
+    wombat::Outbox& outbox = get_outbox();
+    std::vector<uint8_t> msg;
+    uint16_t moved = 0;
+    uint16_t failed = 0;
+    for (const String& name : filenames) {
+        FsFileSource src(SPIFFS, name.c_str());
+        if ( ! src) {
+            failed++;
+            continue;
+        }
+
+        msg.resize(src.size());
+        wombat::MemorySink sink(msg.data(), msg.size());
+        const bool read_ok = transfer(src, sink) && sink.size() == msg.size();
+
+        // An empty or unreadable file holds no message worth keeping.
+        if ( ! read_ok || msg.empty()) {
+            ESP_LOGW(TAG, "Removing unreadable message file %s", name.c_str());
+            SPIFFS.remove(name);
+            continue;
+        }
+
+        const wombat::outbox_msg_type_t type = name.endsWith(".cbor") ? wombat::OUTBOX_MSG_CBOR : wombat::OUTBOX_MSG_JSON;
+        if ( ! outbox.enqueue(type, msg.data(), msg.size())) {
+            failed++;
+            continue;
+        }
+
+        SPIFFS.remove(name);
+        moved++;
+    }
+
+    if (failed == 0) {
+        prefs.putBool(OUTBOX_NVS_MIGRATED_KEY, true);
+        msg_files_migrated = true;
+    }
+    prefs.end();
+
+    ESP_LOGI(TAG, "Moved %u message files into the outbox, %u failed", moved, failed);
+    log_to_sdcardf("Moved %u message files into the outbox, %u failed", moved, failed);
+}
@@ -1,6 +1,7 @@
 #include <Arduino.h>
 #include <time.h> // Note: this is the standard c time library, not Time.h
 #include "SparkFun_u-blox_SARA-R5_Arduino_Library.h"
+#include "clock_sync.h"
 
 #define TAG "ntp"
 
@@ -98,6 +99,9 @@ bool getNTPTime(SARA_R5 &r5) {
 40: E7 8B F8 61 6B 17 F3 80
 
  */
+            // Half the round trip is the best guess of how long ago the server sent the reply.
+            const unsigned long half_rtt_ms = (millis() - requestTime) / 2;
+
             // Extract the time from the reply
 
             // The timestamp starts at byte 40 of the received packet and is a uint32_t value.
@@ -120,15 +124,22 @@ bool getNTPTime(SARA_R5 &r5) {
 
             ESP_LOGI(TAG, "Unix epoch = %lu", epoch);
 
+            // The fraction of a second is the next 4 bytes, in units of 2^-32 s.
+            const uint32_t fraction = (uint32_t)packetBuffer[44] << 24 | (uint32_t)packetBuffer[45] << 16 | (uint32_t)packetBuffer[46] << 8 | packetBuffer[47];
+            const int64_t ntp_us = (int64_t)epoch * 1000000 + (((uint64_t)fraction * 1000000) >> 32) + (int64_t)half_rtt_ms * 1000;
+
             setenv("TZ", "UTC", 1);
             tzset();
 
             struct timeval tv;
+            gettimeofday(&tv, nullptr);
+            const int64_t local_us = (int64_t)tv.tv_sec * 1000000 + tv.tv_usec;
 
-            tv.tv_sec = epoch; //dateTime;
-            tv.tv_usec = 0;
+            tv.tv_sec = ntp_us / 1000000;
+            tv.tv_usec = ntp_us % 1000000;
 
             settimeofday(&tv, nullptr);
+            clock_ntp_synced(ntp_us - local_us, ntp_us);
 
             // Instead of calculating the year, month, day, etc. manually, let's use time_t and tm to do it for us!
             time_t dateTime = epoch;
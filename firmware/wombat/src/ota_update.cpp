@@ -1,18 +1,248 @@
 #include "ota_update.h"
+#include "DeviceConfig.h"
 #include "ftp_stack.h"
 #include "globals.h"
+#include "transfers.h"
 
 #include <mbedtls/sha1.h>
 #include <esp_ota_ops.h>
 #include <SPIFFS.h>
 
 #include <ArduinoJson.h>
+#include <delta_patch.h>
 
 #define TAG "ota_update"
 
 static const char* wombat_sha1 = "wombat.sha1";
 static const char* wombat_bin = "wombat.bin";
 
+/**
+ * Writes a firmware image to an OTA partition, hashing it as it is written.
+ *
+ * Each block is written to flash by a task on the other core while the caller hashes it, and the
+ * time spent on each is recorded.
+ */
+class OtaSink : public wombat::XferSink {
+public:
+    explicit OtaSink(const esp_ota_handle_t handle) : handle(handle) {
+        mbedtls_sha1_init(&sha1_ctx);
+        mbedtls_sha1_starts_ret(&sha1_ctx);
+
+        request = xSemaphoreCreateBinary();
+        done = xSemaphoreCreateBinary();
+        if (request == nullptr || done == nullptr) {
+            return;
+        }
+
+        const BaseType_t other_core = xPortGetCoreID() == 0 ? 1 : 0;
+        if (xTaskCreatePinnedToCore(write_task, "OTA write", 4096, this, uxTaskPriorityGet(nullptr), &task, other_core) != pdPASS) {
+            ESP_LOGW(TAG, "Could not create flash write task, writing in the foreground");
+            task = nullptr;
+        }
+    }
+
+    ~OtaSink() override {
+        if (task != nullptr) {
+            vTaskDelete(task);
+        }
+
+        if (request != nullptr) {
+            vSemaphoreDelete(request);
+        }
+
+        if (done != nullptr) {
+            vSemaphoreDelete(done);
+        }
+
+        mbedtls_sha1_free(&sha1_ctx);
+    }
+
+    bool write(const uint8_t* data, const size_t len) override {
+        const uint32_t start = micros();
+        if (task != nullptr) {
+            write_data = data;
+            write_len = len;
+            xSemaphoreGive(request);
+        }
+
+        mbedtls_sha1_update_ret(&sha1_ctx, data, len);
+        const uint32_t block_hash_us = micros() - start;
+
+        if (task != nullptr) {
+            xSemaphoreTake(done, portMAX_DELAY);
+        } else {
+            flash_write(data, len);
+        }
+
+        hash_us += block_hash_us;
+        blocks++;
+        ESP_LOGD(TAG, "Block %lu: %lu bytes, hash %lu us, flash %lu us, %lu us", (unsigned long)blocks, (unsigned long)len,
+                 (unsigned long)block_hash_us, (unsigned long)block_flash_us, (unsigned long)(micros() - start));
+
+        if (err != ESP_OK) {
+            ESP_LOGE(TAG, "esp_ota_write failed: %d", err);
+            return false;
+        }
+
+        return true;
+    }
+
+    //! The SHA-1 of everything written.
+    void get_hash(unsigned char hash[20]) {
+        mbedtls_sha1_finish_ret(&sha1_ctx, hash);
+    }
+
+    esp_err_t get_error(void) const { return err; }
+
+    //! The total time spent hashing, in milliseconds.
+    uint32_t get_hash_ms(void) const { return hash_us / 1000; }
+    //! The total time spent writing to flash, in milliseconds.
+    uint32_t get_flash_ms(void) const { return flash_us / 1000; }
+
+private:
+    esp_ota_handle_t handle;
+    mbedtls_sha1_context sha1_ctx;
+    esp_err_t err = ESP_OK;
+
+    TaskHandle_t task = nullptr;
+    SemaphoreHandle_t request = nullptr;
+    SemaphoreHandle_t done = nullptr;
+    const uint8_t* write_data = nullptr;
+    size_t write_len = 0;
+
+    uint32_t blocks = 0;
+    uint32_t block_flash_us = 0;
+    uint32_t hash_us = 0;
+    uint32_t flash_us = 0;
+
+    void flash_write(const uint8_t* data, const size_t len) {
+        const uint32_t start = micros();
+        err = esp_ota_write(handle, static_cast<const void*>(data), len);
+        block_flash_us = micros() - start;
+        flash_us += block_flash_us;
+    }
+
+    static void write_task(void* arg) {
+        auto* self = static_cast<OtaSink*>(arg);
+        while (true) {
+            xSemaphoreTake(self->request, portMAX_DELAY);
+            self->flash_write(self->write_data, self->write_len);
+            xSemaphoreGive(self->done);
+        }
+    }
+};
+
+/**
+ * Starts an OTA update of the next OTA partition, erasing the space for the new image in a task on
+ * the other core so the erase overlaps the modem downloading the image from the FTP server.
+ *
+ * If the update handle is not taken with wait() the update is aborted when the eraser is destroyed.
+ */
+class OtaEraser {
+public:
+    OtaEraser(const esp_partition_t* partition, const size_t len) : partition(partition), len(len) {
+        start_ms = millis();
+        done = xSemaphoreCreateBinary();
+        if (done == nullptr) {
+            return;
+        }
+
+        const BaseType_t other_core = xPortGetCoreID() == 0 ? 1 : 0;
+        if (xTaskCreatePinnedToCore(erase_task, "OTA erase", 4096, this, uxTaskPriorityGet(nullptr), &task, other_core) != pdPASS) {
+            ESP_LOGW(TAG, "Could not create erase task, erasing in the foreground");
+            task = nullptr;
+        }
+    }
+
+    ~OtaEraser() {
+        esp_ota_handle_t h;
+        if (wait(h) == ESP_OK) {
+            esp_ota_abort(h);
+        }
+
+        if (done != nullptr) {
+            vSemaphoreDelete(done);
+        }
+    }
+
+    /**
+     * Wait for the erase to finish and take the update handle.
+     *
+     * @return the result of esp_ota_begin, or ESP_ERR_INVALID_STATE if the handle has already been taken.
+     */
+    esp_err_t wait(esp_ota_handle_t& h) {
+        if (taken) {
+            return ESP_ERR_INVALID_STATE;
+        }
+
+        const uint32_t wait_start = millis();
+        if (task != nullptr) {
+            xSemaphoreTake(done, portMAX_DELAY);
+            task = nullptr;
+        } else {
+            erase();
+        }
+        wait_ms = millis() - wait_start;
+
+        taken = true;
+        h = handle;
+        return err;
+    }
+
+    //! The time the erase took, in milliseconds.
+    uint32_t get_erase_ms(void) const { return erase_ms; }
+    //! The time wait() waited for the erase, in milliseconds.
+    uint32_t get_wait_ms(void) const { return wait_ms; }
+
+private:
+    const esp_partition_t* partition;
+    const size_t len;
+    esp_ota_handle_t handle = 0;
+    esp_err_t err = ESP_FAIL;
+    TaskHandle_t task = nullptr;
+    SemaphoreHandle_t done = nullptr;
+    bool taken = false;
+
+    uint32_t start_ms = 0;
+    uint32_t erase_ms = 0;
+    uint32_t wait_ms = 0;
+
+    void erase(void) {
+        // esp_ota_begin erases the space for an image of len bytes.
+        err = esp_ota_begin(partition, len, &handle);
+        erase_ms = millis() - start_ms;
+        if (err != ESP_OK) {
+            ESP_LOGE(TAG, "esp_ota_begin failed: %d", err);
+        }
+    }
+
+    static void erase_task(void* arg) {
+        auto* self = static_cast<OtaEraser*>(arg);
+        self->erase();
+        xSemaphoreGive(self->done);
+        vTaskDelete(nullptr);
+    }
+};
+
+/**
+ * Reads the running firmware image, which delta patches are applied to.
+ */
+class RunningPartitionBase : public wombat::PatchBase {
+public:
+    RunningPartitionBase() : partition(esp_ota_get_running_partition()) {}
+
+    bool read(const size_t offset, uint8_t* buf, const size_t len) override {
+        if (partition == nullptr || offset + len > partition->size) {
+            return false;
+        }
+
+        return esp_partition_read(partition, offset, buf, len) == ESP_OK;
+    }
+
+private:
+    const esp_partition_t* partition;
+};
+
 /**
  * Check if the server has a newer version of the firmware than is running on the Wombat.
  *
@@ -36,8 +266,10 @@ int ota_check_for_update(ota_firmware_info_t& ota_ctx) {
 
     memset(ota_ctx.file_hash, 0, sizeof(ota_ctx.file_hash));
     memset(ota_ctx.git_commit_id, 0, sizeof(ota_ctx.git_commit_id));
+    ota_ctx.patch_len = 0;
 
-    int s_rc = sscanf(g_buffer, "%u.%u.%u %lu %40s %40s", &ota_ctx.new_major, &ota_ctx.new_minor, &ota_ctx.new_update, &ota_ctx.file_len, &ota_ctx.file_hash, &ota_ctx.git_commit_id);
+    int consumed = 0;
+    int s_rc = sscanf(g_buffer, "%u.%u.%u %lu %40s %40s%n", &ota_ctx.new_major, &ota_ctx.new_minor, &ota_ctx.new_update, &ota_ctx.file_len, &ota_ctx.file_hash, &ota_ctx.git_commit_id, &consumed);
     if (s_rc != 6) {
         ESP_LOGE(TAG, "Failed to parse version information");
         return -1;
@@ -45,6 +277,20 @@ int ota_check_for_update(ota_firmware_info_t& ota_ctx) {
 
     ESP_LOGI(TAG, "Version on server: %u.%u.%u, size = %lu, commit: %s (s_rc = %d)", ota_ctx.new_major, ota_ctx.new_minor, ota_ctx.new_update, ota_ctx.file_len, ota_ctx.git_commit_id, s_rc);
 
+    // Any further fields are the versions the server has delta patches from, as version:patch-length.
+    const char* p = g_buffer + consumed;
+    uint16_t from_major, from_minor, from_update;
+    unsigned long patch_len;
+    int n = 0;
+    while (sscanf(p, " %hu.%hu.%hu:%lu%n", &from_major, &from_minor, &from_update, &patch_len, &n) == 4) {
+        if (from_major == ver_major && from_minor == ver_minor && from_update == ver_update) {
+            ota_ctx.patch_len = patch_len;
+            ESP_LOGI(TAG, "Server has a %lu byte patch from the running version", patch_len);
+            break;
+        }
+        p += n;
+    }
+
     if (ota_ctx.new_major < ver_major) {
         return 0;
     }
@@ -70,67 +316,49 @@ int ota_check_for_update(ota_firmware_info_t& ota_ctx) {
     return 0;
 }
 
-bool ota_download_update(const ota_firmware_info_t& ota_ctx) {
-    if (ota_ctx.file_len < 1) {
-        ESP_LOGI(TAG, "Invalid arguments");
-        return false;
-    }
-
-    r5.deleteFile(wombat_bin);
-    if (!ftp_get(wombat_bin)) {
-        ESP_LOGW(TAG, "FTP get wombat.bin failed");
-        return false;
-    }
-
-    int bin_size;
-    r5.getFileSize(wombat_bin, &bin_size);
-    if (bin_size != ota_ctx.file_len) {
-        ESP_LOGW(TAG, "wombat.bin wrong size");
-        return false;
-    }
-
-    ESP_LOGI(TAG, "Next OTA update partition");
-
-    const esp_partition_t* p_type = esp_ota_get_next_update_partition(nullptr);
-    ESP_LOGI(TAG, "%d/%d %lx %lx %s", p_type->type, p_type->subtype, p_type->address, p_type->size, p_type->label);
-
+/**
+ * Write a new firmware image to the next OTA partition, check its hash and make it the boot partition.
+ *
+ * @param src the image, or a delta patch from the running image to the new image.
+ * @param len the number of bytes to read from src.
+ * @param ota_ctx the size and hash of the new image.
+ * @param is_patch true if src is a delta patch.
+ * @param p_type the partition to write the new image to.
+ * @param eraser the update of p_type, started before the image was downloaded.
+ * @return true if the new image will be run on the next boot.
+ */
+static bool install_update(BackgroundSource& src, const size_t len, const ota_firmware_info_t& ota_ctx, const bool is_patch,
+                           const esp_partition_t* p_type, OtaEraser& eraser) {
     esp_ota_handle_t ota_handle;
-    esp_err_t esp_err = esp_ota_begin(p_type,ota_ctx.file_len, &ota_handle);
+    esp_err_t esp_err = eraser.wait(ota_handle);
     if (esp_err != ESP_OK) {
-        ESP_LOGE(TAG, "esp_ota_begin failed: %d", esp_err);
         return false;
     }
 
-    mbedtls_sha1_context sha1_ctx;
-
-    mbedtls_sha1_init(&sha1_ctx);
-    mbedtls_sha1_starts_ret(&sha1_ctx);
+    const uint32_t start = millis();
+    OtaSink sink(ota_handle);
+    RunningPartitionBase base;
+    wombat::DeltaPatcher patcher(base, sink);
+    wombat::XferSink& target = is_patch ? static_cast<wombat::XferSink&>(patcher) : sink;
 
-    size_t bytes_read = 0;
     size_t offset = 0;
-    while (offset < ota_ctx.file_len) {
-        SARA_R5_error_t err = r5.getFileBlock("wombat.bin", g_buffer, offset, 64000, bytes_read);
-        if (err != SARA_R5_ERROR_SUCCESS) {
-            break;
-        }
-
-        ESP_LOGI(TAG, "Read %zu bytes: %02X %02X ... %02X %02X", bytes_read, g_buffer[0], g_buffer[1],
-                 g_buffer[bytes_read - 2], g_buffer[bytes_read - 1]);
-        offset += bytes_read;
-
-        mbedtls_sha1_update_ret(&sha1_ctx, reinterpret_cast<const unsigned char *>(g_buffer), bytes_read);
-
-        ESP_LOGI(TAG, "Writing firmware chunk to OTA partition");
-        esp_err = esp_ota_write(ota_handle, static_cast<const void*>(g_buffer), bytes_read);
-        if (esp_err != ESP_OK) {
-            ESP_LOGE(TAG, "esp_ota_write failed: %d", esp_err);
-            break;
-        }
+    if ( ! transfer(src, target, len, &offset)) {
+        esp_err = sink.get_error() != ESP_OK ? sink.get_error() : ESP_FAIL;
+    } else if (is_patch && ( ! patcher.finish() || patcher.get_out_bytes() != ota_ctx.file_len)) {
+        ESP_LOGE(TAG, "Patch did not produce the new image, %lu bytes written", (unsigned long)patcher.get_out_bytes());
+        esp_err = ESP_FAIL;
     }
 
     unsigned char sha1_buf[20];
-    mbedtls_sha1_finish_ret(&sha1_ctx, sha1_buf);
-    mbedtls_sha1_free(&sha1_ctx);
+    sink.get_hash(sha1_buf);
+
+    // The read, hash and flash write of each block overlap, so the total is close to the slowest of them.
+    ESP_LOGI(TAG, "OTA write %lu ms: read %lu ms, waited %lu ms for reads, hash %lu ms, flash %lu ms, erase %lu ms, waited %lu ms for erase",
+             (unsigned long)(millis() - start), (unsigned long)src.get_read_ms(), (unsigned long)src.get_wait_ms(),
+             (unsigned long)sink.get_hash_ms(), (unsigned long)sink.get_flash_ms(), (unsigned long)eraser.get_erase_ms(),
+             (unsigned long)eraser.get_wait_ms());
+    log_to_sdcardf("OTA write %lu ms, read wait %lu ms, erase wait %lu ms", (unsigned long)(millis() - start),
+                   (unsigned long)src.get_wait_ms(), (unsigned long)eraser.get_wait_ms());
 
     if (esp_err == ESP_OK) {
         esp_err = esp_ota_end(ota_handle);
@@ -138,9 +366,13 @@ bool ota_download_update(const ota_firmware_info_t& ota_ctx) {
             ESP_LOGE(TAG, "Failed writing firmware to OTA partition");
             return false;
         }
+    } else {
+        ESP_LOGE(TAG, "Download failed after %lu bytes", (unsigned long)offset);
+        esp_ota_abort(ota_handle);
+        return false;
     }
 
-    if (offset != ota_ctx.file_len) {
+    if (offset != len) {
         ESP_LOGE(TAG, "Download failed wrong file size");
         return false;
     }
@@ -177,6 +409,81 @@ bool ota_download_update(const ota_firmware_info_t& ota_ctx) {
     return true;
 }
 
+/**
+ * Download the delta patch from the running version and apply it to the running image.
+ *
+ * The patch is named wombat-VERSION.patch, where VERSION is the running version.
+ */
+static bool ota_download_patch(const ota_firmware_info_t& ota_ctx) {
+    char patch_name[32];
+    snprintf(patch_name, sizeof(patch_name), "wombat-%u.%u.%u.patch", ver_major, ver_minor, ver_update);
+
+    const esp_partition_t* p_type = esp_ota_get_next_update_partition(nullptr);
+    OtaEraser eraser(p_type, ota_ctx.file_len);
+
+    r5.deleteFile(patch_name);
+    if ( ! ftp_get(patch_name)) {
+        ESP_LOGW(TAG, "FTP get %s failed", patch_name);
+        return false;
+    }
+
+    int patch_size = 0;
+    r5.getFileSize(patch_name, &patch_size);
+    if (patch_size != ota_ctx.patch_len) {
+        ESP_LOGW(TAG, "%s wrong size", patch_name);
+        r5.deleteFile(patch_name);
+        return false;
+    }
+
+    // The modem is read in the background while the patch is applied and written to flash.
+    R5FileSource patch(patch_name);
+    BackgroundSource src(patch);
+    const bool ok = install_update(src, ota_ctx.patch_len, ota_ctx, true, p_type, eraser);
+
+    r5.deleteFile(patch_name);
+    return ok;
+}
+
+bool ota_download_update(const ota_firmware_info_t& ota_ctx) {
+    if (ota_ctx.file_len < 1) {
+        ESP_LOGI(TAG, "Invalid arguments");
+        return false;
+    }
+
+    if (ota_ctx.patch_len > 0) {
+        if (ota_download_patch(ota_ctx)) {
+            return true;
+        }
+
+        ESP_LOGW(TAG, "Delta update failed, downloading the full image");
+    }
+
+    ESP_LOGI(TAG, "Next OTA update partition");
+    const esp_partition_t* p_type = esp_ota_get_next_update_partition(nullptr);
+    ESP_LOGI(TAG, "%d/%d %lx %lx %s", p_type->type, p_type->subtype, p_type->address, p_type->size, p_type->label);
+
+    // The space for the new image is erased while the modem downloads it.
+    OtaEraser eraser(p_type, ota_ctx.file_len);
+
+    r5.deleteFile(wombat_bin);
+    if (!ftp_get(wombat_bin)) {
+        ESP_LOGW(TAG, "FTP get wombat.bin failed");
+        return false;
+    }
+
+    int bin_size;
+    r5.getFileSize(wombat_bin, &bin_size);
+    if (bin_size != ota_ctx.file_len) {
+        ESP_LOGW(TAG, "wombat.bin wrong size");
+        return false;
+    }
+
+    // The modem is read in the background while each block is hashed and written to flash.
+    R5FileSource bin(wombat_bin);
+    BackgroundSource src(bin);
+    return install_update(src, ota_ctx.file_len, ota_ctx, false, p_type, eraser);
+}
+
 static constexpr size_t MAX_SDI12DEFN_SZ = 2024;
 
 bool ota_download_sdi12defn(void) {
@@ -223,7 +530,9 @@ bool ota_download_sdi12defn(void) {
     ESP_LOGI(TAG, "rename 2");
     SPIFFS.rename(filename, "/sdi12defn.json");
 
-    return true;
+    // Rebuild the binary form of the definitions from the new file.
+    SPIFFS.remove(sdi12defn_bin_spiffs);
+    return DeviceConfig::get().loadSDI12Defns();
 }
 
 //***********************************************************************************************
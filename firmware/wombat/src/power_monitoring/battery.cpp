@@ -7,12 +7,35 @@
  */
 #include "power_monitoring/battery.h"
 
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+
 #define TAG "battery"
 
 //! Adafruit_INA219 battery monitoring instance
 static Adafruit_INA219* battery = nullptr;
 //! Track if the INA219 is setup and available
 static bool ina219_ok = false;
+//! Guards the INA219 during an uplink, when the energy sampler on core 0 and sensor_task on core 1 both read it.
+static SemaphoreHandle_t battery_mutex = nullptr;
+
+/**
+ * @brief Take the INA219 for a reading. Each reading is several I2C transactions, and reading the
+ * current rewrites the calibration register, so one reading must finish before another starts.
+ *
+ * @return false if the INA219 is not available.
+ */
+static bool lock_battery(void) {
+    if ( ! ina219_ok || ! battery || battery_mutex == nullptr) {
+        return false;
+    }
+
+    return xSemaphoreTake(battery_mutex, portMAX_DELAY) == pdTRUE;
+}
+
+static void unlock_battery(void) {
+    xSemaphoreGive(battery_mutex);
+}
 
 /**
  * @brief Setup INA219 IC to monitoring battery voltage and current.
@@ -21,6 +44,11 @@ static bool ina219_ok = false;
  * used to improve accuracy.
  */
 void BatteryMonitor::begin() {
+    if (battery_mutex == nullptr) {
+        battery_mutex = xSemaphoreCreateMutex();
+        configASSERT(battery_mutex);
+    }
+
     if (!battery) {
         battery = new Adafruit_INA219(batteryAddr);
         if (battery->begin()) {
@@ -50,12 +78,13 @@ double BatteryMonitor::get_voltage() {
         ESP_LOGI(TAG, "battery is null");
     }
 
-    if ( ! ina219_ok || ! battery) {
+    if ( ! lock_battery()) {
         return -1.0f;
     }
 
     float bus_volts = battery->getBusVoltage_V();
     float shunt_mv = battery->getShuntVoltage_mV();
+    unlock_battery();
     float battery_voltage = bus_volts + (shunt_mv / 1000.0f);
 
     ESP_LOGI(TAG, "battery bus_volts = %.2f, shunt_mv = %.2f, final value: %.2f", bus_volts, shunt_mv, battery_voltage);
@@ -76,8 +105,9 @@ double BatteryMonitor::get_voltage() {
  * @return Battery current.
  */
 float BatteryMonitor::get_current() {
-    if (ina219_ok && battery) {
+    if (lock_battery()) {
         float mA = battery->getCurrent_mA();
+        unlock_battery();
         ESP_LOGI(TAG, "battery bus_mA = %.2f", mA);
         return mA;
     }
@@ -85,14 +115,36 @@ float BatteryMonitor::get_current() {
     return -1.0f;
 }
 
+/**
+ * @brief Get the power drawn from the battery, less any charging current.
+ *
+ * Unlike get_voltage() and get_current() nothing is logged, so this can be
+ * sampled many times a second.
+ *
+ * If the IC is not initialed this function will return 0, check get_voltage()
+ * first to tell that apart from no power being drawn.
+ *
+ * @return Battery power in mW, negative while the battery is charging.
+ */
+float BatteryMonitor::get_power() {
+    if (lock_battery()) {
+        const float mW = battery->getBusVoltage_V() * battery->getCurrent_mA();
+        unlock_battery();
+        return mW;
+    }
+
+    return 0.0f;
+}
+
 /**
  * @brief Puts the INA219 IC in a sleep mode.
  *
  * The IC will consume around 6 uA when in sleep mode.
  */
 void BatteryMonitor::sleep() {
-    if (ina219_ok && battery) {
+    if (lock_battery()) {
         battery->powerSave(true);
+        unlock_battery();
     }
 }
 
@@ -100,7 +152,8 @@ void BatteryMonitor::sleep() {
  * @brief Wakes up the INA219 IC.
  */
 void BatteryMonitor::wakeup() {
-    if (ina219_ok && battery) {
+    if (lock_battery()) {
         battery->powerSave(false);
+        unlock_battery();
     }
 }
@@ -0,0 +1,104 @@
+#include <Arduino.h>
+#include "profiler.h"
+
+#include <esp_attr.h>
+#include <esp_log.h>
+#include <freertos/FreeRTOS.h>
+
+#define TAG "profiler"
+
+// RTC_NOINIT_ATTR rather than RTC_DATA_ATTR so the profile also survives the restart done by the
+// timeout task, which is when it is most useful. begin() resets it after a power on.
+static RTC_NOINIT_ATTR wombat::WakeProfile wake_profile;
+static wombat::WakeProfiler profiler(wake_profile);
+static bool profiler_begun = false;
+//! Phases are timed on both cores during an uplink cycle.
+static portMUX_TYPE profiler_mux = portMUX_INITIALIZER_UNLOCKED;
+
+/**
+ * @brief Returns the profiler for this wake, starting it on the first call.
+ */
+wombat::WakeProfiler& get_profiler(void) {
+    if ( ! profiler_begun) {
+        profiler.begin();
+        profiler_begun = true;
+    }
+
+    return profiler;
+}
+
+void profile_start(wombat::wake_phase_t phase) {
+    wombat::WakeProfiler& p = get_profiler();
+    const uint32_t now = millis();
+    portENTER_CRITICAL(&profiler_mux);
+    p.start(phase, now);
+    portEXIT_CRITICAL(&profiler_mux);
+}
+
+void profile_stop(wombat::wake_phase_t phase) {
+    wombat::WakeProfiler& p = get_profiler();
+    const uint32_t now = millis();
+    portENTER_CRITICAL(&profiler_mux);
+    p.stop(phase, now);
+    portEXIT_CRITICAL(&profiler_mux);
+}
+
+/**
+ * @brief Record this wake in the profile kept in RTC memory. Called once, just before sleeping.
+ *
+ * The wake is copied and recorded under the same lock as profile_start() and profile_stop(), in case
+ * a task on the other core is still timing a phase, and the copy is logged once the lock is released.
+ */
+void profile_finish(void) {
+    wombat::WakeProfiler& p = get_profiler();
+    const uint32_t now = millis();
+    portENTER_CRITICAL(&profiler_mux);
+    const wombat::WakeRecord wake = p.current();
+    p.finish(now);
+    portEXIT_CRITICAL(&profiler_mux);
+
+    for (size_t phase = 0; phase < wombat::WAKE_NUM_PHASES; phase++) {
+        if (wake.phase_ms[phase] > 0) {
+            ESP_LOGI(TAG, "%s: %lu", wombat::WAKE_PHASE_LABELS[phase], (unsigned long)wake.phase_ms[phase]);
+        }
+    }
+}
+
+/**
+ * @brief Add the profile of the previous wake to an uplink message.
+ *
+ * Only the phases that ran are added, with the total wake time, the 90th percentile of the wake
+ * time over the wakes in the histogram, and the time taken by the slowest SDI-12 sensor.
+ */
+void add_profile_summary(JsonArray& timeseries) {
+    wombat::WakeProfiler& p = get_profiler();
+    const wombat::WakeRecord* last = p.record(0);
+    if (last == nullptr) {
+        return;
+    }
+
+    auto entry = timeseries.add<JsonObject>();
+    entry["name"] = "wake (ms)";
+    entry["value"] = last->total_ms;
+
+    const uint32_t p90 = p.percentile(wombat::WAKE_HISTOGRAM_TOTAL, 90);
+    if (p90 > 0 && p90 < UINT32_MAX) {
+        entry = timeseries.add<JsonObject>();
+        entry["name"] = "wake p90 (ms)";
+        entry["value"] = p90;
+    }
+
+    if (last->slowest_sensor != 0) {
+        entry = timeseries.add<JsonObject>();
+        entry["name"] = "sdi-12 slowest (ms)";
+        entry["value"] = last->slowest_sensor_ms;
+    }
+
+    for (size_t phase = 0; phase < wombat::WAKE_NUM_PHASES; phase++) {
+        if (last->phase_ms[phase] > 0) {
+            entry = timeseries.add<JsonObject>();
+            entry["name"] = wombat::WAKE_PHASE_LABELS[phase];
+            entry["value"] = last->phase_ms[phase];
+        }
+    }
+}
@@ -0,0 +1,244 @@
+#include <Arduino.h>
+#include "registration.h"
+#include "CAT_M1.h"
+#include "Utils.h"
+#include "globals.h"
+
+#include <esp_attr.h>
+#include <esp_log.h>
+#include <Preferences.h>
+
+#define TAG "registration"
+
+//! NVS namespace for the LTE-M band mask, used to restore it after a power loss.
+static constexpr const char* REG_NVS_NAMESPACE = "reg";
+//! NVS key for the LTE-M band mask before it was narrowed.
+static constexpr const char* REG_NVS_MASK_KEY = "mask";
+//! NVS key set while the modem may be left in manual operator selection. The R5 keeps the +COPS mode across a power loss.
+static constexpr const char* REG_NVS_MANUAL_KEY = "manual";
+
+//! How long the modem may take to select an operator, AT+COPS blocks until it has registered or given up.
+static constexpr unsigned long COPS_TIMEOUT_MS = 60000;
+
+static RTC_DATA_ATTR wombat::RegCacheState reg_cache_state;
+static wombat::RegCache reg_cache(reg_cache_state);
+
+/**
+ * @brief Remember the band mask before it is narrowed in NVS, because the modem keeps the narrowed
+ * mask across a power loss but the RTC memory does not.
+ */
+static void save_full_mask(const uint64_t mask) {
+    Preferences prefs;
+    if ( ! prefs.begin(REG_NVS_NAMESPACE, false)) {
+        ESP_LOGE(TAG, "Could not open NVS namespace %s", REG_NVS_NAMESPACE);
+        return;
+    }
+
+    if (mask != 0) {
+        prefs.putULong64(REG_NVS_MASK_KEY, mask);
+    } else {
+        prefs.remove(REG_NVS_MASK_KEY);
+    }
+    prefs.end();
+}
+
+static uint64_t load_full_mask(void) {
+    Preferences prefs;
+    if ( ! prefs.begin(REG_NVS_NAMESPACE, true)) {
+        return 0;
+    }
+
+    const uint64_t mask = prefs.getULong64(REG_NVS_MASK_KEY, 0);
+    prefs.end();
+    return mask;
+}
+
+static bool load_manual_selection(void) {
+    Preferences prefs;
+    if ( ! prefs.begin(REG_NVS_NAMESPACE, true)) {
+        return false;
+    }
+
+    const bool manual = prefs.getBool(REG_NVS_MANUAL_KEY, false);
+    prefs.end();
+    return manual;
+}
+
+static void save_manual_selection(const bool manual) {
+    Preferences prefs;
+    if ( ! prefs.begin(REG_NVS_NAMESPACE, false)) {
+        ESP_LOGE(TAG, "Could not open NVS namespace %s", REG_NVS_NAMESPACE);
+        return;
+    }
+
+    prefs.putBool(REG_NVS_MANUAL_KEY, manual);
+    prefs.end();
+}
+
+/**
+ * @brief Put the modem back to automatic operator selection. AT+COPS=0 blocks until the modem has
+ * registered or given up, so it is only sent if an earlier attach used AT+COPS=4.
+ */
+static void automatic_selection(void) {
+    if (load_manual_selection() && modem_command("+COPS=0", COPS_TIMEOUT_MS)) {
+        save_manual_selection(false);
+    }
+}
+
+static bool set_band_mask(const uint64_t mask) {
+    char cmd[40];
+    snprintf(cmd, sizeof(cmd), "+UBANDMASK=0,%llu", (unsigned long long)mask);
+    return modem_command(cmd);
+}
+
+/**
+ * @brief Narrow the LTE-M band mask to the cached band once registration on it is stable, or put
+ * back the full mask once it is not.
+ *
+ * The modem only uses a new band mask after it restarts, so a change made on one wake takes effect
+ * on the next.
+ */
+static void update_band_mask(void) {
+    uint64_t full = reg_cache.get_full_mask();
+    if (full == 0) {
+        full = load_full_mask();
+    }
+
+    uint64_t mask;
+    if (full != 0) {
+        if ( ! reg_cache.narrow_mask(full, mask)) {
+            if (set_band_mask(full)) {
+                ESP_LOGI(TAG, "Restored LTE-M band mask %llu", (unsigned long long)full);
+                log_to_sdcardf("Restored LTE-M band mask %llu", (unsigned long long)full);
+                reg_cache.restored();
+                save_full_mask(0);
+            }
+        }
+        return;
+    }
+
+    uint64_t current;
+    if ( ! modem_command("+UBANDMASK?") || ! wombat::parse_ubandmask(g_buffer, current)) {
+        return;
+    }
+
+    if (reg_cache.narrow_mask(current, mask) && set_band_mask(mask)) {
+        ESP_LOGI(TAG, "Narrowed LTE-M band mask to band %u", reg_cache.get_cell().band);
+        log_to_sdcardf("Narrowed LTE-M band mask to band %u", reg_cache.get_cell().band);
+        reg_cache.narrowed(current);
+        save_full_mask(current);
+    }
+}
+
+/**
+ * @brief Get the modem ready to register. Called after the network profile is set and before
+ * waiting for registration.
+ *
+ * If the node registered on the same network recently the modem is asked for that PLMN and access
+ * technology directly, rather than searching for an operator. AT+COPS=4 falls back to automatic
+ * selection if the PLMN cannot be found.
+ *
+ * @return true if the fast path was used.
+ */
+bool registration_prepare(void) {
+    reg_cache.begin();
+    update_band_mask();
+
+    if ( ! reg_cache.use_fast_path()) {
+        // The fast path has stopped working, go back to automatic selection.
+        automatic_selection();
+        return false;
+    }
+
+    char cmd[40];
+    if (reg_cache.get_act() != 0) {
+        snprintf(cmd, sizeof(cmd), "+COPS=4,2,\"%s\",%u", reg_cache.get_plmn(), reg_cache.get_act());
+    } else {
+        snprintf(cmd, sizeof(cmd), "+COPS=4,2,\"%s\"", reg_cache.get_plmn());
+    }
+
+    // Recorded before the command is sent, because the modem may keep the mode even if it fails.
+    if ( ! load_manual_selection()) {
+        save_manual_selection(true);
+    }
+
+    ESP_LOGI(TAG, "Registering on cached PLMN %s, band %u", reg_cache.get_plmn(), reg_cache.get_cell().band);
+    if ( ! modem_command(cmd, COPS_TIMEOUT_MS)) {
+        log_to_sdcardf("[W] Cached PLMN %s not selected", reg_cache.get_plmn());
+        registration_failed(true);
+        automatic_selection();
+        return false;
+    }
+
+    return true;
+}
+
+//! How long to wait before polling the registration status again.
+uint32_t registration_poll_ms(const uint32_t elapsed_ms) {
+    return wombat::RegCache::poll_ms(elapsed_ms);
+}
+
+/**
+ * @brief Record a registration, and the network and serving cell it was on.
+ *
+ * @param ms how long the registration took, in milliseconds.
+ * @param fast true if registration_prepare() used the fast path.
+ */
+void registration_succeeded(const uint32_t ms, const bool fast) {
+    char plmn[wombat::PLMN_LEN + 1] = {};
+    uint8_t act = 0;
+    modem_command("+COPS=3,2");
+    if ( ! modem_command("+COPS?") || ! wombat::parse_cops(g_buffer, plmn, act)) {
+        plmn[0] = 0;
+    }
+
+    wombat::ServingCell cell = {};
+    if ( ! modem_command("+UCGED=2") || ! modem_command("+UCGED?") || ! wombat::parse_ucged(g_buffer, cell)) {
+        cell.band = 0;
+    }
+
+    reg_cache.begin();
+    reg_cache.registered(plmn, act, cell, ms, fast);
+
+    ESP_LOGI(TAG, "Registered on %s band %u cell %lX in %lu ms, fast: %d", plmn, cell.band,
+             (unsigned long)cell.cell_id, (unsigned long)ms, fast);
+    log_to_sdcardf("Registered on %s band %u cell %lX in %lu ms, fast: %d, mean %lu ms (%lu), fast mean %lu ms (%lu), max %lu ms",
+                   plmn, cell.band, (unsigned long)cell.cell_id, (unsigned long)ms, fast,
+                   (unsigned long)reg_cache.get_mean_ms(), (unsigned long)reg_cache.get_attaches(),
+                   (unsigned long)reg_cache.get_fast_mean_ms(), (unsigned long)reg_cache.get_fast_attaches(),
+                   (unsigned long)reg_cache.get_max_ms());
+}
+
+/**
+ * @brief Record a registration that did not succeed.
+ *
+ * @param fast true if registration_prepare() used the fast path.
+ */
+void registration_failed(const bool fast) {
+    if (fast) {
+        reg_cache.begin();
+        reg_cache.fast_failed();
+    }
+}
+
+/**
+ * @brief Add whether the last registration used the fast path, and the mean registration time, to
+ * a message, once. The time of the last registration is in the wake profile summary.
+ */
+void add_registration_stats(JsonArray& timeseries) {
+    reg_cache.begin();
+
+    uint32_t ms;
+    bool fast;
+    if ( ! reg_cache.take_unreported(ms, fast)) {
+        return;
+    }
+
+    auto entry = timeseries.add<JsonObject>();
+    entry["name"] = "registration fast";
+    entry["value"] = fast ? 1 : 0;
+
+    entry = timeseries.add<JsonObject>();
+    entry["name"] = "registration mean (ms)";
+    entry["value"] = reg_cache.get_mean_ms();
+}
@@ -0,0 +1,177 @@
+/**
+ * @file transfers.cpp
+ *
+ * @brief Sources and sinks for copying files between SPIFFS, the SD card and the modem with the
+ * wombat::FileTransfer engine.
+ */
+#include "transfers.h"
+#include "globals.h"
+#include "Utils.h"
+
+#define TAG "transfers"
+
+FsFileSource::FsFileSource(fs::FS& fs, const char* path) {
+    file = fs.open(path, FILE_READ);
+}
+
+int32_t FsFileSource::read(uint8_t* buf, const size_t len) {
+    if ( ! file) {
+        return -1;
+    }
+
+    return static_cast<int32_t>(file.read(buf, len));
+}
+
+FsFileSink::FsFileSink(fs::FS& fs, const char* path, const char* mode) {
+    file = fs.open(path, mode, true);
+}
+
+bool FsFileSink::write(const uint8_t* data, const size_t len) {
+    return file && file.write(data, len) == len;
+}
+
+bool FsFileSink::finish(void) {
+    if ( ! file) {
+        return false;
+    }
+
+    file.close();
+    return true;
+}
+
+R5FileSource::R5FileSource(const String& name) : name(name) {
+    int sz = 0;
+    err = r5.getFileSize(name, &sz);
+    ok = err == SARA_R5_ERROR_SUCCESS && sz >= 0;
+    file_size = ok ? static_cast<size_t>(sz) : 0;
+}
+
+int32_t R5FileSource::read(uint8_t* buf, size_t len) {
+    if ( ! ok) {
+        return -1;
+    }
+
+    // Reading past the end of a file is an error, so stop at the size found when the file was opened.
+    if (len > file_size - offset) {
+        len = file_size - offset;
+    }
+
+    if (len < 1) {
+        return 0;
+    }
+
+    size_t bytes_read = 0;
+    err = r5.getFileBlock(name, reinterpret_cast<char*>(buf), offset, len, bytes_read);
+    if (err != SARA_R5_ERROR_SUCCESS) {
+        ESP_LOGE(TAG, "Read of %s at %lu failed: %d", name.c_str(), (unsigned long)offset, err);
+        return -1;
+    }
+
+    offset += bytes_read;
+    return static_cast<int32_t>(bytes_read);
+}
+
+bool R5FileSink::write(const uint8_t* data, const size_t len) {
+    SARA_R5_error_t err = r5.appendFileContents(name, reinterpret_cast<const char*>(data), static_cast<int>(len));
+    if (err != SARA_R5_ERROR_SUCCESS) {
+        ESP_LOGE(TAG, "Append to %s failed: %d", name.c_str(), err);
+        return false;
+    }
+
+    return true;
+}
+
+BackgroundSource::BackgroundSource(wombat::XferSource& source) : source(source) {
+    request = xSemaphoreCreateBinary();
+    done = xSemaphoreCreateBinary();
+    if (request == nullptr || done == nullptr) {
+        return;
+    }
+
+    // Run at the caller's priority so neither side of the transfer starves the other.
+    if (xTaskCreate(read_task, "Xfer read", 8192, this, uxTaskPriorityGet(nullptr), &task) != pdPASS) {
+        ESP_LOGW(TAG, "Could not create read task, reading in the foreground");
+        task = nullptr;
+    }
+}
+
+BackgroundSource::~BackgroundSource() {
+    finish_read();
+
+    if (task != nullptr) {
+        vTaskDelete(task);
+    }
+
+    if (request != nullptr) {
+        vSemaphoreDelete(request);
+    }
+
+    if (done != nullptr) {
+        vSemaphoreDelete(done);
+    }
+}
+
+void BackgroundSource::read_task(void* arg) {
+    auto* self = static_cast<BackgroundSource*>(arg);
+    while (true) {
+        xSemaphoreTake(self->request, portMAX_DELAY);
+        self->timed_read();
+        xSemaphoreGive(self->done);
+    }
+}
+
+void BackgroundSource::timed_read(void) {
+    const uint32_t start = micros();
+    result = source.read(read_buf, read_len);
+    const uint32_t us = micros() - start;
+    read_us += us;
+    ESP_LOGD(TAG, "Read %ld bytes in %lu us", (long)result, (unsigned long)us);
+}
+
+void BackgroundSource::start_read(uint8_t* buf, const size_t len) {
+    read_buf = buf;
+    read_len = len;
+    if (task == nullptr) {
+        timed_read();
+        return;
+    }
+
+    in_flight = true;
+    xSemaphoreGive(request);
+}
+
+int32_t BackgroundSource::finish_read(void) {
+    if (in_flight) {
+        const uint32_t start = micros();
+        xSemaphoreTake(done, portMAX_DELAY);
+        wait_us += micros() - start;
+        in_flight = false;
+    }
+
+    return result;
+}
+
+/**
+ * @brief Copy from src to sink in blocks of half of g_buffer.
+ *
+ * @param limit the most bytes to copy, sink.finish() is only called if src has no more data.
+ * @param bytes [OUT] if not null, set to the number of bytes copied.
+ *
+ * @return false if the source or sink fails.
+ */
+bool transfer(wombat::XferSource& src, wombat::XferSink& sink, const size_t limit, size_t* bytes) {
+    wombat::FileTransfer xfer(reinterpret_cast<uint8_t*>(g_buffer), MAX_G_BUFFER);
+
+    const uint32_t start = millis();
+    const bool ok = xfer.run(src, sink, limit);
+    const uint32_t ms = millis() - start;
+
+    ESP_LOGI(TAG, "%s %lu bytes in %lu blocks, %lu ms", ok ? "Copied" : "Failed after", (unsigned long)xfer.get_bytes(),
+             (unsigned long)xfer.get_blocks(), (unsigned long)ms);
+
+    if (bytes != nullptr) {
+        *bytes = xfer.get_bytes();
+    }
+
+    return ok;
+}
@@ -1,4 +1,5 @@
 #include <SPIFFS.h>
+#include <algorithm>
 
 #include "globals.h"
 
@@ -6,6 +7,11 @@
 #include "uplinks.h"
 #include "mqtt_stack.h"
 #include "Utils.h"
+#include "msg_outbox.h"
+
+#include <msg_batch.h>
+#include <file_stage.h>
+#include <pub_window.h>
 
 #define TAG "uplinks"
 
@@ -18,25 +24,108 @@ enum mqtt_status_t {
 static volatile mqtt_status_t mqtt_status = MQTT_UNINITIALISED;
 
 static String topic("wombat");
+//! CBOR messages are published to a separate topic so consumers of the JSON messages are not affected.
+static String cbor_topic("wombat/cbor");
 
 static char msg_buf[4096 + 1];
 
 /**
- * Sends the given file via MQTT.
- *
- * @param filename the file to send, including the leading '/' required by SPIFFS.
- *
- * @return true if the message was sent ok, otherwise false.
+ * The SARA R5 file system, for staging messages too long to publish directly.
  */
-static bool process_file(const String& filename) {
-    ESP_LOGI(TAG, "Processing message file [%s]", filename.c_str());
-    log_to_sdcardf("Processing message file [%s]", filename.c_str());
+class R5ModemFileSystem : public wombat::ModemFileSystem {
+public:
+    bool remove(const char *name) override {
+        return r5.deleteFile(String(name)) == SARA_R5_ERROR_SUCCESS;
+    }
 
-    size_t msg_len;
-    if (read_spiffs_file(filename.c_str(), msg_buf, sizeof(msg_buf), msg_len)) {
-        return false;
+    bool append(const char *name, const uint8_t *data, size_t len) override {
+        return r5.appendFileContents(String(name), reinterpret_cast<const char*>(data), static_cast<int>(len)) == SARA_R5_ERROR_SUCCESS;
+    }
+
+    bool size(const char *name, size_t &sz) override {
+        int file_size = 0;
+        if (r5.getFileSize(String(name), &file_size) != SARA_R5_ERROR_SUCCESS || file_size < 0) {
+            return false;
+        }
+
+        sz = static_cast<size_t>(file_size);
+        return true;
+    }
+};
+
+static R5ModemFileSystem r5_fs;
+static wombat::FileStager stager(r5_fs, "a.txt");
+
+//! How long to wait for the broker to acknowledge a publish.
+static constexpr uint32_t PUBLISH_ACK_TIMEOUT_MS = 30000;
+
+//! What to do once the broker has acknowledged a publish.
+struct PendingPublish {
+    //! The outbox position after the messages in the publish.
+    wombat::OutboxMark mark;
+    //! The number of messages in the publish.
+    uint16_t count;
+};
+
+/**
+ * Publishes messages from msg_buf with the SARA R5, and acknowledges the outbox up to each batch
+ * once the broker has acknowledged it.
+ */
+class R5PublishLink : public wombat::PublishLink {
+public:
+    /**
+     * Set up the next publish. The message must be in msg_buf, and stays there until the window
+     * has sent it.
+     *
+     * @return the tag to send the publish with.
+     */
+    uint32_t next(String& msg_topic, const size_t msg_len, const PendingPublish& publish) {
+        const uint32_t tag = next_tag++;
+        pending[tag % NUM_PENDING] = publish;
+        topic = &msg_topic;
+        len = msg_len;
+        return tag;
+    }
+
+    bool publish(uint32_t tag) override {
+        return mqtt_publish_start(*topic, msg_buf, len);
+    }
+
+    bool wait_ack(uint32_t timeout_ms, int &result) override {
+        return mqtt_publish_wait(timeout_ms, result);
+    }
+
+    void delivered(uint32_t tag) override {
+        confirm(pending[tag % NUM_PENDING]);
     }
 
+    //! Acknowledge the outbox messages of a publish.
+    void confirm(const PendingPublish& publish) {
+        get_outbox().ack_to(publish.mark);
+        delivered_msgs += publish.count;
+    }
+
+    //! The number of messages acknowledged by the broker.
+    uint32_t delivered_msgs = 0;
+
+private:
+    //! One more than the window, because a publish is set up before the window makes room for it.
+    static constexpr size_t NUM_PENDING = wombat::PublishWindow::MAX_WINDOW + 1;
+
+    PendingPublish pending[NUM_PENDING];
+    uint32_t next_tag = 0;
+    String* topic = nullptr;
+    size_t len = 0;
+};
+
+static R5PublishLink publish_link;
+
+/**
+ * Connect to the internet and log in to the MQTT broker, unless that has already been tried this run.
+ *
+ * @return true if the node is logged in to the MQTT broker.
+ */
+static bool ensure_mqtt_login(void) {
     if (mqtt_status == MQTT_UNINITIALISED) {
         if ( ! connect_to_internet()) {
             ESP_LOGE(TAG, "cti failed, not processing file");
@@ -56,100 +145,167 @@ static bool process_file(const String& filename) {
 
     // This is not always true - if this function is called after a failed login then
     // we want to skip publishing the message.
-    if (mqtt_status == MQTT_LOGIN_OK) {
-        if (msg_len < MAX_MQTT_DIRECT_MSG_LEN) {
-            if (mqtt_publish(topic, msg_buf, msg_len)) {
-                SPIFFS.remove(filename);
-                return true;
-            }
-        } else {
-            const String r5_fn("a.txt");
+    return mqtt_status == MQTT_LOGIN_OK;
+}
 
-            r5.deleteFile(r5_fn);
-            delay(500);
-            r5.appendFileContents(r5_fn, msg_buf, msg_len);
+/**
+ * Publishes the contents of msg_buf, directly through the window if it is short enough or otherwise
+ * via a file on the modem once the publishes in flight have been acknowledged.
+ *
+ * @param msg_topic the topic to publish to.
+ * @param msg_len the number of bytes in msg_buf.
+ * @param publish what to do once the broker has acknowledged the message.
+ *
+ * @return true if the message was sent, otherwise false.
+ */
+static bool publish_msg_buf(wombat::PublishWindow& window, String& msg_topic, const size_t msg_len, const PendingPublish& publish) {
+    if (msg_len < MAX_MQTT_DIRECT_MSG_LEN) {
+        return window.send(publish_link.next(msg_topic, msg_len, publish));
+    }
 
-            const auto a = std::string(msg_buf, msg_len);
+    if ( ! window.flush()) {
+        return false;
+    }
 
-            memset(msg_buf, 0, sizeof(msg_buf));
-            delay(500);
+    if ( ! stager.stage(reinterpret_cast<const uint8_t*>(msg_buf), msg_len)) {
+        ESP_LOGE(TAG, "Failed to stage %lu byte message on modem", (unsigned long)msg_len);
+        log_to_sdcardf("[E] Failed to stage %lu byte message on modem", (unsigned long)msg_len);
+        return false;
+    }
 
-            size_t bytes_read;
-            SARA_R5_error_t r5_err;
-            int x = read_r5_file(r5_fn, msg_buf, msg_len, bytes_read, r5_err);
-            if (x == -1) {
-                return false;
-            }
+    const String r5_fn(stager.get_name());
+    if ( ! mqtt_publish_file(msg_topic, r5_fn)) {
+        return false;
+    }
 
-            if (x == -3 || bytes_read != msg_len) {
-                return false;
-            }
+    publish_link.confirm(publish);
+    return true;
+}
 
-            const char* const a_ptr = a.c_str();
-            bool file_corrupt = false;
-            for (size_t i = 0; i < msg_len; i++) {
-                if (a_ptr[i] != msg_buf[i]) {
-                    ESP_LOGE(TAG, "Mismatch at posn %lu, %c != %c", i, a_ptr[i], msg_buf[i]);
-                    file_corrupt = true;
-                    break;
-                }
-            }
+/**
+ * Publishes the messages read from the outbox since the last batch. The outbox is acknowledged up
+ * to the end of the batch once the broker has acknowledged it.
+ *
+ * A batch of one message is published as the message itself so the receiver sees the same
+ * payload as it would without batching.
+ *
+ * @param first the first message in the batch.
+ *
+ * @return true if the messages were sent, otherwise false.
+ */
+static bool publish_batch(wombat::PublishWindow& window, wombat::Outbox& outbox, const wombat::MsgBatch& batch,
+                          const std::vector<uint8_t>& first, String& msg_topic) {
+    size_t msg_len = first.size();
+    if (batch.count() == 1) {
+        memcpy(msg_buf, first.data(), msg_len);
+    } else {
+        ESP_LOGI(TAG, "Publishing %lu messages in %lu bytes", (unsigned long)batch.count(), (unsigned long)batch.size());
+        log_to_sdcardf("Publishing %lu messages in %lu bytes", (unsigned long)batch.count(), (unsigned long)batch.size());
+
+        std::vector<uint8_t> payload;
+        batch.payload(payload);
+        memcpy(msg_buf, payload.data(), payload.size());
+        msg_len = payload.size();
+    }
 
-            if (file_corrupt) {
-                return false;
-            }
+    const PendingPublish publish = { outbox.mark(), static_cast<uint16_t>(batch.count()) };
+    return ensure_mqtt_login() && publish_msg_buf(window, msg_topic, msg_len, publish);
+}
 
-            if ( ! mqtt_publish_file(topic, r5_fn)) {
-                return false;
+/**
+ * Sends the messages in the outbox, oldest first, stopping at the first message that cannot be sent.
+ *
+ * If batching is enabled consecutive messages of the same type are published together, in batches
+ * short enough to publish directly rather than through a modem file. Up to the window of publishes
+ * are in flight at once.
+ *
+ * @param msg_count incremented for each message the broker acknowledged.
+ *
+ * @return the number of messages that could not be sent.
+ */
+static uint16_t send_outbox(wombat::PublishWindow& window, uint16_t& msg_count) {
+    wombat::Outbox& outbox = get_outbox();
+    const bool batching = DeviceConfig::get().getMsgBatching();
+
+    wombat::MsgBatch batch(wombat::MSG_BATCH_JSON, MAX_MQTT_DIRECT_MSG_LEN - 1);
+    wombat::outbox_msg_type_t batch_type = wombat::OUTBOX_MSG_JSON;
+    std::vector<uint8_t> first;
+    std::vector<uint8_t> data;
+    wombat::outbox_msg_type_t type;
+    uint16_t sent = 0;
+    uint16_t upload_errors = 0;
+    const uint32_t delivered_before = publish_link.delivered_msgs;
+
+    while (mqtt_status != MQTT_LOGIN_FAILED) {
+        const bool have_msg = outbox.peek(type, data);
+
+        // Publish the batch when the next message cannot be added to it.
+        if (batch.count() > 0 && ( ! have_msg || ! batching || type != batch_type || ! batch.add(data.data(), data.size()))) {
+            sent += batch.count();
+            if ( ! publish_batch(window, outbox, batch, first, batch_type == wombat::OUTBOX_MSG_CBOR ? cbor_topic : topic)) {
+                break;
             }
 
-            SPIFFS.remove(filename);
-            return true;
+            batch.clear();
+            continue;
         }
-    }
 
-    return false;
-}
-
-void send_messages(void) {
-    if (spiffs_ok) {
-        File root = SPIFFS.open("/");
-        if ( ! root) {
-            ESP_LOGE(TAG, "Failed to open root directory of SPIFFS");
-            return;
+        if ( ! have_msg) {
+            break;
         }
 
-        const char *msg_file_prefix = DeviceConfig::getMsgFilePrefix();
-        const size_t msg_file_prefix_len = strlen(msg_file_prefix);
-
-        uint16_t file_count = 0;
-        uint16_t upload_errors = 0;
-        String filename = root.getNextFileName();
-        while (filename.length() > 0) {
-            ESP_LOGD(TAG, "Found file %s", filename.c_str());
-            if ( ! strncmp(&filename.c_str()[1], msg_file_prefix, msg_file_prefix_len)) {
-                if (file_count > 0) {
-                    delay(250);
-                }
-
-                if (!process_file(filename)) {
-                    upload_errors++;
+        if (batch.count() == 0) {
+            // Batches are kept short enough to publish directly. A message too long to publish directly
+            // goes in a batch of its own, which is published through a modem file.
+            const wombat::msg_batch_format_t format = type == wombat::OUTBOX_MSG_CBOR ? wombat::MSG_BATCH_CBOR : wombat::MSG_BATCH_JSON;
+            const size_t alone = data.size() + wombat::MsgBatch::overhead(format, 1);
+            batch = wombat::MsgBatch(format, alone < MAX_MQTT_DIRECT_MSG_LEN ? MAX_MQTT_DIRECT_MSG_LEN - 1 : std::min(alone, sizeof(msg_buf) - 1));
+            batch_type = type;
+            if ( ! batch.add(data.data(), data.size())) {
+                ESP_LOGE(TAG, "Discarding queued message, %lu bytes is too long to send", (unsigned long)data.size());
+                log_to_sdcardf("[E] Discarding queued message, %lu bytes is too long to send", (unsigned long)data.size());
+                upload_errors++;
+                outbox.advance();
+                // Only acknowledged once the publishes before it have been, or it would acknowledge them too.
+                if (window.flush()) {
+                    outbox.ack();
                 }
-                file_count++;
+                continue;
             }
 
-            if (mqtt_status == MQTT_LOGIN_FAILED) {
-                ESP_LOGW(TAG, "MQTT login failed, skipping any further messages");
-                log_to_sdcard("MQTT login failed, skipping any further messages");
-                break;
-            }
-
-            filename = root.getNextFileName();
+            first.swap(data);
         }
 
-        root.close();
+        outbox.advance();
+    }
+
+    // Messages after the last one the broker acknowledged are sent again next time.
+    window.flush();
+    outbox.rewind();
+
+    const uint16_t delivered = static_cast<uint16_t>(publish_link.delivered_msgs - delivered_before);
+    msg_count += delivered;
+    upload_errors += sent - delivered;
+
+    if (outbox.get_dropped() > 0) {
+        ESP_LOGW(TAG, "Outbox was full, %lu segments of old messages dropped", (unsigned long)outbox.get_dropped());
+        log_to_sdcardf("[W] Outbox was full, %lu segments of old messages dropped", (unsigned long)outbox.get_dropped());
+    }
+
+    return upload_errors;
+}
 
-        ESP_LOGI(TAG, "Processed %u files with %u upload errors", file_count, upload_errors);
+void send_messages(void) {
+    if (spiffs_ok) {
+        // Messages written to files by earlier firmware versions are moved into the outbox once.
+        migrate_msg_files();
+
+        const size_t window_size = DeviceConfig::get().getMqttWindow();
+        uint16_t msg_count = 0;
+        wombat::PublishWindow outbox_window(publish_link, window_size, PUBLISH_ACK_TIMEOUT_MS);
+        const uint16_t upload_errors = send_outbox(outbox_window, msg_count);
+        ESP_LOGI(TAG, "Sent %u queued messages with %u upload errors", msg_count, upload_errors);
+        log_to_sdcardf("Sent %u queued messages with %u upload errors", msg_count, upload_errors);
     }
 
     if (mqtt_status == MQTT_UNINITIALISED) {
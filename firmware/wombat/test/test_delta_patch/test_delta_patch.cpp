@@ -0,0 +1,261 @@
+#include "delta_patch.h"
+#include "crc32.h"
+
+#include <gtest/gtest.h>
+
+#include <cstring>
+#include <random>
+#include <vector>
+
+using namespace wombat;
+
+class VectorBase : public PatchBase {
+public:
+    explicit VectorBase(const std::vector<uint8_t> &data) : data(data) {}
+
+    bool read(size_t offset, uint8_t *buf, size_t len) override {
+        if (offset + len > data.size()) {
+            return false;
+        }
+        memcpy(buf, data.data() + offset, len);
+        return true;
+    }
+
+private:
+    const std::vector<uint8_t> &data;
+};
+
+class VectorSink : public XferSink {
+public:
+    std::vector<uint8_t> data;
+    int finished = 0;
+
+    bool write(const uint8_t *d, size_t len) override {
+        data.insert(data.end(), d, d + len);
+        return true;
+    }
+
+    bool finish(void) override {
+        finished++;
+        return true;
+    }
+};
+
+static void put_u32(std::vector<uint8_t> &v, uint32_t x) {
+    for (int i = 0; i < 4; i++) {
+        v.push_back(static_cast<uint8_t>(x >> (8 * i)));
+    }
+}
+
+//! Builds patches the way tools/make_ota_patch.py lays them out.
+class PatchWriter {
+public:
+    PatchWriter(const std::vector<uint8_t> &base, uint32_t target_len) {
+        patch = { 'W', 'D', 'P', '1' };
+        put_u32(patch, static_cast<uint32_t>(base.size()));
+        put_u32(patch, crc32(base.data(), base.size()));
+        put_u32(patch, target_len);
+        put_u32(patch, crc32(patch.data(), 16));
+    }
+
+    void copy(uint32_t offset, uint32_t len) {
+        patch.push_back(DeltaPatcher::OP_COPY);
+        put_u32(patch, offset);
+        put_u32(patch, len);
+    }
+
+    void add(const std::vector<uint8_t> &bytes) {
+        patch.push_back(DeltaPatcher::OP_ADD);
+        put_u32(patch, static_cast<uint32_t>(bytes.size()));
+        patch.insert(patch.end(), bytes.begin(), bytes.end());
+    }
+
+    std::vector<uint8_t> end(void) {
+        patch.push_back(DeltaPatcher::OP_END);
+        return patch;
+    }
+
+private:
+    std::vector<uint8_t> patch;
+};
+
+static std::vector<uint8_t> random_bytes(size_t n, unsigned seed) {
+    std::mt19937 rng(seed);
+    std::vector<uint8_t> v(n);
+    for (uint8_t &b : v) {
+        b = static_cast<uint8_t>(rng());
+    }
+    return v;
+}
+
+//! Apply a patch written in pieces of the given size.
+static bool apply(const std::vector<uint8_t> &base, const std::vector<uint8_t> &patch, size_t piece, VectorSink &out) {
+    VectorBase b(base);
+    DeltaPatcher patcher(b, out);
+    for (size_t offset = 0; offset < patch.size(); offset += piece) {
+        if ( ! patcher.write(patch.data() + offset, std::min(piece, patch.size() - offset))) {
+            return false;
+        }
+    }
+    return patcher.finish();
+}
+
+TEST(delta_patch, apply) {
+    const std::vector<uint8_t> base = random_bytes(100000, 1);
+
+    // The new image moves a block of the old one, inserts new bytes and drops the end.
+    std::vector<uint8_t> target(base.begin() + 50000, base.begin() + 90000);
+    const std::vector<uint8_t> inserted = random_bytes(777, 2);
+    target.insert(target.end(), inserted.begin(), inserted.end());
+    target.insert(target.end(), base.begin(), base.begin() + 30000);
+
+    PatchWriter w(base, static_cast<uint32_t>(target.size()));
+    w.copy(50000, 40000);
+    w.add(inserted);
+    w.add({});
+    w.copy(0, 30000);
+    const std::vector<uint8_t> patch = w.end();
+
+    for (size_t piece : { (size_t) 1, (size_t) 5, (size_t) 4096, patch.size() }) {
+        VectorSink out;
+        ASSERT_TRUE(apply(base, patch, piece, out)) << piece;
+        EXPECT_EQ(out.data, target);
+        EXPECT_EQ(out.finished, 1);
+    }
+
+    VectorBase b(base);
+    VectorSink out;
+    DeltaPatcher patcher(b, out);
+    ASSERT_TRUE(patcher.write(patch.data(), patch.size()));
+    ASSERT_TRUE(patcher.finish());
+    EXPECT_EQ(patcher.get_target_len(), target.size());
+    EXPECT_EQ(patcher.get_out_bytes(), target.size());
+    EXPECT_EQ(patcher.get_copied(), 70000U);
+}
+
+TEST(delta_patch, rejects) {
+    const std::vector<uint8_t> base = random_bytes(10000, 3);
+
+    PatchWriter good(base, 100);
+    good.copy(0, 100);
+    const std::vector<uint8_t> patch = good.end();
+
+    VectorSink out;
+    ASSERT_TRUE(apply(base, patch, patch.size(), out));
+
+    // A different base image fails before anything is written.
+    std::vector<uint8_t> other = base;
+    other[9999] ^= 1;
+    out.data.clear();
+    EXPECT_FALSE(apply(other, patch, patch.size(), out));
+    EXPECT_TRUE(out.data.empty());
+
+    // A damaged header.
+    std::vector<uint8_t> bad = patch;
+    bad[13] ^= 1;
+    EXPECT_FALSE(apply(base, bad, bad.size(), out));
+
+    // A truncated patch is not finished.
+    bad.assign(patch.begin(), patch.end() - 1);
+    EXPECT_FALSE(apply(base, bad, bad.size(), out));
+
+    // Bytes after the end.
+    bad = patch;
+    bad.push_back(0);
+    EXPECT_FALSE(apply(base, bad, bad.size(), out));
+
+    // Copying past the end of the base image.
+    PatchWriter past(base, 100);
+    past.copy(9950, 100);
+    bad = past.end();
+    EXPECT_FALSE(apply(base, bad, bad.size(), out));
+
+    // Writing more or less than the new image length.
+    PatchWriter longer(base, 100);
+    longer.copy(0, 101);
+    bad = longer.end();
+    EXPECT_FALSE(apply(base, bad, bad.size(), out));
+
+    PatchWriter shorter(base, 100);
+    shorter.copy(0, 99);
+    bad = shorter.end();
+    EXPECT_FALSE(apply(base, bad, bad.size(), out));
+
+    // An unknown operation.
+    bad = patch;
+    bad[DeltaPatcher::HEADER_SIZE] = 7;
+    EXPECT_FALSE(apply(base, bad, bad.size(), out));
+}
+
+/*
+ * A patch for a modelled minor release, a 1.2 MB image with 40 small edits each shifting the code
+ * after it, is a small fraction of the image to download.
+ */
+TEST(delta_patch, patch_size) {
+    const std::vector<uint8_t> base = random_bytes(1200000, 4);
+
+    std::vector<uint8_t> target;
+    std::vector<std::pair<uint32_t, uint32_t>> copies;
+    std::vector<std::vector<uint8_t>> adds;
+    const size_t edits = 40;
+    const size_t span = base.size() / edits;
+    for (size_t i = 0; i < edits; i++) {
+        const uint32_t start = static_cast<uint32_t>(i * span);
+        // Drop 20 bytes of the old code and insert 64 new bytes.
+        const uint32_t keep = static_cast<uint32_t>(span - 20);
+        target.insert(target.end(), base.begin() + start, base.begin() + start + keep);
+        const std::vector<uint8_t> edit = random_bytes(64, static_cast<unsigned>(100 + i));
+        target.insert(target.end(), edit.begin(), edit.end());
+        copies.emplace_back(start, keep);
+        adds.push_back(edit);
+    }
+
+    PatchWriter patch_writer(base, static_cast<uint32_t>(target.size()));
+    for (size_t i = 0; i < edits; i++) {
+        patch_writer.copy(copies[i].first, copies[i].second);
+        patch_writer.add(adds[i]);
+    }
+    const std::vector<uint8_t> patch = patch_writer.end();
+
+    VectorSink out;
+    ASSERT_TRUE(apply(base, patch, 32768, out));
+    ASSERT_EQ(out.data, target);
+
+    EXPECT_LT(patch.size() * 10, target.size());
+}
+
+//#undef ARDUINO
+#if defined(ARDUINO)
+#include <Arduino.h>
+
+void setup()
+{
+    // should be the same value as for the `test_speed` option in "platformio.ini"
+    // default value is test_speed=115200
+    Serial.begin(115200);
+
+    ::testing::InitGoogleTest();
+}
+
+void loop()
+{
+    // Run tests
+    if (RUN_ALL_TESTS())
+        ;
+
+    // sleep for 1 sec
+    delay(1000);
+}
+
+#else
+int main(int argc, char **argv)
+{
+    ::testing::InitGoogleTest(&argc, argv);
+
+    if (RUN_ALL_TESTS())
+    ;
+
+    // Always return zero-code and allow PlatformIO to parse results
+    return 0;
+}
+#endif
@@ -0,0 +1,234 @@
+#include "energy_policy.h"
+
+#include <gtest/gtest.h>
+
+#include <cstring>
+
+using namespace wombat;
+
+//! The measurement interval the tests use unless they say otherwise, 15 minutes.
+static constexpr uint32_t MEASURE_S = 900;
+
+//! Fill the history with the same readings.
+static void fill(EnergyPolicy &p, const double battery_v, const double solar_v, const size_t n = ENERGY_HISTORY,
+                 const uint32_t interval_s = MEASURE_S) {
+    for (size_t i = 0; i < n; i++) {
+        p.add(battery_v, solar_v, interval_s);
+    }
+}
+
+TEST(energy_policy, reset_when_invalid) {
+    EnergyPolicyState state;
+    memset(&state, 0xA5, sizeof(state));
+
+    EnergyPolicy p(state);
+    p.begin();
+    EXPECT_EQ(p.get_count(), 0U);
+    EXPECT_EQ(p.get_level(), ENERGY_NORMAL);
+    EXPECT_EQ(p.evaluate(), ENERGY_NORMAL);
+    EXPECT_TRUE(p.allows_bulk());
+    EXPECT_EQ(p.uplink_interval(3600, 900), 3600U);
+
+    // Readings the battery monitor could not take are not kept.
+    p.add(-1.0, 6.0, MEASURE_S);
+    EXPECT_EQ(p.get_count(), 0U);
+
+    // A valid state is kept.
+    p.add(3.9, 6.0, MEASURE_S);
+    p.begin();
+    EXPECT_EQ(p.get_count(), 1U);
+    EXPECT_EQ(p.get_battery_mv(), 3900);
+}
+
+TEST(energy_policy, levels) {
+    EnergyPolicyState state = {};
+    EnergyPolicy p(state);
+    p.begin();
+
+    fill(p, 3.9, 6.0, 10);
+    EXPECT_EQ(p.evaluate(), ENERGY_NORMAL);
+    EXPECT_EQ(p.uplink_interval(3600, 900), 3600U);
+
+    // One reading taken under load is averaged out.
+    p.add(3.4, 6.0, MEASURE_S);
+    EXPECT_EQ(p.evaluate(), ENERGY_NORMAL);
+
+    fill(p, 3.65, 6.0, EnergyPolicy::RECENT);
+    EXPECT_EQ(p.evaluate(), ENERGY_LOW);
+    EXPECT_FALSE(p.allows_bulk());
+    EXPECT_EQ(p.uplink_interval(3600, 900), 7200U);
+
+    // Just above the threshold is not enough to raise the level again.
+    fill(p, 3.72, 6.0, EnergyPolicy::RECENT);
+    EXPECT_EQ(p.evaluate(), ENERGY_LOW);
+    fill(p, 3.75, 6.0, EnergyPolicy::RECENT);
+    EXPECT_EQ(p.evaluate(), ENERGY_NORMAL);
+    // But just above it is enough to stay there.
+    fill(p, 3.71, 6.0, EnergyPolicy::RECENT);
+    EXPECT_EQ(p.evaluate(), ENERGY_NORMAL);
+
+    fill(p, 3.45, 6.0, EnergyPolicy::RECENT);
+    EXPECT_EQ(p.evaluate(), ENERGY_CRITICAL);
+    EXPECT_EQ(p.uplink_interval(3600, 900), 14400U);
+    EXPECT_EQ(p.uplink_interval(43200, 900), 86400U);
+
+    fill(p, 4.15, 6.0, EnergyPolicy::RECENT);
+    EXPECT_EQ(p.evaluate(), ENERGY_SURPLUS);
+    EXPECT_TRUE(p.allows_bulk());
+    EXPECT_EQ(p.uplink_interval(3600, 900), 1800U);
+    EXPECT_EQ(p.uplink_interval(2700, 900), 900U);
+    EXPECT_EQ(p.uplink_interval(900, 900), 900U);
+}
+
+TEST(energy_policy, harvest) {
+    EnergyPolicyState state = {};
+    EnergyPolicy p(state);
+    p.begin();
+
+    // A full battery is only a surplus if the panel is charging it.
+    fill(p, 4.15, 1.0);
+    EXPECT_FALSE(p.has_harvest());
+    EXPECT_EQ(p.evaluate(), ENERGY_LOW);
+
+    // A day in shade drops a level.
+    memset(&state, 0, sizeof(state));
+    p.begin();
+    fill(p, 3.9, 1.0, ENERGY_HISTORY - 1);
+    EXPECT_EQ(p.evaluate(), ENERGY_NORMAL);
+    p.add(3.9, 1.0, MEASURE_S);
+    EXPECT_EQ(p.evaluate(), ENERGY_LOW);
+    p.add(3.9, 5.5, MEASURE_S);
+    EXPECT_EQ(p.evaluate(), ENERGY_NORMAL);
+
+    // At a 5 minute interval the history only covers 8 hours, which a night without harvest fills.
+    memset(&state, 0, sizeof(state));
+    p.begin();
+    fill(p, 3.9, 5.5, 1, 300);
+    fill(p, 3.9, 1.0, 12 * 12, 300);
+    EXPECT_TRUE(p.has_harvest());
+    EXPECT_EQ(p.evaluate(), ENERGY_NORMAL);
+    fill(p, 3.9, 1.0, 12 * 12 - 1, 300);
+    EXPECT_EQ(p.evaluate(), ENERGY_NORMAL);
+    p.add(3.9, 1.0, 300);
+    EXPECT_FALSE(p.has_harvest());
+    EXPECT_EQ(p.evaluate(), ENERGY_LOW);
+
+    // A node without a solar monitor is never taken to be in shade, and is never in surplus.
+    memset(&state, 0, sizeof(state));
+    p.begin();
+    fill(p, 4.15, -1.0);
+    EXPECT_FALSE(p.knows_solar());
+    EXPECT_EQ(p.evaluate(), ENERGY_NORMAL);
+}
+
+/*
+ * A crude model of a node with a 2000 mAh cell measuring every 15 minutes and uplinking every hour.
+ * Voltage is taken to be linear in charge, from 3.3 V empty to 4.2 V full. A wake uses 0.7 mAh and an
+ * uplink another 3.3 mAh. In winter shade the panel gives 15 mA for 4 hours a day, in summer 150 mA
+ * for 10 hours.
+ */
+struct Node {
+    double mah;
+    int brownout_day = -1;
+    int uplinks = 0;
+};
+
+static constexpr double CAPACITY_MAH = 2000.0;
+
+static double volts(const double mah) {
+    return 3.3 + 0.9 * (mah / CAPACITY_MAH);
+}
+
+static void run(Node &node, EnergyPolicy *policy, const int days, const double harvest_ma, const int harvest_h) {
+    for (int w = 0; w < days * 96; w++) {
+        const int hour = (w / 4) % 24;
+        const bool sun = hour >= 12 - harvest_h / 2 && hour < 12 + (harvest_h + 1) / 2;
+
+        uint32_t uplink_s = 3600;
+        if (policy != nullptr) {
+            policy->evaluate();
+            uplink_s = policy->uplink_interval(3600, 900);
+        }
+
+        node.mah -= 0.7;
+        if ((static_cast<uint32_t>(w) * 900) % uplink_s == 0) {
+            node.mah -= 3.3;
+            node.uplinks++;
+        }
+        if (sun) {
+            node.mah += harvest_ma / 4.0;
+        }
+        if (node.mah > CAPACITY_MAH) {
+            node.mah = CAPACITY_MAH;
+        }
+        if (node.mah <= 0.0) {
+            node.brownout_day = w / 96;
+            return;
+        }
+
+        if (policy != nullptr) {
+            policy->add(volts(node.mah), sun ? 5.5 : 0.2, MEASURE_S);
+        }
+    }
+}
+
+TEST(energy_policy, seasons) {
+    EnergyPolicyState state = {};
+    EnergyPolicy policy(state);
+
+    Node fixed_winter{CAPACITY_MAH * 0.8};
+    run(fixed_winter, nullptr, 120, 15.0, 4);
+    policy.begin();
+    Node adaptive_winter{CAPACITY_MAH * 0.8};
+    run(adaptive_winter, &policy, 120, 15.0, 4);
+
+    Node fixed_summer{CAPACITY_MAH};
+    run(fixed_summer, nullptr, 30, 150.0, 10);
+    memset(&state, 0, sizeof(state));
+    policy.begin();
+    Node adaptive_summer{CAPACITY_MAH};
+    run(adaptive_summer, &policy, 30, 150.0, 10);
+
+    // A brownout day of -1 means the node ran for all of the days.
+    EXPECT_GE(fixed_winter.brownout_day, 0);
+    EXPECT_TRUE(adaptive_winter.brownout_day < 0 || adaptive_winter.brownout_day > fixed_winter.brownout_day);
+    EXPECT_LT(fixed_summer.brownout_day, 0);
+    EXPECT_LT(adaptive_summer.brownout_day, 0);
+    EXPECT_GT(adaptive_summer.uplinks, fixed_summer.uplinks);
+}
+
+//#undef ARDUINO
+#if defined(ARDUINO)
+#include <Arduino.h>
+
+void setup()
+{
+    // should be the same value as for the `test_speed` option in "platformio.ini"
+    // default value is test_speed=115200
+    Serial.begin(115200);
+
+    ::testing::InitGoogleTest();
+}
+
+void loop()
+{
+    // Run tests
+    if (RUN_ALL_TESTS())
+        ;
+
+    // sleep for 1 sec
+    delay(1000);
+}
+
+#else
+int main(int argc, char **argv)
+{
+    ::testing::InitGoogleTest(&argc, argv);
+
+    if (RUN_ALL_TESTS())
+    ;
+
+    // Always return zero-code and allow PlatformIO to parse results
+    return 0;
+}
+#endif
@@ -0,0 +1,245 @@
+#include "file_stage.h"
+#include "r5_emulator.h"
+
+#include <gtest/gtest.h>
+
+#include <string>
+#include <vector>
+
+using namespace wombat;
+
+/**
+ * The modem file system commands the SARA R5 library sends, driven against the R5 emulator. The
+ * UART time of every byte at 115200 baud is added to the emulated clock.
+ */
+class EmulatedModem : public ModemFileSystem {
+public:
+    explicit EmulatedModem(R5Emulator &r5) : r5(r5) {
+        command("ATE0");
+    }
+
+    bool remove(const char *name) override {
+        return command(std::string("AT+UDELFILE=\"") + name + "\"") == "OK";
+    }
+
+    bool append(const char *name, const uint8_t *data, size_t len) override {
+        appends++;
+        if (command(std::string("AT+UDWNFILE=\"") + name + "\"," + std::to_string(len)) != ">") {
+            return false;
+        }
+
+        send(std::string(reinterpret_cast<const char *>(data), len));
+        return wait_result() == "OK";
+    }
+
+    bool size(const char *name, size_t &sz) override {
+        if (command(std::string("AT+ULSTFILE=2,\"") + name + "\"") != "OK" || rsp.compare(0, 11, "+ULSTFILE: ") != 0) {
+            return false;
+        }
+
+        sz = std::stoul(rsp.substr(11));
+        return true;
+    }
+
+    //! Read a block of a file, as read_r5_file() does.
+    bool read_block(const char *name, size_t offset, size_t len, std::string &out) {
+        if (command(std::string("AT+URDBLOCK=\"") + name + "\"," + std::to_string(offset) + "," + std::to_string(len)) != "OK") {
+            return false;
+        }
+
+        const size_t quote = rsp.find(",\"");
+        out = rsp.substr(quote + 2, rsp.size() - quote - 3);
+        return true;
+    }
+
+    void delay(uint32_t ms) { r5.advance(ms); }
+
+    size_t uart_bytes = 0;
+    int appends = 0;
+
+private:
+    R5Emulator &r5;
+    std::string rx;
+    std::string rsp;
+    uint32_t uart_us = 0;
+
+    void uart_time(size_t n) {
+        uart_bytes += n;
+        uart_us += n * 10 * 1000000ULL / 115200;
+        r5.advance(uart_us / 1000);
+        uart_us %= 1000;
+    }
+
+    void send(const std::string &s) {
+        r5.write(reinterpret_cast<const uint8_t *>(s.data()), s.size());
+        uart_time(s.size());
+    }
+
+    std::string command(const std::string &cmd) {
+        send(cmd + "\r");
+        return wait_result();
+    }
+
+    std::string wait_result(void) {
+        rsp.clear();
+        for (int ms = 0; ms < 10000; ms++) {
+            int c;
+            size_t n = 0;
+            while ((c = r5.read()) >= 0) {
+                rx.push_back(static_cast<char>(c));
+                n++;
+            }
+            uart_time(n);
+
+            size_t eol;
+            while ((eol = rx.find("\r\n")) != std::string::npos) {
+                const std::string line = rx.substr(0, eol);
+                rx.erase(0, eol + 2);
+                if (line == "OK" || line == "ERROR") {
+                    return line;
+                }
+                if ( ! line.empty()) {
+                    rsp = line;
+                }
+            }
+
+            if (rx == ">") {
+                rx.clear();
+                return ">";
+            }
+
+            r5.advance(1);
+        }
+
+        return "";
+    }
+};
+
+static std::vector<uint8_t> make_payload(size_t len, uint8_t seed) {
+    std::vector<uint8_t> payload(len);
+    for (size_t i = 0; i < len; i++) {
+        payload[i] = static_cast<uint8_t>(seed + i * 7);
+    }
+    return payload;
+}
+
+TEST(file_stage, stage_and_reuse) {
+    R5Emulator r5;
+    EmulatedModem modem(r5);
+    FileStager stager(modem, "a.txt", 1000);
+
+    const std::vector<uint8_t> payload = make_payload(2500, 1);
+    ASSERT_TRUE(stager.stage(payload.data(), payload.size()));
+    EXPECT_FALSE(stager.was_reused());
+    EXPECT_EQ(modem.appends, 3);
+    EXPECT_EQ(r5.files["a.txt"], payload);
+
+    // The same payload again is only checked.
+    ASSERT_TRUE(stager.stage(payload.data(), payload.size()));
+    EXPECT_TRUE(stager.was_reused());
+    EXPECT_EQ(modem.appends, 3);
+
+    // A different payload replaces the file rather than appending to it.
+    const std::vector<uint8_t> other = make_payload(1200, 2);
+    ASSERT_TRUE(stager.stage(other.data(), other.size()));
+    EXPECT_FALSE(stager.was_reused());
+    EXPECT_EQ(r5.files["a.txt"], other);
+
+    // The file changed behind the stager's back, so it is written again.
+    r5.files["a.txt"].push_back('x');
+    ASSERT_TRUE(stager.stage(other.data(), other.size()));
+    EXPECT_FALSE(stager.was_reused());
+    EXPECT_EQ(r5.files["a.txt"], other);
+}
+
+TEST(file_stage, write_failure) {
+    R5Emulator r5;
+    EmulatedModem modem(r5);
+    FileStager stager(modem, "a.txt", 1000);
+
+    const std::vector<uint8_t> payload = make_payload(2500, 3);
+    r5.inject_fault("AT+UDWNFILE", R5_FAULT_ERROR);
+    EXPECT_FALSE(stager.stage(payload.data(), payload.size()));
+
+    // A failed stage is never reused, even with the same payload.
+    r5.inject_fault("AT+UDWNFILE=\"a.txt\",1000", R5_FAULT_ERROR);
+    EXPECT_FALSE(stager.stage(payload.data(), payload.size()));
+    ASSERT_TRUE(stager.stage(payload.data(), payload.size()));
+    EXPECT_FALSE(stager.was_reused());
+    EXPECT_EQ(r5.files["a.txt"], payload);
+
+    // A size mismatch fails the stage.
+    r5.inject_fault("AT+ULSTFILE", R5_FAULT_ERROR);
+    stager.invalidate();
+    EXPECT_FALSE(stager.stage(payload.data(), payload.size()));
+}
+
+/*
+ * The time and UART traffic to stage a message for an MQTT publish from a file, reading the file
+ * back and comparing it as publish_msg_buf() used to, and checking the size reported by the modem.
+ */
+TEST(file_stage, staging_time) {
+    const std::vector<uint8_t> payload = make_payload(3000, 4);
+
+    R5Emulator old_r5;
+    EmulatedModem old_modem(old_r5);
+    {
+        old_modem.remove("a.txt");
+        old_modem.delay(500);
+        ASSERT_TRUE(old_modem.append("a.txt", payload.data(), payload.size()));
+        old_modem.delay(500);
+
+        std::string read_back;
+        for (size_t offset = 0; offset < payload.size(); offset += 128) {
+            std::string block;
+            ASSERT_TRUE(old_modem.read_block("a.txt", offset, std::min<size_t>(128, payload.size() - offset), block));
+            read_back += block;
+            old_modem.delay(100);
+        }
+        ASSERT_EQ(read_back, std::string(payload.begin(), payload.end()));
+    }
+
+    R5Emulator r5;
+    EmulatedModem modem(r5);
+    FileStager stager(modem, "a.txt");
+    ASSERT_TRUE(stager.stage(payload.data(), payload.size()));
+
+    EXPECT_LT(modem.uart_bytes, payload.size() + 200);
+    EXPECT_LT(r5.now() * 5, old_r5.now());
+}
+
+//#undef ARDUINO
+#if defined(ARDUINO)
+#include <Arduino.h>
+
+void setup()
+{
+    // should be the same value as for the `test_speed` option in "platformio.ini"
+    // default value is test_speed=115200
+    Serial.begin(115200);
+
+    ::testing::InitGoogleTest();
+}
+
+void loop()
+{
+    // Run tests
+    if (RUN_ALL_TESTS())
+        ;
+
+    // sleep for 1 sec
+    delay(1000);
+}
+
+#else
+int main(int argc, char **argv)
+{
+    ::testing::InitGoogleTest(&argc, argv);
+
+    if (RUN_ALL_TESTS())
+    ;
+
+    // Always return zero-code and allow PlatformIO to parse results
+    return 0;
+}
+#endif
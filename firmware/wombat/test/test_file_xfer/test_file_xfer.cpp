@@ -0,0 +1,356 @@
+#include "file_xfer.h"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+using namespace wombat;
+
+static std::vector<uint8_t> make_data(size_t len) {
+    std::vector<uint8_t> data(len);
+    for (size_t i = 0; i < len; i++) {
+        data[i] = static_cast<uint8_t>(i * 13 + (i >> 8));
+    }
+    return data;
+}
+
+/// A sink that collects what is written to it and can be made to fail.
+class VectorSink : public XferSink {
+public:
+    std::vector<uint8_t> data;
+    std::vector<size_t> writes;
+    int finished = 0;
+    //! If non-zero, the write that would take the sink past this many bytes fails.
+    size_t fail_after = 0;
+
+    bool write(const uint8_t *d, size_t len) override {
+        if (fail_after > 0 && data.size() + len > fail_after) {
+            return false;
+        }
+        data.insert(data.end(), d, d + len);
+        writes.push_back(len);
+        return true;
+    }
+
+    bool finish(void) override {
+        finished++;
+        return true;
+    }
+};
+
+/// A source that counts background reads so the test can check none is left running.
+class CountingSource : public MemorySource {
+public:
+    CountingSource(const uint8_t *data, size_t len) : MemorySource(data, len) {}
+
+    int started = 0;
+    int finished = 0;
+    //! If non-zero, the read at or past this offset fails.
+    size_t fail_at = 0;
+    size_t offset = 0;
+
+    int32_t read(uint8_t *buf, size_t len) override {
+        if (fail_at > 0 && offset + len > fail_at) {
+            return -1;
+        }
+        const int32_t n = MemorySource::read(buf, len);
+        offset += n;
+        return n;
+    }
+
+    void start_read(uint8_t *buf, size_t len) override {
+        started++;
+        XferSource::start_read(buf, len);
+    }
+
+    int32_t finish_read(void) override {
+        finished++;
+        return XferSource::finish_read();
+    }
+};
+
+TEST(file_xfer, copy) {
+    const std::vector<uint8_t> data = make_data(10000);
+    uint8_t buffer[2048];
+
+    MemorySource src(data.data(), data.size());
+    VectorSink sink;
+    FileTransfer xfer(buffer, sizeof(buffer));
+    EXPECT_EQ(xfer.get_block_size(), 1024);
+
+    ASSERT_TRUE(xfer.run(src, sink));
+    EXPECT_EQ(sink.data, data);
+    EXPECT_EQ(xfer.get_bytes(), data.size());
+    EXPECT_EQ(xfer.get_blocks(), 10);
+    EXPECT_TRUE(xfer.at_end());
+    EXPECT_EQ(sink.finished, 1);
+    EXPECT_EQ(sink.writes.front(), 1024);
+    EXPECT_EQ(sink.writes.back(), 10000 - 9 * 1024);
+
+    // Copying into memory.
+    std::vector<uint8_t> out(data.size());
+    MemorySource src2(data.data(), data.size());
+    MemorySink mem(out.data(), out.size());
+    ASSERT_TRUE(xfer.run(src2, mem));
+    EXPECT_EQ(mem.size(), data.size());
+    EXPECT_EQ(out, data);
+
+    // An empty source.
+    MemorySource empty(data.data(), 0);
+    VectorSink sink2;
+    ASSERT_TRUE(xfer.run(empty, sink2));
+    EXPECT_EQ(xfer.get_bytes(), 0);
+    EXPECT_TRUE(xfer.at_end());
+    EXPECT_EQ(sink2.finished, 1);
+}
+
+TEST(file_xfer, parts) {
+    const std::vector<uint8_t> data = make_data(10000);
+    uint8_t buffer[2048];
+    FileTransfer xfer(buffer, sizeof(buffer));
+
+    // Copy the source in parts of 3000 bytes, as into a series of files.
+    MemorySource src(data.data(), data.size());
+    std::vector<uint8_t> joined;
+    int parts = 0;
+    do {
+        VectorSink sink;
+        ASSERT_TRUE(xfer.run(src, sink, 3000));
+        EXPECT_LE(sink.data.size(), 3000);
+        EXPECT_EQ(sink.finished, xfer.at_end() ? 1 : 0);
+        joined.insert(joined.end(), sink.data.begin(), sink.data.end());
+        parts++;
+    } while ( ! xfer.at_end());
+
+    EXPECT_EQ(joined, data);
+    EXPECT_EQ(parts, 4);
+
+    // When the source ends on a part boundary the last part is empty, because the source has to
+    // be read to find its end.
+    MemorySource src2(data.data(), 9000);
+    parts = 0;
+    do {
+        VectorSink sink;
+        ASSERT_TRUE(xfer.run(src2, sink, 3000));
+        parts++;
+    } while ( ! xfer.at_end());
+    EXPECT_EQ(parts, 4);
+    EXPECT_EQ(xfer.get_bytes(), 0);
+}
+
+TEST(file_xfer, errors) {
+    const std::vector<uint8_t> data = make_data(10000);
+    uint8_t buffer[2048];
+    FileTransfer xfer(buffer, sizeof(buffer));
+
+    CountingSource src(data.data(), data.size());
+    src.fail_at = 5000;
+    VectorSink sink;
+    EXPECT_FALSE(xfer.run(src, sink));
+    EXPECT_EQ(sink.data.size(), 4096);
+    EXPECT_EQ(sink.finished, 0);
+    EXPECT_EQ(src.started, src.finished);
+
+    CountingSource src2(data.data(), data.size());
+    VectorSink sink2;
+    sink2.fail_after = 3000;
+    EXPECT_FALSE(xfer.run(src2, sink2));
+    EXPECT_EQ(sink2.data.size(), 2048);
+    EXPECT_EQ(xfer.get_bytes(), 2048);
+    EXPECT_EQ(sink2.finished, 0);
+    EXPECT_EQ(src2.started, src2.finished);
+
+    // A buffer too small to split into blocks.
+    uint8_t tiny[1];
+    FileTransfer bad(tiny, sizeof(tiny));
+    MemorySource src3(data.data(), data.size());
+    EXPECT_FALSE(bad.run(src3, sink));
+}
+
+/*
+ * The throughput of each source and sink pair the node copies between, on a modelled clock.
+ *
+ * Each file system is modelled by a fixed cost per call and a transfer rate. The old copies are
+ * modelled as the code did them: SPIFFS and modem reads of 128 bytes with a delay after each, and
+ * SD card reads that open the file and seek for every block. The engine copies with 32 KB blocks
+ * from a 64 KB buffer, reading in the background so reads overlap writes.
+ */
+struct Fs {
+    const char *name;
+    double call_ms;
+    double bytes_per_ms;
+    //! The cost of opening a file and seeking to a position in it.
+    double open_ms;
+
+    double cost(size_t n) const { return call_ms + n / bytes_per_ms; }
+};
+
+static const Fs SPIFFS_FS = { "SPIFFS", 1.0, 400.0, 5.0 };
+static const Fs SD_FS = { "SD", 2.0, 500.0, 20.0 };
+//! The modem file system over the 115200 baud UART, AT+URDBLOCK or AT+UDWNFILE.
+static const Fs R5_FS = { "R5", 30.0, 11.52, 0.0 };
+//! The OTA partition, including erasing it.
+static const Fs FLASH_FS = { "flash", 0.5, 80.0, 0.0 };
+
+struct Clock {
+    double now = 0;
+};
+
+class ModelSource : public MemorySource {
+public:
+    ModelSource(Clock &clock, const Fs &fs, const uint8_t *data, size_t len, bool background) :
+        MemorySource(data, len), clock(clock), fs(fs), background(background) {}
+
+    int32_t read(uint8_t *buf, size_t len) override {
+        const int32_t n = MemorySource::read(buf, len);
+        clock.now += fs.cost(n);
+        return n;
+    }
+
+    void start_read(uint8_t *buf, size_t len) override {
+        if ( ! background) {
+            XferSource::start_read(buf, len);
+            return;
+        }
+
+        // The read runs alongside whatever the caller does until finish_read().
+        const double start = clock.now;
+        result = read(buf, len);
+        ready_ms = clock.now;
+        clock.now = start;
+    }
+
+    int32_t finish_read(void) override {
+        if ( ! background) {
+            return XferSource::finish_read();
+        }
+
+        clock.now = std::max(clock.now, ready_ms);
+        return result;
+    }
+
+private:
+    Clock &clock;
+    const Fs &fs;
+    bool background;
+    int32_t result = 0;
+    double ready_ms = 0;
+};
+
+class ModelSink : public XferSink {
+public:
+    ModelSink(Clock &clock, const Fs &fs) : clock(clock), fs(fs) {}
+
+    bool write(const uint8_t * /*data*/, size_t len) override {
+        clock.now += fs.cost(len);
+        bytes += len;
+        return true;
+    }
+
+    size_t bytes = 0;
+
+private:
+    Clock &clock;
+    const Fs &fs;
+};
+
+//! The old copy loops: a block of block_size bytes at a time, with delay_ms after each read.
+static double old_copy(const Fs &src, const Fs &dst, size_t len, size_t block_size, double delay_ms, bool reopen) {
+    double ms = src.open_ms;
+    for (size_t offset = 0; offset < len; offset += block_size) {
+        const size_t n = std::min(block_size, len - offset);
+        ms += (reopen ? src.open_ms : 0) + src.cost(n) + delay_ms;
+    }
+
+    // The data is then written in blocks of at most 64 KB.
+    for (size_t offset = 0; offset < len; offset += 65536) {
+        ms += dst.cost(std::min<size_t>(65536, len - offset));
+    }
+
+    return ms;
+}
+
+static double engine_copy(const Fs &src_fs, const Fs &dst_fs, const std::vector<uint8_t> &data, std::vector<uint8_t> &buffer) {
+    Clock clock;
+    clock.now = src_fs.open_ms;
+    ModelSource src(clock, src_fs, data.data(), data.size(), true);
+    ModelSink sink(clock, dst_fs);
+    FileTransfer xfer(buffer.data(), buffer.size());
+    EXPECT_TRUE(xfer.run(src, sink));
+    EXPECT_EQ(sink.bytes, data.size());
+    return clock.now;
+}
+
+TEST(file_xfer, throughput) {
+    std::vector<uint8_t> buffer(65536);
+
+    struct Pair {
+        const Fs &src;
+        const Fs &dst;
+        size_t len;
+        //! How the old code read the source.
+        size_t old_block;
+        double old_delay_ms;
+        bool old_reopen;
+    };
+
+    const Pair pairs[] = {
+        // Uplink, read_spiffs_file() then a publish via a modem file.
+        { SPIFFS_FS, R5_FS, 4096, 128, 250.0, false },
+        // FTP upload of an SD card file to modem chunk files.
+        { SD_FS, R5_FS, 256 * 1024, 65536, 0.0, true },
+        // OTA, modem file to the OTA partition.
+        { R5_FS, FLASH_FS, 1024 * 1024, 64000, 0.0, false },
+        // read_r5_file().
+        { R5_FS, FLASH_FS, 4096, 128, 100.0, false },
+        // CLI spiffs cp to the SD card, which had no implementation.
+        { SPIFFS_FS, SD_FS, 64 * 1024, 0, 0.0, false },
+    };
+
+    for (const Pair &p : pairs) {
+        SCOPED_TRACE(std::string(p.src.name) + " -> " + p.dst.name);
+        const std::vector<uint8_t> data = make_data(p.len);
+        const double new_ms = engine_copy(p.src, p.dst, data, buffer);
+        if (p.old_block > 0) {
+            EXPECT_LT(new_ms, old_copy(p.src, p.dst, p.len, p.old_block, p.old_delay_ms, p.old_reopen));
+        }
+    }
+}
+
+//#undef ARDUINO
+#if defined(ARDUINO)
+#include <Arduino.h>
+
+void setup()
+{
+    // should be the same value as for the `test_speed` option in "platformio.ini"
+    // default value is test_speed=115200
+    Serial.begin(115200);
+
+    ::testing::InitGoogleTest();
+}
+
+void loop()
+{
+    // Run tests
+    if (RUN_ALL_TESTS())
+        ;
+
+    // sleep for 1 sec
+    delay(1000);
+}
+
+#else
+int main(int argc, char **argv)
+{
+    ::testing::InitGoogleTest(&argc, argv);
+
+    if (RUN_ALL_TESTS())
+    ;
+
+    // Always return zero-code and allow PlatformIO to parse results
+    return 0;
+}
+#endif
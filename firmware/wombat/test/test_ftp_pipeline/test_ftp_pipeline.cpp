@@ -0,0 +1,452 @@
+#include "ftp_pipeline.h"
+#include "r5_emulator.h"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <deque>
+#include <string>
+#include <vector>
+
+using namespace wombat;
+
+/**
+ * Uploads chunks of a file held in memory through the R5 emulator, using the commands the SARA R5
+ * library sends. The UART time of every byte at 115200 baud is added to the emulated clock, and
+ * +UUFTPCR URCs are kept until they are waited for.
+ */
+class EmulatedChunkStore : public ChunkStore {
+public:
+    EmulatedChunkStore(R5Emulator &r5, const std::vector<uint8_t> &file) : r5(r5), file(file) {
+        command("ATE0");
+    }
+
+    bool login(void) {
+        r5.advance(5000);
+        if (command("AT+UPSDA=0,3") != "OK" || command("AT+UFTP=1,\"ftp.example.com\"") != "OK" ||
+            command("AT+UFTPC=1") != "OK") {
+            return false;
+        }
+
+        return wait_urc(1) == 1;
+    }
+
+    bool stage(uint32_t chunk, size_t len) override {
+        // The firmware appends blocks of 32 KB from the SD card.
+        const std::string name = chunk_name(chunk);
+        while (len > 0) {
+            const size_t n = std::min<size_t>(len, 32768);
+            if (command("AT+UDWNFILE=\"" + name + "\"," + std::to_string(n)) != ">") {
+                return false;
+            }
+
+            send(std::string(file.begin() + offset, file.begin() + offset + n));
+            if (wait_result() != "OK") {
+                return false;
+            }
+
+            offset += n;
+            len -= n;
+        }
+
+        return true;
+    }
+
+    bool start_put(uint32_t chunk) override {
+        return command("AT+UFTPC=5,\"" + chunk_name(chunk) + "\",\"" + chunk_name(chunk) + "\"") == "OK";
+    }
+
+    bool wait_put(uint32_t /*chunk*/) override {
+        return wait_urc(5) == 1;
+    }
+
+    bool remove(uint32_t chunk) override {
+        return command("AT+UDELFILE=\"" + chunk_name(chunk) + "\"") == "OK";
+    }
+
+    void uploaded(uint32_t chunk) override {
+        if (manifest != nullptr) {
+            manifest->confirm(chunk, file.size());
+        }
+    }
+
+    //! Move to where the next chunk starts in the file, when resuming.
+    void seek(size_t pos) { offset = pos; }
+
+    static std::string chunk_name(uint32_t chunk) {
+        char buf[32];
+        snprintf(buf, sizeof(buf), "data.json_%05u", chunk);
+        return buf;
+    }
+
+    //! The most chunk files on the modem at once.
+    size_t max_files = 0;
+    //! If set, chunks are confirmed in this manifest as they are uploaded.
+    UploadManifest *manifest = nullptr;
+
+private:
+    R5Emulator &r5;
+    const std::vector<uint8_t> &file;
+    size_t offset = 0;
+    std::string rx;
+    std::deque<std::pair<int, int>> urcs;
+    uint32_t uart_us = 0;
+
+    void uart_time(size_t n) {
+        uart_us += n * 10 * 1000000ULL / 115200;
+        r5.advance(uart_us / 1000);
+        uart_us %= 1000;
+    }
+
+    void send(const std::string &s) {
+        r5.write(reinterpret_cast<const uint8_t *>(s.data()), s.size());
+        uart_time(s.size());
+    }
+
+    std::string command(const std::string &cmd) {
+        send(cmd + "\r");
+        const std::string result = wait_result();
+        max_files = std::max(max_files, r5.files.size());
+        return result;
+    }
+
+    //! Read what the modem has sent, returning a final result, a prompt, or "" if there is none yet.
+    std::string poll(void) {
+        int c;
+        size_t n = 0;
+        while ((c = r5.read()) >= 0) {
+            rx.push_back(static_cast<char>(c));
+            n++;
+        }
+        uart_time(n);
+
+        size_t eol;
+        while ((eol = rx.find("\r\n")) != std::string::npos) {
+            const std::string line = rx.substr(0, eol);
+            rx.erase(0, eol + 2);
+            int op, result;
+            if (sscanf(line.c_str(), "+UUFTPCR: %d,%d", &op, &result) == 2) {
+                urcs.emplace_back(op, result);
+            } else if (line == "OK" || line == "ERROR") {
+                return line;
+            }
+        }
+
+        if (rx == ">") {
+            rx.clear();
+            return ">";
+        }
+
+        return "";
+    }
+
+    std::string wait_result(void) {
+        for (int ms = 0; ms < 10000; ms++) {
+            const std::string result = poll();
+            if ( ! result.empty()) {
+                return result;
+            }
+            r5.advance(1);
+        }
+
+        return "";
+    }
+
+    //! Wait for the +UUFTPCR URC of an FTP command, waking as soon as the modem sends it.
+    int wait_urc(int op) {
+        for (int ms = 0; ms < 600000; ms++) {
+            poll();
+            for (auto it = urcs.begin(); it != urcs.end(); it++) {
+                if (it->first == op) {
+                    const int result = it->second;
+                    urcs.erase(it);
+                    return result;
+                }
+            }
+            r5.advance(1);
+        }
+
+        return -1;
+    }
+};
+
+static std::vector<uint8_t> make_file(size_t len) {
+    std::vector<uint8_t> file(len);
+    for (size_t i = 0; i < len; i++) {
+        file[i] = static_cast<uint8_t>('a' + i % 26);
+    }
+    return file;
+}
+
+static std::vector<uint8_t> uploaded(R5Emulator &r5, uint32_t chunks) {
+    std::vector<uint8_t> joined;
+    for (uint32_t i = 0; i < chunks; i++) {
+        const std::vector<uint8_t> &part = r5.ftp_files["/" + EmulatedChunkStore::chunk_name(i)];
+        joined.insert(joined.end(), part.begin(), part.end());
+    }
+    return joined;
+}
+
+TEST(ftp_pipeline, upload) {
+    const std::vector<uint8_t> file = make_file(250000);
+    R5Emulator r5;
+    EmulatedChunkStore store(r5, file);
+    ASSERT_TRUE(store.login());
+
+    PipelinedUpload upload(store, file.size(), 100000);
+    EXPECT_EQ(upload.num_chunks(), 3);
+    ASSERT_TRUE(upload.run());
+    EXPECT_EQ(upload.get_puts(), 3);
+    EXPECT_EQ(uploaded(r5, 3), file);
+    EXPECT_TRUE(r5.files.empty());
+    EXPECT_EQ(store.max_files, 2);
+
+    // A file that fits in one chunk.
+    R5Emulator r5b;
+    EmulatedChunkStore store_b(r5b, file);
+    ASSERT_TRUE(store_b.login());
+    PipelinedUpload single(store_b, 1000, 100000);
+    ASSERT_TRUE(single.run());
+    EXPECT_EQ(r5b.ftp_files["/" + EmulatedChunkStore::chunk_name(0)].size(), 1000);
+    EXPECT_TRUE(r5b.files.empty());
+}
+
+TEST(ftp_pipeline, failures) {
+    const std::vector<uint8_t> file = make_file(250000);
+
+    // A failed PUT is retried without staging the chunk again.
+    R5Emulator r5;
+    EmulatedChunkStore store(r5, file);
+    ASSERT_TRUE(store.login());
+    r5.inject_fault("AT+UFTPC=5,\"data.json_00001\"", R5_FAULT_URC_FAILED);
+    r5.inject_fault("AT+UFTPC=5,\"data.json_00002\"", R5_FAULT_ERROR);
+    PipelinedUpload upload(store, file.size(), 100000);
+    ASSERT_TRUE(upload.run());
+    EXPECT_EQ(upload.get_puts(), 5);
+    EXPECT_EQ(uploaded(r5, 3), file);
+    EXPECT_TRUE(r5.files.empty());
+
+    // A chunk that cannot be sent stops the upload and its files are removed.
+    R5Emulator r5b;
+    EmulatedChunkStore store_b(r5b, file);
+    ASSERT_TRUE(store_b.login());
+    r5b.inject_fault("AT+UFTPC=5,\"data.json_00000\"", R5_FAULT_URC_FAILED, 3);
+    PipelinedUpload failed(store_b, file.size(), 100000);
+    EXPECT_FALSE(failed.run());
+    EXPECT_EQ(failed.get_puts(), 3);
+    EXPECT_TRUE(r5b.files.empty());
+    EXPECT_TRUE(r5b.ftp_files.empty());
+
+    // A chunk that cannot be staged stops the upload.
+    R5Emulator r5c;
+    EmulatedChunkStore store_c(r5c, file);
+    ASSERT_TRUE(store_c.login());
+    r5c.inject_fault("AT+UDWNFILE=\"data.json_00001\"", R5_FAULT_ERROR);
+    PipelinedUpload unstaged(store_c, file.size(), 100000);
+    EXPECT_FALSE(unstaged.run());
+    EXPECT_TRUE(r5c.files.empty());
+    EXPECT_EQ(r5c.ftp_files.size(), 1);
+}
+
+TEST(ftp_pipeline, manifest) {
+    UploadManifest m;
+    EXPECT_EQ(m.start("data.json", 250000, 0x1234, 100000), 0);
+    m.confirm(0, 250000);
+    m.confirm(1, 250000);
+    EXPECT_EQ(m.get_confirmed(), 200000);
+
+    uint8_t buf[UploadManifest::SIZE];
+    m.encode(buf);
+
+    UploadManifest r;
+    ASSERT_TRUE(r.decode(buf, sizeof(buf)));
+    EXPECT_EQ(r.get_chunk_size(), 100000);
+    EXPECT_EQ(r.get_confirmed(), 200000);
+
+    // The same file resumes at the first unconfirmed chunk, even if the modem now has more space.
+    EXPECT_EQ(r.start("data.json", 250000, 0x1234, 300000), 2);
+    EXPECT_EQ(r.get_chunk_size(), 100000);
+
+    // A finished upload has nothing left to send.
+    r.confirm(2, 250000);
+    EXPECT_EQ(r.get_confirmed(), 250000);
+    EXPECT_EQ(r.start("data.json", 250000, 0x1234, 100000), 3);
+
+    // A file that grew resumes at the chunk holding its old end.
+    EXPECT_EQ(r.start("data.json", 260000, 0x1234, 100000), 2);
+
+    // A different file, a file with a different start, or chunks the modem has no room for start again.
+    ASSERT_TRUE(r.decode(buf, sizeof(buf)));
+    EXPECT_EQ(r.start("log.txt", 250000, 0x1234, 100000), 0);
+    ASSERT_TRUE(r.decode(buf, sizeof(buf)));
+    EXPECT_EQ(r.start("data.json", 250000, 0x4321, 100000), 0);
+    ASSERT_TRUE(r.decode(buf, sizeof(buf)));
+    EXPECT_EQ(r.start("data.json", 250000, 0x1234, 50000), 0);
+    EXPECT_EQ(r.get_chunk_size(), 50000);
+    EXPECT_EQ(r.get_confirmed(), 0);
+
+    // A file shorter than the confirmed bytes, such as one deleted and written again.
+    ASSERT_TRUE(r.decode(buf, sizeof(buf)));
+    EXPECT_EQ(r.start("data.json", 150000, 0x1234, 100000), 0);
+
+    // A resumed upload keeps the compression it started with, a new upload uses the one asked for.
+    ASSERT_TRUE(r.decode(buf, sizeof(buf)));
+    EXPECT_EQ(r.start("data.json", 250000, 0x1234, 100000, true), 2);
+    EXPECT_FALSE(r.get_gzip());
+    EXPECT_EQ(r.start("data.json", 250000, 0x1234, 50000, true), 0);
+    EXPECT_TRUE(r.get_gzip());
+    r.encode(buf);
+    ASSERT_TRUE(r.decode(buf, sizeof(buf)));
+    EXPECT_EQ(r.start("data.json", 250000, 0x1234, 50000, false), 0);
+    EXPECT_TRUE(r.get_gzip());
+
+    // Damaged manifests are rejected.
+    buf[12] ^= 1;
+    EXPECT_FALSE(r.decode(buf, sizeof(buf)));
+    EXPECT_FALSE(r.decode(buf, sizeof(buf) - 1));
+}
+
+TEST(ftp_pipeline, manifest_short_file) {
+    // A log shorter than HEAD_SIZE is identified by the bytes it had when the manifest was made.
+    UploadManifest m;
+    EXPECT_EQ(m.head_length("log.txt", 1200), 1200);
+    EXPECT_EQ(m.start("log.txt", 1200, 0x5678, 500), 0);
+    m.confirm(0, 1200);
+    m.confirm(1, 1200);
+    m.confirm(2, 1200);
+
+    uint8_t buf[UploadManifest::SIZE];
+    m.encode(buf);
+
+    UploadManifest r;
+    ASSERT_TRUE(r.decode(buf, sizeof(buf)));
+    EXPECT_EQ(r.head_length("log.txt", 5000), 1200);
+    EXPECT_EQ(r.start("log.txt", 5000, 0x5678, 500), 2);
+    EXPECT_EQ(r.get_confirmed(), 1200);
+
+    // A file rewritten with different first bytes starts again.
+    ASSERT_TRUE(r.decode(buf, sizeof(buf)));
+    EXPECT_EQ(r.start("log.txt", 5000, 0x8765, 500), 0);
+
+    // A file now shorter than its head starts again, over the head it has now.
+    ASSERT_TRUE(r.decode(buf, sizeof(buf)));
+    EXPECT_EQ(r.head_length("log.txt", 1000), 1000);
+    EXPECT_EQ(r.start("log.txt", 1000, 0x5678, 500), 0);
+
+    // Other files, and files without a manifest, use HEAD_SIZE.
+    EXPECT_EQ(r.head_length("data.json", 250000), UploadManifest::HEAD_SIZE);
+    EXPECT_EQ(UploadManifest().head_length("log.txt", 250000), UploadManifest::HEAD_SIZE);
+}
+
+TEST(ftp_pipeline, resume) {
+    std::vector<uint8_t> file = make_file(250000);
+    UploadManifest manifest;
+    uint8_t saved[UploadManifest::SIZE];
+
+    // The second chunk cannot be sent in the first uplink window.
+    R5Emulator r5;
+    EmulatedChunkStore store(r5, file);
+    store.manifest = &manifest;
+    ASSERT_TRUE(store.login());
+    ASSERT_EQ(manifest.start("data.json", file.size(), 0x1234, 100000), 0);
+    r5.inject_fault("AT+UFTPC=5,\"data.json_00001\"", R5_FAULT_URC_FAILED, 3);
+    PipelinedUpload first(store, file.size(), manifest.get_chunk_size());
+    EXPECT_FALSE(first.run());
+    EXPECT_EQ(manifest.get_confirmed(), 100000);
+    EXPECT_TRUE(r5.files.empty());
+    manifest.encode(saved);
+
+    // The file grows before the next window, which resumes at the second chunk.
+    const std::vector<uint8_t> more = make_file(30000);
+    file.insert(file.end(), more.begin(), more.end());
+
+    UploadManifest resumed;
+    ASSERT_TRUE(resumed.decode(saved, sizeof(saved)));
+    const uint32_t first_chunk = resumed.start("data.json", file.size(), 0x1234, 200000);
+    EXPECT_EQ(first_chunk, 1);
+
+    EmulatedChunkStore store2(r5, file);
+    store2.manifest = &resumed;
+    store2.seek(first_chunk * resumed.get_chunk_size());
+    PipelinedUpload second(store2, file.size(), resumed.get_chunk_size());
+    ASSERT_TRUE(second.run(first_chunk));
+    EXPECT_EQ(second.get_puts(), 2);
+    EXPECT_EQ(resumed.get_confirmed(), file.size());
+    EXPECT_EQ(uploaded(r5, 3), file);
+    EXPECT_TRUE(r5.files.empty());
+
+    // Starting past the last chunk uploads nothing.
+    EXPECT_FALSE(second.run(3));
+    EXPECT_EQ(second.get_puts(), 0);
+}
+
+/*
+ * Radio-on time to upload a 1.5 MB data.json in chunks of a third of the free modem file system,
+ * one chunk after another as ftp_upload_file() did, and pipelined.
+ */
+TEST(ftp_pipeline, upload_time) {
+    const std::vector<uint8_t> file = make_file(1500 * 1024);
+    const size_t chunk_size = 1024 * 1024 / 3;
+
+    R5Emulator serial_r5;
+    EmulatedChunkStore serial(serial_r5, file);
+    ASSERT_TRUE(serial.login());
+    const uint32_t serial_start = serial_r5.now();
+    const uint32_t chunks = static_cast<uint32_t>((file.size() + chunk_size - 1) / chunk_size);
+    for (uint32_t i = 0; i < chunks; i++) {
+        ASSERT_TRUE(serial.stage(i, std::min(chunk_size, file.size() - i * chunk_size)));
+        ASSERT_TRUE(serial.start_put(i));
+        ASSERT_TRUE(serial.wait_put(i));
+        ASSERT_TRUE(serial.remove(i));
+    }
+    const uint32_t serial_ms = serial_r5.now() - serial_start;
+    ASSERT_EQ(uploaded(serial_r5, chunks), file);
+
+    R5Emulator r5;
+    EmulatedChunkStore store(r5, file);
+    ASSERT_TRUE(store.login());
+    const uint32_t start = r5.now();
+    PipelinedUpload upload(store, file.size(), chunk_size);
+    ASSERT_TRUE(upload.run());
+    const uint32_t pipelined_ms = r5.now() - start;
+    ASSERT_EQ(uploaded(r5, chunks), file);
+
+    EXPECT_LT(pipelined_ms, serial_ms * 3 / 4);
+}
+
+//#undef ARDUINO
+#if defined(ARDUINO)
+#include <Arduino.h>
+
+void setup()
+{
+    // should be the same value as for the `test_speed` option in "platformio.ini"
+    // default value is test_speed=115200
+    Serial.begin(115200);
+
+    ::testing::InitGoogleTest();
+}
+
+void loop()
+{
+    // Run tests
+    if (RUN_ALL_TESTS())
+        ;
+
+    // sleep for 1 sec
+    delay(1000);
+}
+
+#else
+int main(int argc, char **argv)
+{
+    ::testing::InitGoogleTest(&argc, argv);
+
+    if (RUN_ALL_TESTS())
+    ;
+
+    // Always return zero-code and allow PlatformIO to parse results
+    return 0;
+}
+#endif
@@ -0,0 +1,195 @@
+#include "log_buffer.h"
+
+#include <gtest/gtest.h>
+
+#include <cstring>
+#include <string>
+
+using namespace wombat;
+
+static bool append(LogBuffer &log, const std::string &s) {
+    return log.append(s.data(), s.size());
+}
+
+static std::string drain(LogBuffer &log, size_t &writes) {
+    std::string out;
+    writes = 0;
+    log.drain([&](const char *p, size_t n) {
+        out.append(p, n);
+        writes++;
+        return n;
+    });
+    return out;
+}
+
+TEST(log_buffer, append_drain) {
+    LogBuffer log(64);
+    EXPECT_EQ(log.size(), 0);
+    EXPECT_TRUE(append(log, "one\n"));
+    EXPECT_TRUE(append(log, "two\n"));
+    EXPECT_TRUE(log.append(nullptr, 0));
+    EXPECT_EQ(log.size(), 8);
+
+    size_t writes;
+    EXPECT_EQ(drain(log, writes), "one\ntwo\n");
+    EXPECT_EQ(writes, 1);
+    EXPECT_EQ(log.size(), 0);
+    EXPECT_EQ(log.space(), 64);
+
+    EXPECT_EQ(drain(log, writes), "");
+    EXPECT_EQ(writes, 0);
+}
+
+TEST(log_buffer, wrap) {
+    LogBuffer log(16);
+    ASSERT_TRUE(append(log, "0123456789\n"));
+
+    // Write part of the text so the next line wraps around the end of the buffer.
+    log.drain([](const char *, size_t) { return static_cast<size_t>(8); });
+    EXPECT_EQ(log.size(), 3);
+
+    ASSERT_TRUE(append(log, "abcdefghij\n"));
+    EXPECT_EQ(log.space(), 2);
+
+    size_t writes;
+    EXPECT_EQ(drain(log, writes), "89\nabcdefghij\n");
+    EXPECT_EQ(writes, 2);
+}
+
+TEST(log_buffer, full) {
+    LogBuffer log(16);
+    ASSERT_TRUE(append(log, "0123456789ab\n"));
+    EXPECT_TRUE(log.high_water());
+
+    // Lines are never split, a line that does not fit is dropped.
+    EXPECT_FALSE(append(log, "abcdef\n"));
+    EXPECT_EQ(log.get_dropped(), 1);
+    EXPECT_TRUE(append(log, "ab\n"));
+    EXPECT_EQ(log.space(), 0);
+
+    size_t writes;
+    EXPECT_EQ(drain(log, writes), "0123456789ab\nab\n");
+    EXPECT_FALSE(log.high_water());
+}
+
+TEST(log_buffer, failed_write) {
+    LogBuffer log(32);
+    ASSERT_TRUE(append(log, "0123456789\n"));
+
+    // The text stays in the buffer if the card cannot be written.
+    EXPECT_EQ(log.drain([](const char *, size_t) { return static_cast<size_t>(0); }), 0);
+    EXPECT_EQ(log.size(), 11);
+
+    size_t writes;
+    EXPECT_EQ(drain(log, writes), "0123456789\n");
+}
+
+/// A model of the time spent writing the SD card log during a wake.
+struct SdCost {
+    size_t writes;
+    double ms;
+};
+
+//! Opening /log.txt for append on a FAT file system over SPI reads the directory and FAT, then
+//! closing it writes the data sector, FAT and directory entry. About 6 sector transfers at 4 MHz.
+static constexpr double OPEN_APPEND_CLOSE_MS = 9.0;
+//! Writing the buffered text to the already open file and syncing the FAT and directory entry.
+static constexpr double FLUSH_MS = 4.0;
+//! Each 512 byte sector of data at 4 MHz SPI.
+static constexpr double SECTOR_MS = 1.3;
+
+static SdCost per_line(const size_t lines) {
+    return { lines, lines * OPEN_APPEND_CLOSE_MS };
+}
+
+static SdCost buffered(const size_t lines, const size_t line_len, const size_t phases) {
+    LogBuffer log(8192);
+    const std::string line(line_len - 1, 'x');
+    SdCost cost = { 0, 0.0 };
+
+    auto flush = [&]() {
+        if (log.size() == 0) {
+            return;
+        }
+
+        const double sectors = (log.size() + 511) / 512;
+        log.drain([](const char *, size_t n) { return n; });
+        cost.writes++;
+        cost.ms += FLUSH_MS + sectors * SECTOR_MS;
+    };
+
+    for (size_t i = 0; i < lines; i++) {
+        if ( ! append(log, line + "\n")) {
+            flush();
+            append(log, line + "\n");
+        } else if (log.high_water()) {
+            flush();
+        }
+
+        // log_to_sdcard() is flushed at each phase boundary in setup().
+        if (phases > 0 && (i + 1) % (lines / phases) == 0) {
+            flush();
+        }
+    }
+
+    flush();
+
+    // Opening the file once per wake.
+    cost.ms += OPEN_APPEND_CLOSE_MS;
+    return cost;
+}
+
+TEST(log_buffer, wake_time) {
+    struct Case {
+        const char *name;
+        size_t lines;
+    } cases[] = {
+        { "measurement wake", 25 },
+        { "uplink wake", 120 },
+    };
+
+    for (const Case &c : cases) {
+        SCOPED_TRACE(c.name);
+        const SdCost before = per_line(c.lines);
+        const SdCost after = buffered(c.lines, 60, 5);
+
+        EXPECT_LT(after.writes, before.writes / 4);
+        EXPECT_LT(after.ms, before.ms);
+    }
+}
+
+//#undef ARDUINO
+#if defined(ARDUINO)
+#include <Arduino.h>
+
+void setup()
+{
+    // should be the same value as for the `test_speed` option in "platformio.ini"
+    // default value is test_speed=115200
+    Serial.begin(115200);
+
+    ::testing::InitGoogleTest();
+}
+
+void loop()
+{
+    // Run tests
+    if (RUN_ALL_TESTS())
+        ;
+
+    // sleep for 1 sec
+    delay(1000);
+}
+
+#else
+int main(int argc, char **argv)
+{
+    ::testing::InitGoogleTest(&argc, argv);
+
+    if (RUN_ALL_TESTS())
+    ;
+
+    // Always return zero-code and allow PlatformIO to parse results
+    return 0;
+}
+#endif
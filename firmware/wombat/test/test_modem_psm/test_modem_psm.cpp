@@ -0,0 +1,182 @@
+#include "modem_psm.h"
+
+#include <gtest/gtest.h>
+
+#include <cstring>
+
+using namespace wombat;
+
+TEST(modem_psm, timers) {
+    char bits[PSM_TIMER_BITS + 1];
+
+    // 4 hours is 24 units of 10 minutes.
+    ASSERT_TRUE(psm_encode_periodic(4 * 3600, bits));
+    EXPECT_STREQ(bits, "00011000");
+    EXPECT_EQ(psm_decode_periodic(bits), 4 * 3600);
+
+    // Just over 70 minutes cannot be encoded exactly, the next longer time is 80 minutes in 10 minute units.
+    ASSERT_TRUE(psm_encode_periodic(70 * 60 + 1, bits));
+    EXPECT_STREQ(bits, "00001000");
+    EXPECT_EQ(psm_decode_periodic(bits), 80 * 60);
+
+    ASSERT_TRUE(psm_encode_periodic(24 * 3600, bits));
+    EXPECT_EQ(psm_decode_periodic(bits), 24 * 3600);
+    EXPECT_FALSE(psm_encode_periodic(32U * 1152000, bits));
+
+    // 10 seconds is 5 units of 2 seconds, 0 is valid and means sleep as soon as the connection is released.
+    ASSERT_TRUE(psm_encode_active(10, bits));
+    EXPECT_STREQ(bits, "00000101");
+    EXPECT_EQ(psm_decode_active(bits), 10);
+    ASSERT_TRUE(psm_encode_active(0, bits));
+    EXPECT_STREQ(bits, "00000000");
+    ASSERT_TRUE(psm_encode_active(90, bits));
+    EXPECT_EQ(psm_decode_active(bits), 120);
+    EXPECT_FALSE(psm_encode_active(32 * 360, bits));
+
+    // Deactivated and malformed timers.
+    EXPECT_EQ(psm_decode_active("11100000"), PSM_TIMER_OFF);
+    EXPECT_EQ(psm_decode_periodic("11100000"), PSM_TIMER_OFF);
+    EXPECT_EQ(psm_decode_periodic("0010010"), PSM_TIMER_OFF);
+    EXPECT_EQ(psm_decode_periodic("0010010x"), PSM_TIMER_OFF);
+
+    char edrx[EDRX_BITS + 1];
+    EXPECT_FALSE(edrx_encode(5, edrx));
+    ASSERT_TRUE(edrx_encode(6, edrx));
+    EXPECT_STREQ(edrx, "0000");
+    ASSERT_TRUE(edrx_encode(82, edrx));
+    EXPECT_STREQ(edrx, "0101");
+    EXPECT_EQ(edrx_cycle_ms(edrx), 81920U);
+    ASSERT_TRUE(edrx_encode(86400, edrx));
+    EXPECT_STREQ(edrx, "1111");
+    EXPECT_EQ(edrx_cycle_ms("11"), 0U);
+}
+
+TEST(modem_psm, cereg) {
+    PsmGrant grant;
+
+    ASSERT_TRUE(psm_parse_cereg("\r\n+CEREG: 4,1,\"3073\",\"8A0D10F\",7,,,\"00000101\",\"00100100\"\r\n\r\nOK\r\n", grant));
+    EXPECT_EQ(grant.stat, 1);
+    EXPECT_EQ(grant.active_s, 10);
+    EXPECT_EQ(grant.periodic_s, 4 * 3600);
+    EXPECT_TRUE(grant.granted());
+
+    // Registered, but the network did not grant PSM.
+    ASSERT_TRUE(psm_parse_cereg("+CEREG: 4,5,\"3073\",\"8A0D10F\",7\r\nOK\r\n", grant));
+    EXPECT_EQ(grant.stat, 5);
+    EXPECT_EQ(grant.active_s, PSM_TIMER_OFF);
+    EXPECT_FALSE(grant.granted());
+
+    // Not registered.
+    ASSERT_TRUE(psm_parse_cereg("+CEREG: 4,2\r\nOK\r\n", grant));
+    EXPECT_EQ(grant.stat, 2);
+    EXPECT_FALSE(grant.granted());
+
+    EXPECT_FALSE(psm_parse_cereg("\r\nERROR\r\n", grant));
+    EXPECT_FALSE(psm_parse_cereg(nullptr, grant));
+}
+
+TEST(modem_psm, uplink_energy) {
+    UplinkEnergyState state;
+    memset(&state, 0xA5, sizeof(state));
+
+    UplinkEnergy e(state);
+    e.begin();
+    uint32_t mj;
+    modem_start_t start;
+    EXPECT_FALSE(e.take_unreported(mj, start));
+    EXPECT_EQ(e.get_mean_mj(MODEM_START_PSM), 0U);
+
+    e.record(MODEM_START_COLD, 3000);
+    e.record(MODEM_START_COLD, 4000);
+    e.record(MODEM_START_PSM, 800);
+    e.begin();
+    EXPECT_EQ(e.get_count(MODEM_START_COLD), 2U);
+    EXPECT_EQ(e.get_mean_mj(MODEM_START_COLD), 3500U);
+    EXPECT_EQ(e.get_mean_mj(MODEM_START_PSM), 800U);
+
+    ASSERT_TRUE(e.take_unreported(mj, start));
+    EXPECT_EQ(mj, 800U);
+    EXPECT_EQ(start, MODEM_START_PSM);
+    EXPECT_FALSE(e.take_unreported(mj, start));
+
+    // A steady 100 mW for a second is 100 mJ, and a gap in the samples is not integrated across.
+    EnergyMeter m;
+    m.start();
+    for (uint32_t t = 0; t <= 1000; t += 100) {
+        m.sample(t, 100.0f);
+    }
+    m.sample(10000, 100.0f);
+    EXPECT_NEAR(m.get_mj(), 100.0, 1e-6);
+    EXPECT_EQ(m.get_ms(), 1000U);
+    EXPECT_EQ(m.get_samples(), 12U);
+}
+
+//! Add a phase of steady current at 3.8 V to the meter, sampled every 100 ms.
+static void phase(EnergyMeter &m, uint32_t &t, const uint32_t ms, const float ma) {
+    for (const uint32_t end = t + ms; t < end; t += 100) {
+        m.sample(t, ma * 3.8f);
+    }
+}
+
+/*
+ * A modelled uplink for each way of starting the modem. From cold the R5 is powered on, registers,
+ * activates the PDP context, publishes and is powered off again. From PSM it is woken, publishes and
+ * goes back to sleep, the active time before it does is counted at the idle current.
+ */
+TEST(modem_psm, modelled_uplink) {
+    EnergyMeter cold;
+    uint32_t t = 0;
+    cold.start();
+    phase(cold, t, 5000, 60.0f);     // power on and r5.begin()
+    phase(cold, t, 12000, 110.0f);   // registration
+    phase(cold, t, 2000, 100.0f);    // PDP context
+    phase(cold, t, 6000, 120.0f);    // MQTT publish
+    phase(cold, t, 3000, 50.0f);     // power off
+    cold.sample(t, 0.0f);
+
+    EnergyMeter psm;
+    t = 0;
+    psm.start();
+    phase(psm, t, 500, 60.0f);       // PWR_ON pulse and r5.begin()
+    phase(psm, t, 6000, 120.0f);     // MQTT publish
+    phase(psm, t, 10000, 8.0f);      // active time
+    psm.sample(t, 0.0f);
+
+    EXPECT_LT(psm.get_mj() * 3, cold.get_mj());
+}
+
+//#undef ARDUINO
+#if defined(ARDUINO)
+#include <Arduino.h>
+
+void setup()
+{
+    // should be the same value as for the `test_speed` option in "platformio.ini"
+    // default value is test_speed=115200
+    Serial.begin(115200);
+
+    ::testing::InitGoogleTest();
+}
+
+void loop()
+{
+    // Run tests
+    if (RUN_ALL_TESTS())
+        ;
+
+    // sleep for 1 sec
+    delay(1000);
+}
+
+#else
+int main(int argc, char **argv)
+{
+    ::testing::InitGoogleTest(&argc, argv);
+
+    if (RUN_ALL_TESTS())
+    ;
+
+    // Always return zero-code and allow PlatformIO to parse results
+    return 0;
+}
+#endif
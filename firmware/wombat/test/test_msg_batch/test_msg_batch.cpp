@@ -0,0 +1,206 @@
+#include "cbor.h"
+#include "msg_batch.h"
+
+#include <gtest/gtest.h>
+
+#include <string>
+
+using namespace wombat;
+
+//! MAX_MQTT_DIRECT_MSG_LEN in the SARA-R5 library, mqtt_publish() sends messages shorter than this.
+static constexpr size_t DIRECT_LIMIT = 1024;
+//! The size of msg_buf in uplinks.cpp, less the terminating null.
+static constexpr size_t BATCH_LIMIT = 4096;
+
+static const uint8_t *bytes(const std::string &s) {
+    return reinterpret_cast<const uint8_t *>(s.data());
+}
+
+TEST(msg_batch, overhead) {
+    EXPECT_EQ(MsgBatch::overhead(MSG_BATCH_JSON, 0), 2);
+    EXPECT_EQ(MsgBatch::overhead(MSG_BATCH_JSON, 1), 2);
+    EXPECT_EQ(MsgBatch::overhead(MSG_BATCH_JSON, 3), 4);
+    EXPECT_EQ(MsgBatch::overhead(MSG_BATCH_CBOR, 23), 1);
+    EXPECT_EQ(MsgBatch::overhead(MSG_BATCH_CBOR, 24), 2);
+    EXPECT_EQ(MsgBatch::overhead(MSG_BATCH_CBOR, 256), 3);
+}
+
+TEST(msg_batch, json) {
+    MsgBatch batch(MSG_BATCH_JSON, 20);
+    std::vector<uint8_t> out;
+
+    batch.payload(out);
+    EXPECT_EQ(std::string(out.begin(), out.end()), "[]");
+
+    EXPECT_FALSE(batch.add(nullptr, 0));
+    EXPECT_TRUE(batch.add(bytes("{\"a\":1}"), 7));
+    EXPECT_TRUE(batch.add(bytes("{\"b\":2}"), 7));
+    EXPECT_EQ(batch.size(), 17);
+
+    // 17 + 1 + 7 > 20
+    EXPECT_FALSE(batch.add(bytes("{\"c\":3}"), 7));
+    EXPECT_EQ(batch.count(), 2);
+
+    batch.payload(out);
+    EXPECT_EQ(std::string(out.begin(), out.end()), "[{\"a\":1},{\"b\":2}]");
+    EXPECT_EQ(out.size(), batch.size());
+
+    batch.clear();
+    EXPECT_EQ(batch.count(), 0);
+
+    // A message too large to batch is rejected even by an empty batch.
+    EXPECT_FALSE(batch.add(bytes(std::string(19, 'x')), 19));
+    EXPECT_TRUE(batch.add(bytes(std::string(18, 'x')), 18));
+}
+
+TEST(msg_batch, cbor) {
+    MsgBatch batch(MSG_BATCH_CBOR, BATCH_LIMIT);
+
+    size_t added = 0;
+    for (int i = 0; i < 200; i++) {
+        CborWriter w;
+        w.map(1);
+        w.uint(0);
+        w.text(std::string(30, 'a' + i % 26).c_str());
+        if (batch.add(w.data().data(), w.data().size())) {
+            added++;
+        }
+    }
+
+    EXPECT_EQ(added, batch.count());
+    EXPECT_LE(batch.size(), BATCH_LIMIT);
+    EXPECT_GT(batch.size(), BATCH_LIMIT - 34);
+
+    std::vector<uint8_t> out;
+    batch.payload(out);
+    ASSERT_EQ(out.size(), batch.size());
+
+    CborReader r(out.data(), out.size());
+    size_t n;
+    ASSERT_TRUE(r.read_array(n));
+    EXPECT_EQ(n, added);
+    for (size_t i = 0; i < n; i++) {
+        size_t m;
+        uint64_t key;
+        std::string s;
+        ASSERT_TRUE(r.read_map(m));
+        ASSERT_TRUE(r.read_uint(key));
+        ASSERT_TRUE(r.read_text(s));
+        EXPECT_EQ(s, std::string(30, 'a' + i % 26));
+    }
+    EXPECT_TRUE(r.at_end());
+}
+
+/// A model of the time taken to publish stored messages, using the delays in uplinks.cpp and mqtt_stack.cpp.
+struct DrainResult {
+    size_t publishes;
+    double radio_on_ms;
+};
+
+static DrainResult drain(const size_t backlog, const size_t msg_len, const bool batched, const msg_batch_format_t format) {
+    //! AT+UMQTTC publish command and the PUBACK URC, which is polled every 500 ms, over Cat-M1.
+    static constexpr double PUBLISH_MS = 1000.0 + 20.0 + 20.0;
+    //! The delay between files in send_messages().
+    static constexpr double BETWEEN_FILES_MS = 250.0;
+    //! Reading and removing a file on SPIFFS.
+    static constexpr double SPIFFS_MS = 30.0;
+    //! Sending the payload to the modem at 115200 baud, 10 bits per byte.
+    static constexpr double UART_MS_PER_BYTE = 10.0 * 1000.0 / 115200.0;
+    //! The delays around writing a long message to a file on the modem in publish_msg_buf().
+    static constexpr double MODEM_FILE_MS = 500.0 + 500.0;
+
+    DrainResult res = { 0, 0.0 };
+    const std::string msg(msg_len, 'x');
+    MsgBatch batch(format, BATCH_LIMIT);
+
+    size_t sent = 0;
+    while (sent < backlog) {
+        size_t payload_len = msg_len;
+        size_t n = 1;
+        if (batched) {
+            batch.clear();
+            while (sent + batch.count() < backlog && batch.add(bytes(msg), msg_len)) {
+            }
+            n = batch.count();
+            // send_messages() publishes a batch of one as the message itself.
+            payload_len = n > 1 ? batch.size() : msg_len;
+        }
+
+        if (res.publishes > 0) {
+            res.radio_on_ms += BETWEEN_FILES_MS;
+        }
+
+        res.radio_on_ms += PUBLISH_MS + payload_len * UART_MS_PER_BYTE + n * SPIFFS_MS;
+        if (payload_len >= DIRECT_LIMIT) {
+            // Written to the modem file and read back to check it.
+            res.radio_on_ms += MODEM_FILE_MS + 2 * payload_len * UART_MS_PER_BYTE;
+        }
+        res.publishes++;
+        sent += n;
+    }
+
+    return res;
+}
+
+TEST(msg_batch, drain_backlog) {
+    // Three days of 15 minute readings.
+    static constexpr size_t BACKLOG = 288;
+
+    struct Case {
+        const char *name;
+        size_t msg_len;
+        msg_batch_format_t format;
+    } cases[] = {
+        { "JSON, 2 sensors", 480, MSG_BATCH_JSON },
+        { "CBOR, 2 sensors", 150, MSG_BATCH_CBOR },
+        { "CBOR, 6 sensors", 742, MSG_BATCH_CBOR },
+        { "JSON, 6 sensors", 2575, MSG_BATCH_JSON },
+    };
+
+    for (const Case &c : cases) {
+        SCOPED_TRACE(c.name);
+        const DrainResult one = drain(BACKLOG, c.msg_len, false, c.format);
+        const DrainResult batched = drain(BACKLOG, c.msg_len, true, c.format);
+        EXPECT_EQ(one.publishes, BACKLOG);
+        EXPECT_LE(batched.radio_on_ms, one.radio_on_ms);
+        if (c.msg_len * 2 + MsgBatch::overhead(c.format, 2) <= BATCH_LIMIT) {
+            EXPECT_LT(batched.publishes, BACKLOG / 2 + 1);
+        }
+    }
+}
+
+//#undef ARDUINO
+#if defined(ARDUINO)
+#include <Arduino.h>
+
+void setup()
+{
+    // should be the same value as for the `test_speed` option in "platformio.ini"
+    // default value is test_speed=115200
+    Serial.begin(115200);
+
+    ::testing::InitGoogleTest();
+}
+
+void loop()
+{
+    // Run tests
+    if (RUN_ALL_TESTS())
+        ;
+
+    // sleep for 1 sec
+    delay(1000);
+}
+
+#else
+int main(int argc, char **argv)
+{
+    ::testing::InitGoogleTest(&argc, argv);
+
+    if (RUN_ALL_TESTS())
+    ;
+
+    // Always return zero-code and allow PlatformIO to parse results
+    return 0;
+}
+#endif
@@ -0,0 +1,297 @@
+#include "cbor.h"
+#include "msg_cbor.h"
+
+#include <gtest/gtest.h>
+
+#include <cmath>
+#include <cstdio>
+
+using namespace wombat;
+
+static std::string hex(const std::vector<uint8_t> &v) {
+    std::string s;
+    char buf[4];
+    for (uint8_t b : v) {
+        snprintf(buf, sizeof(buf), "%02x", b);
+        s += buf;
+    }
+    return s;
+}
+
+/// The labels from data/sdi12defn.json.
+static LabelDictionary make_dict(void) {
+    LabelDictionary dict;
+    for (const char *l : { "VWC", "Temperature", "VWC", "Temperature", "Solar", "Precipitation", "Strikes",
+                           "WindSpeed", "WindDirection", "WindGustSpeed", "AirTemperature", "VaporPressure",
+                           "AirPressure", "RH", "HumiditySensorTemperature", "X_Tilt", "Y_Tilt", "VWC_1",
+                           "VWC_2", "VWC_3", "VWC_4", "Temperature_1", "Temperature_2", "Temperature_3",
+                           "Temperature_4", "DialectricPermittivity", "Temperature" }) {
+        dict.add(l);
+    }
+    dict.finish();
+    return dict;
+}
+
+/// A message like those from a node with a weather station and 5 soil moisture probes.
+static UplinkMessage make_message(void) {
+    UplinkMessage msg;
+    msg.timestamp = "2024-05-15T01:02:03Z";
+    msg.source_ids = { { "serial_no", "3C71BF123456" }, { "firmware", "1.2.3 main 70369a9 clean" },
+                       { "ccid", "89610185002185062710" } };
+    msg.timeseries = { { "battery (v)", 4.125f }, { "solar (v)", 5.5f }, { "rsrq", -11 }, { "rsrp", -98 },
+                       { "pulse_count", 0 }, { "shortest_pulse", 0 } };
+
+    const char *atm41[] = { "Solar", "Precipitation", "Strikes", "WindSpeed", "WindDirection", "WindGustSpeed",
+                            "AirTemperature", "VaporPressure", "AirPressure", "RH", "HumiditySensorTemperature",
+                            "X_Tilt", "Y_Tilt" };
+    const double atm41_values[] = { 612, 0.017, 0, 2.31, 187, 4.4, 21.3, 1.52, 101.23, 0.58, 22.1, -0.3, 1.2 };
+    msg.sdi12_ids.emplace_back("013METER   ATM41400631-00000123");
+    for (size_t i = 0; i < 13; i++) {
+        msg.timeseries.emplace_back(std::string("0_") + atm41[i], atm41_values[i]);
+    }
+
+    for (char addr = '1'; addr <= '5'; addr++) {
+        msg.sdi12_ids.emplace_back(std::string(1, addr) + "13EP100GL-04 1.2 04061234");
+        for (int i = 1; i <= 4; i++) {
+            msg.timeseries.emplace_back(std::string(1, addr) + "_VWC_" + std::to_string(i), 20.0 + i * 1.37);
+        }
+        for (int i = 1; i <= 4; i++) {
+            msg.timeseries.emplace_back(std::string(1, addr) + "_Temperature_" + std::to_string(i), 15.0 + i * 0.25);
+        }
+    }
+
+    // A sensor without a definition.
+    msg.sdi12_ids.emplace_back("713ACME    X1   001");
+    msg.timeseries.emplace_back("7_V1", 3.14159);
+    msg.timeseries.emplace_back("7_V2", -0.001);
+
+    return msg;
+}
+
+/// The message as the JSON sensor_task() writes.
+static std::string to_json(const UplinkMessage &msg) {
+    std::string s = "{\"timestamp\":\"" + msg.timestamp + "\",\"source_ids\":{";
+    for (const auto &id : msg.source_ids) {
+        s += "\"" + id.first + "\":\"" + id.second + "\",";
+    }
+    s += "\"sdi-12\":[";
+    for (size_t i = 0; i < msg.sdi12_ids.size(); i++) {
+        s += (i > 0 ? ",\"" : "\"") + msg.sdi12_ids[i] + "\"";
+    }
+    s += "]},\"timeseries\":[";
+    for (size_t i = 0; i < msg.timeseries.size(); i++) {
+        char buf[32];
+        snprintf(buf, sizeof(buf), "%.9g", msg.timeseries[i].second);
+        s += (i > 0 ? ",{\"name\":\"" : "{\"name\":\"") + msg.timeseries[i].first + "\",\"value\":" + buf + "}";
+    }
+    s += "]}";
+    return s;
+}
+
+TEST(cbor, writer) {
+    // Examples from RFC 8949 appendix A.
+    CborWriter w;
+    w.uint(0); w.uint(23); w.uint(24); w.uint(1000); w.uint(1000000); w.uint(1000000000000ull);
+    EXPECT_EQ(hex(w.data()), "001718181903e81a000f42401b000000e8d4a51000");
+
+    w.clear();
+    w.integer(-1); w.integer(-1000); w.integer(INT64_MIN);
+    EXPECT_EQ(hex(w.data()), "203903e73b7fffffffffffffff");
+
+    w.clear();
+    w.text("IETF"); w.text(""); w.array(2); w.map(1); w.boolean(true); w.boolean(false); w.null();
+    EXPECT_EQ(hex(w.data()), "644945544660" "82" "a1" "f5f4f6");
+
+    w.clear();
+    w.float32(100000.0f); w.float64(1.1);
+    EXPECT_EQ(hex(w.data()), "fa47c35000fb3ff199999999999a");
+}
+
+TEST(cbor, numbers) {
+    const double values[] = { 0, 1, -1, 24, -25, 1e15, 0.5, -2.25, 4.125, 0.1, 0.31, -0.001, 21.3, 101.23,
+                              1234567.8, 0.0000012, 3.14159265358979, 1e300, NAN, INFINITY };
+    for (double v : values) {
+        CborWriter w;
+        w.number(v);
+        CborReader r(w.data().data(), w.data().size());
+        double d;
+        ASSERT_TRUE(r.read_number(d)) << v;
+        EXPECT_TRUE(r.at_end());
+        if (std::isnan(v)) {
+            EXPECT_TRUE(std::isnan(d));
+        } else {
+            EXPECT_EQ(d, v);
+        }
+    }
+
+    // Typical SDI-12 values are much shorter than a 64 bit float.
+    CborWriter w;
+    w.number(0.31);
+    EXPECT_EQ(hex(w.data()), "c48221181f");
+    w.clear();
+    w.number(21);
+    EXPECT_EQ(w.data().size(), 1);
+}
+
+TEST(cbor, reader) {
+    CborWriter w;
+    w.map(2);
+    w.uint(1);
+    w.array(3); w.text("a"); w.integer(-5); w.bytes(reinterpret_cast<const uint8_t *>("xyz"), 3);
+    w.text("k");
+    w.tag(1); w.uint(1363896240);
+
+    CborReader r(w.data().data(), w.data().size());
+    size_t n;
+    uint64_t u;
+    int64_t i;
+    std::string s;
+    std::vector<uint8_t> b;
+
+    EXPECT_FALSE(r.read_array(n));
+    ASSERT_TRUE(r.read_map(n));
+    EXPECT_EQ(n, 2);
+    ASSERT_TRUE(r.read_uint(u));
+    EXPECT_EQ(u, 1);
+    ASSERT_TRUE(r.read_array(n));
+    EXPECT_EQ(n, 3);
+    ASSERT_TRUE(r.read_text(s));
+    EXPECT_EQ(s, "a");
+    EXPECT_FALSE(r.read_uint(u));
+    ASSERT_TRUE(r.read_int(i));
+    EXPECT_EQ(i, -5);
+    ASSERT_TRUE(r.read_bytes(b));
+    EXPECT_EQ(b.size(), 3);
+    ASSERT_TRUE(r.read_text(s));
+    EXPECT_EQ(s, "k");
+    ASSERT_TRUE(r.skip());
+    EXPECT_TRUE(r.at_end());
+
+    // Truncated data.
+    CborReader t(w.data().data(), 3);
+    ASSERT_TRUE(t.read_map(n));
+    ASSERT_TRUE(t.read_uint(u));
+    EXPECT_FALSE(t.skip());
+    EXPECT_EQ(t.position(), 2);
+}
+
+TEST(msg_cbor, iso8601) {
+    uint32_t t;
+    ASSERT_TRUE(parse_iso8601("1970-01-01T00:00:00Z", t));
+    EXPECT_EQ(t, 0);
+    ASSERT_TRUE(parse_iso8601("2024-05-15T01:02:03Z", t));
+    EXPECT_EQ(t, 1715734923u);
+    EXPECT_EQ(format_iso8601(t), "2024-05-15T01:02:03Z");
+    ASSERT_TRUE(parse_iso8601("2024-02-29T23:59:59Z", t));
+    EXPECT_EQ(format_iso8601(t), "2024-02-29T23:59:59Z");
+
+    EXPECT_FALSE(parse_iso8601("2023-02-29T00:00:00Z", t));
+    EXPECT_FALSE(parse_iso8601("2024-05-15 01:02:03Z", t));
+    EXPECT_FALSE(parse_iso8601("2024-05-15T01:02:03", t));
+    EXPECT_FALSE(parse_iso8601(nullptr, t));
+}
+
+TEST(msg_cbor, labels) {
+    LabelDictionary dict = make_dict();
+    EXPECT_EQ(dict.size(), 24);
+    EXPECT_EQ(dict.find("AirPressure"), 0);
+    EXPECT_EQ(dict.find("Nope"), -1);
+
+    const char *names[] = { "battery (v)", "shortest_pulse", "wake (ms)", "shutdown (ms)", "1_Temperature",
+                            "0_VWC_3", "9_Y_Tilt", "49_RH", "17_Solar", "a_V0", "Z_V12", "3_V1" };
+    for (const char *name : names) {
+        uint32_t code;
+        std::string decoded;
+        ASSERT_TRUE(encode_label(name, dict, code)) << name;
+        ASSERT_TRUE(decode_label(code, dict, decoded)) << name;
+        EXPECT_EQ(decoded, name);
+    }
+
+    // Names that must be sent as text.
+    uint32_t code;
+    EXPECT_FALSE(encode_label("1_Unknown", dict, code));
+    EXPECT_FALSE(encode_label("01_RH", dict, code));
+    EXPECT_FALSE(encode_label("1_V", dict, code));
+    EXPECT_FALSE(encode_label("1_V01", dict, code));
+    EXPECT_FALSE(encode_label("_RH", dict, code));
+    EXPECT_FALSE(encode_label("battery", dict, code));
+
+    std::string name;
+    EXPECT_FALSE(decode_label(MSG_NUM_FIXED_LABELS - 1, dict, name));
+    EXPECT_FALSE(decode_label(MSG_NUM_FIXED_LABELS + (1000 << 8), dict, name));
+}
+
+TEST(msg_cbor, round_trip) {
+    LabelDictionary dict = make_dict();
+    UplinkMessage msg = make_message();
+    msg.source_ids.emplace_back("other", "value");
+    msg.timeseries.emplace_back("1_V", 2.5);
+
+    std::vector<uint8_t> cbor;
+    encode_message(msg, dict, cbor);
+
+    UplinkMessage out;
+    ASSERT_TRUE(decode_message(cbor.data(), cbor.size(), dict, out));
+    EXPECT_EQ(out.timestamp, msg.timestamp);
+    EXPECT_EQ(out.source_ids, msg.source_ids);
+    EXPECT_EQ(out.sdi12_ids, msg.sdi12_ids);
+    EXPECT_EQ(out.timeseries, msg.timeseries);
+    EXPECT_EQ(to_json(out), to_json(msg));
+
+    // A decoder with different sensor definitions must not guess at the labels.
+    LabelDictionary other = make_dict();
+    other.add("Extra");
+    other.finish();
+    EXPECT_FALSE(decode_message(cbor.data(), cbor.size(), other, out));
+
+    EXPECT_FALSE(decode_message(cbor.data(), cbor.size() - 1, dict, out));
+}
+
+TEST(msg_cbor, size) {
+    LabelDictionary dict = make_dict();
+    UplinkMessage msg = make_message();
+
+    std::vector<uint8_t> cbor;
+    encode_message(msg, dict, cbor);
+    const std::string json = to_json(msg);
+
+    // MAX_MQTT_DIRECT_MSG_LEN in the SARA-R5 library.
+    EXPECT_GT(json.size(), 1024u);
+    EXPECT_LT(cbor.size(), 1024u);
+}
+
+//#undef ARDUINO
+#if defined(ARDUINO)
+#include <Arduino.h>
+
+void setup()
+{
+    // should be the same value as for the `test_speed` option in "platformio.ini"
+    // default value is test_speed=115200
+    Serial.begin(115200);
+
+    ::testing::InitGoogleTest();
+}
+
+void loop()
+{
+    // Run tests
+    if (RUN_ALL_TESTS())
+        ;
+
+    // sleep for 1 sec
+    delay(1000);
+}
+
+#else
+int main(int argc, char **argv)
+{
+    ::testing::InitGoogleTest(&argc, argv);
+
+    if (RUN_ALL_TESTS())
+    ;
+
+    // Always return zero-code and allow PlatformIO to parse results
+    return 0;
+}
+#endif
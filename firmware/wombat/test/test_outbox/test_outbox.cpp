@@ -0,0 +1,442 @@
+#include "outbox.h"
+
+#include <gtest/gtest.h>
+
+#include <cstdio>
+#include <map>
+#include <string>
+
+using namespace wombat;
+
+/// An in-memory file system that counts the operations performed on it.
+class MemStorage : public OutboxStorage {
+public:
+    std::map<std::string, std::vector<uint8_t>> files;
+    size_t ops = 0;
+    //! If non-zero, the next append writes only this many bytes and fails.
+    size_t short_append = 0;
+
+    bool size(const char *name, size_t &sz) override {
+        ops++;
+        auto it = files.find(name);
+        if (it == files.end()) {
+            return false;
+        }
+        sz = it->second.size();
+        return true;
+    }
+
+    bool read(const char *name, size_t offset, uint8_t *buf, size_t len) override {
+        ops++;
+        auto it = files.find(name);
+        if (it == files.end() || offset + len > it->second.size()) {
+            return false;
+        }
+        memcpy(buf, &it->second[offset], len);
+        return true;
+    }
+
+    bool append(const char *name, const uint8_t *data, size_t len) override {
+        ops++;
+        std::vector<uint8_t> &f = files[name];
+        if (short_append > 0) {
+            f.insert(f.end(), data, data + short_append);
+            short_append = 0;
+            return false;
+        }
+        f.insert(f.end(), data, data + len);
+        return true;
+    }
+
+    bool replace(const char *name, const uint8_t *data, size_t len) override {
+        ops++;
+        files[name].assign(data, data + len);
+        return true;
+    }
+
+    bool remove(const char *name) override {
+        ops++;
+        return files.erase(name) > 0;
+    }
+
+    size_t num_segments(void) const {
+        size_t n = 0;
+        for (const auto &f : files) {
+            if (f.first.find("idx") == std::string::npos) {
+                n++;
+            }
+        }
+        return n;
+    }
+};
+
+static const char *PREFIX = "/ob_";
+
+static std::string make_msg(int i, size_t len = 40) {
+    char buf[32];
+    snprintf(buf, sizeof(buf), "{\"msg\":%d}", i);
+    std::string s(buf);
+    s.resize(len, ' ');
+    return s;
+}
+
+static void enqueue(Outbox &outbox, int i, outbox_msg_type_t type = OUTBOX_MSG_JSON, size_t len = 40) {
+    const std::string msg = make_msg(i, len);
+    ASSERT_TRUE(outbox.enqueue(type, reinterpret_cast<const uint8_t *>(msg.data()), msg.size()));
+}
+
+static void expect_next(Outbox &outbox, int i, outbox_msg_type_t expected_type = OUTBOX_MSG_JSON, size_t len = 40) {
+    outbox_msg_type_t type;
+    std::vector<uint8_t> data;
+    ASSERT_TRUE(outbox.peek(type, data));
+    EXPECT_EQ(type, expected_type);
+    EXPECT_EQ(std::string(data.begin(), data.end()), make_msg(i, len));
+    outbox.advance();
+}
+
+TEST(outbox, fifo) {
+    MemStorage storage;
+    Outbox outbox(storage, PREFIX, 256, 16);
+    ASSERT_TRUE(outbox.open());
+    EXPECT_TRUE(outbox.empty());
+
+    // 48 byte records, 5 per segment.
+    for (int i = 0; i < 12; i++) {
+        enqueue(outbox, i, i % 2 ? OUTBOX_MSG_CBOR : OUTBOX_MSG_JSON);
+    }
+    EXPECT_EQ(outbox.num_segments(), 3);
+    EXPECT_EQ(storage.num_segments(), 3);
+
+    for (int i = 0; i < 7; i++) {
+        expect_next(outbox, i, i % 2 ? OUTBOX_MSG_CBOR : OUTBOX_MSG_JSON);
+    }
+    ASSERT_TRUE(outbox.ack());
+
+    // The first segment has been sent.
+    EXPECT_EQ(storage.num_segments(), 2);
+    EXPECT_EQ(storage.files.count("/ob_0"), 0);
+
+    for (int i = 7; i < 12; i++) {
+        expect_next(outbox, i, i % 2 ? OUTBOX_MSG_CBOR : OUTBOX_MSG_JSON);
+    }
+    EXPECT_TRUE(outbox.empty());
+
+    outbox_msg_type_t type;
+    std::vector<uint8_t> data;
+    EXPECT_FALSE(outbox.peek(type, data));
+
+    // Draining the outbox removes every segment and starts the numbering again.
+    ASSERT_TRUE(outbox.ack());
+    EXPECT_EQ(storage.num_segments(), 0);
+    EXPECT_EQ(outbox.num_segments(), 1);
+
+    enqueue(outbox, 100);
+    EXPECT_EQ(storage.files.count("/ob_0"), 1);
+    expect_next(outbox, 100);
+}
+
+TEST(outbox, reject) {
+    MemStorage storage;
+    Outbox outbox(storage, PREFIX, 256, 16);
+    ASSERT_TRUE(outbox.open());
+
+    const std::string big(256 - Outbox::RECORD_HEADER_SIZE + 1, 'x');
+    EXPECT_FALSE(outbox.enqueue(OUTBOX_MSG_JSON, reinterpret_cast<const uint8_t *>(big.data()), big.size()));
+    EXPECT_TRUE(outbox.enqueue(OUTBOX_MSG_JSON, reinterpret_cast<const uint8_t *>(big.data()), big.size() - 1));
+    EXPECT_FALSE(outbox.enqueue(OUTBOX_MSG_JSON, reinterpret_cast<const uint8_t *>(big.data()), 0));
+    EXPECT_FALSE(outbox.enqueue(OUTBOX_MSG_JSON, nullptr, 10));
+}
+
+TEST(outbox, rewind) {
+    MemStorage storage;
+    Outbox outbox(storage, PREFIX, 256, 16);
+    ASSERT_TRUE(outbox.open());
+
+    for (int i = 0; i < 8; i++) {
+        enqueue(outbox, i);
+    }
+
+    for (int i = 0; i < 3; i++) {
+        expect_next(outbox, i);
+    }
+    ASSERT_TRUE(outbox.ack());
+
+    // Read but not acknowledged, for example because the publish failed.
+    for (int i = 3; i < 7; i++) {
+        expect_next(outbox, i);
+    }
+    outbox.rewind();
+
+    // Peeking without advancing returns the same message.
+    outbox_msg_type_t type;
+    std::vector<uint8_t> data;
+    ASSERT_TRUE(outbox.peek(type, data));
+    ASSERT_TRUE(outbox.peek(type, data));
+    EXPECT_EQ(std::string(data.begin(), data.end()), make_msg(3));
+
+    for (int i = 3; i < 8; i++) {
+        expect_next(outbox, i);
+    }
+    EXPECT_TRUE(outbox.empty());
+}
+
+TEST(outbox, ack_to) {
+    MemStorage storage;
+    Outbox outbox(storage, PREFIX, 256, 16);
+    ASSERT_TRUE(outbox.open());
+
+    for (int i = 0; i < 12; i++) {
+        enqueue(outbox, i);
+    }
+
+    // Publishes in flight, the first two acknowledged and the third not.
+    for (int i = 0; i < 3; i++) {
+        expect_next(outbox, i);
+    }
+    const OutboxMark first = outbox.mark();
+    for (int i = 3; i < 7; i++) {
+        expect_next(outbox, i);
+    }
+    const OutboxMark second = outbox.mark();
+    for (int i = 7; i < 9; i++) {
+        expect_next(outbox, i);
+    }
+
+    ASSERT_TRUE(outbox.ack_to(first));
+    ASSERT_TRUE(outbox.ack_to(second));
+    ASSERT_TRUE(outbox.ack_to(first));
+    EXPECT_EQ(storage.files.count("/ob_0"), 0);
+    outbox.rewind();
+    expect_next(outbox, 7);
+
+    // The acknowledged position survives a reset.
+    Outbox reopened(storage, PREFIX, 256, 16);
+    ASSERT_TRUE(reopened.open());
+    for (int i = 7; i < 12; i++) {
+        expect_next(reopened, i);
+    }
+    ASSERT_TRUE(reopened.ack_to(reopened.mark()));
+    EXPECT_EQ(storage.num_segments(), 0);
+}
+
+TEST(outbox, reopen) {
+    MemStorage storage;
+    {
+        Outbox outbox(storage, PREFIX, 256, 16);
+        ASSERT_TRUE(outbox.open());
+        for (int i = 0; i < 12; i++) {
+            enqueue(outbox, i);
+        }
+        for (int i = 0; i < 6; i++) {
+            expect_next(outbox, i);
+        }
+        ASSERT_TRUE(outbox.ack());
+
+        // Not acknowledged, so sent again after a reset.
+        expect_next(outbox, 6);
+    }
+
+    Outbox outbox(storage, PREFIX, 256, 16);
+    ASSERT_TRUE(outbox.open());
+    enqueue(outbox, 12);
+    for (int i = 6; i < 13; i++) {
+        expect_next(outbox, i);
+    }
+    EXPECT_TRUE(outbox.empty());
+}
+
+TEST(outbox, interrupted_index_write) {
+    MemStorage storage;
+    {
+        Outbox outbox(storage, PREFIX, 256, 16);
+        ASSERT_TRUE(outbox.open());
+        for (int i = 0; i < 12; i++) {
+            enqueue(outbox, i);
+        }
+        for (int i = 0; i < 2; i++) {
+            expect_next(outbox, i);
+        }
+        ASSERT_TRUE(outbox.ack());
+        for (int i = 2; i < 4; i++) {
+            expect_next(outbox, i);
+        }
+        ASSERT_TRUE(outbox.ack());
+    }
+
+    // Damage the most recently written index, the other still records the first ack.
+    std::vector<uint8_t> &idx0 = storage.files["/ob_idx0"];
+    std::vector<uint8_t> &idx1 = storage.files["/ob_idx1"];
+    ASSERT_EQ(idx0.size(), Outbox::INDEX_SIZE);
+    ASSERT_EQ(idx1.size(), Outbox::INDEX_SIZE);
+    const uint32_t seq0 = idx0[4] | (idx0[5] << 8);
+    const uint32_t seq1 = idx1[4] | (idx1[5] << 8);
+    (seq0 > seq1 ? idx0 : idx1).resize(10);
+
+    Outbox outbox(storage, PREFIX, 256, 16);
+    ASSERT_TRUE(outbox.open());
+    for (int i = 2; i < 12; i++) {
+        expect_next(outbox, i);
+    }
+    EXPECT_TRUE(outbox.empty());
+}
+
+TEST(outbox, partial_record) {
+    MemStorage storage;
+    Outbox outbox(storage, PREFIX, 256, 16);
+    ASSERT_TRUE(outbox.open());
+
+    for (int i = 0; i < 2; i++) {
+        enqueue(outbox, i);
+    }
+
+    storage.short_append = 20;
+    const std::string msg = make_msg(2);
+    EXPECT_FALSE(outbox.enqueue(OUTBOX_MSG_JSON, reinterpret_cast<const uint8_t *>(msg.data()), msg.size()));
+
+    // After a reset the tail segment ends with the partial record, so a new segment is started.
+    Outbox reopened(storage, PREFIX, 256, 16);
+    ASSERT_TRUE(reopened.open());
+    EXPECT_EQ(reopened.num_segments(), 2);
+    enqueue(reopened, 3);
+
+    expect_next(reopened, 0);
+    expect_next(reopened, 1);
+    expect_next(reopened, 3);
+    EXPECT_TRUE(reopened.empty());
+
+    // A failed append also starts a new segment.
+    storage.short_append = 20;
+    EXPECT_FALSE(reopened.enqueue(OUTBOX_MSG_JSON, reinterpret_cast<const uint8_t *>(msg.data()), msg.size()));
+    enqueue(reopened, 4);
+    expect_next(reopened, 4);
+    EXPECT_TRUE(reopened.empty());
+}
+
+TEST(outbox, corrupt_record) {
+    MemStorage storage;
+    Outbox outbox(storage, PREFIX, 256, 16);
+    ASSERT_TRUE(outbox.open());
+
+    for (int i = 0; i < 12; i++) {
+        enqueue(outbox, i);
+    }
+
+    // Damage the second message, the rest of its segment is skipped.
+    storage.files["/ob_0"][48 + Outbox::RECORD_HEADER_SIZE + 3] ^= 0x01;
+
+    expect_next(outbox, 0);
+    for (int i = 5; i < 12; i++) {
+        expect_next(outbox, i);
+    }
+    EXPECT_TRUE(outbox.empty());
+}
+
+TEST(outbox, full) {
+    MemStorage storage;
+    Outbox outbox(storage, PREFIX, 256, 3);
+    ASSERT_TRUE(outbox.open());
+
+    for (int i = 0; i < 20; i++) {
+        enqueue(outbox, i);
+    }
+
+    // Segments 0 and 1 were dropped to make room.
+    EXPECT_EQ(outbox.num_segments(), 3);
+    EXPECT_EQ(storage.num_segments(), 3);
+    EXPECT_EQ(outbox.get_dropped(), 1);
+
+    for (int i = 5; i < 20; i++) {
+        expect_next(outbox, i);
+    }
+    EXPECT_TRUE(outbox.empty());
+}
+
+TEST(outbox, stale_segments) {
+    MemStorage storage;
+    {
+        Outbox outbox(storage, PREFIX, 256, 16);
+        ASSERT_TRUE(outbox.open());
+        for (int i = 0; i < 12; i++) {
+            enqueue(outbox, i);
+        }
+        for (int i = 0; i < 6; i++) {
+            expect_next(outbox, i);
+        }
+        ASSERT_TRUE(outbox.ack());
+    }
+
+    // As if the node was reset after the index was written but before the segment was removed.
+    storage.files["/ob_0"] = std::vector<uint8_t>(240, 0);
+
+    Outbox outbox(storage, PREFIX, 256, 16);
+    ASSERT_TRUE(outbox.open());
+    EXPECT_EQ(storage.files.count("/ob_0"), 0);
+    for (int i = 6; i < 12; i++) {
+        expect_next(outbox, i);
+    }
+}
+
+TEST(outbox, operations_per_message) {
+    // Messages the size of a CBOR message from a node with two SDI-12 sensors.
+    static constexpr size_t MSG_LEN = 150;
+
+    for (const int backlog : { 100, 1000 }) {
+        MemStorage storage;
+        Outbox outbox(storage, PREFIX, 8192, 256);
+        ASSERT_TRUE(outbox.open());
+
+        storage.ops = 0;
+        for (int i = 0; i < backlog; i++) {
+            enqueue(outbox, i, OUTBOX_MSG_CBOR, MSG_LEN);
+        }
+        const size_t enqueue_ops = storage.ops;
+
+        storage.ops = 0;
+        for (int i = 0; i < backlog; i++) {
+            expect_next(outbox, i, OUTBOX_MSG_CBOR, MSG_LEN);
+            ASSERT_TRUE(outbox.ack());
+        }
+        const size_t drain_ops = storage.ops;
+
+        // Independent of the number of messages waiting.
+        EXPECT_LT(enqueue_ops, backlog * 2);
+        EXPECT_LT(drain_ops, backlog * 6);
+        EXPECT_EQ(storage.num_segments(), 0);
+    }
+}
+
+//#undef ARDUINO
+#if defined(ARDUINO)
+#include <Arduino.h>
+
+void setup()
+{
+    // should be the same value as for the `test_speed` option in "platformio.ini"
+    // default value is test_speed=115200
+    Serial.begin(115200);
+
+    ::testing::InitGoogleTest();
+}
+
+void loop()
+{
+    // Run tests
+    if (RUN_ALL_TESTS())
+        ;
+
+    // sleep for 1 sec
+    delay(1000);
+}
+
+#else
+int main(int argc, char **argv)
+{
+    ::testing::InitGoogleTest(&argc, argv);
+
+    if (RUN_ALL_TESTS())
+    ;
+
+    // Always return zero-code and allow PlatformIO to parse results
+    return 0;
+}
+#endif
@@ -0,0 +1,303 @@
+#include "pub_window.h"
+#include "r5_emulator.h"
+
+#include <gtest/gtest.h>
+
+#include <deque>
+#include <string>
+#include <vector>
+
+using namespace wombat;
+
+/**
+ * Publishes messages held in memory through the R5 emulator with the commands mqtt_publish_start()
+ * sends. The UART time of every byte at 115200 baud is added to the emulated clock, and +UUMQTTC
+ * URCs are kept until they are waited for.
+ */
+class EmulatedPublishLink : public PublishLink {
+public:
+    EmulatedPublishLink(R5Emulator &r5, const std::vector<std::string> &msgs) : r5(r5), msgs(msgs) {
+        command("ATE0");
+    }
+
+    bool login(void) {
+        r5.advance(5000);
+        if (command("AT+UPSDA=0,3") != "OK" || command("AT+UMQTT=2,\"mqtt.example.com\",1883") != "OK" ||
+            command("AT+UMQTTC=1") != "OK") {
+            return false;
+        }
+
+        int result = -1;
+        return wait_urc(1, 60000, result) && result == 1;
+    }
+
+    bool publish(uint32_t tag) override {
+        const std::string &msg = msgs[tag];
+        if (command("AT+UMQTTC=9,1,0,\"wombat\"," + std::to_string(msg.size())) != ">") {
+            return false;
+        }
+
+        send(msg);
+        return wait_result() == "OK";
+    }
+
+    bool wait_ack(uint32_t timeout_ms, int &result) override {
+        return wait_urc(9, timeout_ms, result);
+    }
+
+    void delivered(uint32_t tag) override {
+        confirmed.push_back(tag);
+    }
+
+    //! The tags reported delivered, in order.
+    std::vector<uint32_t> confirmed;
+
+private:
+    R5Emulator &r5;
+    const std::vector<std::string> &msgs;
+    std::string rx;
+    std::deque<std::pair<int, int>> urcs;
+    uint32_t uart_us = 0;
+
+    void uart_time(size_t n) {
+        uart_us += n * 10 * 1000000ULL / 115200;
+        r5.advance(uart_us / 1000);
+        uart_us %= 1000;
+    }
+
+    void send(const std::string &s) {
+        r5.write(reinterpret_cast<const uint8_t *>(s.data()), s.size());
+        uart_time(s.size());
+    }
+
+    std::string command(const std::string &cmd) {
+        send(cmd + "\r");
+        return wait_result();
+    }
+
+    //! Read what the modem has sent, returning a final result, a prompt, or "" if there is none yet.
+    std::string poll(void) {
+        int c;
+        size_t n = 0;
+        while ((c = r5.read()) >= 0) {
+            rx.push_back(static_cast<char>(c));
+            n++;
+        }
+        uart_time(n);
+
+        size_t eol;
+        while ((eol = rx.find("\r\n")) != std::string::npos) {
+            const std::string line = rx.substr(0, eol);
+            rx.erase(0, eol + 2);
+            int op, result;
+            if (sscanf(line.c_str(), "+UUMQTTC: %d,%d", &op, &result) == 2) {
+                urcs.emplace_back(op, result);
+            } else if (line == "OK" || line == "ERROR") {
+                return line;
+            }
+        }
+
+        if (rx == ">") {
+            rx.clear();
+            return ">";
+        }
+
+        return "";
+    }
+
+    std::string wait_result(void) {
+        for (int ms = 0; ms < 10000; ms++) {
+            const std::string result = poll();
+            if ( ! result.empty()) {
+                return result;
+            }
+            r5.advance(1);
+        }
+
+        return "";
+    }
+
+    //! Wait for the oldest +UUMQTTC URC of an MQTT command, waking as soon as the modem sends it.
+    bool wait_urc(int op, uint32_t timeout_ms, int &result) {
+        for (uint32_t ms = 0; ms < timeout_ms; ms++) {
+            poll();
+            for (auto it = urcs.begin(); it != urcs.end(); it++) {
+                if (it->first == op) {
+                    result = it->second;
+                    urcs.erase(it);
+                    return true;
+                }
+            }
+            r5.advance(1);
+        }
+
+        return false;
+    }
+};
+
+static std::vector<std::string> make_msgs(size_t n, size_t len = 200) {
+    std::vector<std::string> msgs;
+    for (size_t i = 0; i < n; i++) {
+        std::string msg = "{\"msg\":" + std::to_string(i) + "}";
+        msg.resize(len, ' ');
+        msgs.push_back(msg);
+    }
+    return msgs;
+}
+
+//! The payloads the broker received, in order.
+static std::vector<std::string> received(const R5Emulator &r5) {
+    std::vector<std::string> msgs;
+    for (const R5Emulator::MqttMessage &m : r5.published) {
+        msgs.emplace_back(m.payload.begin(), m.payload.end());
+    }
+    return msgs;
+}
+
+TEST(pub_window, in_order) {
+    const std::vector<std::string> msgs = make_msgs(10);
+    R5Emulator r5;
+    EmulatedPublishLink link(r5, msgs);
+    ASSERT_TRUE(link.login());
+
+    PublishWindow window(link, 4, 30000);
+    for (uint32_t i = 0; i < msgs.size(); i++) {
+        ASSERT_TRUE(window.send(i));
+        EXPECT_LE(window.in_flight(), 4);
+    }
+    ASSERT_TRUE(window.flush());
+    EXPECT_EQ(window.in_flight(), 0);
+    EXPECT_EQ(window.get_max_in_flight(), 4);
+    EXPECT_EQ(window.get_delivered(), 10);
+
+    const std::vector<uint32_t> expected = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9 };
+    EXPECT_EQ(link.confirmed, expected);
+    EXPECT_EQ(received(r5), msgs);
+
+    // The window is limited to MAX_WINDOW.
+    PublishWindow big(link, 100, 30000);
+    EXPECT_EQ(big.get_window(), PublishWindow::MAX_WINDOW);
+    PublishWindow none(link, 0, 30000);
+    EXPECT_EQ(none.get_window(), 1);
+}
+
+TEST(pub_window, failures) {
+    const std::vector<std::string> msgs = make_msgs(10);
+
+    // The broker rejects the third message, nothing after it is reported delivered.
+    R5Emulator r5;
+    EmulatedPublishLink link(r5, msgs);
+    ASSERT_TRUE(link.login());
+    PublishWindow window(link, 4, 30000);
+    ASSERT_TRUE(window.send(0));
+    ASSERT_TRUE(window.send(1));
+    r5.inject_fault("AT+UMQTTC=9", R5_FAULT_URC_FAILED);
+    ASSERT_TRUE(window.send(2));
+    for (uint32_t i = 3; i < msgs.size() && window.send(i); i++) {}
+    EXPECT_FALSE(window.flush());
+    EXPECT_TRUE(window.has_failed());
+    EXPECT_FALSE(window.send(9));
+    const std::vector<uint32_t> first_two = { 0, 1 };
+    EXPECT_EQ(link.confirmed, first_two);
+
+    // A lost result shifts the later ones onto earlier publishes, so it is found when the last
+    // publish gets no result. That publish is not reported delivered and is sent again later.
+    R5Emulator r5b;
+    EmulatedPublishLink lost(r5b, msgs);
+    ASSERT_TRUE(lost.login());
+    PublishWindow lost_window(lost, 4, 30000);
+    r5b.inject_fault("AT+UMQTTC=9", R5_FAULT_URC_LOST);
+    for (uint32_t i = 0; i < 6 && lost_window.send(i); i++) {}
+    EXPECT_FALSE(lost_window.flush());
+    EXPECT_EQ(lost.confirmed.size(), 5);
+    EXPECT_EQ(r5b.published.size(), 6);
+
+    // A modem that rejects a publish while others are in flight is sent one at a time.
+    R5Emulator r5c;
+    EmulatedPublishLink busy(r5c, msgs);
+    ASSERT_TRUE(busy.login());
+    PublishWindow busy_window(busy, 4, 30000);
+    ASSERT_TRUE(busy_window.send(0));
+    r5c.inject_fault("AT+UMQTTC=9", R5_FAULT_ERROR);
+    ASSERT_TRUE(busy_window.send(1));
+    EXPECT_EQ(busy_window.get_window(), 1);
+    for (uint32_t i = 2; i < msgs.size(); i++) {
+        ASSERT_TRUE(busy_window.send(i));
+    }
+    ASSERT_TRUE(busy_window.flush());
+    EXPECT_EQ(busy_window.get_max_in_flight(), 1);
+    EXPECT_EQ(received(r5c), msgs);
+}
+
+/*
+ * Radio-on time to publish a backlog of 50 messages one at a time, waiting for each acknowledgement
+ * and 250 ms between publishes as send_outbox() did, and with up to 4 in flight.
+ */
+TEST(pub_window, throughput) {
+    const std::vector<std::string> msgs = make_msgs(50);
+
+    R5Emulator serial_r5;
+    EmulatedPublishLink serial(serial_r5, msgs);
+    ASSERT_TRUE(serial.login());
+    const uint32_t serial_start = serial_r5.now();
+    for (uint32_t i = 0; i < msgs.size(); i++) {
+        if (i > 0) {
+            serial_r5.advance(250);
+        }
+        int result = -1;
+        ASSERT_TRUE(serial.publish(i));
+        ASSERT_TRUE(serial.wait_ack(30000, result));
+        ASSERT_EQ(result, 1);
+    }
+    const uint32_t serial_ms = serial_r5.now() - serial_start;
+
+    R5Emulator r5;
+    EmulatedPublishLink link(r5, msgs);
+    ASSERT_TRUE(link.login());
+    const uint32_t start = r5.now();
+    PublishWindow window(link, 4, 30000);
+    for (uint32_t i = 0; i < msgs.size(); i++) {
+        ASSERT_TRUE(window.send(i));
+    }
+    ASSERT_TRUE(window.flush());
+    const uint32_t windowed_ms = r5.now() - start;
+    EXPECT_EQ(received(r5), msgs);
+
+    EXPECT_LT(windowed_ms * 3, serial_ms);
+}
+
+//#undef ARDUINO
+#if defined(ARDUINO)
+#include <Arduino.h>
+
+void setup()
+{
+    // should be the same value as for the `test_speed` option in "platformio.ini"
+    // default value is test_speed=115200
+    Serial.begin(115200);
+
+    ::testing::InitGoogleTest();
+}
+
+void loop()
+{
+    // Run tests
+    if (RUN_ALL_TESTS())
+        ;
+
+    // sleep for 1 sec
+    delay(1000);
+}
+
+#else
+int main(int argc, char **argv)
+{
+    ::testing::InitGoogleTest(&argc, argv);
+
+    if (RUN_ALL_TESTS())
+    ;
+
+    // Always return zero-code and allow PlatformIO to parse results
+    return 0;
+}
+#endif
@@ -0,0 +1,501 @@
+#include "r5_emulator.h"
+
+#include <gtest/gtest.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+using namespace wombat;
+
+/**
+ * The host side of the UART, driving the emulator the way the SparkFun library and the firmware
+ * drive the modem: send a command, poll for the response, and collect URCs as they arrive.
+ */
+class AtClient {
+public:
+    static constexpr int AT_ERROR = 0;
+    static constexpr int AT_OK = 1;
+    static constexpr int AT_PROMPT = 2;
+    static constexpr int AT_TIMEOUT = -1;
+
+    explicit AtClient(R5Emulator &r5) : r5(r5) {}
+
+    void delay(uint32_t ms) { r5.advance(ms); }
+
+    int command(const std::string &cmd, std::vector<std::string> *rsp = nullptr, uint32_t timeout_ms = 10000) {
+        r5.write((cmd + "\r").c_str());
+        const uint32_t start = r5.now();
+        while (r5.now() - start < timeout_ms) {
+            const int result = poll(rsp);
+            if (result != AT_TIMEOUT) {
+                return result;
+            }
+            r5.advance(1);
+        }
+
+        return AT_TIMEOUT;
+    }
+
+    int send_data(const std::string &data) {
+        r5.write(reinterpret_cast<const uint8_t *>(data.data()), data.size());
+        return command_result();
+    }
+
+    /**
+     * Like CommandURCRing::waitForURC, with a timeout of retries * delay_ms. If event is true the
+     * wait ends as soon as the modem sends something, as it does when woken by the UART, otherwise
+     * the modem is polled every delay_ms.
+     */
+    bool wait_for_urc(const std::string &prefix, int &result, int retries, uint32_t delay_ms, bool event = false) {
+        const uint32_t deadline = r5.now() + retries * delay_ms;
+        while (true) {
+            poll(nullptr);
+            for (auto it = urcs.begin(); it != urcs.end(); it++) {
+                if (it->compare(0, prefix.size(), prefix) == 0) {
+                    result = atoi(it->c_str() + prefix.size());
+                    urcs.erase(it);
+                    return true;
+                }
+            }
+
+            if (r5.now() >= deadline) {
+                return false;
+            }
+
+            if (event) {
+                while (r5.available() == 0 && r5.now() < deadline) {
+                    r5.advance(1);
+                }
+            } else {
+                r5.advance(delay_ms);
+            }
+        }
+    }
+
+    std::vector<std::string> urcs;
+
+private:
+    R5Emulator &r5;
+    std::string rx;
+
+    int command_result(void) {
+        const uint32_t start = r5.now();
+        while (r5.now() - start < 10000) {
+            const int result = poll(nullptr);
+            if (result != AT_TIMEOUT) {
+                return result;
+            }
+            r5.advance(1);
+        }
+
+        return AT_TIMEOUT;
+    }
+
+    int poll(std::vector<std::string> *rsp) {
+        int c;
+        while ((c = r5.read()) >= 0) {
+            rx.push_back(static_cast<char>(c));
+        }
+
+        size_t eol;
+        while ((eol = rx.find("\r\n")) != std::string::npos) {
+            std::string line = rx.substr(0, eol);
+            rx.erase(0, eol + 2);
+
+            if (line.empty() || line.compare(0, 2, "AT") == 0) {
+                continue;
+            }
+
+            if (line == "OK") {
+                return AT_OK;
+            }
+
+            if (line == "ERROR") {
+                return AT_ERROR;
+            }
+
+            if (line.compare(0, 3, "+UU") == 0) {
+                urcs.push_back(line);
+            } else if (rsp != nullptr) {
+                rsp->push_back(line);
+            }
+        }
+
+        if (rx == ">" || rx == "@") {
+            rx.clear();
+            return AT_PROMPT;
+        }
+
+        return AT_TIMEOUT;
+    }
+};
+
+/**
+ * The command sequence of connect_to_internet: wait for registration, activate the PDP context and
+ * query NTP.
+ */
+static bool connect(AtClient &at, uint32_t cereg_poll_ms = 2000) {
+    if (at.command("ATE0") != AtClient::AT_OK) {
+        return false;
+    }
+
+    for (int attempts = 0; attempts < 45; attempts++) {
+        std::vector<std::string> rsp;
+        if (at.command("AT+CEREG?", &rsp) != AtClient::AT_OK || rsp.empty()) {
+            return false;
+        }
+        at.delay(20);
+
+        const int stat = atoi(rsp[0].c_str() + 10);
+        if (stat == 1) {
+            break;
+        }
+        if (stat == 3 || attempts == 44) {
+            return false;
+        }
+
+        at.delay(cereg_poll_ms);
+    }
+
+    at.command("AT+UMNOPROF?");
+    at.delay(20);
+    at.command("AT+UPSD=0,0,0");
+    at.delay(20);
+    at.command("AT+UPSD=0,100,1");
+    at.delay(20);
+    if (at.command("AT+UPSDA=0,3", nullptr, 180000) != AtClient::AT_OK) {
+        return false;
+    }
+    at.delay(20);
+
+    at.command("AT+USOCR=17");
+    if (at.command("AT+USOST=0,\"pool.ntp.org\",123,48") != AtClient::AT_PROMPT) {
+        return false;
+    }
+    std::string ntp_query(48, '\0');
+    ntp_query[0] = 0x23;
+    at.send_data(ntp_query);
+
+    for (int i = 0; i < 100; i++) {
+        std::vector<std::string> rsp;
+        at.command("AT+USORF=0,0", &rsp);
+        if ( ! rsp.empty() && rsp[0] != "+USORF: 0,0") {
+            at.command("AT+USORF=0,48");
+            at.command("AT+USOCL=0");
+            return true;
+        }
+        at.delay(100);
+    }
+
+    return false;
+}
+
+//! The command sequence of mqtt_login, without the config script check.
+static bool mqtt_login(AtClient &at, uint32_t urc_poll_ms = 500, bool event = false) {
+    at.command("AT+UMQTT=2,\"mqtt.example.com\",1883");
+    at.delay(20);
+    at.command("AT+UMQTT=4,\"user\",\"password\"");
+    at.delay(20);
+    at.command("AT+UMQTT=0,\"w123\"");
+    at.delay(20);
+    if (at.command("AT+UMQTTC=1") != AtClient::AT_OK) {
+        return false;
+    }
+    at.delay(20);
+
+    int result = -1;
+    at.wait_for_urc("+UUMQTTC: 1,", result, 60000 / urc_poll_ms, urc_poll_ms, event);
+    return result == 1;
+}
+
+//! The command sequence of mqtt_publish.
+static bool mqtt_publish(AtClient &at, const std::string &topic, const std::string &msg, uint32_t urc_poll_ms = 500,
+                         bool event = false) {
+    char cmd[128];
+    snprintf(cmd, sizeof(cmd), "AT+UMQTTC=9,1,0,\"%s\",%u", topic.c_str(), static_cast<unsigned>(msg.size()));
+    if (at.command(cmd) != AtClient::AT_PROMPT || at.send_data(msg) != AtClient::AT_OK) {
+        return false;
+    }
+    at.delay(40);
+
+    int result = -1;
+    at.wait_for_urc("+UUMQTTC: 9,", result, 30000 / urc_poll_ms, urc_poll_ms, event);
+    return result == 1;
+}
+
+static bool mqtt_logout(AtClient &at, uint32_t urc_poll_ms = 500, bool event = false) {
+    at.command("AT+UMQTTC=0");
+    at.delay(20);
+
+    int result = -1;
+    at.wait_for_urc("+UUMQTTC: 0,", result, 22500 / urc_poll_ms, urc_poll_ms, event);
+    at.urcs.clear();
+    return result == 1;
+}
+
+TEST(r5_emulator, split_at_args) {
+    const std::vector<std::string> args = split_at_args("9,1,0,\"wombat/a,b\",12");
+    ASSERT_EQ(args.size(), 5);
+    EXPECT_EQ(args[0], "9");
+    EXPECT_EQ(args[3], "wombat/a,b");
+    EXPECT_EQ(args[4], "12");
+
+    EXPECT_TRUE(split_at_args("").empty());
+    EXPECT_EQ(split_at_args("1,").size(), 2);
+}
+
+TEST(r5_emulator, responses_are_timed) {
+    R5Timing timing;
+    R5Emulator r5(timing);
+    AtClient at(r5);
+
+    r5.write("AT\r");
+    EXPECT_EQ(r5.available(), 3);   // Only the echo.
+    r5.advance(timing.command_ms - 1);
+    EXPECT_EQ(r5.available(), 3);
+    r5.advance(1);
+    EXPECT_EQ(r5.available(), 9);
+    while (r5.read() >= 0) {}
+    EXPECT_EQ(r5.available(), 0);
+
+    EXPECT_EQ(at.command("AT+NOTACOMMAND"), AtClient::AT_ERROR);
+    EXPECT_EQ(r5.commands.size(), 2);
+    EXPECT_EQ(r5.commands[1].command, "AT+NOTACOMMAND");
+}
+
+TEST(r5_emulator, connect_and_ntp) {
+    R5Timing timing;
+    R5Emulator r5(timing);
+    r5.set_epoch(1700000000);
+    AtClient at(r5);
+
+    ASSERT_TRUE(connect(at));
+    // Registration is found by the third +CEREG poll, 2 seconds apart.
+    EXPECT_GE(r5.now(), timing.registration_ms + timing.pdp_ms + timing.udp_rtt_ms);
+
+    std::vector<std::string> rsp;
+    ASSERT_EQ(at.command("AT+CCLK?", &rsp), AtClient::AT_OK);
+    ASSERT_EQ(rsp.size(), 1);
+    EXPECT_EQ(rsp[0].substr(0, 16), "+CCLK: \"23/11/14");
+
+    ASSERT_EQ(at.command("AT+CCLK=\"24/01/01,00:00:00+00\""), AtClient::AT_OK);
+    rsp.clear();
+    at.command("AT+CCLK?", &rsp);
+    EXPECT_EQ(rsp[0], "+CCLK: \"24/01/01,00:00:00+00\"");
+
+    rsp.clear();
+    at.command("AT+UPSND=0,8", &rsp);
+    EXPECT_EQ(rsp[0], "+UPSND: 0,8,1");
+}
+
+TEST(r5_emulator, registration_denied) {
+    R5Emulator r5;
+    r5.deny_registration();
+    AtClient at(r5);
+
+    EXPECT_FALSE(connect(at));
+    EXPECT_EQ(at.command("AT+UPSDA=0,3"), AtClient::AT_ERROR);
+}
+
+TEST(r5_emulator, mqtt_publish_and_downlink) {
+    R5Emulator r5;
+    r5.queue_downlink("wombat/123", "interval 600");
+    AtClient at(r5);
+
+    ASSERT_TRUE(connect(at));
+
+    // Not logged in yet.
+    EXPECT_EQ(at.command("AT+UMQTTC=9,1,0,\"wombat\",5"), AtClient::AT_ERROR);
+
+    ASSERT_TRUE(mqtt_login(at));
+
+    ASSERT_EQ(at.command("AT+UMQTTC=4,1,\"wombat/123\""), AtClient::AT_OK);
+    int result = -1;
+    ASSERT_TRUE(at.wait_for_urc("+UUMQTTC: 4,", result, 30, 100));
+    EXPECT_EQ(result, 1);
+    ASSERT_TRUE(at.wait_for_urc("+UUMQTTCM: 6,", result, 20, 100));
+    EXPECT_EQ(result, 1);
+
+    std::vector<std::string> rsp;
+    ASSERT_EQ(at.command("AT+UMQTTC=6,1", &rsp), AtClient::AT_OK);
+    ASSERT_EQ(rsp.size(), 1);
+    EXPECT_EQ(rsp[0], "+UMQTTC: 6,0,10,\"wombat/123\",12,\"interval 600\"");
+
+    const std::string msg("{\"a\":1}\r\n\0x", 10);
+    ASSERT_TRUE(mqtt_publish(at, "wombat", msg));
+    ASSERT_EQ(r5.published.size(), 1);
+    EXPECT_EQ(r5.published[0].topic, "wombat");
+    EXPECT_EQ(std::string(r5.published[0].payload.begin(), r5.published[0].payload.end()), msg);
+    EXPECT_EQ(r5.published[0].qos, 1);
+
+    // Publish from a file on the modem.
+    ASSERT_EQ(at.command("AT+UDWNFILE=\"a.txt\",4"), AtClient::AT_PROMPT);
+    ASSERT_EQ(at.send_data("abcd"), AtClient::AT_OK);
+    ASSERT_EQ(at.command("AT+UMQTTC=3,1,0,\"wombat\",\"a.txt\""), AtClient::AT_OK);
+    ASSERT_TRUE(at.wait_for_urc("+UUMQTTC: 3,", result, 60, 500));
+    EXPECT_EQ(result, 1);
+    ASSERT_EQ(r5.published.size(), 2);
+    EXPECT_EQ(r5.published[1].payload.size(), 4);
+
+    EXPECT_TRUE(mqtt_logout(at));
+    EXPECT_FALSE(mqtt_publish(at, "wombat", "x"));
+}
+
+TEST(r5_emulator, faults) {
+    R5Emulator r5;
+    AtClient at(r5);
+    ASSERT_TRUE(connect(at));
+
+    r5.inject_fault("AT+UMQTTC=1", R5_FAULT_URC_FAILED);
+    EXPECT_FALSE(mqtt_login(at));
+    ASSERT_TRUE(mqtt_login(at));
+
+    r5.inject_fault("AT+UMQTTC=9", R5_FAULT_URC_LOST);
+    const uint32_t start = r5.now();
+    EXPECT_FALSE(mqtt_publish(at, "wombat", "lost"));
+    // The firmware waits the whole URC timeout for a lost URC, and the broker got the message anyway.
+    EXPECT_GE(r5.now() - start, 30000);
+    EXPECT_EQ(r5.published.size(), 1);
+
+    r5.inject_fault("AT+UMQTTC=9", R5_FAULT_ERROR, 2);
+    EXPECT_FALSE(mqtt_publish(at, "wombat", "one"));
+    EXPECT_FALSE(mqtt_publish(at, "wombat", "two"));
+    EXPECT_TRUE(mqtt_publish(at, "wombat", "three"));
+    ASSERT_EQ(r5.published.size(), 2);
+
+    r5.inject_fault("AT+CSQ", R5_FAULT_NO_RESPONSE);
+    EXPECT_EQ(at.command("AT+CSQ", nullptr, 1000), AtClient::AT_TIMEOUT);
+    EXPECT_EQ(at.command("AT+CSQ"), AtClient::AT_OK);
+}
+
+TEST(r5_emulator, file_system) {
+    R5Emulator r5;
+    AtClient at(r5);
+    ASSERT_EQ(at.command("ATE0"), AtClient::AT_OK);
+
+    ASSERT_EQ(at.command("AT+UDWNFILE=\"f.bin\",6"), AtClient::AT_PROMPT);
+    ASSERT_EQ(at.send_data(std::string("ab\0cd\n", 6)), AtClient::AT_OK);
+    ASSERT_EQ(r5.files["f.bin"].size(), 6);
+
+    std::vector<std::string> rsp;
+    ASSERT_EQ(at.command("AT+ULSTFILE=2,\"f.bin\"", &rsp), AtClient::AT_OK);
+    EXPECT_EQ(rsp[0], "+ULSTFILE: 6");
+
+    rsp.clear();
+    ASSERT_EQ(at.command("AT+URDBLOCK=\"f.bin\",1,3", &rsp), AtClient::AT_OK);
+    EXPECT_EQ(rsp[0], std::string("+URDBLOCK: \"f.bin\",3,\"b\0c\"", 26));
+
+    ASSERT_EQ(at.command("AT+UDELFILE=\"f.bin\""), AtClient::AT_OK);
+    EXPECT_EQ(at.command("AT+UDELFILE=\"f.bin\""), AtClient::AT_ERROR);
+    EXPECT_EQ(at.command("AT+URDFILE=\"f.bin\""), AtClient::AT_ERROR);
+}
+
+TEST(r5_emulator, ftp) {
+    R5Timing timing;
+    R5Emulator r5(timing);
+    r5.ftp_files["/firmware/wombat.bin"] = std::vector<uint8_t>(100000, 0xAA);
+    AtClient at(r5);
+    ASSERT_TRUE(connect(at));
+
+    at.command("AT+UFTP=1,\"ftp.example.com\"");
+    at.command("AT+UFTP=2,\"user\"");
+    at.command("AT+UFTP=3,\"password\"");
+    ASSERT_EQ(at.command("AT+UFTPC=1"), AtClient::AT_OK);
+    int result = -1;
+    ASSERT_TRUE(at.wait_for_urc("+UUFTPCR: 1,", result, 30, 500));
+    EXPECT_EQ(result, 1);
+
+    ASSERT_EQ(at.command("AT+UFTPC=8,\"firmware\""), AtClient::AT_OK);
+    ASSERT_TRUE(at.wait_for_urc("+UUFTPCR: 8,", result, 30, 1000));
+
+    uint32_t start = r5.now();
+    ASSERT_EQ(at.command("AT+UFTPC=4,\"wombat.bin\",\"fw.bin\""), AtClient::AT_OK);
+    ASSERT_TRUE(at.wait_for_urc("+UUFTPCR: 4,", result, 300, 100));
+    EXPECT_EQ(result, 1);
+    EXPECT_EQ(r5.files["fw.bin"].size(), 100000);
+    // 100 kB at 20 kB/s.
+    EXPECT_GE(r5.now() - start, timing.ftp_command_ms + 5000);
+    EXPECT_LT(r5.now() - start, timing.ftp_command_ms + 5200);
+
+    ASSERT_EQ(at.command("AT+UFTPC=4,\"missing.bin\",\"x\""), AtClient::AT_OK);
+    ASSERT_TRUE(at.wait_for_urc("+UUFTPCR: 4,", result, 300, 100));
+    EXPECT_EQ(result, 0);
+
+    ASSERT_EQ(at.command("AT+UFTPC=5,\"fw.bin\",\"copy.bin\""), AtClient::AT_OK);
+    ASSERT_TRUE(at.wait_for_urc("+UUFTPCR: 5,", result, 300, 100));
+    EXPECT_EQ(result, 1);
+    EXPECT_EQ(r5.ftp_files.count("/firmware/copy.bin"), 1);
+}
+
+/*
+ * Emulated wake time of a typical uplink: register, activate the PDP context, query NTP, log in,
+ * publish the messages and log out, using the firmware's command sequence and delays.
+ */
+TEST(r5_emulator, uplink_wake_time) {
+    const int num_msgs = 4;
+    const std::string msg(600, 'm');
+
+    // URC polling every 500 ms and 100 ms, then waking as soon as the modem sends something.
+    const struct { uint32_t poll_ms; bool event; } waits[] = { { 500, false }, { 100, false }, { 500, true } };
+    for (const auto &wait : waits) {
+        SCOPED_TRACE(wait.event ? "UART event" : "URC polling every " + std::to_string(wait.poll_ms) + " ms");
+        R5Timing timing;
+        R5Emulator r5(timing);
+        AtClient at(r5);
+
+        ASSERT_TRUE(connect(at));
+        const uint32_t connected = r5.now();
+        ASSERT_TRUE(mqtt_login(at, wait.poll_ms, wait.event));
+        for (int i = 0; i < num_msgs; i++) {
+            ASSERT_TRUE(mqtt_publish(at, "wombat", msg, wait.poll_ms, wait.event));
+        }
+        ASSERT_TRUE(mqtt_logout(at, wait.poll_ms, wait.event));
+        const uint32_t total = r5.now();
+
+        // The modem itself needs this long, the rest is time spent polling.
+        const uint32_t floor_ms = timing.mqtt_login_ms + num_msgs * timing.mqtt_publish_ms + timing.mqtt_logout_ms;
+
+        EXPECT_EQ(r5.published.size(), num_msgs);
+        EXPECT_GE(total - connected, floor_ms);
+        const uint32_t max_wait_ms = wait.event ? 0 : wait.poll_ms;
+        EXPECT_LT(total - connected, floor_ms + (num_msgs + 2) * (max_wait_ms + 100));
+    }
+}
+
+//#undef ARDUINO
+#if defined(ARDUINO)
+#include <Arduino.h>
+
+void setup()
+{
+    // should be the same value as for the `test_speed` option in "platformio.ini"
+    // default value is test_speed=115200
+    Serial.begin(115200);
+
+    ::testing::InitGoogleTest();
+}
+
+void loop()
+{
+    // Run tests
+    if (RUN_ALL_TESTS())
+        ;
+
+    // sleep for 1 sec
+    delay(1000);
+}
+
+#else
+int main(int argc, char **argv)
+{
+    ::testing::InitGoogleTest(&argc, argv);
+
+    if (RUN_ALL_TESTS())
+    ;
+
+    // Always return zero-code and allow PlatformIO to parse results
+    return 0;
+}
+#endif
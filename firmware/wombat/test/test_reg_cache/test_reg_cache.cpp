@@ -0,0 +1,196 @@
+#include "reg_cache.h"
+
+#include <gtest/gtest.h>
+
+#include <cstring>
+
+using namespace wombat;
+
+TEST(reg_cache, parsers) {
+    char plmn[PLMN_LEN + 1];
+    uint8_t act;
+
+    ASSERT_TRUE(parse_cops("\r\n+COPS: 0,2,\"50501\",7\r\n\r\nOK\r\n", plmn, act));
+    EXPECT_STREQ(plmn, "50501");
+    EXPECT_EQ(act, 7);
+    ASSERT_TRUE(parse_cops("+COPS: 1,2,\"310410\"\r\nOK\r\n", plmn, act));
+    EXPECT_STREQ(plmn, "310410");
+    EXPECT_EQ(act, 0);
+
+    // Not registered, an alphanumeric operator, and no response.
+    EXPECT_FALSE(parse_cops("+COPS: 0\r\nOK\r\n", plmn, act));
+    EXPECT_FALSE(parse_cops("+COPS: 0,0,\"Telstra\",7\r\nOK\r\n", plmn, act));
+    EXPECT_FALSE(parse_cops("\r\nERROR\r\n", plmn, act));
+    EXPECT_FALSE(parse_cops(nullptr, plmn, act));
+
+    ServingCell cell;
+    ASSERT_TRUE(parse_ucged("\r\n+UCGED: 2\r\n6,4,505,001\r\n9410,28,3,3,3073,8A0D10F,101,00000000,ffff,ff,67,19,0.31,21\r\n\r\nOK\r\n", cell));
+    EXPECT_EQ(cell.earfcn, 9410U);
+    EXPECT_EQ(cell.band, 28);
+    EXPECT_EQ(cell.tac, 0x3073);
+    EXPECT_EQ(cell.cell_id, 0x8A0D10FU);
+
+    // Band 3 from the EARFCN when the modem does not report it.
+    ASSERT_TRUE(parse_ucged("+UCGED: 2\r\n6,4,505,001\r\n1275,0,3,3,3073,8A0D10F\r\nOK\r\n", cell));
+    EXPECT_EQ(cell.band, 3);
+
+    EXPECT_FALSE(parse_ucged("+UCGED: 2\r\n6,0,,\r\nOK\r\n", cell));
+    EXPECT_FALSE(parse_ucged("\r\nERROR\r\n", cell));
+
+    uint64_t mask;
+    ASSERT_TRUE(parse_ubandmask("\r\n+UBANDMASK: 0,185473183,0,1,185473183,0\r\n\r\nOK\r\n", mask));
+    EXPECT_EQ(mask, 185473183ULL);
+    EXPECT_FALSE(parse_ubandmask("+UBANDMASK: 1,185473183\r\nOK\r\n", mask));
+
+    EXPECT_EQ(earfcn_to_band(0), 1);
+    EXPECT_EQ(earfcn_to_band(3749), 8);
+    EXPECT_EQ(earfcn_to_band(66436), 66);
+    EXPECT_EQ(earfcn_to_band(7000), 0);
+    EXPECT_EQ(band_bit(1), 1ULL);
+    EXPECT_EQ(band_bit(28), 1ULL << 27);
+    EXPECT_EQ(band_bit(66), 0ULL);
+}
+
+TEST(reg_cache, fast_path) {
+    RegCacheState state;
+    memset(&state, 0xA5, sizeof(state));
+
+    RegCache cache(state);
+    cache.begin();
+    EXPECT_FALSE(cache.use_fast_path());
+    EXPECT_EQ(cache.get_mean_ms(), 0U);
+    uint32_t ms;
+    bool fast;
+    EXPECT_FALSE(cache.take_unreported(ms, fast));
+
+    const uint64_t full = band_bit(3) | band_bit(5) | band_bit(8) | band_bit(28);
+    const ServingCell b28 = { 9410, 28, 0x3073, 0x8A0D10F };
+    uint64_t mask = 0;
+
+    cache.registered("50501", 7, b28, 20000, false);
+    ASSERT_TRUE(cache.use_fast_path());
+    EXPECT_STREQ(cache.get_plmn(), "50501");
+    EXPECT_FALSE(cache.narrow_mask(full, mask));
+
+    // The band mask is narrowed after STABLE_ATTACHES registrations on the same PLMN and band.
+    cache.registered("50501", 7, b28, 4000, true);
+    cache.registered("50501", 7, b28, 3000, true);
+    cache.begin();
+    EXPECT_EQ(cache.get_stable(), RegCache::STABLE_ATTACHES);
+    ASSERT_TRUE(cache.narrow_mask(full, mask));
+    EXPECT_EQ(mask, band_bit(28));
+    EXPECT_FALSE(cache.narrow_mask(band_bit(28), mask));
+    EXPECT_FALSE(cache.narrow_mask(band_bit(3), mask));
+
+    cache.narrowed(full);
+    cache.narrowed(band_bit(28));
+    EXPECT_EQ(cache.get_full_mask(), full);
+
+    EXPECT_EQ(cache.get_attaches(), 3U);
+    EXPECT_EQ(cache.get_fast_attaches(), 2U);
+    EXPECT_EQ(cache.get_mean_ms(), 9000U);
+    EXPECT_EQ(cache.get_fast_mean_ms(), 3500U);
+    EXPECT_EQ(cache.get_max_ms(), 20000U);
+    EXPECT_EQ(cache.get_last_ms(), 3000U);
+    ASSERT_TRUE(cache.take_unreported(ms, fast));
+    EXPECT_EQ(ms, 3000U);
+    EXPECT_TRUE(fast);
+    EXPECT_FALSE(cache.take_unreported(ms, fast));
+
+    // A failed fast path stops the narrowing, and MAX_FAILS in a row stop the fast path.
+    cache.fast_failed();
+    EXPECT_TRUE(cache.use_fast_path());
+    EXPECT_FALSE(cache.narrow_mask(full, mask));
+    cache.fast_failed();
+    EXPECT_FALSE(cache.use_fast_path());
+
+    // A normal registration on another band starts again.
+    const ServingCell b3 = { 1275, 3, 0x3073, 0x1234 };
+    cache.registered("50501", 7, b3, 30000, false);
+    EXPECT_TRUE(cache.use_fast_path());
+    EXPECT_EQ(cache.get_stable(), 1);
+    EXPECT_EQ(cache.get_cell().band, 3);
+
+    // A registration without a PLMN is counted, but does not change the cache.
+    cache.registered(nullptr, 0, b28, 1000, false);
+    EXPECT_EQ(cache.get_cell().band, 3);
+    EXPECT_EQ(cache.get_attaches(), 5U);
+
+    EXPECT_EQ(RegCache::poll_ms(0), 250U);
+    EXPECT_EQ(RegCache::poll_ms(15000), 1000U);
+    EXPECT_EQ(RegCache::poll_ms(60000), 2000U);
+}
+
+//! How long the modem takes to register, given how many bands it scans and if it searches for the PLMN.
+static uint32_t modem_ms(const int bands, const bool search) {
+    return 2500 + bands * 1800 + (search ? 4000 : 0);
+}
+
+//! When a registration is seen when polling every interval_ms, or with RegCache::poll_ms if it is 0.
+static uint32_t seen_ms(const uint32_t ms, const uint32_t interval_ms) {
+    uint32_t t = 0;
+    while (t < ms) {
+        t += interval_ms > 0 ? interval_ms : RegCache::poll_ms(t);
+    }
+    return t;
+}
+
+/*
+ * A modelled day of hourly registrations by a node that does not move. Without the cache every
+ * registration searches all 8 bands of the mask for the network, and is seen at the next 2 s poll.
+ */
+TEST(reg_cache, modelled_registration) {
+    RegCacheState state;
+    RegCache cache(state);
+    memset(&state, 0, sizeof(state));
+    cache.begin();
+
+    const ServingCell b28 = { 9410, 28, 0x3073, 0x8A0D10F };
+    uint64_t before = 0;
+    for (int i = 0; i < 24; i++) {
+        before += seen_ms(modem_ms(8, true), 2000);
+
+        uint64_t mask;
+        const bool fast = cache.use_fast_path();
+        const int bands = cache.narrow_mask(0xFF | band_bit(28), mask) ? 1 : 8;
+        cache.registered("50501", 7, b28, seen_ms(modem_ms(bands, ! fast), 0), fast);
+    }
+
+    EXPECT_LT(cache.get_mean_ms() * 3, before / 24);
+}
+
+//#undef ARDUINO
+#if defined(ARDUINO)
+#include <Arduino.h>
+
+void setup()
+{
+    // should be the same value as for the `test_speed` option in "platformio.ini"
+    // default value is test_speed=115200
+    Serial.begin(115200);
+
+    ::testing::InitGoogleTest();
+}
+
+void loop()
+{
+    // Run tests
+    if (RUN_ALL_TESTS())
+        ;
+
+    // sleep for 1 sec
+    delay(1000);
+}
+
+#else
+int main(int argc, char **argv)
+{
+    ::testing::InitGoogleTest(&argc, argv);
+
+    if (RUN_ALL_TESTS())
+    ;
+
+    // Always return zero-code and allow PlatformIO to parse results
+    return 0;
+}
+#endif
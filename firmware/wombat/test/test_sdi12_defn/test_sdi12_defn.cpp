@@ -0,0 +1,198 @@
+#include "crc32.h"
+#include "sdi12_defn.h"
+
+#include <gtest/gtest.h>
+
+#include <cstring>
+
+using namespace wombat;
+
+/// The definitions from data/sdi12defn.json, which is 1257 bytes.
+static void add_defns(SensorDefnTableBuilder &builder) {
+    builder.add("METER", "TER11", { "aC!" }, nullptr, { "VWC", "Temperature" }, false);
+    builder.add("METER", "TER12", { "aC!" }, "110", { "VWC", "Temperature" }, false);
+    builder.add("METER", "ATM41", { "aC!" }, "111011111111110000",
+                { "Solar", "Precipitation", "Strikes", "WindSpeed", "WindDirection", "WindGustSpeed",
+                  "AirTemperature", "VaporPressure", "AirPressure", "RH", "HumiditySensorTemperature",
+                  "X_Tilt", "Y_Tilt" }, false);
+    builder.add("EP100GL-", "04", { "aC3!", "aC2!" }, nullptr,
+                { "VWC_1", "VWC_2", "VWC_3", "VWC_4", "Temperature_1", "Temperature_2", "Temperature_3",
+                  "Temperature_4" }, false);
+    builder.add("DECAGON", "5TM", { "aC!" }, nullptr, { "DialectricPermittivity", "Temperature" }, true);
+}
+
+static std::vector<uint8_t> build_table(void) {
+    SensorDefnTableBuilder builder;
+    add_defns(builder);
+    std::vector<uint8_t> blob;
+    EXPECT_TRUE(builder.build(1257, 0x5eed1257, blob));
+    return blob;
+}
+
+TEST(crc32, check_value) {
+    EXPECT_EQ(crc32("123456789", 9), 0xcbf43926u);
+    EXPECT_EQ(crc32("", 0), 0u);
+
+    // The CRC can be calculated in pieces.
+    EXPECT_EQ(crc32("6789", 4, crc32("12345", 5)), 0xcbf43926u);
+}
+
+TEST(sdi12_defn, lookup) {
+    std::vector<uint8_t> blob = build_table();
+    SensorDefnTable table;
+    ASSERT_TRUE(table.load(blob.data(), blob.size()));
+    EXPECT_EQ(table.size(), 5);
+    EXPECT_EQ(table.get_source_size(), 1257u);
+    EXPECT_EQ(table.get_source_crc(), 0x5eed1257u);
+
+    SensorDefn d = table.find("METER", "TER12");
+    ASSERT_TRUE(d);
+    EXPECT_EQ(d.num_read_cmds(), 1);
+    EXPECT_STREQ(d.read_cmd(0), "aC!");
+    EXPECT_EQ(d.read_cmd(1), nullptr);
+    EXPECT_STREQ(d.value_mask(), "110");
+    EXPECT_EQ(d.num_labels(), 2);
+    EXPECT_STREQ(d.label(0), "VWC");
+    EXPECT_STREQ(d.label(1), "Temperature");
+    EXPECT_EQ(d.label(2), nullptr);
+    EXPECT_FALSE(d.ignore_sr());
+
+    d = table.find("METER", "TER11");
+    ASSERT_TRUE(d);
+    EXPECT_EQ(d.value_mask(), nullptr);
+
+    d = table.find("EP100GL-", "04");
+    ASSERT_TRUE(d);
+    ASSERT_EQ(d.num_read_cmds(), 2);
+    EXPECT_STREQ(d.read_cmd(0), "aC3!");
+    EXPECT_STREQ(d.read_cmd(1), "aC2!");
+    EXPECT_STREQ(d.label(7), "Temperature_4");
+
+    d = table.find("DECAGON", "5TM");
+    ASSERT_TRUE(d);
+    EXPECT_TRUE(d.ignore_sr());
+
+    EXPECT_FALSE(table.find("METER", "TER1"));
+    EXPECT_FALSE(table.find("METERT", "ER11"));
+    EXPECT_FALSE(table.find("", ""));
+    EXPECT_FALSE(table.find(nullptr, "TER11"));
+
+    SensorDefn none;
+    EXPECT_FALSE(none);
+    EXPECT_EQ(none.num_read_cmds(), 0);
+    EXPECT_EQ(none.value_mask(), nullptr);
+    EXPECT_EQ(none.label(0), nullptr);
+}
+
+TEST(sdi12_defn, builder) {
+    SensorDefnTableBuilder builder;
+    EXPECT_TRUE(builder.add("A", "B", { "aC!" }, nullptr, {}, false));
+    EXPECT_FALSE(builder.add("A", "B", { "aM!" }, nullptr, {}, false));
+    EXPECT_FALSE(builder.add(nullptr, "B", { "aM!" }, nullptr, {}, false));
+
+    std::vector<uint8_t> blob;
+    ASSERT_TRUE(builder.build(0, 0, blob));
+
+    SensorDefnTable table;
+    ASSERT_TRUE(table.load(blob.data(), blob.size()));
+    EXPECT_STREQ(table.find("A", "B").read_cmd(0), "aC!");
+    EXPECT_EQ(table.find("A", "B").num_labels(), 0);
+
+    // An empty table is valid.
+    SensorDefnTableBuilder empty;
+    ASSERT_TRUE(empty.build(0, 0, blob));
+    ASSERT_TRUE(table.load(blob.data(), blob.size()));
+    EXPECT_EQ(table.size(), 0);
+    EXPECT_FALSE(table.find("A", "B"));
+}
+
+TEST(sdi12_defn, many_sensors) {
+    // Enough definitions to force collisions in the hash buckets.
+    SensorDefnTableBuilder builder;
+    char model[8];
+    for (int i = 0; i < 200; i++) {
+        snprintf(model, sizeof(model), "M%d", i);
+        ASSERT_TRUE(builder.add("VENDOR", model, { "aM!" }, nullptr, { model }, false));
+    }
+
+    std::vector<uint8_t> blob;
+    ASSERT_TRUE(builder.build(0, 0, blob));
+
+    SensorDefnTable table;
+    ASSERT_TRUE(table.load(blob.data(), blob.size()));
+    for (int i = 0; i < 200; i++) {
+        snprintf(model, sizeof(model), "M%d", i);
+        SensorDefn d = table.find("VENDOR", model);
+        ASSERT_TRUE(d) << model;
+        EXPECT_STREQ(d.label(0), model);
+    }
+
+    EXPECT_FALSE(table.find("VENDOR", "M200"));
+
+    for (int i = 0; i < 200; i++) {
+        snprintf(model, sizeof(model), "M%d", i);
+        EXPECT_STREQ(table.at(i).label(0), model);
+    }
+
+    EXPECT_FALSE(table.at(200));
+}
+
+TEST(sdi12_defn, rejects_bad_tables) {
+    std::vector<uint8_t> blob = build_table();
+    SensorDefnTable table;
+
+    EXPECT_FALSE(table.load(nullptr, 0));
+    EXPECT_FALSE(table.load(blob.data(), SensorDefnTable::HEADER_SIZE - 1));
+    EXPECT_FALSE(table.load(blob.data(), blob.size() - 1));
+
+    std::vector<uint8_t> bad = blob;
+    bad[0] = 'X';
+    EXPECT_FALSE(table.load(bad.data(), bad.size()));
+
+    // Corrupt a string, the CRC catches it.
+    bad = blob;
+    bad[bad.size() - 2] ^= 0x20;
+    EXPECT_FALSE(table.load(bad.data(), bad.size()));
+    EXPECT_FALSE(table.find("METER", "TER12"));
+
+    ASSERT_TRUE(table.load(blob.data(), blob.size()));
+    EXPECT_TRUE(table.find("METER", "TER12"));
+    table.clear();
+    EXPECT_FALSE(table.find("METER", "TER12"));
+}
+
+//#undef ARDUINO
+#if defined(ARDUINO)
+#include <Arduino.h>
+
+void setup()
+{
+    // should be the same value as for the `test_speed` option in "platformio.ini"
+    // default value is test_speed=115200
+    Serial.begin(115200);
+
+    ::testing::InitGoogleTest();
+}
+
+void loop()
+{
+    // Run tests
+    if (RUN_ALL_TESTS())
+        ;
+
+    // sleep for 1 sec
+    delay(1000);
+}
+
+#else
+int main(int argc, char **argv)
+{
+    ::testing::InitGoogleTest(&argc, argv);
+
+    if (RUN_ALL_TESTS())
+    ;
+
+    // Always return zero-code and allow PlatformIO to parse results
+    return 0;
+}
+#endif
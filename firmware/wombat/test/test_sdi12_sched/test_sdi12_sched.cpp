@@ -0,0 +1,253 @@
+#include "sdi12_sched.h"
+
+#include <gtest/gtest.h>
+
+#include <cstdio>
+#include <cstring>
+#include <map>
+
+using namespace wombat;
+
+/// A simulated SDI-12 bus with a virtual clock. Every command costs a fixed bus time.
+class SimBus : public SDI12Bus {
+public:
+    struct Sensor {
+        uint16_t ready_secs;
+        // Values returned by each concurrent command, keyed by the character after the C.
+        std::map<char, std::vector<double>> values;
+        // The command in progress and when it will be ready.
+        char active = 0;
+        uint32_t started = 0;
+    };
+
+    //! Break + command + response time for one transaction on a 1200 baud bus.
+    static constexpr uint32_t CMD_MS = 60;
+
+    std::map<char, Sensor> sensors;
+    uint32_t clock = 0;
+    int transactions = 0;
+
+    size_t transact(const char *cmd, char *rsp, size_t rsp_max) override {
+        clock += CMD_MS;
+        transactions++;
+
+        auto iter = sensors.find(cmd[0]);
+        if (iter == sensors.end()) {
+            return 0;
+        }
+
+        Sensor &s = iter->second;
+        if (cmd[1] == 'C') {
+            const char which = cmd[2] == '!' ? '0' : cmd[2];
+            s.active = which;
+            s.started = clock;
+            snprintf(rsp, rsp_max, "%c%03u%02u", cmd[0], s.ready_secs, (unsigned)s.values[which].size());
+            return strlen(rsp);
+        }
+
+        if (cmd[1] == 'D') {
+            std::string out(1, cmd[0]);
+            // The data is not available until the measurement time has passed.
+            if (s.active != 0 && clock - s.started >= s.ready_secs * 1000u) {
+                // Three values per D command to exercise multiple D commands.
+                const size_t first = (cmd[2] - '0') * 3;
+                const auto &v = s.values[s.active];
+                for (size_t i = first; i < first + 3 && i < v.size(); i++) {
+                    char buf[16];
+                    snprintf(buf, sizeof(buf), "%+g", v[i]);
+                    out += buf;
+                }
+            }
+
+            strncpy(rsp, out.c_str(), rsp_max - 1);
+            return strlen(rsp);
+        }
+
+        return 0;
+    }
+
+    uint32_t now_ms() override { return clock; }
+    void wait_ms(uint32_t ms) override { clock += ms; }
+};
+
+static SimBus make_six_sensor_bus(void) {
+    SimBus bus;
+    bus.sensors['0'] = { 1, { { '0', { 0.25, 21.5 } } } };
+    bus.sensors['1'] = { 2, { { '0', { 0.31, 20.0 } } } };
+    bus.sensors['2'] = { 1, { { '0', { 1.0, 2.0, 3.0, 4.0, 5.0, 6.0, 7.0 } } } };
+    bus.sensors['3'] = { 3, { { '3', { 10.0, 11.0, 12.0, 13.0 } }, { '2', { -1.5, -2.5 } } } };
+    bus.sensors['4'] = { 1, { { '0', { 99.5 } } } };
+    bus.sensors['5'] = { 2, { { '0', { 0.0, -0.125 } } } };
+    return bus;
+}
+
+static void add_six_sensors(ConcurrentScheduler &sched) {
+    sched.add('0', { "aC!" });
+    sched.add('1', { "aC!" });
+    sched.add('2', { "aC!" });
+    sched.add('3', { "aC3!", "aC2!" });
+    sched.add('4', { "aC!" });
+    sched.add('5', { "aC!" });
+}
+
+TEST(sdi12_sched, parse_start_response) {
+    uint16_t secs;
+    uint8_t n;
+
+    EXPECT_FALSE(parse_start_response(nullptr, '0', secs, n));
+    EXPECT_FALSE(parse_start_response("", '0', secs, n));
+    EXPECT_FALSE(parse_start_response("1001", '0', secs, n));
+    EXPECT_FALSE(parse_start_response("000102", '1', secs, n));
+    EXPECT_FALSE(parse_start_response("0x0102", '0', secs, n));
+
+    EXPECT_TRUE(parse_start_response("00013", '0', secs, n));
+    EXPECT_EQ(secs, 1);
+    EXPECT_EQ(n, 3);
+
+    EXPECT_TRUE(parse_start_response("312012", '3', secs, n));
+    EXPECT_EQ(secs, 120);
+    EXPECT_EQ(n, 12);
+}
+
+TEST(sdi12_sched, parse_data_values) {
+    std::vector<double> v;
+
+    EXPECT_EQ(parse_data_values(nullptr, '0', v), -1);
+    EXPECT_EQ(parse_data_values("1+1.0", '0', v), -1);
+    EXPECT_EQ(parse_data_values("0", '0', v), 0);
+    EXPECT_TRUE(v.empty());
+
+    EXPECT_EQ(parse_data_values("0+1.23-4.5+6", '0', v), 3);
+    ASSERT_EQ(v.size(), 3);
+    EXPECT_DOUBLE_EQ(v[0], 1.23);
+    EXPECT_DOUBLE_EQ(v[1], -4.5);
+    EXPECT_DOUBLE_EQ(v[2], 6.0);
+
+    // Values are appended.
+    EXPECT_EQ(parse_data_values("0-0.001", '0', v), 1);
+    EXPECT_EQ(v.size(), 4);
+    EXPECT_DOUBLE_EQ(v[3], -0.001);
+}
+
+TEST(sdi12_sched, is_concurrent_cmd) {
+    EXPECT_TRUE(ConcurrentScheduler::is_concurrent_cmd("aC!"));
+    EXPECT_TRUE(ConcurrentScheduler::is_concurrent_cmd("aC3!"));
+    EXPECT_FALSE(ConcurrentScheduler::is_concurrent_cmd("aM!"));
+    EXPECT_FALSE(ConcurrentScheduler::is_concurrent_cmd("aM1!"));
+    EXPECT_FALSE(ConcurrentScheduler::is_concurrent_cmd("aCC!"));
+    EXPECT_FALSE(ConcurrentScheduler::is_concurrent_cmd("aC0!"));
+    EXPECT_FALSE(ConcurrentScheduler::is_concurrent_cmd(nullptr));
+
+    SimBus bus;
+    ConcurrentScheduler sched(bus);
+    EXPECT_FALSE(sched.add('0', { "aC!", "aM!" }));
+    EXPECT_FALSE(sched.add('0', {}));
+    EXPECT_TRUE(sched.get_jobs().empty());
+}
+
+TEST(sdi12_sched, collects_same_values) {
+    SimBus bus = make_six_sensor_bus();
+    ConcurrentScheduler sched(bus);
+    add_six_sensors(sched);
+    sched.run();
+
+    for (const auto &s : bus.sensors) {
+        const auto *job = sched.find(s.first);
+        ASSERT_NE(job, nullptr);
+        for (const auto &r : job->cmds) {
+            const char which = r.cmd[2] == '!' ? '0' : r.cmd[2];
+            EXPECT_TRUE(r.ok) << r.cmd;
+            EXPECT_EQ(r.values, s.second.values.at(which)) << r.cmd;
+        }
+    }
+
+    // Commands were run in the order given in the definition.
+    const auto *job = sched.find('3');
+    ASSERT_EQ(job->cmds.size(), 2);
+    EXPECT_EQ(job->cmds[0].cmd, "3C3!");
+    EXPECT_EQ(job->cmds[1].cmd, "3C2!");
+
+    // The sensor with two 3 s commands finishes last.
+    EXPECT_GE(job->done_at, 6000u);
+    EXPECT_EQ(job->done_at, bus.clock);
+    EXPECT_LT(sched.find('0')->done_at, job->done_at);
+}
+
+TEST(sdi12_sched, missing_sensor) {
+    SimBus bus = make_six_sensor_bus();
+    ConcurrentScheduler sched(bus);
+    sched.add('0', { "aC!" });
+    sched.add('7', { "aC!" });
+    sched.run();
+
+    EXPECT_TRUE(sched.find('0')->cmds[0].ok);
+    EXPECT_FALSE(sched.find('7')->cmds[0].ok);
+    EXPECT_TRUE(sched.find('7')->cmds[0].values.empty());
+}
+
+TEST(sdi12_sched, wall_clock_saving) {
+    // Baseline: one sensor at a time, as read_sensor() does.
+    SimBus seq_bus = make_six_sensor_bus();
+    uint32_t sequential_ms = 0;
+    {
+        std::vector<std::pair<char, std::vector<const char *>>> defs = {
+            { '0', { "aC!" } }, { '1', { "aC!" } }, { '2', { "aC!" } },
+            { '3', { "aC3!", "aC2!" } }, { '4', { "aC!" } }, { '5', { "aC!" } },
+        };
+
+        for (const auto &d : defs) {
+            ConcurrentScheduler one(seq_bus);
+            one.add(d.first, d.second);
+            one.run();
+        }
+
+        sequential_ms = seq_bus.clock;
+    }
+
+    SimBus bus = make_six_sensor_bus();
+    ConcurrentScheduler sched(bus);
+    add_six_sensors(sched);
+    sched.run();
+    const uint32_t concurrent_ms = bus.clock;
+
+    // The slowest sensor needs 3 s + 3 s for its two commands, the sum of all waits is 13 s.
+    EXPECT_EQ(seq_bus.transactions, bus.transactions);
+    EXPECT_LT(concurrent_ms, sequential_ms / 2);
+    EXPECT_LT(concurrent_ms, 6000u + bus.transactions * SimBus::CMD_MS);
+}
+
+//#undef ARDUINO
+#if defined(ARDUINO)
+#include <Arduino.h>
+
+void setup()
+{
+    // should be the same value as for the `test_speed` option in "platformio.ini"
+    // default value is test_speed=115200
+    Serial.begin(115200);
+
+    ::testing::InitGoogleTest();
+}
+
+void loop()
+{
+    // Run tests
+    if (RUN_ALL_TESTS())
+        ;
+
+    // sleep for 1 sec
+    delay(1000);
+}
+
+#else
+int main(int argc, char **argv)
+{
+    ::testing::InitGoogleTest(&argc, argv);
+
+    if (RUN_ALL_TESTS())
+    ;
+
+    // Always return zero-code and allow PlatformIO to parse results
+    return 0;
+}
+#endif
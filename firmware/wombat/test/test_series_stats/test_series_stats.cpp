@@ -0,0 +1,226 @@
+#include "series_stats.h"
+
+#include <gtest/gtest.h>
+
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+using namespace wombat;
+
+TEST(series_stats, welford) {
+    SeriesStatsState state;
+    memset(&state, 0xA5, sizeof(state));
+
+    SeriesStats stats(state);
+    stats.begin();
+    EXPECT_EQ(stats.size(), 0U);
+    EXPECT_EQ(stats.find("1_VWC"), nullptr);
+
+    // Values with a large offset lose precision if the variance is worked out from the sums of the values and their squares.
+    const double values[] = { 1e6 + 4.0, 1e6 + 7.0, 1e6 + 13.0, 1e6 + 16.0 };
+    for (const double v : values) {
+        ASSERT_TRUE(stats.add("1_VWC", v));
+    }
+    EXPECT_FALSE(stats.add("1_VWC", NAN));
+    EXPECT_FALSE(stats.add("1_VWC", INFINITY));
+
+    // The state is kept across deep sleep.
+    stats.begin();
+    const SeriesStat *s = stats.find("1_VWC");
+    ASSERT_NE(s, nullptr);
+    EXPECT_EQ(s->count, 4U);
+    EXPECT_DOUBLE_EQ(s->mean, 1e6 + 10.0);
+    EXPECT_DOUBLE_EQ(s->variance(), 30.0);
+    EXPECT_FLOAT_EQ(s->min, 1e6f + 4.0f);
+    EXPECT_FLOAT_EQ(s->max, 1e6f + 16.0f);
+    EXPECT_FLOAT_EQ(s->last, 1e6f + 16.0f);
+
+    ASSERT_TRUE(stats.add("battery (v)", 4.1));
+    EXPECT_EQ(stats.size(), 2U);
+    EXPECT_DOUBLE_EQ(stats.find("battery (v)")->variance(), 0.0);
+
+    stats.clear();
+    EXPECT_EQ(stats.size(), 0U);
+    EXPECT_EQ(stats.find("1_VWC"), nullptr);
+}
+
+TEST(series_stats, ring) {
+    SeriesStatsState state;
+    memset(&state, 0, sizeof(state));
+
+    SeriesStats stats(state);
+    stats.begin();
+
+    char name[16];
+    for (size_t i = 0; i < STATS_MAX_SERIES + 2; i++) {
+        snprintf(name, sizeof(name), "1_V%u", (unsigned)i);
+        ASSERT_TRUE(stats.add(name, static_cast<double>(i)));
+    }
+
+    // The two oldest series made room for the two newest.
+    EXPECT_EQ(stats.size(), STATS_MAX_SERIES);
+    EXPECT_EQ(stats.get_evicted(), 2U);
+    EXPECT_EQ(stats.find("1_V0"), nullptr);
+    EXPECT_EQ(stats.find("1_V1"), nullptr);
+    ASSERT_NE(stats.find("1_V2"), nullptr);
+    snprintf(name, sizeof(name), "1_V%u", (unsigned)(STATS_MAX_SERIES + 1));
+    ASSERT_NE(stats.find(name), nullptr);
+    EXPECT_EQ(stats.find(name)->count, 1U);
+
+    // Until the clock is set the summaries are due every interval / measure cycles, then on UTC boundaries.
+    EXPECT_FALSE(stats.summary_due(0, 0, 300));
+    stats.next_cycle();
+    stats.next_cycle();
+    EXPECT_FALSE(stats.summary_due(0, 900, 300));
+    stats.next_cycle();
+    EXPECT_TRUE(stats.summary_due(0, 900, 300));
+    EXPECT_TRUE(stats.summary_due(1700000100, 900, 300));
+    EXPECT_FALSE(stats.summary_due(1700000400, 900, 300));
+    stats.clear();
+    EXPECT_EQ(stats.get_cycles(), 0U);
+
+    // A state with a bad slot count is reset.
+    state.num_series = STATS_MAX_SERIES + 1;
+    stats.begin();
+    EXPECT_EQ(stats.size(), 0U);
+    EXPECT_EQ(stats.get_evicted(), 0U);
+}
+
+TEST(series_stats, modes) {
+    stats_mode_t mode = STATS_RAW;
+    EXPECT_TRUE(parse_stats_mode("summary", 7, mode));
+    EXPECT_EQ(mode, STATS_SUMMARY);
+    EXPECT_TRUE(parse_stats_mode("both times", 4, mode));
+    EXPECT_EQ(mode, STATS_BOTH);
+    EXPECT_FALSE(parse_stats_mode("sum", 3, mode));
+    EXPECT_STREQ(stats_mode_name(STATS_RAW), "raw");
+    EXPECT_TRUE(stats_sends_raw(STATS_BOTH));
+    EXPECT_FALSE(stats_sends_raw(STATS_SUMMARY));
+    EXPECT_FALSE(stats_sends_summary(STATS_RAW));
+
+    EXPECT_TRUE(is_sdi12_series("1_VWC"));
+    EXPECT_TRUE(is_sdi12_series("17_X_Tilt"));
+    EXPECT_TRUE(is_sdi12_series("a_V3"));
+    EXPECT_FALSE(is_sdi12_series("pulse_count"));
+    EXPECT_FALSE(is_sdi12_series("battery (v)"));
+    EXPECT_FALSE(is_sdi12_series("1_"));
+
+    SeriesModes modes;
+    const char *cmd = "battery (v) summary";
+    ASSERT_TRUE(modes.set(cmd, 11, STATS_SUMMARY));
+    ASSERT_TRUE(modes.set("1_VWC", 5, STATS_BOTH));
+    ASSERT_TRUE(modes.set("1_VWC", 5, STATS_RAW));
+    EXPECT_EQ(modes.size(), 2U);
+    EXPECT_EQ(modes.get("battery (v)", STATS_BOTH), STATS_SUMMARY);
+    EXPECT_EQ(modes.get("1_VWC", STATS_BOTH), STATS_RAW);
+    EXPECT_EQ(modes.get("1_Temperature", STATS_BOTH), STATS_BOTH);
+
+    EXPECT_FALSE(modes.set("", 0, STATS_RAW));
+    EXPECT_FALSE(modes.set("a name longer than STATS_NAME_LEN", 33, STATS_RAW));
+    EXPECT_FALSE(modes.remove("1_VW", 4));
+    ASSERT_TRUE(modes.remove("battery (v)", 11));
+    EXPECT_EQ(modes.size(), 1U);
+    EXPECT_STREQ(modes.at(0).name, "1_VWC");
+
+    char name[16];
+    for (size_t i = modes.size(); i < STATS_MAX_MODES; i++) {
+        snprintf(name, sizeof(name), "2_V%u", (unsigned)i);
+        ASSERT_TRUE(modes.set(name, strlen(name), STATS_SUMMARY));
+    }
+    EXPECT_FALSE(modes.set("3_VWC", 5, STATS_SUMMARY));
+}
+
+//! The length of a timeseries entry as sensor_task() serialises it.
+static size_t entry_len(const char *name, const double value) {
+    char buf[96];
+    return snprintf(buf, sizeof(buf), "{\"name\":\"%s\",\"value\":%g},", name, value);
+}
+
+//! The length of a message without its timeseries, as sensor_task() serialises it.
+static size_t envelope_len(void) {
+    char buf[192];
+    return snprintf(buf, sizeof(buf), "{\"timestamp\":\"%s\",\"source_ids\":{\"serial_no\":\"%s\",\"firmware\":\"%s\"},\"timeseries\":[]}",
+                    "2026-10-17T09:00:00Z", "3C71BF4A1B2C", "1.2.3 main 8e23ebc clean");
+}
+
+/*
+ * A node with a 12 depth soil probe measured every 5 minutes. Sending each value uplinks a message
+ * of 12 values per cycle, an hourly summary of each series uplinks one message of 6 values per series.
+ */
+TEST(series_stats, modelled_volume) {
+    SeriesStatsState state;
+    memset(&state, 0, sizeof(state));
+    SeriesStats stats(state);
+    stats.begin();
+
+    static constexpr size_t DEPTHS = 12;
+    static constexpr size_t CYCLES = 12;
+    const char *suffixes[] = { " n", " min", " max", " mean", " var", " last" };
+
+    char name[32];
+    size_t raw_bytes = 0;
+    size_t summary_bytes = 0;
+    for (size_t cycle = 0; cycle < CYCLES; cycle++) {
+        stats.next_cycle();
+        raw_bytes += envelope_len();
+        for (size_t depth = 0; depth < DEPTHS; depth++) {
+            snprintf(name, sizeof(name), "1_VWC_%u", (unsigned)(depth + 1));
+            const double value = 20.0 + depth + 0.25 * sin(static_cast<double>(cycle));
+            raw_bytes += entry_len(name, value);
+            ASSERT_TRUE(stats.add(name, value));
+        }
+    }
+
+    ASSERT_TRUE(stats.summary_due(0, 3600, 300));
+    summary_bytes += envelope_len();
+    for (size_t depth = 0; depth < DEPTHS; depth++) {
+        snprintf(name, sizeof(name), "1_VWC_%u", (unsigned)(depth + 1));
+        const SeriesStat *s = stats.find(name);
+        ASSERT_NE(s, nullptr);
+        EXPECT_EQ(s->count, CYCLES);
+        for (const char *suffix : suffixes) {
+            char summary_name[40];
+            snprintf(summary_name, sizeof(summary_name), "%s%s", name, suffix);
+            summary_bytes += entry_len(summary_name, s->mean);
+        }
+    }
+
+    EXPECT_LT(summary_bytes * 2, raw_bytes);
+}
+
+//#undef ARDUINO
+#if defined(ARDUINO)
+#include <Arduino.h>
+
+void setup()
+{
+    // should be the same value as for the `test_speed` option in "platformio.ini"
+    // default value is test_speed=115200
+    Serial.begin(115200);
+
+    ::testing::InitGoogleTest();
+}
+
+void loop()
+{
+    // Run tests
+    if (RUN_ALL_TESTS())
+        ;
+
+    // sleep for 1 sec
+    delay(1000);
+}
+
+#else
+int main(int argc, char **argv)
+{
+    ::testing::InitGoogleTest(&argc, argv);
+
+    if (RUN_ALL_TESTS())
+    ;
+
+    // Always return zero-code and allow PlatformIO to parse results
+    return 0;
+}
+#endif
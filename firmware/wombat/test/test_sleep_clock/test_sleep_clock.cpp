@@ -0,0 +1,190 @@
+#include "sleep_clock.h"
+
+#include <gtest/gtest.h>
+
+#include <cmath>
+#include <cstring>
+#include <random>
+
+using namespace wombat;
+
+static constexpr int64_t SECOND = 1000000;
+
+/**
+ * A node that wakes every 15 minutes and uplinks every hour, with a sleep clock that runs slow by
+ * drift_ppb and NTP times that are out by up to 400 ms.
+ */
+class Node {
+public:
+    Node(SleepClockState &state, double drift_ppb, bool correct) : clock(state), drift_ppb(drift_ppb), correct(correct) {
+        clock.begin(0);
+    }
+
+    SleepClock clock;
+    double drift_ppb;
+    bool correct;
+
+    //! True time and the node's clock.
+    int64_t real_us = 0;
+    int64_t local_us = 0;
+
+    int ntp_queries = 0;
+    int wakes = 0;
+    //! The largest difference from 15 minutes between wakes, and from true time at a wake, after the first day.
+    int64_t worst_interval_us = 0;
+    int64_t worst_clock_us = 0;
+
+    void run(int days) {
+        std::mt19937 rng(7);
+        std::uniform_int_distribution<int64_t> ntp_error(-400000, 400000);
+        const int64_t awake_us = 20 * SECOND;
+        int64_t last_wake_us = 0;
+
+        for (int i = 0; i < days * 96; i++) {
+            if (correct) {
+                local_us += clock.correction();
+            }
+
+            if (i % 4 == 0 && ( ! correct || clock.sync_due(local_us))) {
+                const int64_t error = real_us + ntp_error(rng) - local_us;
+                local_us += error;
+                clock.synced(error, local_us);
+                ntp_queries++;
+            }
+
+            if (i >= 96) {
+                worst_interval_us = std::max(worst_interval_us, std::abs(real_us - last_wake_us - 900 * SECOND));
+                worst_clock_us = std::max(worst_clock_us, std::abs(real_us - local_us));
+            }
+            last_wake_us = real_us;
+            wakes++;
+
+            real_us += awake_us;
+            local_us += awake_us;
+
+            const uint64_t real_sleep = 900 * SECOND - awake_us;
+            const uint64_t sleep = correct ? clock.sleep_for(real_sleep) : real_sleep;
+            clock.slept(sleep);
+            local_us += sleep;
+            real_us += static_cast<int64_t>(sleep * (1.0 + drift_ppb / 1e9));
+        }
+    }
+};
+
+TEST(sleep_clock, reset_when_invalid) {
+    SleepClockState state;
+    memset(&state, 0xA5, sizeof(state));
+
+    SleepClock clock(state);
+    clock.begin(0);
+    EXPECT_EQ(clock.get_drift_ppb(), 0);
+    EXPECT_EQ(clock.get_windows(), 0U);
+    EXPECT_FALSE(clock.has_estimate());
+    EXPECT_FALSE(clock.is_trusted());
+    EXPECT_TRUE(clock.sync_due(0));
+    EXPECT_EQ(clock.correction(), 0);
+    EXPECT_EQ(clock.sleep_for(900 * SECOND), 900U * SECOND);
+
+    // The state is kept across wakes with the same clock source.
+    Node node(state, 40000, true);
+    node.run(3);
+    const int32_t drift = clock.get_drift_ppb();
+    EXPECT_NE(drift, 0);
+    clock.begin(0);
+    EXPECT_EQ(clock.get_drift_ppb(), drift);
+
+    // A change of clock source starts again.
+    clock.begin(1);
+    EXPECT_EQ(clock.get_drift_ppb(), 0);
+    EXPECT_EQ(clock.get_windows(), 0U);
+}
+
+TEST(sleep_clock, clock_set_elsewhere) {
+    SleepClockState state = {};
+    SleepClock clock(state);
+    clock.begin(0);
+
+    // The first sync after power on moves the clock from 1970.
+    clock.synced(1700000000LL * SECOND, 1700000000LL * SECOND);
+    EXPECT_EQ(clock.get_drift_ppb(), 0);
+    clock.slept(3600 * SECOND);
+    clock.synced(2 * SECOND, 1700003600LL * SECOND);
+    EXPECT_NEAR(clock.get_drift_ppb(), 555555, 1);
+
+    // A jump far larger than the drift could make is not counted.
+    clock.slept(3600 * SECOND);
+    clock.synced(3600 * SECOND, 1700010800LL * SECOND);
+    EXPECT_EQ(clock.get_drift_ppb(), 0);
+
+    clock.slept(3600 * SECOND);
+    clock.synced(SECOND, 1700014400LL * SECOND);
+    EXPECT_NEAR(clock.get_drift_ppb(), 277777, 1);
+}
+
+TEST(sleep_clock, crystal) {
+    // A 32 kHz crystal that runs 40 ppm slow. The estimate is trusted after a day or so, and NTP is
+    // then only needed once a day.
+    SleepClockState state = {};
+    Node node(state, 40000, true);
+    node.run(7);
+
+    EXPECT_TRUE(node.clock.is_trusted());
+    EXPECT_NEAR(node.clock.get_drift_ppb(), 40000, 15000);
+    EXPECT_LT(node.ntp_queries, 7 * 24 / 3);
+    EXPECT_LT(node.worst_clock_us, 3 * SECOND);
+}
+
+/*
+ * The 150 kHz RC oscillator, used when the crystal does not start, is out by a few percent. With the
+ * drift estimated the node wakes every 15 minutes instead of every 15 minutes give or take half a
+ * minute.
+ */
+TEST(sleep_clock, rc_oscillator) {
+    SleepClockState plain_state = {};
+    Node plain(plain_state, -30000000, false);
+    plain.run(7);
+
+    SleepClockState state = {};
+    Node node(state, -30000000, true);
+    node.run(7);
+
+    EXPECT_NEAR(node.clock.get_drift_ppb(), -30000000, 100000);
+    EXPECT_LT(node.worst_interval_us, SECOND);
+    EXPECT_GT(plain.worst_interval_us, 20 * SECOND);
+}
+
+//#undef ARDUINO
+#if defined(ARDUINO)
+#include <Arduino.h>
+
+void setup()
+{
+    // should be the same value as for the `test_speed` option in "platformio.ini"
+    // default value is test_speed=115200
+    Serial.begin(115200);
+
+    ::testing::InitGoogleTest();
+}
+
+void loop()
+{
+    // Run tests
+    if (RUN_ALL_TESTS())
+        ;
+
+    // sleep for 1 sec
+    delay(1000);
+}
+
+#else
+int main(int argc, char **argv)
+{
+    ::testing::InitGoogleTest(&argc, argv);
+
+    if (RUN_ALL_TESTS())
+    ;
+
+    // Always return zero-code and allow PlatformIO to parse results
+    return 0;
+}
+#endif
@@ -0,0 +1,104 @@
+#include "urc_ring.h"
+
+#include <gtest/gtest.h>
+
+using namespace wombat;
+
+static Urc make_urc(int command, int result) {
+    Urc urc;
+    urc.command = command;
+    urc.result = result;
+    return urc;
+}
+
+TEST(urc_ring, take_by_command) {
+    UrcRing ring;
+    Urc urc;
+    EXPECT_FALSE(ring.take(4, urc));
+    EXPECT_EQ(urc.command, -1);
+
+    // A subscribe URC followed immediately by a read URC, both from one poll.
+    EXPECT_TRUE(ring.push(make_urc(4, 1)));
+    EXPECT_TRUE(ring.push(make_urc(6, 2)));
+    EXPECT_TRUE(ring.push(make_urc(4, 0)));
+    EXPECT_EQ(ring.size(), 3);
+
+    ASSERT_TRUE(ring.take(6, urc));
+    EXPECT_EQ(urc.result, 2);
+    EXPECT_FALSE(ring.take(6, urc));
+
+    // The oldest URC for a command is taken first.
+    ASSERT_TRUE(ring.take(4, urc));
+    EXPECT_EQ(urc.result, 1);
+    ASSERT_TRUE(ring.take(4, urc));
+    EXPECT_EQ(urc.result, 0);
+    EXPECT_EQ(ring.size(), 0);
+}
+
+TEST(urc_ring, full) {
+    UrcRing ring;
+    for (int i = 0; i < static_cast<int>(UrcRing::CAPACITY); i++) {
+        EXPECT_TRUE(ring.push(make_urc(i, i)));
+    }
+
+    // The oldest URC is dropped to make room.
+    EXPECT_FALSE(ring.push(make_urc(100, 1)));
+    EXPECT_EQ(ring.size(), UrcRing::CAPACITY);
+    EXPECT_EQ(ring.get_dropped(), 1);
+
+    Urc urc;
+    EXPECT_FALSE(ring.take(0, urc));
+    ASSERT_TRUE(ring.take(100, urc));
+    ASSERT_TRUE(ring.take(1, urc));
+    EXPECT_EQ(urc.result, 1);
+
+    // Taking from the middle of a wrapped ring keeps the rest in order.
+    ASSERT_TRUE(ring.take(8, urc));
+    for (int i = 2; i < static_cast<int>(UrcRing::CAPACITY); i++) {
+        if (i != 8) {
+            ASSERT_TRUE(ring.take(i, urc)) << i;
+            EXPECT_EQ(urc.result, i);
+        }
+    }
+    EXPECT_EQ(ring.size(), 0);
+
+    ring.push(make_urc(1, 1));
+    ring.clear();
+    EXPECT_FALSE(ring.take(1, urc));
+}
+
+//#undef ARDUINO
+#if defined(ARDUINO)
+#include <Arduino.h>
+
+void setup()
+{
+    // should be the same value as for the `test_speed` option in "platformio.ini"
+    // default value is test_speed=115200
+    Serial.begin(115200);
+
+    ::testing::InitGoogleTest();
+}
+
+void loop()
+{
+    // Run tests
+    if (RUN_ALL_TESTS())
+        ;
+
+    // sleep for 1 sec
+    delay(1000);
+}
+
+#else
+int main(int argc, char **argv)
+{
+    ::testing::InitGoogleTest(&argc, argv);
+
+    if (RUN_ALL_TESTS())
+    ;
+
+    // Always return zero-code and allow PlatformIO to parse results
+    return 0;
+}
+#endif
@@ -0,0 +1,162 @@
+#include "wake_profile.h"
+
+#include <gtest/gtest.h>
+
+#include <cstring>
+
+using namespace wombat;
+
+TEST(wake_profile, reset_when_invalid) {
+    WakeProfile profile;
+    memset(&profile, 0xA5, sizeof(profile));
+
+    WakeProfiler p(profile);
+    p.begin();
+    EXPECT_EQ(p.get_wakes(), 0);
+    EXPECT_EQ(p.num_records(), 0);
+    EXPECT_EQ(p.record(0), nullptr);
+    EXPECT_EQ(p.percentile(WAKE_HISTOGRAM_TOTAL, 50), 0);
+}
+
+TEST(wake_profile, phases) {
+    WakeProfile profile = {};
+    WakeProfiler p(profile);
+    p.begin();
+
+    p.add(WAKE_PHASE_BOOT, 120);
+    p.start(WAKE_PHASE_SPIFFS, 120);
+    p.stop(WAKE_PHASE_SPIFFS, 150);
+    // Phases run more than once are added.
+    p.start(WAKE_PHASE_UPLINK, 1000);
+    p.stop(WAKE_PHASE_UPLINK, 3000);
+    p.start(WAKE_PHASE_UPLINK, 4000);
+    p.stop(WAKE_PHASE_UPLINK, 4500);
+    // Stopping a phase that was not started does nothing.
+    p.stop(WAKE_PHASE_NTP, 5000);
+    // A phase still running at the end is not included.
+    p.start(WAKE_PHASE_SHUTDOWN, 5000);
+
+    p.sensor('1', 1500);
+    p.sensor('3', 6000);
+    p.sensor('2', 2000);
+
+    EXPECT_EQ(p.current().phase_ms[WAKE_PHASE_UPLINK], 2500);
+    p.finish(5100);
+
+    ASSERT_EQ(p.num_records(), 1);
+    const WakeRecord *r = p.record(0);
+    ASSERT_NE(r, nullptr);
+    EXPECT_EQ(r->total_ms, 5100);
+    EXPECT_EQ(r->phase_ms[WAKE_PHASE_BOOT], 120);
+    EXPECT_EQ(r->phase_ms[WAKE_PHASE_SPIFFS], 30);
+    EXPECT_EQ(r->phase_ms[WAKE_PHASE_UPLINK], 2500);
+    EXPECT_EQ(r->phase_ms[WAKE_PHASE_NTP], 0);
+    EXPECT_EQ(r->phase_ms[WAKE_PHASE_SHUTDOWN], 0);
+    EXPECT_EQ(r->slowest_sensor, '3');
+    EXPECT_EQ(r->slowest_sensor_ms, 6000);
+
+    // The next wake starts from zero.
+    p.begin();
+    EXPECT_EQ(p.current().phase_ms[WAKE_PHASE_UPLINK], 0);
+    EXPECT_EQ(p.current().slowest_sensor, 0);
+}
+
+TEST(wake_profile, ring) {
+    WakeProfile profile = {};
+    WakeProfiler p(profile);
+
+    for (uint32_t wake = 1; wake <= WAKE_RING_SIZE + 3; wake++) {
+        p.begin();
+        p.add(WAKE_PHASE_SDI12, wake);
+        p.finish(wake * 1000);
+    }
+
+    EXPECT_EQ(p.get_wakes(), WAKE_RING_SIZE + 3);
+    EXPECT_EQ(p.num_records(), WAKE_RING_SIZE);
+    EXPECT_EQ(p.record(0)->total_ms, (WAKE_RING_SIZE + 3) * 1000);
+    EXPECT_EQ(p.record(WAKE_RING_SIZE - 1)->total_ms, 4000);
+    EXPECT_EQ(p.record(WAKE_RING_SIZE), nullptr);
+}
+
+TEST(wake_profile, histogram) {
+    WakeProfile profile = {};
+    WakeProfiler p(profile);
+
+    EXPECT_EQ(WakeProfiler::bucket_limit(0), 64);
+    EXPECT_EQ(WakeProfiler::bucket_limit(1), 128);
+    EXPECT_EQ(WakeProfiler::bucket_limit(WAKE_HISTOGRAM_BUCKETS - 1), UINT32_MAX);
+
+    // 90 short wakes and 10 long ones.
+    for (int i = 0; i < 100; i++) {
+        p.begin();
+        p.finish(i < 90 ? 10000 : 200000);
+    }
+
+    EXPECT_EQ(p.percentile(WAKE_HISTOGRAM_TOTAL, 50), 16384);
+    EXPECT_EQ(p.percentile(WAKE_HISTOGRAM_TOTAL, 90), 16384);
+    EXPECT_EQ(p.percentile(WAKE_HISTOGRAM_TOTAL, 91), 262144);
+    EXPECT_EQ(p.percentile(WAKE_HISTOGRAM_TOTAL, 100), 262144);
+    // Phases that did not run are not counted.
+    EXPECT_EQ(p.percentile(WAKE_PHASE_UPLINK, 50), 0);
+
+    // Very long wakes go in the last bucket.
+    p.begin();
+    p.add(WAKE_PHASE_UPLINK, 3600000);
+    p.finish(3600000);
+    EXPECT_EQ(p.percentile(WAKE_PHASE_UPLINK, 50), UINT32_MAX);
+}
+
+TEST(wake_profile, histogram_overflow) {
+    WakeProfile profile = {};
+    WakeProfiler p(profile);
+    p.begin();
+
+    // Counts are halved rather than wrapping, keeping the proportions.
+    for (int i = 0; i < 70000; i++) {
+        p.finish(i % 4 == 0 ? 1000 : 10);
+    }
+
+    const uint16_t *row = profile.histogram[WAKE_HISTOGRAM_TOTAL];
+    EXPECT_GT(row[0], 30000);
+    EXPECT_GT(row[4], 10000);
+    EXPECT_EQ(p.percentile(WAKE_HISTOGRAM_TOTAL, 50), 64);
+    EXPECT_EQ(p.percentile(WAKE_HISTOGRAM_TOTAL, 90), 1024);
+
+    EXPECT_LT(sizeof(WakeProfile), 1024);
+}
+
+//#undef ARDUINO
+#if defined(ARDUINO)
+#include <Arduino.h>
+
+void setup()
+{
+    // should be the same value as for the `test_speed` option in "platformio.ini"
+    // default value is test_speed=115200
+    Serial.begin(115200);
+
+    ::testing::InitGoogleTest();
+}
+
+void loop()
+{
+    // Run tests
+    if (RUN_ALL_TESTS())
+        ;
+
+    // sleep for 1 sec
+    delay(1000);
+}
+
+#else
+int main(int argc, char **argv)
+{
+    ::testing::InitGoogleTest(&argc, argv);
+
+    if (RUN_ALL_TESTS())
+    ;
+
+    // Always return zero-code and allow PlatformIO to parse results
+    return 0;
+}
+#endif
@@ -0,0 +1,167 @@
+#include "wake_schedule.h"
+
+#include <gtest/gtest.h>
+
+#include <cstring>
+#include <random>
+
+using namespace wombat;
+
+static constexpr int64_t SECOND = 1000000;
+//! 2024-03-01T00:00:00Z
+static constexpr int64_t MARCH = 1709251200LL * SECOND;
+
+TEST(wake_schedule, reset_when_invalid) {
+    WakeScheduleState state;
+    memset(&state, 0xA5, sizeof(state));
+
+    WakeSchedule s(state);
+    s.begin();
+    EXPECT_EQ(s.get_missed(), 0U);
+
+    // Before the clock is set there are no slots and the node sleeps for an interval.
+    EXPECT_EQ(s.wake(5 * SECOND, 900), 0);
+    EXPECT_FALSE(s.is_slot_on(3600));
+    EXPECT_EQ(s.next(30 * SECOND, 900), 900U * SECOND);
+
+    // The clock was set during the wake, the next wake is on a boundary.
+    EXPECT_EQ(s.next(MARCH + 7 * 60 * SECOND, 900), 8U * 60 * SECOND);
+}
+
+TEST(wake_schedule, boundaries) {
+    WakeScheduleState state = {};
+    WakeSchedule s(state);
+    s.begin();
+
+    // Waking a little late or early is for the nearest boundary.
+    EXPECT_EQ(s.wake(MARCH + 900 * SECOND + 300000, 900), MARCH / SECOND + 900);
+    EXPECT_FALSE(s.is_slot_on(3600));
+    EXPECT_EQ(s.next(MARCH + 920 * SECOND, 900), 880U * SECOND);
+
+    s.begin();
+    EXPECT_EQ(s.wake(MARCH + 1800 * SECOND - 2 * SECOND, 900), MARCH / SECOND + 1800);
+    EXPECT_EQ(s.get_missed_before(), 0U);
+    // Finishing before the slot started does not schedule the same slot again.
+    EXPECT_EQ(s.next(MARCH + 1800 * SECOND - SECOND, 900), 901U * SECOND);
+
+    s.begin();
+    EXPECT_EQ(s.wake(MARCH + 2700 * SECOND, 900), MARCH / SECOND + 2700);
+    s.next(MARCH + 2700 * SECOND + 899 * SECOND, 900);
+    // Too close to the next boundary to sleep, so wait for the one after.
+    s.begin();
+    EXPECT_EQ(s.wake(MARCH + 4500 * SECOND, 900), MARCH / SECOND + 4500);
+    EXPECT_EQ(s.get_missed_before(), 1U);
+
+    s.next(MARCH + 4520 * SECOND, 900);
+    s.begin();
+    EXPECT_EQ(s.wake(MARCH + 5400 * SECOND, 900), MARCH / SECOND + 5400);
+    EXPECT_FALSE(s.is_slot_on(3600));
+    EXPECT_EQ(s.get_missed_before(), 0U);
+
+    // A wake that ran over two boundaries misses them, and so does a restart that lost a wake.
+    s.next(MARCH + 7300 * SECOND, 900);
+    s.begin();
+    EXPECT_EQ(s.wake(MARCH + 8100 * SECOND, 900), MARCH / SECOND + 8100);
+    EXPECT_EQ(s.get_missed_before(), 2U);
+    EXPECT_EQ(s.get_missed(), 3U);
+    EXPECT_FALSE(s.is_slot_on(3600));
+
+    s.next(MARCH + 8120 * SECOND, 900);
+    s.begin();
+    EXPECT_EQ(s.wake(MARCH + 10800 * SECOND, 900), MARCH / SECOND + 10800);
+    EXPECT_TRUE(s.is_slot_on(3600));
+    EXPECT_EQ(s.get_missed_before(), 2U);
+    EXPECT_EQ(s.get_missed(), 5U);
+
+    // A change of interval does not count as missed slots.
+    s.next(MARCH + 10820 * SECOND, 600);
+    s.begin();
+    s.wake(MARCH + 11400 * SECOND, 900);
+    EXPECT_EQ(s.get_missed_before(), 0U);
+}
+
+/*
+ * Ten nodes that were powered on at random times and whose wakes take 10 to 60 s. With the old
+ * schedule each measured every 15 minutes from when it was powered on, with the boundary schedule
+ * they all measure at the same times.
+ */
+TEST(wake_schedule, fleet) {
+    std::mt19937 rng(3);
+    std::uniform_int_distribution<int64_t> power_on(0, 900 * SECOND);
+    std::uniform_int_distribution<int64_t> run(10 * SECOND, 60 * SECOND);
+
+    int64_t worst_spread_old = 0;
+    int64_t worst_spread_new = 0;
+    std::vector<int64_t> old_wake(10), new_wake(10);
+    std::vector<WakeScheduleState> states(10);
+    for (size_t n = 0; n < 10; n++) {
+        old_wake[n] = new_wake[n] = MARCH + power_on(rng);
+        states[n] = {};
+    }
+
+    for (int w = 0; w < 96; w++) {
+        for (size_t n = 0; n < 10; n++) {
+            const int64_t r = run(rng);
+            // The old schedule slept for the interval less the run time, in whole milliseconds.
+            old_wake[n] += r + ((900 * SECOND - r) / 1000 * 1000) + 1000;
+
+            WakeSchedule s(states[n]);
+            s.begin();
+            s.wake(new_wake[n], 900);
+            new_wake[n] += r + static_cast<int64_t>(s.next(new_wake[n] + r, 900));
+        }
+
+        // How far apart the nodes' measurements are, modulo the interval.
+        int64_t lo_old = INT64_MAX, hi_old = 0, lo_new = INT64_MAX, hi_new = 0;
+        for (size_t n = 0; n < 10; n++) {
+            lo_old = std::min(lo_old, old_wake[n] % (900 * SECOND));
+            hi_old = std::max(hi_old, old_wake[n] % (900 * SECOND));
+            lo_new = std::min(lo_new, new_wake[n] % (900 * SECOND));
+            hi_new = std::max(hi_new, new_wake[n] % (900 * SECOND));
+        }
+        worst_spread_old = std::max(worst_spread_old, hi_old - lo_old);
+        worst_spread_new = std::max(worst_spread_new, hi_new - lo_new);
+    }
+
+    EXPECT_GT(worst_spread_old, 0);
+    EXPECT_EQ(worst_spread_new, 0);
+    for (const WakeScheduleState &state : states) {
+        EXPECT_EQ(state.missed, 0U);
+    }
+}
+
+//#undef ARDUINO
+#if defined(ARDUINO)
+#include <Arduino.h>
+
+void setup()
+{
+    // should be the same value as for the `test_speed` option in "platformio.ini"
+    // default value is test_speed=115200
+    Serial.begin(115200);
+
+    ::testing::InitGoogleTest();
+}
+
+void loop()
+{
+    // Run tests
+    if (RUN_ALL_TESTS())
+        ;
+
+    // sleep for 1 sec
+    delay(1000);
+}
+
+#else
+int main(int argc, char **argv)
+{
+    ::testing::InitGoogleTest(&argc, argv);
+
+    if (RUN_ALL_TESTS())
+    ;
+
+    // Always return zero-code and allow PlatformIO to parse results
+    return 0;
+}
+#endif
@@ -0,0 +1,197 @@
+#!/usr/bin/env python3
+"""
+Convert Wombat uplink messages sent in CBOR format back into the JSON messages the
+node sends when `mqtt format json` is configured.
+
+The labels of the SDI-12 values are sent as numbers from a dictionary built from the
+sensor definitions file, so the decoder must be given the same sdi12defn.json file
+the node has.
+
+Usage: cbor_to_json.py sdi12defn.json [msg.cbor ...]
+
+With no message files the message is read from stdin. A batch of messages, published
+when `mqtt batch on` is configured, is converted to a JSON array of messages.
+"""
+
+import datetime
+import json
+import struct
+import sys
+import zlib
+
+# These lists must match MSG_FIXED_LABELS and MSG_SOURCE_ID_KEYS in lib/msg_cbor/msg_cbor.cpp.
+FIXED_LABELS = ['battery (v)', 'solar (v)', 'rsrq', 'rsrp', 'pulse_count', 'shortest_pulse',
+                'wake (ms)', 'wake p90 (ms)', 'sdi-12 slowest (ms)',
+                'boot (ms)', 'spiffs (ms)', 'config (ms)', 'modem (ms)', 'registration (ms)', 'ntp (ms)',
+                'sdi-12 (ms)', 'msg write (ms)', 'uplink (ms)', 'shutdown (ms)',
+                'missed slots', 'uplink (mJ)', 'uplink psm', 'registration fast', 'registration mean (ms)']
+NUM_FIXED_LABELS = 32
+SOURCE_ID_KEYS = ['serial_no', 'firmware', 'ccid', 'sdi-12']
+
+KEY_TIMESTAMP = 0
+KEY_SOURCE_IDS = 1
+KEY_TIMESERIES = 2
+KEY_DICTIONARY = 3
+
+TAG_DECIMAL_FRACTION = 4
+
+
+class Float32(float):
+    """A value that was sent as a 32 bit float, printed with float precision."""
+    pass
+
+
+def load_dictionary(defn_filename):
+    """Returns the sorted SDI-12 label list and its fingerprint, as LabelDictionary does."""
+    with open(defn_filename, 'r') as f:
+        defns = json.load(f)
+
+    labels = set()
+    for models in defns.values():
+        for defn in models.values():
+            labels.update(defn.get('labels', []))
+
+    labels = sorted(labels, key=lambda s: s.encode('utf-8'))
+    fp = zlib.crc32(''.join(label + '\n' for label in labels).encode('utf-8')) & 0xffffffff
+    return labels, fp
+
+
+def decode_item(data, pos):
+    """Decode the CBOR item at data[pos], returning the item and the position after it."""
+    ib = data[pos]
+    major = ib >> 5
+    info = ib & 0x1f
+    pos += 1
+
+    if major == 7:
+        if info == 20:
+            return False, pos
+        if info == 21:
+            return True, pos
+        if info == 22:
+            return None, pos
+        if info == 25:
+            return struct.unpack('>e', data[pos:pos + 2])[0], pos + 2
+        if info == 26:
+            return Float32(struct.unpack('>f', data[pos:pos + 4])[0]), pos + 4
+        if info == 27:
+            return struct.unpack('>d', data[pos:pos + 8])[0], pos + 8
+        raise ValueError('Unsupported simple value %d' % info)
+
+    if info < 24:
+        arg = info
+    elif info < 28:
+        n = 1 << (info - 24)
+        arg = int.from_bytes(data[pos:pos + n], 'big')
+        pos += n
+    else:
+        raise ValueError('Indefinite length items are not supported')
+
+    if major == 0:
+        return arg, pos
+    if major == 1:
+        return -1 - arg, pos
+    if major == 2:
+        return bytes(data[pos:pos + arg]), pos + arg
+    if major == 3:
+        return data[pos:pos + arg].decode('utf-8'), pos + arg
+    if major == 4:
+        items = []
+        for _ in range(arg):
+            item, pos = decode_item(data, pos)
+            items.append(item)
+        return items, pos
+    if major == 5:
+        items = {}
+        for _ in range(arg):
+            key, pos = decode_item(data, pos)
+            value, pos = decode_item(data, pos)
+            items[key] = value
+        return items, pos
+
+    item, pos = decode_item(data, pos)
+    if arg == TAG_DECIMAL_FRACTION:
+        exponent, mantissa = item
+        return mantissa / 10 ** -exponent if exponent < 0 else float(mantissa * 10 ** exponent), pos
+
+    return item, pos
+
+
+def decode_label(label, labels):
+    if isinstance(label, str):
+        return label
+
+    if label < NUM_FIXED_LABELS:
+        return FIXED_LABELS[label]
+
+    x = label - NUM_FIXED_LABELS
+    addr = chr((x >> 1) & 0x7f)
+    n = x >> 8
+    if x & 1:
+        return '%s_V%d' % (addr, n)
+
+    return '%d_%s' % (ord(addr) - ord('0'), labels[n])
+
+
+def decode_value(value):
+    if isinstance(value, Float32):
+        # Values that were floats on the node are printed as the node would have.
+        return float('%.7g' % value)
+
+    return value
+
+
+def to_json(data, labels, fp):
+    item, pos = decode_item(data, 0)
+    if pos != len(data):
+        raise ValueError('Not a Wombat CBOR message')
+
+    if isinstance(item, list):
+        return [msg_to_json(msg, labels, fp) for msg in item]
+
+    return msg_to_json(item, labels, fp)
+
+
+def msg_to_json(msg, labels, fp):
+    if not isinstance(msg, dict):
+        raise ValueError('Not a Wombat CBOR message')
+
+    if msg.get(KEY_DICTIONARY) != fp:
+        raise ValueError('Message was encoded with different sensor definitions')
+
+    timestamp = msg[KEY_TIMESTAMP]
+    if isinstance(timestamp, int):
+        timestamp = datetime.datetime.fromtimestamp(timestamp, datetime.timezone.utc).strftime('%Y-%m-%dT%H:%M:%SZ')
+
+    source_ids = {}
+    for key, value in msg[KEY_SOURCE_IDS].items():
+        source_ids[SOURCE_ID_KEYS[key] if isinstance(key, int) else key] = value
+
+    items = msg[KEY_TIMESERIES]
+    timeseries = []
+    for i in range(0, len(items), 2):
+        timeseries.append({'name': decode_label(items[i], labels), 'value': decode_value(items[i + 1])})
+
+    return {'timestamp': timestamp, 'source_ids': source_ids, 'timeseries': timeseries}
+
+
+def main():
+    if len(sys.argv) < 2:
+        print(__doc__, file=sys.stderr)
+        return 1
+
+    labels, fp = load_dictionary(sys.argv[1])
+
+    if len(sys.argv) == 2:
+        print(json.dumps(to_json(sys.stdin.buffer.read(), labels, fp)))
+        return 0
+
+    for filename in sys.argv[2:]:
+        with open(filename, 'rb') as f:
+            print(json.dumps(to_json(f.read(), labels, fp)))
+
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
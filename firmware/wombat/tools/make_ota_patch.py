@@ -0,0 +1,125 @@
+#!/usr/bin/env python3
+"""
+Make a delta patch that turns one Wombat firmware image into another, for over-the-air
+updates of nodes running the old image.
+
+The patch is a list of COPY operations, which copy a run of bytes from the old image,
+and ADD operations, which carry new bytes. The layout must match DeltaPatcher in
+lib/delta_patch/delta_patch.h.
+
+Usage: make_ota_patch.py old.bin new.bin patch.bin
+
+The patch is applied to the new image in memory before it is written, so a patch that
+does not reproduce the new image exactly is never published.
+"""
+
+import struct
+import sys
+import zlib
+
+MAGIC = b'WDP1'
+OP_END = 0
+OP_COPY = 1
+OP_ADD = 2
+
+# Runs of the old image are found by looking up BLOCK bytes of the new image in an index of
+# the old image taken every STEP bytes, so any run of at least BLOCK + STEP - 1 bytes is found
+# wherever it has moved to.
+BLOCK = 16
+STEP = 4
+# A COPY costs 9 bytes and splits the ADD around it, so shorter runs are sent as they are.
+MIN_COPY = 24
+
+
+def make_patch(old, new):
+    index = {}
+    for i in range(0, len(old) - BLOCK + 1, STEP):
+        index.setdefault(old[i:i + BLOCK], i)
+
+    header = MAGIC + struct.pack('<III', len(old), zlib.crc32(old), len(new))
+    ops = [header + struct.pack('<I', zlib.crc32(header))]
+
+    def add(start, end):
+        if end > start:
+            ops.append(struct.pack('<BI', OP_ADD, end - start) + new[start:end])
+
+    literal = 0
+    p = 0
+    while p + BLOCK <= len(new):
+        o = index.get(new[p:p + BLOCK])
+        if o is None:
+            p += 1
+            continue
+
+        # Extend the run back into the bytes waiting to be added, and forward as far as it goes.
+        start = p
+        while start > literal and o > 0 and new[start - 1] == old[o - 1]:
+            start -= 1
+            o -= 1
+
+        end = p + BLOCK
+        oe = o + (end - start)
+        while end < len(new) and oe < len(old) and new[end] == old[oe]:
+            end += 1
+            oe += 1
+
+        if end - start < MIN_COPY:
+            p += 1
+            continue
+
+        add(literal, start)
+        ops.append(struct.pack('<BII', OP_COPY, o, end - start))
+        literal = end
+        p = end
+
+    add(literal, len(new))
+    ops.append(bytes([OP_END]))
+    return b''.join(ops)
+
+
+def apply_patch(old, patch):
+    magic, old_len, old_crc, new_len, header_crc = struct.unpack_from('<4sIIII', patch)
+    if magic != MAGIC or header_crc != zlib.crc32(patch[:16]) or old_len != len(old) or old_crc != zlib.crc32(old):
+        raise ValueError('patch does not match the old image')
+
+    out = bytearray()
+    p = 20
+    while patch[p] != OP_END:
+        if patch[p] == OP_COPY:
+            offset, length = struct.unpack_from('<II', patch, p + 1)
+            out += old[offset:offset + length]
+            p += 9
+        else:
+            length, = struct.unpack_from('<I', patch, p + 1)
+            out += patch[p + 5:p + 5 + length]
+            p += 5 + length
+
+    if len(out) != new_len or p != len(patch) - 1:
+        raise ValueError('patch is damaged')
+    return bytes(out)
+
+
+def main():
+    if len(sys.argv) != 4:
+        print(__doc__.strip(), file=sys.stderr)
+        return 1
+
+    with open(sys.argv[1], 'rb') as f:
+        old = f.read()
+    with open(sys.argv[2], 'rb') as f:
+        new = f.read()
+
+    patch = make_patch(old, new)
+    if apply_patch(old, patch) != new:
+        print('The patch does not reproduce the new image', file=sys.stderr)
+        return 1
+
+    with open(sys.argv[3], 'wb') as f:
+        f.write(patch)
+
+    print(f'{sys.argv[3]}: {len(patch)} bytes, {100.0 * len(patch) / len(new):.1f}% of {sys.argv[2]}')
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())